@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+// Bit manipulation built-ins on 64-bit values:
+//   popcount(x), clz(x), ctz(x)   clz and ctz of 0 are 64
+//   bswap(x), rotl(x, n)          n is taken mod 64
+//   pdep(x, mask), pext(x, mask)  BMI2 deposit and extract
+// They lower to single instructions when -march has them and are reserved
+// names, a function can't be declared with one.
+
+bool IsBitBuiltin(const std::string& name);
+int BitBuiltinArity(const std::string& name); // 0 if not a bit built-in
+
+// What the generated code computes, nullopt for a wrong argument count
+std::optional<int64_t> EvaluateBitBuiltin(const std::string& name, const std::vector<int64_t>& args);
@@ -5,6 +5,10 @@
 #include <vector>
 #include <unordered_map>
 #include <parser.hpp>
+#include <types.hpp>
+#include <output.hpp>
+#include <constpool.hpp>
+#include <profile.hpp>
 #include <sstream>
 #include <iosfwd>
 
@@ -13,25 +17,106 @@ struct VariableInfo {
     int offset; // relative to rbp
     int size; // in bytes
     std::string reg; // register
+    std::string type = ""; // declared type, vector locals are addressed from %rbx
+    bool inArea = false; // over-aligned struct, addressed from %rbx like vectors
+    std::string label = ""; // top-level variable: its data label, addressed without a base register
+    bool hidden = false; // declared in a block that has ended, the slot stays allocated
 };
 
 struct FunctionSymbol {
     std::string name;
     std::vector<VariableInfo> params;
     std::vector<VariableInfo> locals;
+    std::string returnType;
+    std::string symbol; // link name of an extern function, "" for functions compiled here
     int stackSize; // total stack size for locals
     std::shared_ptr<ASTNode> body;
+    bool internalConv = false; // only called from AOL code, arguments in InternalArgRegs
+    bool summarized = false; // clobbers is known, otherwise a call loses every caller-saved register
+    uint32_t clobbers = 0; // caller-saved registers a call may change, bit RegisterIndex(reg)
+    bool coroutine = false; // async fn or its frame constructor, always System V
+};
+
+// Argument registers of the System V ABI and of the internal convention,
+// which takes %r10 and %r11 as well
+extern const std::vector<std::string> SysVArgRegs;
+extern const std::vector<std::string> InternalArgRegs;
+
+// Encoding number of a general purpose register (%rax 0, %rcx 1, ... %r15 15),
+// sub-registers count as the full one, -1 for anything else
+int RegisterIndex(const std::string& reg);
+
+// Memory image of a vector with these lanes, float lanes are converted from the integer values
+std::vector<uint8_t> VectorBytes(const VectorType* type, const std::vector<int64_t>& lanes);
+
+// Operand of a lane-wise vector operation
+struct VecOperand {
+    int reg = -1; // register index, or -1 when the value sits in a spill slot
+    int slot = 0; // offset from %rbx
+};
+
+// Memory a struct or one of its fields lives in: [base + offset]
+struct Place {
+    std::string base; // %rbp, %rbx, a global's symbol or %rax holding a pointer
+    int offset = 0;
+    std::string type; // type of the value stored there
+    bool packed = false; // inside a #[packed] struct, may be misaligned
+};
+
+// Consecutive switch cases dispatched by one test, covering [low, high]
+struct SwitchCluster {
+    enum Kind { Single, JumpTable, BitTest } kind;
+    int64_t low;
+    int64_t high;
+    std::vector<std::pair<int64_t, std::string>> cases; // value, clause label
+};
+
+// Instruction set extensions code may be generated for, SSE2 is always available
+struct TargetFeatures {
+    bool popcnt = false;
+    bool lzcnt = false;
+    bool bmi1 = false; // tzcnt, andn
+    bool bmi2 = false; // shlx/sarx, rorx, pdep/pext
+    bool movbe = false;
+    bool avx2 = false;
+    bool avx512 = false; // x86-64-v4, vectors stay at most 256 bits wide
+};
+
+// -march: x86-64, x86-64-v2/v3/v4 (or just v2/v3/v4) and native, false for an unknown name (target_amd64.cpp)
+bool ParseMarch(const std::string& name, TargetFeatures& features);
+TargetFeatures HostFeatures(); // CPUID of the machine running the compiler
+std::string DescribeFeatures(const TargetFeatures& features); // "popcnt lzcnt ...", "baseline" without any
+
+struct CompileOptions {
+    bool entryBanner = false; // print "DBG: Entry!" before main runs
+    bool module = false; // `module m;` source: no process entry, the importer brings the runtime
+    std::string profilePath; // --profile-generate: counters of profile are written here on exit
+    ProfileLayout profile;
+    std::string instrumentReport; // --instrument=functions: cycles per function are written here on exit
+    std::string instrumentStacks; // and the collapsed call stacks here
+    bool ipra = false; // internal calling convention and per-function register summaries
 };
 
 class Compiler_Amd64 {
 public:
-    Compiler_Amd64();
+    Compiler_Amd64(TargetFeatures features = {}, CompileOptions options = {});
     ~Compiler_Amd64() = default;
 
-    std::string compile(const std::shared_ptr<ASTNode>& program);
+    // .text goes to out as each top-level declaration is compiled, finish() the sink with sections()
+    void compile(const std::shared_ptr<ASTNode>& program, OutputSink& out);
+    std::vector<std::string_view> sections() const; // .rodata, .data and .bss, valid until the next compile
+    const ConstantPool& constants() const { return pool; }
+    std::string ipraSummary() const; // "" unless options.ipra
 
 private:
-    std::string compileProgram(const std::shared_ptr<ASTNode>& node);
+    void compileProgram(const std::shared_ptr<ASTNode>& node, OutputSink& out);
+    std::string compileRuntime(); // runtime_amd64.cpp
+    std::string compileProfileRuntime(); // profile_amd64.cpp
+    std::string compileAioRuntime(); // aio_amd64.cpp
+    std::string compileThreadRuntime(); // thread_amd64.cpp
+    std::string profileCounter(const std::shared_ptr<ASTNode>& node);
+    std::string compileInstrumentRuntime(); // instrument_amd64.cpp, after every function is compiled
+    std::string instrumentEnter(const std::shared_ptr<ASTNode>& fn); // "" for functions without hooks
     std::string compileStatement(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
     std::string compileFunction(const std::shared_ptr<ASTNode>& node);
     std::string compileVariableDecl(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
@@ -39,24 +124,147 @@ private:
     std::string compileIf(const std::shared_ptr<ASTNode>& node);
     std::string compileWhile(const std::shared_ptr<ASTNode>& node);
     std::string compileFor(const std::shared_ptr<ASTNode>& node);
+    std::string compileSwitch(const std::shared_ptr<ASTNode>& node);
+    std::string compileSwitchTree(const std::vector<SwitchCluster>& clusters, size_t lo, size_t hi, const std::string& defaultLabel);
+    std::string compileSwitchCluster(const SwitchCluster& cluster, const std::string& outOfRange, const std::string& defaultLabel);
     std::string compileBreak(const std::shared_ptr<ASTNode>& node);
     std::string compileContinue(const std::shared_ptr<ASTNode>& node);
+    std::string compileBlock(const std::shared_ptr<ASTNode>& node, bool scoped = true);
+    std::string compileLoopClause(const std::shared_ptr<ASTNode>& node); // a for's init or step, in the loop's scope
+    void endScope(size_t firstLocal); // hides the locals declared since
+    std::string compileAsm(const std::shared_ptr<ASTNode>& node); // asm_amd64.cpp
+    std::string compileCondJump(const std::shared_ptr<ASTNode>& cond, const std::string& falseLabel);
 
     std::string compileExpression(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
     std::string compileBinaryExpr(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
     std::string compileUnaryExpr(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
+    std::string compileAssignExpr(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
     std::string compileLiteral(const std::shared_ptr<ASTNode>& node);
     std::string compileIdentifier(const std::shared_ptr<ASTNode>& node, const std::string& targetReg = "%rax");
     std::string compileCallExpr(const std::shared_ptr<ASTNode>& node);
+    std::string compileBitBuiltin(const std::shared_ptr<ASTNode>& node, const std::string& targetReg); // bits_amd64.cpp
+    bool isAtomicBuiltin(const std::string& name) const; // atomic_amd64.cpp
+    std::string compileAtomicBuiltin(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
+    std::string compileOperandPair(const std::shared_ptr<ASTNode>& lhs, const std::shared_ptr<ASTNode>& rhs); // into %rax, %rcx
+    std::string compileArithIsel(const std::shared_ptr<ASTNode>& node); // isel_amd64.cpp, "" if no rule applies
+    std::string compileLeaForm(const std::shared_ptr<ASTNode>& node);
+    bool isUnsignedOperand(const std::shared_ptr<ASTNode>& node);
+    bool isUnsignedOp(const std::shared_ptr<ASTNode>& node); // comparison or shift on unsigned values
+
+    // Interprocedural register allocation (ipra_amd64.cpp)
+    std::vector<std::vector<std::shared_ptr<ASTNode>>> callGraphOrder(const std::shared_ptr<ASTNode>& program); // callees first, one SCC each
+    void assignConventions(const std::shared_ptr<ASTNode>& program);
+    void summarize(const std::vector<std::shared_ptr<ASTNode>>& scc, const std::vector<std::string>& code);
+    const std::vector<std::string>& argRegisters(const FunctionSymbol& fn) const;
+    uint32_t callClobbers(const std::shared_ptr<ASTNode>& call);
+    uint32_t exprClobbers(const std::shared_ptr<ASTNode>& node);
+    std::string holdRegister(const std::shared_ptr<ASTNode>& node); // "" if the stack has to keep %rax
+    std::string compileSecondOperand(const std::shared_ptr<ASTNode>& rhs); // %rax kept, rhs into %rcx
+    std::string compileArgRegisters(const std::vector<std::shared_ptr<ASTNode>>& args, const std::vector<std::string>& regs);
+    std::string compileDwordArith(const std::shared_ptr<ASTNode>& node); // into %eax, "" if it needs 64 bits
+    std::string dwordOperand(const std::shared_ptr<ASTNode>& node) const;
+
+    // Coroutines (async_amd64.cpp)
+    std::string compileCoroutineEntry(const std::shared_ptr<ASTNode>& fn); // frame slots, before the body
+    std::string compileCoroutineDispatch(); // after the prologue, once the stack size is known
+    std::string compileCoroutineSuspend();
+    std::string compileCoroutineFinish(const std::string& reg); // result from reg, the task is done
+    std::string compileCoroutineConstructor(const std::shared_ptr<ASTNode>& fn);
+    std::string compileAwait(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
+    std::string compileAsyncNew(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
+    bool isCoroutine(const std::string& name) const;
+
+    // Parallel for (parallel_amd64.cpp)
+    std::string compileParallelFor(const std::shared_ptr<ASTNode>& node);
+    std::string compileCaptures(const std::shared_ptr<ASTNode>& fn); // outlined body: copies the enclosing locals it reads
+
+    // SIMD vectors (simd_amd64.cpp)
+    const VectorType* vectorTypeOf(const std::shared_ptr<ASTNode>& node);
+    bool isVectorBuiltin(const std::string& name) const;
+    bool containsCall(const std::shared_ptr<ASTNode>& node) const;
+    std::string compileVectorDecl(const std::shared_ptr<ASTNode>& node, const VectorType* type);
+    std::string compileVectorExpr(const std::shared_ptr<ASTNode>& node, int reg, const VectorType* type);
+    std::string compileVectorCall(const std::shared_ptr<ASTNode>& node, int reg, const VectorType* type);
+    std::string compileVectorScalarBuiltin(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
+    std::string compileVectorOperands(const std::vector<std::shared_ptr<ASTNode>>& args, const std::vector<const VectorType*>& types, int reg, std::vector<VecOperand>& operands);
+    std::string compileSplat(const std::shared_ptr<ASTNode>& node, int reg, const VectorType* type);
+    std::string loadVector(const VectorType* type, int reg, const std::string& base, int offset, bool aligned = true);
+    std::string storeVector(const VectorType* type, int reg, const std::string& base, int offset, bool aligned = true);
+    std::string vectorConstant(const VectorType* type, const std::vector<int64_t>& lanes);
+    void layoutGlobals(const std::shared_ptr<ASTNode>& program); // globals_amd64.cpp
+    int allocateVectorSlot(int bytes, int align = 0); // offset from %rbx, aligned to the vector size by default
+    int vectorParts(const VectorType* type) const; // xmm registers holding one value
+
+    // Structs (struct_amd64.cpp)
+    std::string exprType(const std::shared_ptr<ASTNode>& node);
+    bool staticPlace(const std::shared_ptr<ASTNode>& node, Place& place) const; // places that need no code
+    bool compilePlace(const std::shared_ptr<ASTNode>& node, std::ostringstream& out, Place& place);
+    std::string compileStructDecl(const std::shared_ptr<ASTNode>& node, const StructType* type);
+    std::string compileMemberLoad(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
+    std::string compileMemberStore(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
+    std::string compileAddressOf(const std::shared_ptr<ASTNode>& node, const std::string& targetReg);
 
-    int allocateLocal(const std::string& name, int size = 8); // default 8 bytes for int/ptr
+    int allocateLocal(const std::string& name, int size = 8, const std::string& type = "", int align = 8); // default 8 bytes for int/ptr
+    const VariableInfo* findVariable(const std::string& name) const;
+    std::string variableOperand(const std::string& name) const; // memory operand of a local/param, "" if unknown
+    std::string simpleOperand(const std::shared_ptr<ASTNode>& node) const; // imm/mem operand usable directly, "" otherwise
+    std::string newLabel(const std::string& kind);
+    std::string push(const std::string& reg);
+    std::string pop(const std::string& reg);
+
+    struct LoopLabels {
+        std::string breakLabel;
+        std::string continueLabel;
+    };
 
     std::unordered_map<std::string, FunctionSymbol> functions;
     FunctionSymbol* currentFunction;
+    std::vector<LoopLabels> loopStack;
+    std::string returnLabel;
+    std::ostringstream coldCode; // blocks the profile says rarely run, placed after the epilogue
+    std::vector<std::string> hookedFunctions; // --instrument=functions, by hook index
     int localOffset; // current stack offset for locals
+    int pushDepth; // 8-byte slots pushed by expression temporaries, keeps calls 16-byte aligned
+    int labelIdx;
+    uint32_t heldRegs; // registers holding a value an enclosing expression still needs
+    size_t heldValues; // temporaries and arguments that stayed in a register, for ipraSummary
+
+    TargetFeatures target;
+    CompileOptions options;
+    int vectorAreaSize; // aligned area below the locals, based at %rbx
+    int areaAlign; // 32, or more for over-aligned structs
+    std::vector<VariableInfo> globalVars; // top-level variables in .data, .rodata or .bss
+    std::shared_ptr<ASTNode> globalInit; // __aol_init_globals, null when every initializer is constant
+    struct CoroutineState {
+        bool active = false; // compiling an async fn
+        int frameSlot = 0, arenaSlot = 0, childSlot = 0; // hidden locals
+        std::vector<std::string> resumeLabels; // by state - 1
+        std::string suspendLabel;
+    } coroutine;
+    struct Capture {
+        std::string name, type;
+        std::string operand; // in the enclosing frame, based at %rcx
+    };
+    std::unordered_map<const ASTNode*, std::vector<Capture>> captures; // by outlined parallel for body
+    std::vector<std::shared_ptr<ASTNode>> parallelBodies; // outlined, compiled after the enclosing function
+    int vecTop; // first vector register not holding a live temporary
+    bool usesYmm;
     std::ostringstream bss;
     std::ostringstream data;
     std::ostringstream rodata;
-
-    int str_idx;
+    ConstantPool pool; // string literals and vector constants, emitted into rodata after the code
 };
+
+bool IsIntegerLiteral(const std::shared_ptr<ASTNode>& node);
+bool IsComparisonOp(const std::string& op);
+std::string MemOperand(const std::string& base, int offset);
+std::string SubRegister(const std::string& reg, int bytes); // %rax, 4 -> %eax
+void EmitBytes(std::ostream& section, const std::string& label, const std::string& bytes, bool terminate); // label!ubyte[] = ..., NUL-terminated if asked
+
+// Moves between a register and memory holding a value of a scalar type,
+// narrow integers are sign or zero extended on the way in
+std::string LoadScalar(const std::string& type, const std::string& reg, const std::string& mem);
+std::string StoreScalar(const std::string& type, const std::string& mem, const std::string& reg);
+
+// Leaves the value a store and reload through the type would give in reg
+std::string WrapScalar(const std::string& type, const std::string& reg);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstdint>
+#include <unordered_map>
+
+struct ASTNode;
+struct IntegerType;
+
+// Tree-walking interpreter for `const fn` bodies. Arithmetic wraps at 64 bits
+// exactly like the generated code, anything that would trap or that the
+// interpreter cannot model makes the call fall back to runtime.
+class ConstEvaluator {
+public:
+    static constexpr int64_t MaxSteps = 1000000; // per evaluated call site
+    static constexpr int MaxDepth = 256;
+
+    void define(const std::shared_ptr<ASTNode>& fn);
+    bool isConst(const std::string& name) const { return functions.count(name) != 0; }
+
+    // Literals, operators and calls to const functions with constant arguments
+    bool isConstantExpr(const std::shared_ptr<ASTNode>& expr) const;
+
+    // nullopt if evaluation has to be left to runtime, why then says what stopped it
+    std::optional<int64_t> evaluate(const std::shared_ptr<ASTNode>& expr, std::string& why);
+    int64_t lastSteps() const { return steps; }
+
+private:
+    enum class Flow { Next, Break, Continue, Return };
+    struct Frame {
+        std::unordered_map<std::string, int64_t> vars;
+        std::unordered_map<std::string, const IntegerType*> types; // sized locals, wrapped on store
+        int64_t result = 0;
+    };
+
+    Flow exec(const std::shared_ptr<ASTNode>& stmt, Frame& frame);
+    int64_t eval(const std::shared_ptr<ASTNode>& expr, Frame& frame);
+    std::string typeOf(const std::shared_ptr<ASTNode>& expr, const Frame& frame) const; // as the code generator types it
+    bool isUnsigned(const std::shared_ptr<ASTNode>& expr, const Frame& frame) const;
+    bool isUnsignedOp(const std::shared_ptr<ASTNode>& expr, const Frame& frame) const;
+    void store(Frame& frame, const std::string& name, int64_t v);
+    int64_t call(const std::shared_ptr<ASTNode>& site, const std::vector<int64_t>& args);
+    void step(const std::shared_ptr<ASTNode>& at);
+
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> functions;
+    int64_t steps = 0;
+    int depth = 0;
+};
+
+// Checks the body of every const function, computes top-level `const N = ...;`
+// values and replaces their uses and calls whose arguments are all constant. Calls that cannot be evaluated stay
+// runtime calls with a warning. Evaluations are appended to remarks.
+// Returns false on errors.
+bool EvaluateConstCalls(const std::shared_ptr<ASTNode>& program, std::vector<std::string>& remarks);
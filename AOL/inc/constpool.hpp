@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <iosfwd>
+
+// Read-only literals of one compilation. Equal literals share one entry and a
+// string that ends another string points into it, so "World!" costs nothing
+// next to "Hello World!". Entries are written at the end of code generation,
+// strings 16-byte aligned for vectorized string routines.
+class ConstantPool {
+public:
+    static constexpr int StringAlign = 16;
+
+    // Label of the NUL-terminated bytes of value
+    std::string string(const std::string& value);
+    // Byte length of a literal with its escapes decoded, nullopt for an escape
+    // the assembler may read differently
+    static std::optional<size_t> length(const std::string& value);
+
+    // Label of a constant with these bytes, aligned to align
+    std::string bytes(const std::vector<uint8_t>& data, int align);
+
+    void emit(std::ostream& rodata);
+    void clear();
+
+    // "N literals in M entries ..." for -v, empty when nothing was pooled
+    std::string summary() const;
+
+private:
+    struct StringEntry {
+        std::string value;
+        std::string label;
+        size_t host; // entry whose bytes this one ends, itself if none
+    };
+    struct ByteEntry {
+        std::vector<uint8_t> data;
+        int align;
+        std::string label;
+    };
+
+    std::vector<StringEntry> strings;
+    std::unordered_map<std::string, size_t> stringIds;
+    std::vector<ByteEntry> byteEntries;
+    std::unordered_map<std::string, size_t> byteIds; // align and data as a key
+    size_t references = 0;
+    size_t naiveBytes = 0; // one copy per reference, as without the pool
+    size_t pooledBytes = 0;
+    size_t merged = 0;
+};
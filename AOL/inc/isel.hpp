@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <optional>
+#include <cstdint>
+#include <iosfwd>
+
+// Instruction selection for integer arithmetic by constants. Every sequence
+// takes the left operand in %rax, leaves the result there and may clobber
+// %rcx and %rdx. nullopt means the plain instruction (imul, idiv, div) is the
+// best choice, or the only one that keeps its behavior, like idiv trapping
+// on a divisor of 0 or INT64_MIN / -1.
+
+// x * c as shifts, lea and add/sub
+std::optional<std::string> SelectMulConst(int64_t c);
+
+// x / d and x % d (op "/" or "%"): a multiply by the magic reciprocal of d
+// (Granlund & Montgomery), shifts and masks for powers of two. Unsigned
+// treats x as a u64 and needs d > 0.
+std::optional<std::string> SelectDivConst(const std::string& op, int64_t d, bool isUnsigned);
+
+// lea %rax, [base + index*scale + disp], base or index may be ""
+std::string SelectLea(const std::string& base, const std::string& index, int scale, int64_t disp);
+
+// Runs every rule above on edge values through an interpreter of the emitted
+// instructions and compares with plain 64-bit arithmetic. Reports the first
+// mismatches to err, returns the number of mismatches.
+size_t VerifyIsel(std::ostream& log, std::ostream& err);
@@ -1,6 +1,7 @@
 #pragma once
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <colors.hpp>
@@ -44,6 +45,9 @@ enum class TokenType {
     Interface,
     Import,
     Module,
+    Async,
+    Await,
+    Parallel,
 
     // Types
     Var,
@@ -107,6 +111,7 @@ enum class TokenType {
     Semicolon,
     Comma,
     Colon,
+    Hash,
 };
 
 struct Token {
@@ -118,18 +123,31 @@ struct Token {
 
 class AOL_Lexer {
     public:
+        static constexpr size_t DefaultChunkBytes = 1 << 20;
+
         AOL_Lexer(const std::string& source);
+        AOL_Lexer(const AOL_Lexer&) = delete; // src may point into storage
 
         Token nextToken();
         std::vector<Token> tokenize();
+
+        // Same tokens as tokenize(). The source is cut into line-aligned chunks of
+        // about chunkBytes that are lexed on up to threads threads.
+        std::vector<Token> tokenizeParallel(unsigned threads, size_t chunkBytes = DefaultChunkBytes) const;
     
     private:
+        // Lexes part of whole, starting at start which must be between tokens
+        AOL_Lexer(std::string_view whole, size_t start, int line, int col);
+        // Tokens that start before end, the last one may run past it
+        std::vector<Token> tokenizeRange(size_t end);
+
         char peek(int offset = 0) const;
         char advance();
         bool match(char expected);
 
         void skipWhitespace();
         void skipComment();
+        void skipTrivia();
 
         Token identifierOrKeyword();
         Token number();
@@ -138,7 +156,8 @@ class AOL_Lexer {
         Token operatorOrDelimiter();
 
     private:
-        std::string src;
+        std::string storage;
+        std::string_view src;
         size_t pos = 0;
         int line = 1;
         int col = 1;
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct ASTNode;
+
+// What `import m;` needs from module m: struct declarations, function
+// signatures and bodies, const values and the modules it imports itself.
+// Bodies are compiled into the importer, this toolchain has no link step
+// between AOL outputs.
+struct ModuleInterface {
+    std::string name;
+    uint64_t hash = 0; // of the module source, a stale interface is rebuilt
+    std::vector<std::string> imports;
+    std::vector<std::shared_ptr<ASTNode>> decls;
+};
+
+// One module brought in by ImportModules
+struct ModuleLoad {
+    std::string name;
+    std::string path;
+    bool fromInterface; // mapped a current .aoli instead of parsing the source
+    size_t bytes;
+    double ms;
+};
+
+uint64_t HashSource(const std::string& source);
+
+// Name from `module m;`, "" if the program isn't a module
+std::string ModuleName(const std::shared_ptr<ASTNode>& program);
+
+// The declarations program exports, anything it imported itself stays with its module
+ModuleInterface BuildInterface(const std::shared_ptr<ASTNode>& program, uint64_t hash);
+
+// Binary .aoli file: a string table and the declarations as a tree of indices
+bool WriteInterface(const ModuleInterface& module, const std::string& path);
+bool ReadInterface(const std::string& path, ModuleInterface& module, size_t* bytes = nullptr);
+
+// Resolves every `import m;` against searchPath (m.aoli, rebuilt from m.aol when
+// stale) and adds the declarations of m and of what m imports to the program.
+// Imported functions nothing calls are dropped. Returns false on errors.
+bool ImportModules(const std::shared_ptr<ASTNode>& program, const std::vector<std::string>& searchPath, std::vector<ModuleLoad>& loads);
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <optional>
+#include <cstdint>
+
+#include <parser.hpp>
+#include <consteval.hpp>
+
+// A loop in the function body. AOL has no goto, so every while/for is a natural
+// loop whose header is the condition and whose only back edge is the loop end.
+struct LoopInfo {
+    std::shared_ptr<ASTNode> node; // WhileStmt or ForStmt
+    std::shared_ptr<ASTNode> block; // statement list the loop sits in
+    LoopInfo* parent = nullptr;
+    int depth = 0;
+    std::unordered_set<std::string> defs; // variables written anywhere in the loop
+    bool hasCalls = false;
+};
+
+// Basic induction variable: written exactly once per iteration as v = v + step
+struct InductionVar {
+    std::string name;
+    int64_t step;
+};
+
+// for-loop whose exit test compares a basic induction variable with an invariant bound
+struct CountedLoop {
+    InductionVar iv;
+    std::string relation; // <, <=, >, >= or !=, with the induction variable on the left
+    std::shared_ptr<ASTNode> bound;
+    bool knownStart = false;
+    int64_t start = 0;
+};
+
+class AOL_Optimizer {
+public:
+    AOL_Optimizer(int level = 1);
+
+    void run(const std::shared_ptr<ASTNode>& program);
+    const std::vector<std::string>& remarks() const { return remarkLog; }
+
+private:
+    void optimizeFunction(const std::shared_ptr<ASTNode>& fn);
+
+    // Analysis
+    void findLoops(const std::shared_ptr<ASTNode>& block, LoopInfo* parent, std::vector<std::unique_ptr<LoopInfo>>& loops);
+    void computeDefs(LoopInfo& loop);
+    bool isInvariant(const std::shared_ptr<ASTNode>& expr, const LoopInfo& loop) const;
+    std::vector<InductionVar> findInductionVars(const LoopInfo& loop) const;
+    bool analyzeCountedLoop(const LoopInfo& loop, CountedLoop& out);
+    std::optional<int64_t> constTripCount(const CountedLoop& cl) const;
+    std::string typeOf(const std::shared_ptr<ASTNode>& expr) const; // as the code generator types it, "?" if unknown
+    std::optional<bool> isUnsignedCompare(const std::shared_ptr<ASTNode>& lhs, const std::shared_ptr<ASTNode>& rhs) const;
+
+    // Transforms
+    void foldConstants(std::shared_ptr<ASTNode>& node);
+    void reduceStrength(LoopInfo& loop);
+    void replaceExitTest(LoopInfo& loop, const InductionVar& iv, const std::string& derived, int64_t scale);
+    void hoistInvariants(LoopInfo& loop);
+    void unrollLoop(LoopInfo& loop);
+    void unrollFully(LoopInfo& loop, int64_t tripCount);
+    bool unrollPartially(LoopInfo& loop, const CountedLoop& cl, int factor);
+    void numberValues(const std::shared_ptr<ASTNode>& fn);
+    void removeDeadAllocations(const std::shared_ptr<ASTNode>& fn);
+    void removeDeadAsm(const std::shared_ptr<ASTNode>& fn);
+    void inlineHotCalls(std::shared_ptr<ASTNode>& node);
+
+    // Interprocedural
+    void findPureFunctions(const std::shared_ptr<ASTNode>& program);
+    bool isPureCall(const std::string& name) const;
+    bool clobbersGlobals(const std::string& name) const;
+
+    void insertBefore(const std::shared_ptr<ASTNode>& block, const std::shared_ptr<ASTNode>& anchor, const std::shared_ptr<ASTNode>& stmt);
+    std::string newTemp(const std::string& kind);
+    void remark(const std::shared_ptr<ASTNode>& at, const std::string& msg);
+
+    int level;
+    int tempIdx = 0;
+    std::shared_ptr<ASTNode> currentFunction;
+    std::unordered_set<std::string> functionLocals; // params and declared locals of currentFunction
+    std::unordered_set<std::string> narrowLocals; // those of them with an integer type narrower than 64 bits
+    std::unordered_map<std::string, std::string> varTypes; // declared types in currentFunction, "?" for names declared with several
+    std::unordered_map<std::string, std::string> globalTypes; // top-level variables and function results
+    std::unordered_set<std::string> pureFunctions; // neither read nor write anything but their arguments
+    std::unordered_set<std::string> allocFunctions; // #[alloc]: return fresh memory and have no other effect
+    std::unordered_set<std::string> freeFunctions; // #[free]: release the block passed as first argument
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> inlineCandidates; // `ret expr;` functions, by name
+    ConstEvaluator constEval; // const functions, for calls whose arguments become constant after folding
+    std::vector<std::string> remarkLog;
+};
+
+std::string ExprToString(const std::shared_ptr<ASTNode>& node);
+std::shared_ptr<ASTNode> CloneAST(const std::shared_ptr<ASTNode>& node);
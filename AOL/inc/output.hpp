@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+// Destination of the generated assembly. .text is appended as each function
+// is compiled and spilled to an unlinked temporary file next to the output,
+// so only the side sections and one buffer are held in memory. finish() puts
+// the file together: the leading sections with writev, then .text with
+// copy_file_range.
+class OutputSink {
+public:
+    static constexpr size_t BufferBytes = 1 << 16;
+
+    explicit OutputSink(const std::string& path);
+    ~OutputSink();
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    bool ok() const { return tmpFd >= 0; }
+    void text(std::string_view s);
+
+    // Writes head, in order, followed by everything passed to text()
+    bool finish(const std::vector<std::string_view>& head);
+
+    size_t textBytes() const { return spilled + buffer.size(); }
+
+private:
+    bool flush();
+
+    std::string path;
+    int tmpFd = -1;
+    std::string buffer;
+    size_t spilled = 0;
+    bool failed = false;
+};
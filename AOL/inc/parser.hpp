@@ -3,12 +3,16 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 
 #include <lexer.hpp>
 
 enum class ASTNodeType {
     Program,
     FunctionDecl,
+    StructDecl,
+    ImportDecl,
+    ModuleDecl,
     VariableDecl,
     ConstDecl,
     ReturnStmt,
@@ -16,14 +20,19 @@ enum class ASTNodeType {
     StmtBlock,
     WhileStmt,
     ForStmt,
+    SwitchStmt,
+    CaseClause,
     BreakStmt,
     ContinueStmt,
+    AsmStmt,
     Expression,
     BinaryExpr,
     UnaryExpr,
+    AssignExpr,
     Literal,
     Identifier,
     CallExpr,
+    MemberExpr,
     Error,
 };
 
@@ -33,8 +42,10 @@ struct ASTNode {
     ASTNodeType type;
     std::string name; // variable, function name, or operator
     std::string value; // literal value
+    std::string typeName; // declared type of a variable, param or function result, "" = 64-bit integer
     std::vector<std::shared_ptr<ASTNode>> children;
-    std::vector<std::shared_ptr<ASTNode>> params; // Only for functions!
+    std::vector<std::shared_ptr<ASTNode>> params; // function parameters, struct fields, asm operands
+    std::unordered_map<std::string, std::string> attributes; // #[name] / #[name(arg)]
     int line = 0;
     int col = 0;
 
@@ -50,6 +61,7 @@ public:
 private:
     const std::vector<Token>& tokens;
     size_t pos = 0;
+    bool statementPosition = false; // the next assignment's value is unused
 
     Token peek(int offset = 0) const;
     Token advance();
@@ -58,22 +70,32 @@ private:
     void expect(TokenType type, const std::string& errMsg);
 
     std::shared_ptr<ASTNode> parseFunction();
+    std::shared_ptr<ASTNode> parseStruct();
     std::shared_ptr<ASTNode> parseStatement();
     std::shared_ptr<ASTNode> parseVariableDecl();
     std::shared_ptr<ASTNode> parseReturn();
     std::shared_ptr<ASTNode> parseIf();
     std::shared_ptr<ASTNode> parseWhile();
     std::shared_ptr<ASTNode> parseFor();
+    std::shared_ptr<ASTNode> parseSwitch();
     std::shared_ptr<ASTNode> parseBreak();
     std::shared_ptr<ASTNode> parseContinue();
+    std::shared_ptr<ASTNode> parseAsm();
+    std::shared_ptr<ASTNode> parseModuleName(ASTNodeType type); // import m; / module m;
+    std::shared_ptr<ASTNode> parseBlock();
+    std::unordered_map<std::string, std::string> parseAttributes();
+    std::string parseType();
 
     std::shared_ptr<ASTNode> parseExpression();
+    std::shared_ptr<ASTNode> parseStatementExpression();
+    std::shared_ptr<ASTNode> parseAssignment();
     std::shared_ptr<ASTNode> parseBinaryOp(int minPrecedence = 0);
     std::shared_ptr<ASTNode> parseUnary();
     std::shared_ptr<ASTNode> parsePrimary();
     std::shared_ptr<ASTNode> parseLiteral();
     std::shared_ptr<ASTNode> parseIdentifier();
     std::shared_ptr<ASTNode> parseCallExpr(std::shared_ptr<ASTNode> callee);
+    std::shared_ptr<ASTNode> parsePostfix(std::shared_ptr<ASTNode> expr);
 
     bool isAtEnd() const { return pos >= tokens.size() || tokens[pos].type == TokenType::TK_EOF; }
 };
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct ASTNode;
+
+// Profile-guided optimization. Every function gets counters for its entry, both
+// arms of each if (a missing else is counted too) and the body of each loop,
+// numbered in a fixed pre-order walk. --profile-generate has codegen bump them
+// and __aol_exit write them to a .aolprof file; --profile-use reads them back
+// onto the same nodes as "count" attributes. Functions are matched by name and
+// a hash of their body, a function edited since the profile was taken is
+// reported and compiled without it.
+//
+// .aolprof: a text header, "AOLPROF <version>", one "fn <name> <hash> <first>
+// <count>" line per function and "counters <n>", followed by n little-endian
+// 64-bit counters.
+
+struct ProfileFunction {
+    std::string name;
+    uint64_t hash;
+    size_t first; // index of its entry counter
+    size_t count;
+};
+
+struct ProfileLayout {
+    std::vector<ProfileFunction> functions;
+    size_t counters = 0;
+
+    std::string header() const;
+};
+
+// Of the function body as parsed, positions are left out so moving code around doesn't invalidate a profile
+uint64_t HashFunction(const std::shared_ptr<ASTNode>& fn);
+
+// Puts a "prof" counter index on every counted node, adding empty else blocks to hold the else counters
+ProfileLayout AssignProfileCounters(const std::shared_ptr<ASTNode>& program);
+
+// Sets "count" on counted nodes and on the ifs, loops and calls inside them,
+// and "hot" on calls made at least 1% as often as the hottest block.
+// Returns false if the file can't be read, stale functions are warned about.
+bool ApplyProfile(const std::shared_ptr<ASTNode>& program, const std::string& path, std::vector<std::string>& remarks);
+
+// Executions recorded by ApplyProfile, -1 without a profile
+int64_t ProfileCount(const std::shared_ptr<ASTNode>& node);
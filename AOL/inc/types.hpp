@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct ASTNode;
+
+// Built-in SIMD vector type, e.g. v4i32 = 4 lanes of 32-bit signed integers
+struct VectorType {
+    std::string name;
+    int lanes;
+    int laneBits;
+    bool isFloat;
+
+    int bytes() const { return lanes * laneBits / 8; }
+    int laneBytes() const { return laneBits / 8; }
+};
+
+// nullptr if name is not a vector type
+const VectorType* FindVectorType(const std::string& name);
+
+// Integer vector of the same shape, the type of a lane-wise compare mask
+const VectorType* MaskTypeOf(const VectorType* type);
+
+// Built-in sized integer type. Registers hold values sign or zero extended to
+// 64 bits, a store keeps only the low bytes.
+struct IntegerType {
+    std::string name;
+    int bytes;
+    bool isSigned;
+    bool isBool; // stored as 0 or 1
+};
+
+// nullptr if name is not an integer type, "" (plain 64-bit) isn't one either
+const IntegerType* FindIntegerType(const std::string& name);
+
+// v wrapped to the width of the type, bool becomes 0 or 1
+int64_t WrapInteger(const IntegerType* type, int64_t v);
+
+// Integer narrower than a register, loads and stores need the width
+bool IsNarrowType(const std::string& type);
+
+// "", *T or an integer type: fits a general purpose register
+bool IsScalarType(const std::string& type);
+
+struct StructField {
+    std::string name;
+    std::string type; // "" = 64-bit integer
+    int offset;
+    int size; // bytes the field occupies, includes the tail of an #[align(N)] field
+    int align;
+};
+
+// User struct type with its computed layout
+struct StructType {
+    std::string name;
+    std::vector<StructField> fields; // memory order
+    int size;
+    int align;
+    bool packed;
+
+    const StructField* field(const std::string& name) const;
+};
+
+// nullptr if name is not a declared struct
+const StructType* FindStructType(const std::string& name);
+
+// *T
+bool IsPointerType(const std::string& type);
+std::string PointeeType(const std::string& type);
+
+// Size and alignment of a value of the type, false if the type is unknown
+bool TypeLayout(const std::string& type, int& size, int& align);
+
+// Lays out every struct declared in the program and replaces sizeof(T) and
+// offsetof(T, field) by their values. Layout decisions are appended to remarks.
+// Returns false on errors.
+bool LayoutStructs(const std::shared_ptr<ASTNode>& program, std::vector<std::string>& remarks);
@@ -0,0 +1,348 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+
+// Asynchronous file I/O for aol_stdlib/aio.aol, straight on the io_uring
+// syscalls. A ring handle is one mapping that starts with the header below.
+// The prep functions fill a submission entry and publish it at once, the
+// kernel only consumes entries in io_uring_enter, so publishing early is safe
+// and a whole batch still goes out with one syscall.
+//
+// Without io_uring (an old kernel, seccomp, or AIO_BLOCKING asked for) the
+// same header points at rings inside the handle. Submitting then runs each
+// entry as the matching blocking syscall and posts its completion, so the
+// prep and reap paths are the same in both modes.
+//
+// x86 keeps stores in order and loads in order, the ring head/tail updates
+// need no fences: entries are written before the tail is, completions are
+// read before the head is.
+static const int AioMaxEntries = 4096;
+static const int AioMaxBuffers = 1024; // UIO_MAXIOV
+static const int AioHeader = 192;
+
+// Handle layout
+static const int RingFd = 0;         // io_uring fd, -1 when blocking
+static const int RingSqHead = 8;     // -> u32
+static const int RingSqTail = 16;    // -> u32
+static const int RingSqMask = 24;
+static const int RingSqArray = 32;   // -> u32[entries]
+static const int RingSqes = 40;      // -> 64-byte entries
+static const int RingCqHead = 48;    // -> u32
+static const int RingCqTail = 56;    // -> u32
+static const int RingCqMask = 64;
+static const int RingCqes = 72;      // -> 16-byte completions
+static const int RingEntries = 80;
+static const int RingInFlight = 88;  // submitted, not reaped yet
+static const int RingBufBase = 96;   // registered buffers: count buffers of size bytes from base
+static const int RingBufSize = 104;
+static const int RingBufCount = 112;
+static const int RingMaps = 120;     // sq ring, cq ring and sqes mappings: address and size pairs
+static const int RingOwnIndex = 168; // blocking mode sq head, sq tail, cq head, cq tail (u32 each)
+static const int RingHandleSize = 184;
+
+// struct io_uring_params offsets
+static const int ParamsSqEntries = 0;
+static const int ParamsCqEntries = 4;
+static const int ParamsFeatures = 20;
+static const int ParamsSqOff = 40;
+static const int ParamsCqOff = 80;
+
+// IORING_OP_*
+static const int OpReadFixed = 4;
+static const int OpWriteFixed = 5;
+static const int OpOpenat = 18;
+static const int OpClose = 19;
+static const int OpRead = 22;
+static const int OpWrite = 23;
+
+static std::string at(const std::string& reg, int offset) {
+    return "[" + reg + " + " + std::to_string(offset) + "]";
+}
+
+std::string Compiler_Amd64::compileAioRuntime() {
+    std::ostringstream out;
+    const std::string r = "%r12"; // the ring in the functions that call out
+
+    // __aol_aio_setup(entries, flags): ring handle, 0 when out of memory.
+    // entries is rounded up to a power of two, flags & 1 forces blocking mode.
+    out << "__aol_aio_setup:\n";
+    out << "\tpush %r12\n\tpush %r13\n\tpush %r14\n\tsub %rsp, 128\n"; // io_uring_params
+    out << "\tmov %r14, %rsi\n\tmov %r13, 1\n";
+    out << "\tcmp %rdi, " << AioMaxEntries << "\n\tjbe __aol_aio_setup_round__\n\tmov %rdi, " << AioMaxEntries << "\n";
+    out << "__aol_aio_setup_round__:\n";
+    out << "\tcmp %rdi, 1\n\tjbe __aol_aio_setup_map__\n";
+    out << "\tlea %rcx, [%rdi - 1]\n\tbsr %rcx, %rcx\n\tinc %rcx\n\tshl %r13, %cl\n";
+    out << "__aol_aio_setup_map__:\n"; // header, then the blocking mode rings: 64 + 2 * 16 bytes per entry
+    out << "\tlea %rdi, [%r13 + %r13*2]\n\tshl %rdi, 5\n\tadd %rdi, " << AioHeader << "\n";
+    out << "\tpush %rdi\n\tcall __aol_mmap\n\tpop %rcx\n";
+    out << "\ttest %rax, %rax\n\tjz __aol_aio_setup_done__\n";
+    out << "\tmov %r12, %rax\n";
+    out << "\tmov " << at(r, RingHandleSize) << ", %rcx\n\tmov " << at(r, RingEntries) << ", %r13\n";
+    out << "\tmov %rcx, -1\n\tmov " << at(r, RingFd) << ", %rcx\n";
+    out << "\ttest %r14, 1\n\tjnz __aol_aio_setup_blocking__\n";
+
+    out << "\tmov %rdi, %rsp\n\txor %eax, %eax\n\tmov %rcx, 16\n\trep stosq\n";
+    out << "\tmov %rax, 425\n\tmov %rdi, %r13\n\tmov %rsi, %rsp\n\tsyscall\n"; // io_uring_setup
+    out << "\ttest %rax, %rax\n\tjs __aol_aio_setup_blocking__\n";
+    out << "\tmov " << at(r, RingFd) << ", %rax\n";
+    // IORING_FEAT_RW_CUR_POS came with the READ, WRITE, OPENAT and CLOSE opcodes (5.6)
+    out << "\tmov %eax, " << at("%rsp", ParamsFeatures) << "\n\ttest %eax, 8\n\tjz __aol_aio_setup_fallback__\n";
+    out << "\tmov %eax, " << at("%rsp", ParamsSqEntries) << "\n\tmov " << at(r, RingEntries) << ", %rax\n";
+
+    // SQ ring: array offset + 4 bytes per entry
+    out << "\tmov %esi, " << at("%rsp", ParamsSqOff + 24) << "\n\tmov %ecx, " << at("%rsp", ParamsSqEntries) << "\n";
+    out << "\tlea %rsi, [%rsi + %rcx*4]\n\txor %r9, %r9\n\tmov %r13, " << RingMaps << "\n\tcall __aol_aio_map__\n";
+    out << "\ttest %rax, %rax\n\tjz __aol_aio_setup_fallback__\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsSqOff) << "\n\tadd %rcx, %rax\n\tmov " << at(r, RingSqHead) << ", %rcx\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsSqOff + 4) << "\n\tadd %rcx, %rax\n\tmov " << at(r, RingSqTail) << ", %rcx\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsSqOff + 8) << "\n\tmov %ecx, [%rax + %rcx]\n\tmov " << at(r, RingSqMask) << ", %rcx\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsSqOff + 24) << "\n\tadd %rcx, %rax\n\tmov " << at(r, RingSqArray) << ", %rcx\n";
+
+    // CQ ring: cqes offset + 16 bytes per completion
+    out << "\tmov %esi, " << at("%rsp", ParamsCqOff + 20) << "\n\tmov %ecx, " << at("%rsp", ParamsCqEntries) << "\n";
+    out << "\tshl %rcx, 4\n\tadd %rsi, %rcx\n\tmov %r9, 134217728\n\tmov %r13, " << RingMaps + 16 << "\n\tcall __aol_aio_map__\n"; // IORING_OFF_CQ_RING
+    out << "\ttest %rax, %rax\n\tjz __aol_aio_setup_fallback__\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsCqOff) << "\n\tadd %rcx, %rax\n\tmov " << at(r, RingCqHead) << ", %rcx\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsCqOff + 4) << "\n\tadd %rcx, %rax\n\tmov " << at(r, RingCqTail) << ", %rcx\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsCqOff + 8) << "\n\tmov %ecx, [%rax + %rcx]\n\tmov " << at(r, RingCqMask) << ", %rcx\n";
+    out << "\tmov %ecx, " << at("%rsp", ParamsCqOff + 20) << "\n\tadd %rcx, %rax\n\tmov " << at(r, RingCqes) << ", %rcx\n";
+
+    // Submission entries, the array maps slot i to entry i for good
+    out << "\tmov %rsi, " << at(r, RingEntries) << "\n\tshl %rsi, 6\n\tmov %r9, 268435456\n\tmov %r13, " << RingMaps + 32 << "\n\tcall __aol_aio_map__\n"; // IORING_OFF_SQES
+    out << "\ttest %rax, %rax\n\tjz __aol_aio_setup_fallback__\n";
+    out << "\tmov " << at(r, RingSqes) << ", %rax\n";
+    out << "\tmov %rdx, " << at(r, RingSqArray) << "\n\txor %ecx, %ecx\n";
+    out << "__aol_aio_setup_array__:\n";
+    out << "\tmov [%rdx + %rcx*4], %ecx\n\tinc %rcx\n\tcmp %rcx, " << at(r, RingEntries) << "\n\tjb __aol_aio_setup_array__\n";
+    out << "\tjmp __aol_aio_setup_ready__\n";
+
+    out << "__aol_aio_setup_fallback__:\n";
+    out << "\tmov %rdi, %r12\n\tcall __aol_aio_release__\n";
+    out << "\tmov %r13, " << at(r, RingEntries) << "\n";
+    out << "__aol_aio_setup_blocking__:\n"; // %r13 = entries
+    int index = RingOwnIndex;
+    for (int field : {RingSqHead, RingSqTail, RingCqHead, RingCqTail}) {
+        out << "\tlea %rax, " << at(r, index) << "\n\tmov " << at(r, field) << ", %rax\n";
+        index += 4;
+    }
+    out << "\tlea %rax, [%r13 - 1]\n\tmov " << at(r, RingSqMask) << ", %rax\n";
+    out << "\tlea %rax, [%r13*2 - 1]\n\tmov " << at(r, RingCqMask) << ", %rax\n";
+    out << "\tlea %rax, " << at(r, AioHeader) << "\n\tmov " << at(r, RingSqes) << ", %rax\n";
+    out << "\tshl %r13, 6\n\tadd %rax, %r13\n\tmov " << at(r, RingCqes) << ", %rax\n";
+    out << "__aol_aio_setup_ready__:\n";
+    out << "\tmov %rax, %r12\n";
+    out << "__aol_aio_setup_done__:\n";
+    out << "\tadd %rsp, 128\n\tpop %r14\n\tpop %r13\n\tpop %r12\n\tret\n\n";
+
+    // mmap(0, %rsi, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring fd, %r9) of
+    // ring %r12, recorded at handle offset %r13 so it can be undone. 0 on failure.
+    out << "__aol_aio_map__:\n";
+    out << "\tpush %rsi\n";
+    out << "\txor %edi, %edi\n\tmov %rdx, 3\n\tmov %r10, 32769\n\tmov %r8, " << at(r, RingFd) << "\n";
+    out << "\tmov %rax, 9\n\tsyscall\n\tpop %rsi\n";
+    out << "\tcmp %rax, -4096\n\tjbe __aol_aio_mapped__\n\txor %eax, %eax\n\tret\n";
+    out << "__aol_aio_mapped__:\n";
+    out << "\tmov [%r12 + %r13], %rax\n\tmov [%r12 + %r13 + 8], %rsi\n\tret\n\n";
+
+    // __aol_aio_release__(ring): unmaps the kernel rings and closes the ring fd, the handle stays
+    out << "__aol_aio_release__:\n";
+    out << "\tpush %r12\n\tpush %r13\n\tmov %r12, %rdi\n\tmov %r13, " << RingMaps << "\n";
+    out << "__aol_aio_release_map__:\n";
+    out << "\tmov %rdi, [%r12 + %r13]\n\tmov %rsi, [%r12 + %r13 + 8]\n";
+    out << "\ttest %rsi, %rsi\n\tjz __aol_aio_release_next__\n\tcall __aol_munmap\n";
+    out << "\txor %eax, %eax\n\tmov [%r12 + %r13], %rax\n\tmov [%r12 + %r13 + 8], %rax\n";
+    out << "__aol_aio_release_next__:\n";
+    out << "\tadd %r13, 16\n\tcmp %r13, " << RingMaps + 48 << "\n\tjb __aol_aio_release_map__\n";
+    out << "\tmov %rdi, " << at(r, RingFd) << "\n\ttest %rdi, %rdi\n\tjs __aol_aio_released__\n";
+    out << "\tmov %rax, 3\n\tsyscall\n\tmov %rax, -1\n\tmov " << at(r, RingFd) << ", %rax\n"; // close
+    out << "__aol_aio_released__:\n";
+    out << "\tpop %r13\n\tpop %r12\n\tret\n\n";
+
+    // __aol_aio_destroy(ring): waits for nothing, in-flight requests still complete into their buffers
+    out << "__aol_aio_destroy:\n";
+    out << "\ttest %rdi, %rdi\n\tjz __aol_aio_destroyed__\n";
+    out << "\tpush %rdi\n\tcall __aol_aio_release__\n\tpop %rdi\n";
+    out << "\tmov %rsi, " << at("%rdi", RingHandleSize) << "\n\tjmp __aol_munmap\n";
+    out << "__aol_aio_destroyed__:\n";
+    out << "\tret\n\n";
+
+    // __aol_aio_blocking(ring): 1 when the ring runs on blocking syscalls
+    out << "__aol_aio_blocking:\n";
+    out << "\tmov %rax, " << at("%rdi", RingFd) << "\n\tshr %rax, 63\n\tret\n\n";
+
+    // Zeroed entry at the sq tail of ring %rdi into %rax, submits first when the
+    // ring is full. A negative %rax is the error of that submit. Only clobbers %r11.
+    out << "__aol_aio_sqe__:\n";
+    out << "\tmov %rax, " << at("%rdi", RingSqHead) << "\n\tmov %eax, [%rax]\n";
+    out << "\tmov %r11, " << at("%rdi", RingSqTail) << "\n\tmov %r11d, [%r11]\n";
+    out << "\tsub %r11d, %eax\n\tcmp %r11, " << at("%rdi", RingEntries) << "\n\tjb __aol_aio_sqe_free__\n";
+    out << "\tpush %rdi\n\tpush %rsi\n\tpush %rdx\n\tpush %rcx\n\tpush %r8\n\tpush %r9\n\tpush %r10\n";
+    out << "\tcall __aol_aio_submit\n";
+    out << "\tpop %r10\n\tpop %r9\n\tpop %r8\n\tpop %rcx\n\tpop %rdx\n\tpop %rsi\n\tpop %rdi\n";
+    out << "\ttest %rax, %rax\n\tjg __aol_aio_sqe__\n\tjs __aol_aio_sqe_done__\n";
+    out << "\tmov %rax, -16\n\tret\n"; // -EBUSY: blocking mode with every completion slot taken
+    out << "__aol_aio_sqe_free__:\n";
+    out << "\tmov %r11, " << at("%rdi", RingSqTail) << "\n\tmov %r11d, [%r11]\n";
+    out << "\tand %r11, " << at("%rdi", RingSqMask) << "\n\tshl %r11, 6\n";
+    out << "\tmov %rax, " << at("%rdi", RingSqes) << "\n\tadd %rax, %r11\n";
+    out << "\txor %r11d, %r11d\n";
+    for (int i = 0; i < 64; i += 8) out << "\tmov " << at("%rax", i) << ", %r11\n";
+    out << "__aol_aio_sqe_done__:\n";
+    out << "\tret\n\n";
+
+    // Publishes the entry filled at the sq tail of ring %rdi, returns 0
+    out << "__aol_aio_push__:\n";
+    out << "\tmov %r11, " << at("%rdi", RingSqTail) << "\n\tadd dword [%r11], 1\n";
+    out << "\txor %eax, %eax\n\tret\n\n";
+
+    // Every prep function returns 0, or a negative errno when the request was not queued.
+    // __aol_aio_read/__aol_aio_write(ring, fd, buf, len, offset, userData): offset -1 is the file position
+    out << "__aol_aio_read:\n\tmov %r10d, " << OpRead << "\n\tjmp __aol_aio_rw__\n";
+    out << "__aol_aio_write:\n\tmov %r10d, " << OpWrite << "\n";
+    out << "__aol_aio_rw__:\n";
+    out << "\tcall __aol_aio_sqe__\n\ttest %rax, %rax\n\tjs __aol_aio_sqe_done__\n";
+    out << "\tmov [%rax], %r10d\n\tmov [%rax + 4], %esi\n\tmov [%rax + 8], %r8\n";
+    out << "\tmov [%rax + 16], %rdx\n\tmov [%rax + 24], %ecx\n\tmov [%rax + 32], %r9\n";
+    out << "\tjmp __aol_aio_push__\n\n";
+
+    // __aol_aio_read_fixed/__aol_aio_write_fixed(ring, fd, index, len, offset, userData):
+    // from or into the start of registered buffer index
+    out << "__aol_aio_read_fixed:\n\tmov %r10d, " << OpReadFixed << "\n\tjmp __aol_aio_fixed__\n";
+    out << "__aol_aio_write_fixed:\n\tmov %r10d, " << OpWriteFixed << "\n";
+    out << "__aol_aio_fixed__:\n";
+    out << "\tcmp %rdx, " << at("%rdi", RingBufCount) << "\n\tjae __aol_aio_einval__\n";
+    out << "\tcmp %rcx, " << at("%rdi", RingBufSize) << "\n\tja __aol_aio_einval__\n";
+    out << "\tcall __aol_aio_sqe__\n\ttest %rax, %rax\n\tjs __aol_aio_sqe_done__\n";
+    out << "\tmov [%rax], %r10d\n\tmov [%rax + 4], %esi\n\tmov [%rax + 8], %r8\n";
+    out << "\tmov %r11, %rdx\n\timul %r11, " << at("%rdi", RingBufSize) << "\n\tadd %r11, " << at("%rdi", RingBufBase) << "\n";
+    out << "\tmov [%rax + 16], %r11\n\tmov [%rax + 24], %ecx\n\tmov [%rax + 32], %r9\n";
+    out << "\tmov [%rax + 40], %edx\n"; // buf_index, below 65536
+    out << "\tjmp __aol_aio_push__\n";
+    out << "__aol_aio_einval__:\n";
+    out << "\tmov %rax, -22\n\tret\n\n";
+
+    // __aol_aio_openat(ring, path, flags, mode, userData): relative to the working directory
+    out << "__aol_aio_openat:\n";
+    out << "\tmov %r10d, " << OpOpenat << "\n\tcall __aol_aio_sqe__\n\ttest %rax, %rax\n\tjs __aol_aio_sqe_done__\n";
+    out << "\tmov [%rax], %r10d\n\tmov %r10d, -100\n\tmov [%rax + 4], %r10d\n"; // AT_FDCWD
+    out << "\tmov [%rax + 16], %rsi\n\tmov [%rax + 24], %ecx\n\tmov [%rax + 28], %edx\n\tmov [%rax + 32], %r8\n";
+    out << "\tjmp __aol_aio_push__\n\n";
+
+    // __aol_aio_close(ring, fd, userData)
+    out << "__aol_aio_close:\n";
+    out << "\tmov %r10d, " << OpClose << "\n\tcall __aol_aio_sqe__\n\ttest %rax, %rax\n\tjs __aol_aio_sqe_done__\n";
+    out << "\tmov [%rax], %r10d\n\tmov [%rax + 4], %esi\n\tmov [%rax + 32], %rdx\n";
+    out << "\tjmp __aol_aio_push__\n\n";
+
+    // __aol_aio_register_buffers(ring, base, size, count): buffer i is size bytes at
+    // base + i * size. Pins the pages once instead of on every fixed read or write.
+    out << "__aol_aio_register_buffers:\n";
+    out << "\tlea %rax, [%rcx - 1]\n\tcmp %rax, " << AioMaxBuffers << "\n\tjae __aol_aio_einval__\n";
+    out << "\tmov %rax, " << at("%rdi", RingFd) << "\n\ttest %rax, %rax\n\tjs __aol_aio_registered__\n";
+    out << "\tpush %rbp\n\tmov %rbp, %rsp\n";
+    out << "\tmov %r8, %rcx\n\tshl %r8, 4\n\tsub %rsp, %r8\n\tand %rsp, -16\n";
+    out << "\tmov %r8, %rsi\n\txor %r9d, %r9d\n";
+    out << "__aol_aio_register_iov__:\n"; // struct iovec { base, len }
+    out << "\tmov %rax, %r9\n\tshl %rax, 4\n\tmov [%rsp + %rax], %r8\n\tmov [%rsp + %rax + 8], %rdx\n";
+    out << "\tadd %r8, %rdx\n\tinc %r9\n\tcmp %r9, %rcx\n\tjb __aol_aio_register_iov__\n";
+    out << "\tpush %rdi\n\tpush %rsi\n\tpush %rdx\n\tpush %rcx\n";
+    out << "\tmov %r10, %rcx\n\tlea %rdx, [%rsp + 32]\n\tmov %rdi, " << at("%rdi", RingFd) << "\n\txor %esi, %esi\n"; // IORING_REGISTER_BUFFERS
+    out << "\tmov %rax, 427\n\tsyscall\n";
+    out << "\tpop %rcx\n\tpop %rdx\n\tpop %rsi\n\tpop %rdi\n";
+    out << "\tmov %rsp, %rbp\n\tpop %rbp\n";
+    out << "\ttest %rax, %rax\n\tjs __aol_aio_sqe_done__\n";
+    out << "__aol_aio_registered__:\n";
+    out << "\tmov " << at("%rdi", RingBufBase) << ", %rsi\n\tmov " << at("%rdi", RingBufSize) << ", %rdx\n";
+    out << "\tmov " << at("%rdi", RingBufCount) << ", %rcx\n\txor %eax, %eax\n\tret\n\n";
+
+    // __aol_aio_submit(ring) / __aol_aio_submit_wait(ring, waitNr): hands every queued
+    // entry to the kernel with one io_uring_enter and waits for waitNr completions.
+    // Returns the number submitted or a negative errno.
+    out << "__aol_aio_submit:\n";
+    out << "\txor %esi, %esi\n";
+    out << "__aol_aio_submit_wait:\n";
+    out << "\tmov %rax, " << at("%rdi", RingFd) << "\n\ttest %rax, %rax\n\tjs __aol_aio_run__\n";
+    out << "\tpush %rdi\n";
+    out << "\tmov %rcx, " << at("%rdi", RingSqHead) << "\n\tmov %ecx, [%rcx]\n";
+    out << "\tmov %rdx, " << at("%rdi", RingSqTail) << "\n\tmov %edx, [%rdx]\n\tsub %edx, %ecx\n";
+    out << "\txor %r10d, %r10d\n\ttest %rsi, %rsi\n\tjz __aol_aio_enter__\n\tmov %r10d, 1\n"; // IORING_ENTER_GETEVENTS
+    out << "__aol_aio_enter__:\n";
+    out << "\tmov %rdi, %rax\n\txchg %rsi, %rdx\n\txor %r8d, %r8d\n\txor %r9d, %r9d\n";
+    out << "__aol_aio_enter_retry__:\n";
+    out << "\tmov %rax, 426\n\tsyscall\n";
+    out << "\tcmp %rax, -4\n\tje __aol_aio_enter_retry__\n"; // -EINTR before anything was submitted
+    out << "\tpop %rdi\n\ttest %rax, %rax\n\tjs __aol_aio_sqe_done__\n";
+    out << "\tadd " << at("%rdi", RingInFlight) << ", %rax\n\tret\n\n";
+
+    // Blocking mode submit: runs the queued entries in order while there is room
+    // for their completions, returns how many ran
+    out << "__aol_aio_run__:\n";
+    out << "\tpush %r12\n\tpush %r13\n\tmov %r12, %rdi\n\txor %r13d, %r13d\n";
+    out << "__aol_aio_run_next__:\n";
+    out << "\tmov %eax, " << at(r, RingOwnIndex) << "\n\tcmp %eax, " << at(r, RingOwnIndex + 4) << "\n\tje __aol_aio_run_done__\n";
+    out << "\tmov %ecx, " << at(r, RingOwnIndex + 12) << "\n\tsub %ecx, " << at(r, RingOwnIndex + 8) << "\n";
+    out << "\tmov %rdx, " << at(r, RingCqMask) << "\n\tcmp %rcx, %rdx\n\tja __aol_aio_run_done__\n";
+    out << "\tand %rax, " << at(r, RingSqMask) << "\n\tshl %rax, 6\n\tmov %r9, " << at(r, RingSqes) << "\n\tadd %r9, %rax\n";
+    out << "\tmovzx %eax, byte [%r9]\n\tmovsxd %rdi, dword [%r9 + 4]\n";
+    out << "\tmov %rsi, [%r9 + 16]\n\tmov %edx, [%r9 + 24]\n\tmov %r10, [%r9 + 8]\n";
+    out << "\tcmp %eax, " << OpRead << "\n\tje __aol_aio_run_read__\n";
+    out << "\tcmp %eax, " << OpReadFixed << "\n\tje __aol_aio_run_read__\n";
+    out << "\tcmp %eax, " << OpWrite << "\n\tje __aol_aio_run_write__\n";
+    out << "\tcmp %eax, " << OpWriteFixed << "\n\tje __aol_aio_run_write__\n";
+    out << "\tcmp %eax, " << OpOpenat << "\n\tje __aol_aio_run_openat__\n";
+    out << "\tmov %r8, 3\n\tcmp %eax, " << OpClose << "\n\tje __aol_aio_run_syscall__\n";
+    out << "\tmov %rax, -22\n\tjmp __aol_aio_run_post__\n";
+    out << "__aol_aio_run_read__:\n"; // pread64, read at the file position for offset -1
+    out << "\tmov %r8, 17\n\tcmp %r10, -1\n\tjne __aol_aio_run_syscall__\n\txor %r8d, %r8d\n\tjmp __aol_aio_run_syscall__\n";
+    out << "__aol_aio_run_write__:\n"; // pwrite64 or write
+    out << "\tmov %r8, 18\n\tcmp %r10, -1\n\tjne __aol_aio_run_syscall__\n\tmov %r8, 1\n\tjmp __aol_aio_run_syscall__\n";
+    out << "__aol_aio_run_openat__:\n";
+    out << "\tmov %r8, 257\n\tmov %edx, [%r9 + 28]\n\tmov %r10d, [%r9 + 24]\n";
+    out << "__aol_aio_run_syscall__:\n";
+    out << "\tmov %rax, %r8\n\tsyscall\n\tcmp %rax, -4\n\tje __aol_aio_run_syscall__\n"; // -EINTR
+    out << "__aol_aio_run_post__:\n"; // completion { userData, res, flags 0 }
+    out << "\tmov %ecx, " << at(r, RingOwnIndex + 12) << "\n\tmov %rdx, %rcx\n\tand %rdx, " << at(r, RingCqMask) << "\n";
+    out << "\tshl %rdx, 4\n\tadd %rdx, " << at(r, RingCqes) << "\n";
+    out << "\tmov %r11, [%r9 + 32]\n\tmov [%rdx], %r11\n\tmov [%rdx + 8], %eax\n\txor %r11d, %r11d\n\tmov [%rdx + 12], %r11d\n";
+    out << "\tinc %ecx\n\tmov " << at(r, RingOwnIndex + 12) << ", %ecx\n";
+    out << "\tadd dword " << at(r, RingOwnIndex) << ", 1\n";
+    out << "\tmov %rax, " << at(r, RingInFlight) << "\n\tinc %rax\n\tmov " << at(r, RingInFlight) << ", %rax\n";
+    out << "\tinc %r13\n\tjmp __aol_aio_run_next__\n";
+    out << "__aol_aio_run_done__:\n";
+    out << "\tmov %rax, %r13\n\tpop %r13\n\tpop %r12\n\tret\n\n";
+
+    // __aol_aio_peek(ring, completion): takes the oldest completion into
+    // completion { userData, res }, 1 if there was one, 0 otherwise
+    out << "__aol_aio_peek:\n";
+    out << "\tmov %rax, " << at("%rdi", RingCqHead) << "\n\tmov %ecx, [%rax]\n";
+    out << "\tmov %rdx, " << at("%rdi", RingCqTail) << "\n\tmov %edx, [%rdx]\n";
+    out << "\tcmp %ecx, %edx\n\tje __aol_aio_peek_empty__\n";
+    out << "\tmov %rdx, %rcx\n\tand %rdx, " << at("%rdi", RingCqMask) << "\n\tshl %rdx, 4\n\tadd %rdx, " << at("%rdi", RingCqes) << "\n";
+    out << "\tmov %r8, [%rdx]\n\tmov [%rsi], %r8\n\tmovsxd %r8, dword [%rdx + 8]\n\tmov [%rsi + 8], %r8\n";
+    out << "\tinc %ecx\n\tmov [%rax], %ecx\n"; // the slot is the kernel's again
+    out << "\tmov %r8, " << at("%rdi", RingInFlight) << "\n\tdec %r8\n\tmov " << at("%rdi", RingInFlight) << ", %r8\n";
+    out << "\tmov %rax, 1\n\tret\n";
+    out << "__aol_aio_peek_empty__:\n";
+    out << "\txor %eax, %eax\n\tret\n\n";
+
+    // __aol_aio_wait(ring, completion): like peek, but submits what is queued and
+    // sleeps until a completion arrives. 0, a negative errno, or -EAGAIN when
+    // nothing is queued or in flight.
+    out << "__aol_aio_wait:\n";
+    out << "\tpush %rdi\n\tpush %rsi\n";
+    out << "__aol_aio_wait_again__:\n";
+    out << "\tmov %rdi, [%rsp + 8]\n\tmov %rsi, [%rsp]\n\tcall __aol_aio_peek\n";
+    out << "\ttest %rax, %rax\n\tjnz __aol_aio_wait_got__\n";
+    out << "\tmov %rdi, [%rsp + 8]\n";
+    out << "\tmov %rcx, " << at("%rdi", RingSqHead) << "\n\tmov %ecx, [%rcx]\n";
+    out << "\tmov %rdx, " << at("%rdi", RingSqTail) << "\n\tmov %edx, [%rdx]\n\tsub %edx, %ecx\n";
+    out << "\tor %rdx, " << at("%rdi", RingInFlight) << "\n\tjz __aol_aio_wait_idle__\n";
+    out << "\tmov %rsi, 1\n\tcall __aol_aio_submit_wait\n";
+    out << "\ttest %rax, %rax\n\tjns __aol_aio_wait_again__\n\tjmp __aol_aio_wait_done__\n";
+    out << "__aol_aio_wait_idle__:\n";
+    out << "\tmov %rax, -11\n\tjmp __aol_aio_wait_done__\n";
+    out << "__aol_aio_wait_got__:\n";
+    out << "\txor %eax, %eax\n";
+    out << "__aol_aio_wait_done__:\n";
+    out << "\tadd %rsp, 16\n\tret\n\n";
+    return out.str();
+}
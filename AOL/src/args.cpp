@@ -30,6 +30,14 @@ bool ArgParser::parse(int argc, char** argv, bool& showHelp) {
         }
 
         if (arg.starts_with("-")) {
+            // --name=value or -name=value (-march=v3), for options with an optional value this is the only way to give one
+            std::optional<std::string> inlineValue;
+            size_t eq = arg.find('=');
+            if (eq != std::string::npos) {
+                inlineValue = arg.substr(eq + 1);
+                arg.resize(eq);
+            }
+
             auto opt = find(arg);
             if (!opt) {
                 std::cerr << Color::Red << "Error: Unknown option '" << arg << "'" << Color::Reset << "\n";
@@ -38,7 +46,9 @@ bool ArgParser::parse(int argc, char** argv, bool& showHelp) {
 
             opt->found = true;
 
-            if (opt->requiresValue) {
+            if (inlineValue) {
+                opt->value = inlineValue;
+            } else if (opt->requiresValue) {
                 if (i + 1 >= argc) {
                     std::cerr << Color::Red << "Error: Missing value for '" << arg << "'" << Color::Reset << "\n";
                     return false;
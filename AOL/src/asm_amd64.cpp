@@ -0,0 +1,156 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+// Registers an "r" operand may be given. %rbx anchors the aligned area and the
+// callee-saved ones would have to be preserved, so only scratch registers are used.
+static const std::vector<std::string> AsmScratchRegs = {
+    "%rax", "%rcx", "%rdx", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11",
+};
+
+static const std::vector<std::string> CalleeSavedRegs = {"%rbx", "%r12", "%r13", "%r14", "%r15"};
+
+static const std::vector<std::string> AllGprs = {
+    "%rax", "%rbx", "%rcx", "%rdx", "%rsi", "%rdi", "%rbp", "%rsp",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+};
+
+// "rax" or "%rax", "" if it doesn't name a 64-bit general purpose register
+static std::string gprName(const std::string& text) {
+    std::string reg = !text.empty() && text[0] == '%' ? text : "%" + text;
+    return std::find(AllGprs.begin(), AllGprs.end(), reg) != AllGprs.end() ? reg : "";
+}
+
+// Statements start with no AOL value live in a register, so an asm block only
+// moves its own operands: inputs are loaded right before it, outputs stored
+// right after, and every register it doesn't name or clobber is left alone.
+std::string Compiler_Amd64::compileAsm(const std::shared_ptr<ASTNode>& node) {
+    auto where = [&](const std::shared_ptr<ASTNode>& at) {
+        return " at line " + std::to_string(at->line) + " col " + std::to_string(at->col) + "\n";
+    };
+
+    std::vector<std::string> clobbers;
+    std::stringstream clobberList(node->attributes.count("clobber") ? node->attributes.at("clobber") : "");
+    for (std::string item; std::getline(clobberList, item, ',');) {
+        if (item == "memory" || item == "cc") continue; // nothing is cached in registers across statements anyway
+        std::string reg = gprName(item);
+        if (reg.empty() || reg == "%rbp" || reg == "%rsp") {
+            std::cerr << "Error: Can't clobber '" << item << "' in asm block" << where(node);
+            return "";
+        }
+        clobbers.push_back(reg);
+    }
+
+    // Fixed registers first, then "r" operands take what is left
+    std::vector<std::string> regs(node->params.size());
+    std::vector<std::string> taken = clobbers;
+    for (size_t i = 0; i < node->params.size(); ++i) {
+        auto& op = node->params[i];
+        if (op->value == "r" || op->value == "m" || op->value == "i") continue;
+        regs[i] = gprName(op->value);
+        if (regs[i].empty() || regs[i] == "%rbp" || regs[i] == "%rsp") {
+            std::cerr << "Error: Unknown asm constraint \"" << op->value << "\" for '" << op->name << "'" << where(op);
+            return "";
+        }
+        if (std::find(taken.begin(), taken.end(), regs[i]) != taken.end()) {
+            std::cerr << "Error: Register " << regs[i] << " of '" << op->name << "' is already in use by the asm block" << where(op);
+            return "";
+        }
+        taken.push_back(regs[i]);
+    }
+    for (size_t i = 0; i < node->params.size(); ++i) {
+        if (node->params[i]->value != "r") continue;
+        for (auto& reg : AsmScratchRegs) {
+            if (std::find(taken.begin(), taken.end(), reg) != taken.end()) continue;
+            regs[i] = reg;
+            taken.push_back(reg);
+            break;
+        }
+        if (regs[i].empty()) {
+            std::cerr << "Error: Out of registers for asm operand '" << node->params[i]->name << "'" << where(node->params[i]);
+            return "";
+        }
+    }
+
+    // Placeholder text of every operand, checking what each constraint accepts
+    std::unordered_map<std::string, std::string> text;
+    for (size_t i = 0; i < node->params.size(); ++i) {
+        auto& op = node->params[i];
+        auto& value = node->children[i];
+        const std::string& dir = op->attributes["dir"];
+        std::string mem = value->type == ASTNodeType::Literal ? "" : simpleOperand(value);
+        std::string type = exprType(value);
+        if (dir != "in" && (mem.empty() || !IsScalarType(type) || IsNarrowType(type))) {
+            std::cerr << "Error: asm output '" << op->name << "' must be a 64-bit scalar variable or struct field" << where(op);
+            return "";
+        }
+        if (op->value == "m" && mem.empty()) {
+            std::cerr << "Error: asm operand '" << op->name << "' has constraint \"m\" but is not in memory" << where(op);
+            return "";
+        }
+        if (op->value == "i" && (!IsIntegerLiteral(value) || dir != "in")) {
+            std::cerr << "Error: asm operand '" << op->name << "' has constraint \"i\" but is not a constant" << where(op);
+            return "";
+        }
+        if (!text.emplace(op->name, op->value == "m" ? mem : op->value == "i" ? value->value : regs[i]).second) {
+            std::cerr << "Error: Duplicate asm operand '" << op->name << "'" << where(op);
+            return "";
+        }
+    }
+    text["#"] = std::to_string(labelIdx++); // unique per block, for labels inside the template
+
+    std::ostringstream out;
+    out << "\t// asm\n";
+
+    std::vector<std::string> saved;
+    for (auto& reg : taken)
+        if (std::find(CalleeSavedRegs.begin(), CalleeSavedRegs.end(), reg) != CalleeSavedRegs.end()) {
+            out << push(reg);
+            saved.push_back(reg);
+        }
+
+    // Inputs that need code are evaluated onto the stack first, so computing one
+    // can't clobber a register another was already loaded into
+    std::vector<size_t> computed;
+    for (size_t i = 0; i < node->params.size(); ++i) {
+        if (regs[i].empty() || node->params[i]->attributes["dir"] == "out") continue;
+        if (!simpleOperand(node->children[i]).empty()) continue;
+        out << compileExpression(node->children[i], "%rax");
+        out << push("%rax");
+        computed.push_back(i);
+    }
+    for (auto it = computed.rbegin(); it != computed.rend(); ++it) out << pop(regs[*it]);
+    for (size_t i = 0; i < node->params.size(); ++i) {
+        if (regs[i].empty() || node->params[i]->attributes["dir"] == "out") continue;
+        if (std::find(computed.begin(), computed.end(), i) != computed.end()) continue;
+        out << "\tmov " << regs[i] << ", " << simpleOperand(node->children[i]) << "\n";
+    }
+
+    std::stringstream lines(node->value);
+    for (std::string line; std::getline(lines, line);) {
+        std::string expanded;
+        for (size_t p = 0; p < line.size(); ++p) {
+            size_t close = line[p] == '{' ? line.find('}', p) : std::string::npos;
+            auto found = close != std::string::npos ? text.find(line.substr(p + 1, close - p - 1)) : text.end();
+            if (found == text.end()) {
+                if (close != std::string::npos) {
+                    std::cerr << "Error: Unknown asm operand '" << line.substr(p, close - p + 1) << "'" << where(node);
+                    return "";
+                }
+                expanded += line[p];
+                continue;
+            }
+            expanded += found->second;
+            p = close;
+        }
+        out << "\t" << expanded << "\n";
+    }
+
+    for (size_t i = 0; i < node->params.size(); ++i)
+        if (!regs[i].empty() && node->params[i]->attributes["dir"] != "in")
+            out << "\tmov " << simpleOperand(node->children[i]) << ", " << regs[i] << "\n";
+
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) out << pop(*it);
+    return out.str();
+}
@@ -0,0 +1,198 @@
+#include <compiler_amd64.hpp>
+#include <iostream>
+#include <sstream>
+
+// Stackless coroutines. An async fn compiles to a resume function taking its
+// frame in %rdi and a constructor, name__new(arena, args...), that carves the
+// frame out of the arena. The frame is a header followed by an image of the
+// function's stack locals:
+//
+//     0 resume  8 state  16 result  24 waiter  32 next  40 arena  48 locals...
+//
+// Locals live on the stack while the coroutine runs like in any other
+// function. Suspending copies them into the frame and returns, resuming copies
+// them back and jumps to the await the state names, so an await may sit
+// anywhere in the control flow as long as no expression around it holds a
+// value (the code generator checks).
+//
+// Resuming returns 0 once the coroutine has finished, its result is in the
+// frame then. Otherwise it returns the task that is ready to run again: itself
+// after async_yield(), or the innermost task of a chain of awaits. The waiter
+// of a finished task is ready to run. aol_stdlib/executor.aol schedules by
+// these rules, nothing here knows about the executor.
+static const int FrameResume = 0;
+static const int FrameState = 8;
+static const int FrameResult = 16;
+static const int FrameWaiter = 24;
+static const int FrameNext = 32;
+static const int FrameArena = 40;
+static const int FrameLocals = 48;
+
+static const int MaxCoroutineParams = 5; // the arena takes the first argument register of the constructor
+
+static std::string slot(int offset) {
+    return "[%rbp - " + std::to_string(offset) + "]";
+}
+
+bool Compiler_Amd64::isCoroutine(const std::string& name) const {
+    auto fn = functions.find(name);
+    return fn != functions.end() && fn->second.body && fn->second.body->attributes.count("async");
+}
+
+// The hidden slots come first, the parameters arrive in the frame image
+std::string Compiler_Amd64::compileCoroutineEntry(const std::shared_ptr<ASTNode>& fn) {
+    coroutine = CoroutineState();
+    coroutine.active = true;
+    coroutine.suspendLabel = newLabel("suspend");
+    coroutine.frameSlot = allocateLocal("%frame");
+    coroutine.arenaSlot = allocateLocal("%arena");
+    coroutine.childSlot = allocateLocal("%child");
+
+    if ((int)fn->params.size() > MaxCoroutineParams)
+        std::cerr << "Error: Async function '" << fn->name << "' takes more than " << MaxCoroutineParams << " parameters at line " << fn->line << " col " << fn->col << "\n";
+    for (auto& param : fn->params) {
+        if (!IsScalarType(param->typeName)) {
+            std::cerr << "Error: Parameter '" << param->name << "' of async function '" << fn->name << "' must be a scalar at line " << param->line << " col " << param->col << "\n";
+            continue;
+        }
+        const IntegerType* it = FindIntegerType(param->typeName);
+        int size = it ? it->bytes : 8;
+        allocateLocal(param->name, size, param->typeName, size);
+        currentFunction->params.push_back({param->name, 0, size, "", param->typeName});
+    }
+    return "";
+}
+
+// Copies the frame image onto the stack and continues where the state says
+std::string Compiler_Amd64::compileCoroutineDispatch() {
+    std::ostringstream out;
+    int size = currentFunction->stackSize;
+    std::string start = newLabel("start");
+    out << "\tmov %rax, %rdi\n";
+    out << "\tlea %rsi, [%rdi + " << FrameLocals << "]\n\tlea %rdi, " << slot(size) << "\n\tmov %rcx, " << size << "\n\trep movsb\n";
+    out << "\tmov " << slot(coroutine.frameSlot) << ", %rax\n";
+    out << "\tmov %rcx, [%rax + " << FrameArena << "]\n\tmov " << slot(coroutine.arenaSlot) << ", %rcx\n";
+    out << "\tmov %rcx, [%rax + " << FrameState << "]\n\ttest %rcx, %rcx\n\tjz " << start << "\n";
+    for (size_t i = 0; i < coroutine.resumeLabels.size(); ++i)
+        out << "\tcmp %rcx, " << i + 1 << "\n\tje " << coroutine.resumeLabels[i] << "\n";
+    out << "\txor %eax, %eax\n\tjmp " << returnLabel << "\n"; // finished already
+    out << start << ":\n";
+    return out.str();
+}
+
+// %rax = the task to run next, the state is set. Saves the locals and returns.
+std::string Compiler_Amd64::compileCoroutineSuspend() {
+    std::ostringstream out;
+    int size = currentFunction->stackSize;
+    out << coroutine.suspendLabel << ":\n";
+    out << "\tmov %r8, %rax\n";
+    out << "\tmov %rdi, " << slot(coroutine.frameSlot) << "\n\tadd %rdi, " << FrameLocals << "\n";
+    out << "\tlea %rsi, " << slot(size) << "\n\tmov %rcx, " << size << "\n\trep movsb\n";
+    out << "\tmov %rax, %r8\n\tjmp " << returnLabel << "\n";
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileCoroutineFinish(const std::string& reg) {
+    std::ostringstream out;
+    out << "\tmov %rcx, " << slot(coroutine.frameSlot) << "\n";
+    out << "\tmov [%rcx + " << FrameResult << "], " << reg << "\n";
+    out << "\tmov %rdx, -1\n\tmov [%rcx + " << FrameState << "], %rdx\n";
+    out << "\txor %eax, %eax\n\tjmp " << returnLabel << "\n";
+    return out.str();
+}
+
+// name__new(arena, args...): the frame, not started yet, 0 when the arena is full
+std::string Compiler_Amd64::compileCoroutineConstructor(const std::shared_ptr<ASTNode>& fn) {
+    std::ostringstream out;
+    int size = currentFunction->stackSize;
+    size_t args = std::min<size_t>(currentFunction->params.size(), MaxCoroutineParams) + 1;
+    std::string done = newLabel("new_done");
+    out << ".func " << fn->name << "__new\n";
+    out << "\tpush %rbp\n\tmov %rbp, %rsp\n\tsub %rsp, 48\n";
+    for (size_t i = 0; i < args; ++i) out << "\tmov " << slot(8 * (i + 1)) << ", " << SysVArgRegs[i] << "\n";
+    out << "\tmov %rsi, " << FrameLocals + size << "\n\tcall __aol_arena_alloc\n";
+    out << "\ttest %rax, %rax\n\tjz " << done << "\n";
+    out << "\tlea %rcx, [$" << fn->name << "]\n\tmov [%rax + " << FrameResume << "], %rcx\n";
+    out << "\txor %ecx, %ecx\n";
+    for (int field : {FrameState, FrameResult, FrameWaiter, FrameNext}) out << "\tmov [%rax + " << field << "], %rcx\n";
+    out << "\tmov %rcx, " << slot(8) << "\n\tmov [%rax + " << FrameArena << "], %rcx\n";
+    for (size_t i = 0; i + 1 < args; ++i) {
+        const VariableInfo* param = findVariable(currentFunction->params[i].name);
+        if (!param) continue;
+        out << "\tmov %rcx, " << slot(8 * (i + 2)) << "\n";
+        out << StoreScalar(param->type, "[%rax + " + std::to_string(FrameLocals + size - param->offset) + "]", "%rcx");
+    }
+    out << done << ":\n";
+    out << "\tmov %rsp, %rbp\n\tpop %rbp\n\tret\n";
+    out << ".endfunc\n\n";
+    return out.str();
+}
+
+// await f(args) starts f in a frame from this task's arena and runs it right
+// away, a task that finishes without suspending costs no trip through the
+// executor. await async_yield() lets every other ready task run first.
+std::string Compiler_Amd64::compileAwait(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    auto where = " at line " + std::to_string(node->line) + " col " + std::to_string(node->col) + "\n";
+    auto& call = node->children[0];
+    if (!coroutine.active) {
+        std::cerr << "Error: await outside of an async function" << where;
+        return "";
+    }
+    if (pushDepth != 0 || heldRegs != 0) {
+        std::cerr << "Error: await inside an expression that holds a value, await in a statement, a let or an assignment" << where;
+        return "";
+    }
+    bool yield = call->type == ASTNodeType::CallExpr && call->name == "async_yield" && !functions.count(call->name);
+    if (!yield && (call->type != ASTNodeType::CallExpr || !isCoroutine(call->name))) {
+        std::cerr << "Error: await needs a call to an async function or async_yield()" << where;
+        return "";
+    }
+
+    std::ostringstream out;
+    std::string resume = newLabel("resume");
+    coroutine.resumeLabels.push_back(resume);
+    size_t state = coroutine.resumeLabels.size();
+    if (yield) {
+        if (!call->children.empty()) std::cerr << "Error: async_yield takes no arguments" << where;
+        out << "\tmov %rax, " << slot(coroutine.frameSlot) << "\n";
+        out << "\tmov %rcx, " << state << "\n\tmov [%rax + " << FrameState << "], %rcx\n";
+        out << "\tjmp " << coroutine.suspendLabel << "\n";
+        out << resume << ":\n";
+        out << "\txor %eax, %eax\n";
+    } else {
+        auto start = std::make_shared<ASTNode>(*call);
+        start->name = call->name + "__new";
+        start->children.insert(start->children.begin(), std::make_shared<ASTNode>(ASTNodeType::Identifier, node->line, node->col, "%arena"));
+        std::string started = newLabel("started");
+        out << compileCallExpr(start);
+        out << "\ttest %rax, %rax\n\tjnz " << started << "\n";
+        out << "\tmov %rdi, 12\n\tcall __aol_exit\n"; // ENOMEM, the arena is full
+        out << started << ":\n";
+        out << "\tmov " << slot(coroutine.childSlot) << ", %rax\n";
+        out << "\tmov %rdi, %rax\n\tcall [%rax + " << FrameResume << "]\n";
+        out << "\ttest %rax, %rax\n\tjz " << resume << "\n";
+        out << "\tmov %rcx, " << slot(coroutine.childSlot) << "\n\tmov %rdx, " << slot(coroutine.frameSlot) << "\n";
+        out << "\tmov [%rcx + " << FrameWaiter << "], %rdx\n";
+        out << "\tmov %rcx, " << state << "\n\tmov [%rdx + " << FrameState << "], %rcx\n";
+        out << "\tjmp " << coroutine.suspendLabel << "\n";
+        out << resume << ":\n";
+        out << "\tmov %rax, " << slot(coroutine.childSlot) << "\n\tmov %rax, [%rax + " << FrameResult << "]\n";
+    }
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
+
+// async_new(arena, f(args)): f's frame from arena, for an executor to run
+std::string Compiler_Amd64::compileAsyncNew(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    auto& args = node->children;
+    if (args.size() != 2 || !args[1] || args[1]->type != ASTNodeType::CallExpr || !isCoroutine(args[1]->name)) {
+        std::cerr << "Error: async_new takes an arena and a call to an async function at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    auto start = std::make_shared<ASTNode>(*args[1]);
+    start->name = args[1]->name + "__new";
+    start->children.insert(start->children.begin(), args[0]);
+    std::string out = compileCallExpr(start);
+    if (targetReg != "%rax") out += "\tmov " + targetReg + ", %rax\n";
+    return out;
+}
@@ -0,0 +1,144 @@
+#include <compiler_amd64.hpp>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+// Atomic built-ins. The location is a pointer, &s.count takes the width and
+// signedness of the field, a plain 64-bit value is the address of a 64-bit word.
+// The last argument is the memory order, one of the constants of the atomic
+// module (the C++ numbering):
+//
+//   atomic_load(p, order)                       acquire or weaker
+//   atomic_store(p, v, order)                   release or weaker
+//   atomic_fetch_add(p, v, order), _sub, _and, _or, _xor
+//   atomic_exchange(p, v, order)
+//   atomic_compare_exchange(p, expected, desired, order), _weak
+//   atomic_fence(order)
+//
+// Read-modify-writes return the value found before the update, a compare
+// exchange succeeded when that equals expected. x86 is strongly ordered, so
+// only seq_cst stores and fences cost an instruction of their own and the weak
+// compare exchange never fails spuriously. None of them is pure, which keeps
+// the optimizer from moving memory accesses across them.
+
+enum MemoryOrder { Relaxed = 0, Acquire = 2, Release = 3, AcqRel = 4, SeqCst = 5 };
+
+static const std::unordered_map<std::string, int> AtomicBuiltins = { // arguments, order included
+    {"atomic_load", 2}, {"atomic_store", 3}, {"atomic_exchange", 3},
+    {"atomic_fetch_add", 3}, {"atomic_fetch_sub", 3}, {"atomic_fetch_and", 3}, {"atomic_fetch_or", 3}, {"atomic_fetch_xor", 3},
+    {"atomic_compare_exchange", 4}, {"atomic_compare_exchange_weak", 4}, {"atomic_fence", 1},
+};
+
+static const char* orderName(int order) {
+    switch (order) {
+        case Relaxed: return "relaxed";
+        case Acquire: return "acquire";
+        case Release: return "release";
+        case AcqRel: return "acq_rel";
+        case SeqCst: return "seq_cst";
+        default: return nullptr;
+    }
+}
+
+static std::string sized(int bytes, const std::string& mem) {
+    switch (bytes) {
+        case 1: return "byte " + mem;
+        case 2: return "word " + mem;
+        case 4: return "dword " + mem;
+        default: return mem;
+    }
+}
+
+bool Compiler_Amd64::isAtomicBuiltin(const std::string& name) const {
+    return AtomicBuiltins.count(name) != 0;
+}
+
+std::string Compiler_Amd64::compileAtomicBuiltin(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    const std::string& name = node->name;
+    auto& args = node->children;
+    auto where = " at line " + std::to_string(node->line) + " col " + std::to_string(node->col) + "\n";
+    int arity = AtomicBuiltins.at(name);
+    if ((int)args.size() != arity) {
+        std::cerr << "Error: " << name << " expects " << arity << (arity == 1 ? " argument" : " arguments") << where;
+        return "";
+    }
+
+    // The order picks the instructions, so it has to be known here
+    auto& last = args.back();
+    int order = IsIntegerLiteral(last) ? (int)std::stoll(last->value) : -1;
+    if (!orderName(order)) {
+        std::cerr << "Error: Memory order of " << name << " must be one of RELAXED, ACQUIRE, RELEASE, ACQ_REL or SEQ_CST" << where;
+        return "";
+    }
+    if ((name == "atomic_load" && (order == Release || order == AcqRel)) || (name == "atomic_store" && (order == Acquire || order == AcqRel))) {
+        std::cerr << "Error: " << name << " can't be " << orderName(order) << where;
+        return "";
+    }
+
+    std::ostringstream out;
+    if (name == "atomic_fence") {
+        // Loads aren't reordered with loads nor stores with stores, only a
+        // store followed by a load needs the full fence
+        if (order == SeqCst) out << "\tmfence\n";
+        else out << "\t// fence " << orderName(order) << "\n";
+        out << "\txor " << SubRegister(targetReg, 4) << ", " << SubRegister(targetReg, 4) << "\n";
+        return out.str();
+    }
+
+    std::string type = exprType(args[0]);
+    std::string pointee = IsPointerType(type) ? PointeeType(type) : "";
+    const IntegerType* it = FindIntegerType(pointee);
+    if (!pointee.empty() && !it) {
+        std::cerr << "Error: " << name << " needs a pointer to an integer, not '" << type << "'" << where;
+        return "";
+    }
+    int bytes = it ? it->bytes : 8;
+    std::string mem = sized(bytes, "[%rdx]");
+
+    // Address in %rdx, the value in %rcx and what a compare exchange expects in %rax
+    if (arity == 2) {
+        out << compileExpression(args[0], "%rax");
+    } else if (arity == 3) {
+        out << compileOperandPair(args[0], args[1]);
+    } else {
+        out << compileExpression(args[0], "%rax") << push("%rax");
+        out << compileExpression(args[1], "%rax") << push("%rax");
+        out << compileExpression(args[2], "%rax");
+        out << "\tmov %rcx, %rax\n";
+        out << pop("%rax");
+        out << pop("%rdx");
+    }
+    if (arity != 4) out << "\tmov %rdx, %rax\n";
+
+    std::string value = SubRegister("%rcx", bytes);
+    if (name == "atomic_load") {
+        out << LoadScalar(pointee, "%rax", "[%rdx]");
+    } else if (name == "atomic_store") {
+        // A seq_cst store must not pass a later load, xchg is a locked instruction
+        if (order == SeqCst) out << "\txchg " << mem << ", " << value << "\n";
+        else out << "\tmov " << mem << ", " << value << "\n";
+        out << "\tmov %rax, %rcx\n" << WrapScalar(pointee, "%rax");
+    } else if (name == "atomic_exchange") {
+        out << "\txchg " << mem << ", " << value << "\n";
+        out << "\tmov %rax, %rcx\n" << WrapScalar(pointee, "%rax");
+    } else if (name == "atomic_fetch_add" || name == "atomic_fetch_sub") {
+        if (name == "atomic_fetch_sub") out << "\tneg %rcx\n";
+        out << "\tlock xadd " << mem << ", " << value << "\n";
+        out << "\tmov %rax, %rcx\n" << WrapScalar(pointee, "%rax");
+    } else if (name == "atomic_compare_exchange" || name == "atomic_compare_exchange_weak") {
+        out << "\tlock cmpxchg " << mem << ", " << value << "\n";
+        out << WrapScalar(pointee, "%rax");
+    } else {
+        // and, or and xor have no fetching form, retry until nothing came between
+        std::string op = name.substr(13); // after "atomic_fetch_"
+        std::string retry = newLabel("atomic");
+        out << LoadScalar(pointee, "%rax", "[%rdx]");
+        out << retry << ":\n";
+        out << "\tmov %r8, %rax\n\t" << op << " %r8, %rcx\n";
+        out << "\tlock cmpxchg " << mem << ", " << SubRegister("%r8", bytes) << "\n";
+        out << "\tjne " << retry << "\n";
+        out << WrapScalar(pointee, "%rax");
+    }
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
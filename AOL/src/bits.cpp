@@ -0,0 +1,37 @@
+#include <bits.hpp>
+#include <unordered_map>
+
+static const std::unordered_map<std::string, int> BitBuiltins = {
+    {"popcount", 1}, {"clz", 1}, {"ctz", 1}, {"bswap", 1}, {"rotl", 2}, {"pdep", 2}, {"pext", 2},
+};
+
+bool IsBitBuiltin(const std::string& name) {
+    return BitBuiltins.count(name) != 0;
+}
+
+int BitBuiltinArity(const std::string& name) {
+    auto it = BitBuiltins.find(name);
+    return it == BitBuiltins.end() ? 0 : it->second;
+}
+
+std::optional<int64_t> EvaluateBitBuiltin(const std::string& name, const std::vector<int64_t>& args) {
+    if (!IsBitBuiltin(name) || (int)args.size() != BitBuiltinArity(name)) return std::nullopt;
+    uint64_t x = (uint64_t)args[0];
+    if (name == "popcount") return __builtin_popcountll(x);
+    if (name == "clz") return x ? __builtin_clzll(x) : 64;
+    if (name == "ctz") return x ? __builtin_ctzll(x) : 64;
+    if (name == "bswap") return (int64_t)__builtin_bswap64(x);
+
+    uint64_t y = (uint64_t)args[1];
+    if (name == "rotl") {
+        unsigned n = y & 63;
+        return (int64_t)(n ? (x << n) | (x >> (64 - n)) : x);
+    }
+    uint64_t r = 0, bit = 1;
+    for (uint64_t mask = y; mask; mask &= mask - 1, bit <<= 1) {
+        uint64_t low = mask & (0 - mask);
+        if (name == "pdep" && (x & bit)) r |= low;
+        if (name == "pext" && (x & low)) r |= bit;
+    }
+    return (int64_t)r;
+}
@@ -0,0 +1,100 @@
+#include <compiler_amd64.hpp>
+#include <bits.hpp>
+#include <iostream>
+#include <sstream>
+
+// Bit built-ins, see bits.hpp. Each has a single instruction form for the
+// -march that provides it and an inline fallback for baseline x86-64.
+
+// SWAR popcount of %rax, the masks are 0x55.., 0x33.., 0x0F.. and 0x01..
+static std::string popcountFallback() {
+    std::ostringstream out;
+    out << "\tmov %rcx, %rax\n\tshr %rcx, 1\n\tmov %rdx, 6148914691236517205\n\tand %rcx, %rdx\n\tsub %rax, %rcx\n";
+    out << "\tmov %rdx, 3689348814741910323\n\tmov %rcx, %rax\n\tshr %rcx, 2\n\tand %rax, %rdx\n\tand %rcx, %rdx\n\tadd %rax, %rcx\n";
+    out << "\tmov %rcx, %rax\n\tshr %rcx, 4\n\tadd %rax, %rcx\n\tmov %rdx, 1085102592571150095\n\tand %rax, %rdx\n";
+    out << "\tmov %rdx, 72340172838076673\n\timul %rax, %rdx\n\tshr %rax, 56\n";
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileOperandPair(const std::shared_ptr<ASTNode>& lhs, const std::shared_ptr<ASTNode>& rhs) {
+    std::ostringstream out;
+    out << compileExpression(lhs, "%rax");
+    std::string operand = simpleOperand(rhs);
+    if (operand.empty()) {
+        out << compileSecondOperand(rhs);
+    } else {
+        out << "\tmov %rcx, " << operand << "\n";
+    }
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileBitBuiltin(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    const std::string& name = node->name;
+    auto& args = node->children;
+    int arity = BitBuiltinArity(name);
+    if ((int)args.size() != arity) {
+        std::cerr << "Error: " << name << " expects " << arity << (arity == 1 ? " argument" : " arguments") << " at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+
+    std::ostringstream out;
+    std::string mem = simpleOperand(args[0]); // the one-instruction forms read a variable in place
+    if (mem.empty() || mem[0] != '[') mem.clear();
+    auto unary = [&](bool available, const std::string& instr) {
+        if (available && !mem.empty()) {
+            out << "\t" << instr << " %rax, " << mem << "\n";
+            return true;
+        }
+        out << compileExpression(args[0], "%rax");
+        if (!available) return false;
+        out << "\t" << instr << " %rax, %rax\n";
+        return true;
+    };
+
+    if (name == "popcount") {
+        if (!unary(target.popcnt, "popcnt")) out << popcountFallback();
+    } else if (name == "clz") {
+        if (!unary(target.lzcnt, "lzcnt")) // bsr leaves the index of the top bit, 63 - i == i ^ 63, and 127 ^ 63 == 64 for zero
+            out << "\tmov %rcx, 127\n\tbsr %rax, %rax\n\tcmovz %rax, %rcx\n\txor %rax, 63\n";
+    } else if (name == "ctz") {
+        if (!unary(target.bmi1, "tzcnt"))
+            out << "\tmov %rcx, 64\n\tbsf %rax, %rax\n\tcmovz %rax, %rcx\n";
+    } else if (name == "bswap") {
+        if (target.movbe && !mem.empty()) out << "\tmovbe %rax, " << mem << "\n";
+        else out << compileExpression(args[0], "%rax") << "\tbswap %rax\n";
+    } else if (name == "rotl") {
+        if (IsIntegerLiteral(args[1])) {
+            int n = (int)(std::stoll(args[1]->value) & 63);
+            if (target.bmi2 && !mem.empty()) {
+                out << "\trorx %rax, " << mem << ", " << ((64 - n) & 63) << "\n";
+            } else {
+                out << compileExpression(args[0], "%rax");
+                if (n) out << "\trol %rax, " << n << "\n";
+            }
+        } else {
+            out << compileOperandPair(args[0], args[1]);
+            out << "\trol %rax, %cl\n";
+        }
+    } else if (name == "pdep" || name == "pext") {
+        out << compileOperandPair(args[0], args[1]);
+        if (target.bmi2) {
+            out << "\t" << name << " %rax, %rax, %rcx\n";
+        } else {
+            // One mask bit per iteration, lowest first: %r9 the mask bit, %r8 the matching packed bit
+            std::string loop = newLabel(name), skip = newLabel(name + "_skip"), done = newLabel(name + "_done");
+            out << "\txor %rdx, %rdx\n\tmov %r8, 1\n";
+            out << loop << ":\n";
+            out << "\ttest %rcx, %rcx\n\tjz " << done << "\n";
+            out << "\tmov %r9, %rcx\n\tneg %r9\n\tand %r9, %rcx\n";
+            if (name == "pdep") out << "\ttest %rax, %r8\n\tjz " << skip << "\n\tor %rdx, %r9\n";
+            else out << "\ttest %rax, %r9\n\tjz " << skip << "\n\tor %rdx, %r8\n";
+            out << skip << ":\n";
+            out << "\tadd %r8, %r8\n\tlea %r9, [%rcx - 1]\n\tand %rcx, %r9\n\tjmp " << loop << "\n";
+            out << done << ":\n";
+            out << "\tmov %rax, %rdx\n";
+        }
+    }
+
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
@@ -1,53 +1,230 @@
 #include <compiler_amd64.hpp>
+#include <bits.hpp>
 #include <sstream>
 #include <cctype>
 #include <iostream>
 #include <algorithm>
 
-Compiler_Amd64::Compiler_Amd64() : currentFunction(nullptr), localOffset(0) {}
+Compiler_Amd64::Compiler_Amd64(TargetFeatures features, CompileOptions options)
+    : currentFunction(nullptr), localOffset(0), pushDepth(0), labelIdx(0), heldRegs(0), heldValues(0), target(features), options(options),
+      vectorAreaSize(0), areaAlign(32), vecTop(0), usesYmm(false) {}
 
-std::string Compiler_Amd64::compile(const std::shared_ptr<ASTNode>& program) {
+bool IsIntegerLiteral(const std::shared_ptr<ASTNode>& node) {
+    if (!node || node->type != ASTNodeType::Literal || node->name == "string" || node->value.empty()) return false;
+    size_t i = (node->value[0] == '-') ? 1 : 0;
+    if (i == node->value.size()) return false;
+    return std::all_of(node->value.begin() + i, node->value.end(), [](unsigned char c){return std::isdigit(c);});
+}
+
+// Runtime routines taking a NUL-terminated string and their (ptr, len) counterparts
+static const std::unordered_map<std::string, std::string> StringLengthVariants = {
+    {"__aol_print", "__aol_write"},
+    {"__aol_println", "__aol_writeln"},
+};
+
+static bool fitsImm32(const std::string& value) {
+    try {
+        long long v = std::stoll(value);
+        return v >= INT32_MIN && v <= INT32_MAX;
+    } catch (...) {
+        return false;
+    }
+}
+
+std::string MemOperand(const std::string& base, int offset) {
+    if (offset == 0) return "[" + base + "]";
+    if (offset < 0) return "[" + base + " - " + std::to_string(-offset) + "]";
+    return "[" + base + " + " + std::to_string(offset) + "]";
+}
+
+void EmitBytes(std::ostream& section, const std::string& label, const std::string& bytes, bool terminate) {
+    section << "\t" << label << "!ubyte[] = ";
+    for (size_t i = 0; i < bytes.size(); ++i) section << (i ? ", " : "") << (int)(unsigned char)bytes[i];
+    if (terminate) section << (bytes.empty() ? "" : ", ") << "0";
+    section << "\n";
+}
+
+std::string SubRegister(const std::string& reg, int bytes) {
+    if (bytes >= 8) return reg;
+    // %r8 ... %r15
+    if (reg.size() > 2 && std::isdigit((unsigned char)reg[2]))
+        return reg + (bytes == 4 ? "d" : bytes == 2 ? "w" : "b");
+    std::string base = reg.substr(2); // ax, si, ...
+    if (bytes == 4) return "%e" + base;
+    if (bytes == 2) return "%" + base;
+    return base[1] == 'x' ? "%" + base.substr(0, 1) + "l" : "%" + base + "l";
+}
+
+static std::string sizeKeyword(int bytes) {
+    switch (bytes) {
+        case 1: return "byte ";
+        case 2: return "word ";
+        case 4: return "dword ";
+        default: return "";
+    }
+}
+
+std::string LoadScalar(const std::string& type, const std::string& reg, const std::string& mem) {
+    const IntegerType* t = FindIntegerType(type);
+    if (!t || t->bytes == 8) return "\tmov " + reg + ", " + mem + "\n";
+    if (t->bytes == 4 && t->isSigned) return "\tmovsxd " + reg + ", dword " + mem + "\n";
+    if (t->bytes == 4) return "\tmov " + SubRegister(reg, 4) + ", " + mem + "\n"; // zero-extends
+    if (t->isSigned) return "\tmovsx " + reg + ", " + sizeKeyword(t->bytes) + mem + "\n";
+    return "\tmovzx " + SubRegister(reg, 4) + ", " + sizeKeyword(t->bytes) + mem + "\n";
+}
+
+std::string StoreScalar(const std::string& type, const std::string& mem, const std::string& reg) {
+    const IntegerType* t = FindIntegerType(type);
+    return "\tmov " + mem + ", " + SubRegister(reg, t ? t->bytes : 8) + "\n";
+}
+
+std::string WrapScalar(const std::string& type, const std::string& reg) {
+    const IntegerType* t = FindIntegerType(type);
+    if (!t || t->bytes == 8) return "";
+    std::string low = SubRegister(reg, t->bytes), dword = SubRegister(reg, 4);
+    if (t->isBool) return "\ttest " + reg + ", " + reg + "\n\tsetne " + low + "\n\tmovzx " + dword + ", " + low + "\n";
+    if (t->bytes == 4) return t->isSigned ? "\tmovsxd " + reg + ", " + low + "\n" : "\tmov " + dword + ", " + low + "\n";
+    return t->isSigned ? "\tmovsx " + reg + ", " + low + "\n" : "\tmovzx " + dword + ", " + low + "\n";
+}
+
+bool IsComparisonOp(const std::string& op) {
+    return op == "==" || op == "!=" || op == "<" || op == "<=" || op == ">" || op == ">=";
+}
+
+// Jump taken when the comparison is false
+static std::string inverseJump(const std::string& op, bool isUnsigned) {
+    if (op == "==") return "jne";
+    if (op == "!=") return "je";
+    if (op == "<")  return isUnsigned ? "jae" : "jge";
+    if (op == "<=") return isUnsigned ? "ja" : "jg";
+    if (op == ">")  return isUnsigned ? "jbe" : "jle";
+    return isUnsigned ? "jb" : "jl"; // >=
+}
+
+static std::string setInstr(const std::string& op, bool isUnsigned) {
+    if (op == "==") return "sete";
+    if (op == "!=") return "setne";
+    if (op == "<")  return isUnsigned ? "setb" : "setl";
+    if (op == "<=") return isUnsigned ? "setbe" : "setle";
+    if (op == ">")  return isUnsigned ? "seta" : "setg";
+    return isUnsigned ? "setae" : "setge"; // >=
+}
+
+static bool isImmediate(const std::string& operand) {
+    return !operand.empty() && (std::isdigit((unsigned char)operand[0]) || operand[0] == '-');
+}
+
+// %rax = %rax <op> operand. operand is an imm32, memory operand or %rcx.
+// isUnsigned picks shr for >> and the below/above forms of comparisons.
+static std::string emitArith(const std::string& op, const std::string& operand, const TargetFeatures& target, bool isUnsigned) {
+    std::ostringstream out;
+    if (op == "+") out << "\tadd %rax, " << operand << "\n";
+    else if (op == "-") out << "\tsub %rax, " << operand << "\n";
+    else if (op == "*") {
+        if (isImmediate(operand)) out << "\timul %rax, %rax, " << operand << "\n";
+        else out << "\timul %rax, " << operand << "\n";
+    }
+    else if (op == "/" || op == "%") {
+        if (operand != "%rcx") out << "\tmov %rcx, " << operand << "\n";
+        out << "\tcqo\n\tidiv %rcx\n";
+        if (op == "%") out << "\tmov %rax, %rdx\n";
+    }
+    else if (op == "&") out << "\tand %rax, " << operand << "\n";
+    else if (op == "|") out << "\tor %rax, " << operand << "\n";
+    else if (op == "^") out << "\txor %rax, " << operand << "\n";
+    else if (op == "<<" || op == ">>") {
+        std::string instr = op == "<<" ? "sal" : isUnsigned ? "shr" : "sar";
+        if (isImmediate(operand)) out << "\t" << instr << " %rax, " << operand << "\n";
+        else {
+            if (operand != "%rcx") out << "\tmov %rcx, " << operand << "\n";
+            if (target.bmi2) out << "\t" << (op == "<<" ? "shlx" : isUnsigned ? "shrx" : "sarx") << " %rax, %rax, %rcx\n"; // no flags, count in any register
+            else out << "\t" << instr << " %rax, %cl\n";
+        }
+    }
+    else if (IsComparisonOp(op)) {
+        out << "\tcmp %rax, " << operand << "\n";
+        out << "\t" << setInstr(op, isUnsigned) << " %al\n\tmovzx %rax, %al\n";
+    }
+    else {
+        std::cerr << "Error: Unsupported operator '" << op << "'\n";
+    }
+    return out.str();
+}
+
+void Compiler_Amd64::compile(const std::shared_ptr<ASTNode>& program, OutputSink& out) {
     if (!program) {
-        return "";
+        return;
     }
 
     bss.str(""); bss.clear();
     data.str(""); data.clear();
     rodata.str(""); rodata.clear();
-
-    std::ostringstream out;
-    std::ostringstream tsec;
+    pool.clear();
 
     bss << "\t:align 8\n:section .bss\n";
     data << "\t:align 8\n:section .data\n";
     rodata << "\t:align 8\n:section .rodata\n";
-    rodata << "\t__aol_entry_dbg!ubyte[] = \"DBG: Entry!\", 10\n";
 
-    tsec << compileProgram(program);
-    out << rodata.str();
-    out << data.str();
-    out << bss.str();
-    out << tsec.str();
-    return out.str();
+    compileProgram(program, out);
+    pool.emit(rodata);
 }
 
-std::string Compiler_Amd64::compileProgram(const std::shared_ptr<ASTNode>& node) {
-    std::ostringstream out;
+std::vector<std::string_view> Compiler_Amd64::sections() const {
+    return {rodata.view(), data.view(), bss.view()};
+}
 
-    out << "\t:align 16\n:section .text\n\t:global __aol_main__\n\n";
-    out << "__aol_main__:\n";
-    out << "\tmov %rdi, %rsp\n\tmov %rsi, %rdi\n"; // argc -> rax, argv -> rbx
-    out << "\tlea %rdi, [__aol_entry_dbg]\n\tmov %rsi, 12\n\tcall __aol_print\n";
-    out << "\tcall $main\n";
-    out << "\tjmp __aol_exit\n\tret\n";
-    out << "__aol_print:\n";
-    out << "\tmov %rsi, %rdi\n\tmov %rdx, %rsi\n\tmov %rax, 1\n\tmov %rdi, 1\n";
-    out << "\tsyscall\n\tret\n\n";
+void Compiler_Amd64::compileProgram(const std::shared_ptr<ASTNode>& node, OutputSink& out) {
+    layoutGlobals(node);
+    if (!options.module) out.text(compileRuntime());
+    else out.text("\t:align 16\n:section .text\n\n");
 
-    for (auto& child : node->children)
-        out << compileStatement(child, "%rax");
+    // Register every function up front so calls may precede the definition
+    for (auto& child : node->children) {
+        if (!child || child->type != ASTNodeType::FunctionDecl) continue;
+        if (IsBitBuiltin(child->name) || isAtomicBuiltin(child->name))
+            std::cerr << "Error: '" << child->name << "' is a built-in function and can't be redefined at line " << child->line << " col " << child->col << "\n";
+        FunctionSymbol sym;
+        sym.name = child->name;
+        sym.stackSize = 0;
+        sym.body = child;
+        sym.returnType = child->typeName;
+        if (child->attributes.count("extern")) {
+            auto link = child->attributes.find("symbol");
+            sym.symbol = link != child->attributes.end() && !link->second.empty() ? link->second : child->name;
+        }
+        for (auto& param : child->params)
+            sym.params.push_back({param->name, 0, 8, "", param->typeName});
+        if (child->attributes.count("async")) {
+            sym.coroutine = true;
+            FunctionSymbol start = sym; // name__new(arena, params...), emitted with the resume function
+            start.name = child->name + "__new";
+            start.body = nullptr;
+            start.returnType = "";
+            start.params.insert(start.params.begin(), {"arena", 0, 8, "", ""});
+            functions[start.name] = start;
+        }
+        functions[sym.name] = sym;
+    }
 
-    return out.str();
+    hookedFunctions.clear();
+    heldValues = 0;
+    if (!options.ipra) {
+        for (auto& child : node->children)
+            out.text(compileStatement(child, "%rax"));
+    } else {
+        // Callees first, so every call outside the caller's own cycle knows what it clobbers
+        assignConventions(node);
+        for (auto& scc : callGraphOrder(node)) {
+            std::vector<std::string> code;
+            for (auto& fn : scc) {
+                code.push_back(compileStatement(fn, "%rax"));
+                out.text(code.back());
+            }
+            summarize(scc, code);
+        }
+    }
+    if (globalInit) out.text(compileFunction(globalInit));
+    if (!options.instrumentReport.empty()) out.text(compileInstrumentRuntime());
 }
 
 std::string Compiler_Amd64::compileStatement(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
@@ -55,20 +232,51 @@ std::string Compiler_Amd64::compileStatement(const std::shared_ptr<ASTNode>& nod
 
     switch (node->type) {
         case ASTNodeType::FunctionDecl: return compileFunction(node);
+        case ASTNodeType::ModuleDecl:
+        case ASTNodeType::ImportDecl:   return ""; // resolved before code generation
         case ASTNodeType::VariableDecl: return compileVariableDecl(node, targetReg);
         case ASTNodeType::ReturnStmt:   return compileReturn(node, targetReg);
         case ASTNodeType::IfStmt:       return compileIf(node);
         case ASTNodeType::WhileStmt:    return compileWhile(node);
         case ASTNodeType::ForStmt:      return compileFor(node);
+        case ASTNodeType::SwitchStmt:   return compileSwitch(node);
         case ASTNodeType::BreakStmt:    return compileBreak(node);
         case ASTNodeType::ContinueStmt: return compileContinue(node);
-        case ASTNodeType::Literal:      return compileLiteral(node);
+        case ASTNodeType::StmtBlock:    return compileBlock(node);
+        case ASTNodeType::AsmStmt:      return compileAsm(node);
+        case ASTNodeType::Literal:      return ""; // no side effects
         case ASTNodeType::CallExpr:     return compileCallExpr(node);
-        default:                        return compileExpression(node, targetReg) + "\n";
+        default:
+            if (const VectorType* vt = vectorTypeOf(node)) return compileVectorExpr(node, vecTop, vt);
+            return compileExpression(node, targetReg);
     }
 }
 
+std::string Compiler_Amd64::compileBlock(const std::shared_ptr<ASTNode>& node, bool scoped) {
+    std::ostringstream out;
+    size_t scope = currentFunction ? currentFunction->locals.size() : 0;
+    out << profileCounter(node);
+    for (auto& stmt : node->children)
+        out << compileStatement(stmt);
+    if (scoped) endScope(scope);
+    return out.str();
+}
+
+// The optimizer turns a for's init and step into blocks to add temporaries,
+// what they declare is used by the loop
+std::string Compiler_Amd64::compileLoopClause(const std::shared_ptr<ASTNode>& node) {
+    if (node && node->type == ASTNodeType::StmtBlock) return compileBlock(node, false);
+    return compileStatement(node);
+}
+
+// Names declared in a block end with it, their slots stay so frames don't shrink mid-function
+void Compiler_Amd64::endScope(size_t firstLocal) {
+    if (!currentFunction) return;
+    for (size_t i = firstLocal; i < currentFunction->locals.size(); ++i) currentFunction->locals[i].hidden = true;
+}
+
 std::string Compiler_Amd64::compileFunction(const std::shared_ptr<ASTNode>& node) {
+    if (node->attributes.count("extern")) return ""; // the body lives in the runtime or another object
     std::ostringstream out;
     std::ostringstream func_s;
 
@@ -76,20 +284,55 @@ std::string Compiler_Amd64::compileFunction(const std::shared_ptr<ASTNode>& node
     func.name = node->name;
     func.stackSize = 0;
     func.body = node;
+    func.returnType = node->typeName;
     currentFunction = &func;
     localOffset = 0;
+    pushDepth = 0;
+    loopStack.clear();
+    vectorAreaSize = 0;
+    areaAlign = 32;
+    vecTop = 0;
+    usesYmm = false;
+    returnLabel = newLabel("ret");
+    coldCode.str("");
+
+    if (FindStructType(node->typeName))
+        std::cerr << "Error: '" << node->name << "' must return a struct by pointer (*" << node->typeName << ") at line " << node->line << " col " << node->col << "\n";
+
+    func.internalConv = functions[func.name].internalConv;
+    func.coroutine = node->attributes.count("async") > 0;
+    coroutine = CoroutineState();
+    heldRegs = 0;
 
-    // Assign parameter offsets (System V AMD64 ABI: rdi, rsi, rdx, rcx, r8, r9, rest on stack)
-    const std::vector<std::string> paramRegs = {"%rdi","%rsi","%rdx","%rcx","%r8","%r9"};
+    // Assign parameter offsets (System V AMD64 ABI: rdi, rsi, rdx, rcx, r8, r9, rest on stack,
+    // vectors in xmm0-xmm7; the internal convention adds r10 and r11)
+    const std::vector<std::string>& paramRegs = argRegisters(func);
     int stackParamOffset = 16; // Start of first stack param (after saved rbp + return addr)
+    size_t nextReg = 0;
+    int nextVecReg = 0;
     
-    for (size_t i = 0; i < node->params.size(); ++i) {
+    for (auto& param : func.coroutine ? std::vector<std::shared_ptr<ASTNode>>() : node->params) {
         VariableInfo v;
-        v.name = node->params[i]->name;
+        v.name = param->name;
         v.size = 8; // default
-        if (i < paramRegs.size()) {
+        v.type = param->typeName;
+        if (const VectorType* vt = FindVectorType(param->typeName)) {
+            if (nextVecReg + vectorParts(vt) > 8) {
+                std::cerr << "Error: Too many vector parameters in '" << node->name << "' at line " << param->line << " col " << param->col << "\n";
+                break;
+            }
+            v.size = vt->bytes();
+            v.offset = 0;
+            v.reg = (target.avx2 && vt->bytes() == 32 ? "%ymm" : "%xmm") + std::to_string(nextVecReg);
+            nextVecReg += vectorParts(vt);
+        } else if (FindStructType(param->typeName)) {
+            std::cerr << "Error: Struct parameter '" << param->name << "' must be passed by pointer (*" << param->typeName << ") at line " << param->line << " col " << param->col << "\n";
+        } else if (!IsScalarType(param->typeName)) {
+            std::cerr << "Error: Unknown type '" << param->typeName << "' at line " << param->line << " col " << param->col << "\n";
+        } else if (nextReg < paramRegs.size()) {
+            if (const IntegerType* it = FindIntegerType(param->typeName)) v.size = it->bytes;
             v.offset = 0; // Mark as register-passed
-            v.reg = paramRegs[i];
+            v.reg = paramRegs[nextReg++];
         } else {
             v.offset = stackParamOffset;
             v.reg = ""; 
@@ -105,131 +348,366 @@ std::string Compiler_Amd64::compileFunction(const std::shared_ptr<ASTNode>& node
     func_s << "\tpush %rbp\n";
     func_s << "\tmov %rbp, %rsp\n";
 
+    if (func.coroutine) out << compileCoroutineEntry(node);
+    out << profileCounter(node);
+
     // Move register params into stack locals for uniform access
     for (auto& param : func.params) {
-        if (!param.reg.empty()) {
-            int offset = allocateLocal(param.name, param.size);
-            out << "\tmov [%rbp - " << offset << "], " << param.reg << "\n";
+        if (param.reg.empty()) continue;
+        if (const VectorType* vt = FindVectorType(param.type)) {
+            int slot = allocateVectorSlot(vt->bytes());
+            currentFunction->locals.push_back({param.name, slot, vt->bytes(), "", vt->name});
+            out << storeVector(vt, std::stoi(param.reg.substr(4)), "%rbx", slot);
+        } else {
+            int offset = allocateLocal(param.name, param.size, param.type, param.size);
+            out << StoreScalar(param.type, "[%rbp - " + std::to_string(offset) + "]", param.reg);
         }
     }
 
+    out << compileCaptures(node);
+
+    // The hook loses %r10 and %r11, the params are stored by now
+    std::string enterHook = func.coroutine || node->attributes.count("parallel") ? "" : instrumentEnter(node);
+    out << enterHook;
+
     // Compile statements
     for (auto& stmt : node->children)
         out << compileStatement(stmt, "%rax");
+    if (func.coroutine) out << "\txor %eax, %eax\n" << compileCoroutineFinish("%rax");
+
+    // A trailing ret falls through into the epilogue
+    std::string body = out.str();
+    std::string lastJump = "\tjmp " + returnLabel + "\n";
+    if (body.size() >= lastJump.size() && body.compare(body.size() - lastJump.size(), lastJump.size(), lastJump) == 0)
+        body.resize(body.size() - lastJump.size());
+
+    // Vector locals, spills and over-aligned structs live in an aligned area
+    // addressed from %rbx, the caller's %rbx is saved just below the scalar locals
+    int stackSize = currentFunction->stackSize;
+    int rbxSave = stackSize + 8;
+    int frameSize = stackSize;
+    if (vectorAreaSize > 0) frameSize = rbxSave + areaAlign - 1 + vectorAreaSize;
+    if (func.coroutine && vectorAreaSize > 0)
+        std::cerr << "Error: Async function '" << node->name << "' can't hold vectors or over-aligned structs across an await at line " << node->line << " col " << node->col << "\n";
 
     // Function epilogue
-    out << "\tmov %rsp, %rbp\n";
-    out << "\tpop %rbp\n";
-    out << "\tret\n";
-    out << ".endfunc\n\n";
+    body += returnLabel + ":\n";
+    if (!enterHook.empty()) body += "\tcall __aol_instr_leave\n";
+    // A 256-bit result comes back in %ymm0, clearing the upper halves would cut it
+    const VectorType* resultVector = FindVectorType(func.returnType);
+    if (usesYmm && !(resultVector && resultVector->bytes() == 32)) body += "\tvzeroupper\n";
+    if (vectorAreaSize > 0) body += "\tmov %rbx, [%rbp - " + std::to_string(rbxSave) + "]\n";
+    body += "\tmov %rsp, %rbp\n";
+    body += "\tpop %rbp\n";
+    body += "\tret\n";
+    body += coldCode.str();
+    if (func.coroutine) body += compileCoroutineSuspend();
+    body += ".endfunc\n\n";
 
-    func_s << "\tsub %rsp, " << currentFunction->stackSize << "\n";
-    func_s << out.str();
+    // Keep %rsp 16-byte aligned so calls out of this frame honor the ABI
+    func_s << "\tsub %rsp, " << ((frameSize + 15) & ~15) << "\n";
+    if (vectorAreaSize > 0) {
+        func_s << "\tmov [%rbp - " << rbxSave << "], %rbx\n";
+        func_s << "\tlea %rbx, [%rsp + " << areaAlign - 1 << "]\n";
+        func_s << "\tand %rbx, -" << areaAlign << "\n";
+    }
+    if (func.coroutine) func_s << compileCoroutineDispatch();
+    func_s << body;
+    if (func.coroutine) func_s << compileCoroutineConstructor(node);
 
+    coroutine.active = false;
     currentFunction = nullptr;
-    return func_s.str();
+
+    // Parallel for bodies outlined while compiling this function
+    std::string code = func_s.str();
+    auto bodies = std::move(parallelBodies);
+    parallelBodies.clear();
+    for (auto& body : bodies) code += compileFunction(body);
+    return code;
 }
 
 std::string Compiler_Amd64::compileCallExpr(const std::shared_ptr<ASTNode>& node) {
-    if (functions.find(node->name) == functions.end()) {
+    auto fn = functions.find(node->name);
+    if (fn == functions.end()) {
+        if (isVectorBuiltin(node->name)) {
+            if (const VectorType* vt = vectorTypeOf(node)) return compileVectorExpr(node, vecTop, vt);
+            return compileVectorScalarBuiltin(node, "%rax");
+        }
+        if (IsBitBuiltin(node->name)) return compileBitBuiltin(node, "%rax");
+        if (isAtomicBuiltin(node->name)) return compileAtomicBuiltin(node, "%rax");
+        if (node->name == "async_new") return compileAsyncNew(node, "%rax");
         std::cerr << "Error: Unknown function '" << node->name << "' at line " << node->line << " col " << node->col << "\n";
         return "";
     }
+    const FunctionSymbol& callee = fn->second;
+    if (isCoroutine(node->name)) {
+        std::cerr << "Error: '" << node->name << "' is async, await it or start it with async_new at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
 
-    auto func = functions.at(node->name);
     std::ostringstream out;
 
+    // Vector arguments are evaluated first into aligned slots, calls made while
+    // computing them would clobber the argument registers
+    std::vector<std::shared_ptr<ASTNode>> args;
+    std::vector<std::pair<const VectorType*, int>> vectorArgs;
+    for (size_t i = 0; i < node->children.size(); ++i) {
+        auto& arg = node->children[i];
+        const VectorType* pt = i < callee.params.size() ? FindVectorType(callee.params[i].type) : nullptr;
+        if (!pt) {
+            if (vectorTypeOf(arg))
+                std::cerr << "Error: Vector passed to scalar parameter of '" << node->name << "' at line " << arg->line << " col " << arg->col << "\n";
+            args.push_back(arg);
+            continue;
+        }
+        int slot = allocateVectorSlot(pt->bytes());
+        out << compileVectorExpr(arg, vecTop, pt);
+        out << storeVector(pt, vecTop, "%rbx", slot);
+        vectorArgs.push_back({pt, slot});
+    }
+
+    // print and println of a literal write its known length instead of scanning for the NUL
+    std::string symbol = callee.symbol;
+    auto lengthVariant = StringLengthVariants.find(symbol);
+    if (lengthVariant != StringLengthVariants.end() && args.size() == 1 && args[0]->type == ASTNodeType::Literal && args[0]->name == "string") {
+        if (auto len = ConstantPool::length(args[0]->value)) {
+            auto lenArg = std::make_shared<ASTNode>(ASTNodeType::Literal, args[0]->line, args[0]->col);
+            lenArg->value = std::to_string(*len);
+            args.push_back(lenArg);
+            symbol = lengthVariant->second;
+        }
+    }
+
     // Evaluate arguments
-    std::vector<std::string> argRegs = {"%rdi","%rsi","%rdx","%rcx","%r8","%r9"};
-    size_t nArgs = node->children.size();
+    const std::vector<std::string>& argRegs = argRegisters(callee);
+    size_t nArgs = args.size();
+    size_t nReg = std::min(nArgs, argRegs.size());
+    size_t nStack = nArgs - nReg;
+
+    // Stack args and pending temporaries must leave %rsp 16-byte aligned at the call
+    bool pad = (pushDepth + nStack) % 2 != 0;
+    if (pad) {
+        out << "\tsub %rsp, 8\n";
+        pushDepth++;
+    }
 
     // Push stack args first (reverse-order)
     for (size_t i = nArgs; i-- > argRegs.size();) {
-        out << "\tpush " << compileExpression(node->children[i], "%rax") << "\n";
+        out << compileExpression(args[i], "%rax");
+        out << push("%rax");
     }
 
-    // Move first 6 args into registers
-    for (size_t i = 0; i < std::min(nArgs, argRegs.size()); ++i) {
-        out << "\tmov " << compileExpression(node->children[i], "%rax") 
-            << ", " << argRegs[i] << "\n";
+    // Move first 6 args into registers. Plain operands are loaded directly, anything
+    // else is evaluated left to right onto the stack and popped into place.
+    bool allSimple = true;
+    for (size_t i = 0; i < nReg; ++i)
+        if (simpleOperand(args[i]).empty() && !IsIntegerLiteral(args[i])) allSimple = false;
+
+    if (allSimple) {
+        for (size_t i = 0; i < nReg; ++i)
+            out << compileExpression(args[i], argRegs[i]);
+    } else {
+        out << compileArgRegisters({args.begin(), args.begin() + nReg}, argRegs);
+    }
+
+    int xmm = 0;
+    for (auto& [type, slot] : vectorArgs) {
+        out << loadVector(type, xmm, "%rbx", slot);
+        xmm += vectorParts(type);
     }
 
     // Final stuff
-    out << "\tcall $" << node->name << "\n";
+    if (callee.symbol.empty()) out << "\tcall $" << node->name << "\n";
+    else out << "\tcall " << symbol << "\n";
 
-    if (nArgs > argRegs.size()) {
-        out << "\tadd %rsp, " << (int64_t)(8 * (nArgs - argRegs.size())) << "\n";
+    size_t cleanup = nStack + (pad ? 1 : 0);
+    if (cleanup > 0) {
+        out << "\tadd %rsp, " << (int64_t)(8 * cleanup) << "\n";
+        pushDepth -= (int)cleanup;
     }
 
-    // Return is in rax reg
+    // Return is in rax reg, vectors in xmm0/ymm0
     return out.str();
 }
 
 std::string Compiler_Amd64::compileLiteral(const std::shared_ptr<ASTNode>& node) {
-    if (std::all_of(node->value.begin(), node->value.end(), [](unsigned char c){return std::isdigit(c);})) {
+    if (IsIntegerLiteral(node)) {
         return node->value;
     }
-    rodata << "\tstr_" << str_idx << "!ubyte[] = \"" << node->value << "\"\n";
-    std::ostringstream out;
-    out << "str_" << str_idx;
-    str_idx++;
-    return out.str();
+    return pool.string(node->value);
 }
 
 std::string Compiler_Amd64::compileReturn(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
     std::ostringstream out;
     if (!node->children.empty()) {
-        out << compileExpression(node->children[0], targetReg) << "\n";
+        const VectorType* vt = currentFunction ? FindVectorType(currentFunction->returnType) : nullptr;
+        if (vt) out << compileVectorExpr(node->children[0], 0, vt);
+        else out << compileExpression(node->children[0], targetReg);
+        if (currentFunction) out << WrapScalar(currentFunction->returnType, targetReg);
+    }
+    if (coroutine.active) {
+        if (node->children.empty()) out << "\txor %eax, %eax\n";
+        out << compileCoroutineFinish(node->children.empty() ? "%rax" : targetReg);
+        return out.str();
     }
-    out << "\tleave\n\tret\n";
+    out << "\tjmp " << returnLabel << "\n";
     return out.str();
 }
 
 std::string Compiler_Amd64::compileVariableDecl(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
     if (!currentFunction) return "";
 
+    if (const StructType* st = FindStructType(node->typeName)) return compileStructDecl(node, st);
+    const VectorType* vt = FindVectorType(node->typeName);
+    int size = 8, align = 8;
+    if (!vt && !node->typeName.empty() && !FindIntegerType(node->typeName) &&
+        (!IsPointerType(node->typeName) || !TypeLayout(PointeeType(node->typeName), size, align))) {
+        std::cerr << "Error: Unknown type '" << node->typeName << "' at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    if (!vt && !node->children.empty()) vt = vectorTypeOf(node->children[0]);
+    if (vt) return compileVectorDecl(node, vt);
+
+    // Sized integers take their own width, so small locals pack together
+    const IntegerType* it = FindIntegerType(node->typeName);
+    size = align = it ? it->bytes : 8;
+
     std::ostringstream out;
-    int offset = allocateLocal(node->name, 8); // locals: negative offset
+    int offset = allocateLocal(node->name, size, node->typeName, align); // locals: negative offset
+    std::string slot = "[%rbp - " + std::to_string(offset) + "]";
 
     if (!node->children.empty()) {
-        std::string val = compileExpression(node->children[0], "no_reg");
-        out << "\tmov [" << "%rbp - " << offset << "], " << val << "\n";
+        auto& init = node->children[0];
+        std::string dword;
+        if (IsIntegerLiteral(init) && fitsImm32(init->value)) {
+            int64_t v = std::stoll(init->value);
+            out << "\tmov " << sizeKeyword(size) << slot << ", " << (it ? WrapInteger(it, v) : v) << "\n";
+        } else if (size == 4 && !(dword = compileDwordArith(init)).empty()) {
+            out << dword;
+            out << "\tmov " << slot << ", %eax\n";
+        } else {
+            out << compileExpression(init, targetReg);
+            if (it && it->isBool) out << WrapScalar(node->typeName, targetReg);
+            out << StoreScalar(node->typeName, slot, targetReg);
+        }
     } else {
         out << "\t// uninitialized var " << node->name << "\n";
-        bss << "\t:res " << node->name << "!ubyte";
     }
     return out.str();
 }
 
+// Branches to falseLabel when cond evaluates to zero, falls through otherwise
+std::string Compiler_Amd64::compileCondJump(const std::shared_ptr<ASTNode>& cond, const std::string& falseLabel) {
+    std::ostringstream out;
+
+    if (cond->type == ASTNodeType::BinaryExpr && IsComparisonOp(cond->name)) {
+        out << compileExpression(cond->children[0], "%rax");
+        std::string rhs = simpleOperand(cond->children[1]);
+        if (rhs.empty()) {
+            out << compileSecondOperand(cond->children[1]);
+            rhs = "%rcx";
+        }
+        out << "\tcmp %rax, " << rhs << "\n";
+        out << "\t" << inverseJump(cond->name, isUnsignedOp(cond)) << " " << falseLabel << "\n";
+        return out.str();
+    }
+
+    if (cond->type == ASTNodeType::BinaryExpr && cond->name == "&&") {
+        out << compileCondJump(cond->children[0], falseLabel);
+        out << compileCondJump(cond->children[1], falseLabel);
+        return out.str();
+    }
+
+    if (cond->type == ASTNodeType::UnaryExpr && cond->name == "!") {
+        out << compileExpression(cond->children[0], "%rax");
+        out << "\ttest %rax, %rax\n";
+        out << "\tjne " << falseLabel << "\n";
+        return out.str();
+    }
+
+    out << compileExpression(cond, "%rax");
+    out << "\ttest %rax, %rax\n";
+    out << "\tje " << falseLabel << "\n";
+    return out.str();
+}
+
+// Arms the profile saw run at most 1/ColdRatio as often as the other one are cold
+static const int64_t ColdRatio = 64;
+
+// The condition with the opposite truth value, comparisons flip their operator
+static std::shared_ptr<ASTNode> negateCondition(const std::shared_ptr<ASTNode>& cond) {
+    static const std::unordered_map<std::string, std::string> flipped = {
+        {"==", "!="}, {"!=", "=="}, {"<", ">="}, {">=", "<"}, {">", "<="}, {"<=", ">"},
+    };
+    if (cond->type == ASTNodeType::UnaryExpr && cond->name == "!") return cond->children[0];
+    auto neg = std::make_shared<ASTNode>(*cond);
+    auto op = flipped.find(cond->name);
+    if (cond->type == ASTNodeType::BinaryExpr && op != flipped.end()) {
+        neg->name = op->second;
+        return neg;
+    }
+    neg = std::make_shared<ASTNode>(ASTNodeType::UnaryExpr, cond->line, cond->col, "!");
+    neg->children.push_back(cond);
+    return neg;
+}
+
 std::string Compiler_Amd64::compileIf(const std::shared_ptr<ASTNode>& node) {
     std::ostringstream out;
-    std::string ifLabel = "__aol_if__";
-    std::string elseLabel = "__aol_else__";
-    std::string endLabel = "__aol_endif__";
+    std::string elseLabel = newLabel("else");
+    std::string endLabel = newLabel("endif");
 
-    out << ifLabel << ":\n";
-    out << "\tcmp " << compileExpression(node->children[0], "no_reg") << ", 0\n";
-    out << "\tje " << elseLabel << "\n";
+    // With a profile the hotter arm falls through and a cold arm moves behind the epilogue
+    bool hasElse = node->children.size() > 2;
+    int64_t thenCount = ProfileCount(node->children[1]);
+    int64_t elseCount = hasElse ? ProfileCount(node->children[2]) : -1;
+    if (!hasElse && node->attributes.count("else_count")) elseCount = std::stoll(node->attributes["else_count"]);
+    if (thenCount >= 0 && elseCount >= 0) {
+        bool thenCold = elseCount > 0 && thenCount * ColdRatio <= elseCount;
+        bool elseCold = hasElse && thenCount > 0 && elseCount * ColdRatio <= thenCount;
+        if (thenCold || elseCold || (hasElse && elseCount > thenCount)) {
+            bool thenFirst = elseCold;
+            auto first = thenFirst ? node->children[1] : (hasElse ? node->children[2] : nullptr);
+            auto second = thenFirst ? node->children[2] : node->children[1];
+            out << compileCondJump(thenFirst ? node->children[0] : negateCondition(node->children[0]), elseLabel);
+            if (first) out << compileStatement(first);
+            if (thenCold || elseCold) {
+                std::string cold = compileStatement(second); // may add cold blocks of its own first
+                coldCode << elseLabel << ":\n" << cold << "\tjmp " << endLabel << "\n";
+            } else {
+                out << "\tjmp " << endLabel << "\n";
+                out << elseLabel << ":\n";
+                out << compileStatement(second);
+            }
+            out << endLabel << ":\n";
+            return out.str();
+        }
+    }
 
-    for (size_t i = 1; i < node->children.size(); ++i)
-        out << compileStatement(node->children[i]);
+    out << compileCondJump(node->children[0], elseLabel);
+    out << compileStatement(node->children[1]);
 
-    out << elseLabel << ":\n";
-    out << endLabel << ":\n";
+    if (hasElse) {
+        out << "\tjmp " << endLabel << "\n";
+        out << elseLabel << ":\n";
+        out << compileStatement(node->children[2]);
+        out << endLabel << ":\n";
+    } else {
+        out << elseLabel << ":\n";
+    }
     return out.str();
 }
 
 std::string Compiler_Amd64::compileWhile(const std::shared_ptr<ASTNode>& node) {
     std::ostringstream out;
-    std::string startLabel = "__aol_while__";
-    std::string endLabel   = "__aol_while_end__";
+    std::string startLabel = newLabel("while");
+    std::string endLabel   = newLabel("while_end");
 
     out << startLabel << ":\n";
-    out << "\tcmp " << compileExpression(node->children[0], "no_reg") << ", 0\n";
-    out << "\tje " << endLabel << "\n";
+    out << compileCondJump(node->children[0], endLabel);
 
-    for (size_t i = 1; i < node->children.size(); ++i)
-        out << compileStatement(node->children[i]);
+    loopStack.push_back({endLabel, startLabel});
+    out << compileStatement(node->children[1]); // body
+    loopStack.pop_back();
 
     out << "\tjmp " << startLabel << "\n";
     out << endLabel << ":\n";
@@ -239,41 +717,277 @@ std::string Compiler_Amd64::compileWhile(const std::shared_ptr<ASTNode>& node) {
 std::string Compiler_Amd64::compileFor(const std::shared_ptr<ASTNode>& node) {
     std::ostringstream out;
     if (node->children.size() < 4) return "\t// malformed for loop\n";
+    size_t scope = currentFunction ? currentFunction->locals.size() : 0;
+    if (node->attributes.count("parallel")) {
+        std::string code = compileParallelFor(node);
+        endScope(scope);
+        return code;
+    }
 
-    out << compileStatement(node->children[0]); // init
-    std::string startLabel = "__aol_for__";
-    std::string endLabel   = "__aol_for_end__";
+    out << compileLoopClause(node->children[0]); // init
+    std::string startLabel = newLabel("for");
+    std::string stepLabel  = newLabel("for_step");
+    std::string endLabel   = newLabel("for_end");
 
     out << startLabel << ":\n";
-    out << "\tcmp " << compileExpression(node->children[1], "no_reg") << ", 0\n";
-    out << "\tje " << endLabel << "\n";
+    if (node->children[1])
+        out << compileCondJump(node->children[1], endLabel);
 
+    loopStack.push_back({endLabel, stepLabel});
     out << compileStatement(node->children[3]); // body
-    out << compileStatement(node->children[2]); // increment
+    loopStack.pop_back();
+
+    out << stepLabel << ":\n";
+    out << compileLoopClause(node->children[2]); // increment
     out << "\tjmp " << startLabel << "\n";
     out << endLabel << ":\n";
+    endScope(scope);
     return out.str();
 }
 
-std::string Compiler_Amd64::compileBreak(const std::shared_ptr<ASTNode>&) {
-    return "\t// break\n";
+// Lowering thresholds: a jump table needs 4+ cases filling 40% of its range, a bit
+// test covers up to 3 destinations within 64 values and pays off once it replaces
+// 3, 5 or 6 compares, and up to 3 clusters are tested in a row before the
+// dispatch splits into a binary decision tree.
+static const size_t JumpTableMinCases = 4;
+static const int JumpTableMinDensity = 40; // percent
+static const uint64_t JumpTableMaxRange = 4096;
+static const size_t BitTestMaxDests = 3;
+static const size_t BitTestMinCases[BitTestMaxDests] = {3, 5, 6};
+static const size_t LinearClusters = 3;
+
+static bool caseValue(const std::shared_ptr<ASTNode>& node, int64_t& value) {
+    bool negate = false;
+    auto lit = node;
+    if (lit->type == ASTNodeType::UnaryExpr && lit->name == "-") {
+        negate = true;
+        lit = lit->children[0];
+    }
+    if (!IsIntegerLiteral(lit)) return false;
+    try {
+        value = std::stoll(lit->value);
+    } catch (...) {
+        return false;
+    }
+    if (negate) value = (int64_t)(0 - (uint64_t)value);
+    return true;
+}
+
+// Splits sorted cases into clusters. At each point the longest dense run becomes a jump
+// table, unless a bit test covers at least as many cases without the indirect branch.
+static std::vector<SwitchCluster> clusterCases(const std::vector<std::pair<int64_t, std::string>>& cases) {
+    std::vector<SwitchCluster> clusters;
+    size_t n = cases.size();
+    size_t i = 0;
+    while (i < n) {
+        size_t table = i;
+        for (size_t j = i + JumpTableMinCases - 1; j < n; ++j) {
+            uint64_t span = (uint64_t)cases[j].first - (uint64_t)cases[i].first;
+            if (span >= JumpTableMaxRange) break;
+            if ((j - i + 1) * 100 >= (span + 1) * JumpTableMinDensity) table = j;
+        }
+
+        size_t bits = i;
+        std::vector<std::string> dests;
+        for (size_t j = i; j < n; ++j) {
+            if ((uint64_t)cases[j].first - (uint64_t)cases[i].first >= 64) break;
+            if (std::find(dests.begin(), dests.end(), cases[j].second) == dests.end()) dests.push_back(cases[j].second);
+            if (dests.size() > BitTestMaxDests) break;
+            if (j - i + 1 >= BitTestMinCases[dests.size() - 1]) bits = j;
+        }
+
+        SwitchCluster::Kind kind = SwitchCluster::Single;
+        size_t last = i;
+        if (bits > i && bits >= table) {
+            kind = SwitchCluster::BitTest;
+            last = bits;
+        } else if (table > i) {
+            kind = SwitchCluster::JumpTable;
+            last = table;
+        }
+
+        SwitchCluster c{kind, cases[i].first, cases[last].first, {}};
+        c.cases.assign(cases.begin() + i, cases.begin() + last + 1);
+        clusters.push_back(c);
+        i = last + 1;
+    }
+    return clusters;
 }
 
-std::string Compiler_Amd64::compileContinue(const std::shared_ptr<ASTNode>&) {
-    return "\t// continue\n";
+std::string Compiler_Amd64::compileSwitch(const std::shared_ptr<ASTNode>& node) {
+    std::ostringstream out;
+    std::string endLabel = newLabel("switch_end");
+    std::string defaultLabel = endLabel;
+
+    std::vector<std::pair<int64_t, std::string>> cases;
+    std::vector<std::string> clauseLabels;
+    for (size_t i = 1; i < node->children.size(); ++i) {
+        auto& clause = node->children[i];
+        std::string label = newLabel("case");
+        clauseLabels.push_back(label);
+        if (clause->name == "default") defaultLabel = label;
+
+        for (size_t v = 1; v < clause->children.size(); ++v) {
+            int64_t value;
+            if (!caseValue(clause->children[v], value)) {
+                std::cerr << "Error: Case value must be an integer constant at line " << clause->children[v]->line << " col " << clause->children[v]->col << "\n";
+                continue;
+            }
+            cases.push_back({value, label});
+        }
+    }
+
+    std::stable_sort(cases.begin(), cases.end(), [](auto& a, auto& b) { return a.first < b.first; });
+    for (size_t i = 1; i < cases.size(); ++i) {
+        if (cases[i].first == cases[i - 1].first) {
+            std::cerr << "Error: Duplicate case value " << cases[i].first << " in switch at line " << node->line << " col " << node->col << "\n";
+            return "";
+        }
+    }
+
+    out << compileExpression(node->children[0], "%rax");
+    auto clusters = clusterCases(cases);
+    out << compileSwitchTree(clusters, 0, clusters.size(), defaultLabel);
+
+    // break leaves the switch, continue still belongs to the enclosing loop
+    loopStack.push_back({endLabel, loopStack.empty() ? "" : loopStack.back().continueLabel});
+    for (size_t i = 1; i < node->children.size(); ++i) {
+        out << clauseLabels[i - 1] << ":\n";
+        out << compileStatement(node->children[i]->children[0]);
+    }
+    loopStack.pop_back();
+
+    out << endLabel << ":\n";
+    return out.str();
+}
+
+// Dispatches the switch value in %rax over clusters [lo, hi)
+std::string Compiler_Amd64::compileSwitchTree(const std::vector<SwitchCluster>& clusters, size_t lo, size_t hi, const std::string& defaultLabel) {
+    std::ostringstream out;
+
+    if (hi - lo <= LinearClusters) {
+        for (size_t i = lo; i < hi; ++i) {
+            bool last = i + 1 == hi;
+            std::string next = last ? defaultLabel : newLabel("case_next");
+            out << compileSwitchCluster(clusters[i], next, defaultLabel);
+            if (!last && clusters[i].kind != SwitchCluster::Single) out << next << ":\n";
+        }
+        // Jump tables and bit tests end in a jump of their own
+        if (lo == hi || clusters[hi - 1].kind == SwitchCluster::Single)
+            out << "\tjmp " << defaultLabel << "\n";
+        return out.str();
+    }
+
+    // A single-case pivot is tested on the way down
+    size_t mid = lo + (hi - lo) / 2;
+    const SwitchCluster& pivot = clusters[mid];
+    std::string leftLabel = newLabel("case_lt");
+    if (fitsImm32(std::to_string(pivot.low))) {
+        out << "\tcmp %rax, " << pivot.low << "\n";
+    } else {
+        out << "\tmov %rcx, " << pivot.low << "\n\tcmp %rax, %rcx\n";
+    }
+    if (pivot.kind == SwitchCluster::Single) out << "\tje " << pivot.cases[0].second << "\n";
+    out << "\tjl " << leftLabel << "\n";
+    out << compileSwitchTree(clusters, pivot.kind == SwitchCluster::Single ? mid + 1 : mid, hi, defaultLabel);
+    out << leftLabel << ":\n";
+    out << compileSwitchTree(clusters, lo, mid, defaultLabel);
+    return out.str();
+}
+
+// Tests one cluster, values below or above its range continue at outOfRange
+std::string Compiler_Amd64::compileSwitchCluster(const SwitchCluster& cluster, const std::string& outOfRange, const std::string& defaultLabel) {
+    std::ostringstream out;
+
+    if (cluster.kind == SwitchCluster::Single) {
+        int64_t v = cluster.low;
+        if (fitsImm32(std::to_string(v))) out << "\tcmp %rax, " << v << "\n";
+        else out << "\tmov %rcx, " << v << "\n\tcmp %rax, %rcx\n";
+        out << "\tje " << cluster.cases[0].second << "\n";
+        return out.str();
+    }
+
+    // %rcx = value - low, a single unsigned compare catches both ends of the range
+    uint64_t span = (uint64_t)cluster.high - (uint64_t)cluster.low;
+    out << "\tmov %rcx, %rax\n";
+    if (cluster.low != 0) {
+        if (fitsImm32(std::to_string(cluster.low))) out << "\tsub %rcx, " << cluster.low << "\n";
+        else out << "\tmov %rdx, " << cluster.low << "\n\tsub %rcx, %rdx\n";
+    }
+    if (span <= INT32_MAX) out << "\tcmp %rcx, " << span << "\n";
+    else out << "\tmov %rdx, " << span << "\n\tcmp %rcx, %rdx\n";
+    out << "\tja " << outOfRange << "\n";
+
+    if (cluster.kind == SwitchCluster::JumpTable) {
+        std::string table = "__aol_jt_" + std::to_string(labelIdx++);
+        out << "\t// jump table [" << cluster.low << ", " << cluster.high << "], " << cluster.cases.size() << " cases\n";
+        out << "\tlea %rdx, [" << table << "]\n";
+        out << "\tjmp [%rdx + %rcx*8]\n";
+
+        rodata << "\t:align 8\n\t" << table << "!uqword[] = ";
+        size_t next = 0;
+        for (uint64_t k = 0; k <= span; ++k) {
+            const std::string* target = &defaultLabel;
+            if (next < cluster.cases.size() && (uint64_t)cluster.cases[next].first - (uint64_t)cluster.low == k)
+                target = &cluster.cases[next++].second;
+            rodata << (k ? ", " : "") << *target;
+        }
+        rodata << "\n";
+        return out.str();
+    }
+
+    // Bit test: one mask of (value - low) offsets per destination
+    std::vector<std::pair<std::string, uint64_t>> masks;
+    for (auto& [value, label] : cluster.cases) {
+        auto it = std::find_if(masks.begin(), masks.end(), [&](auto& m) { return m.first == label; });
+        if (it == masks.end()) it = masks.insert(masks.end(), {label, 0});
+        it->second |= 1ull << ((uint64_t)value - (uint64_t)cluster.low);
+    }
+    out << "\t// bit test [" << cluster.low << ", " << cluster.high << "], " << cluster.cases.size() << " cases\n";
+    for (auto& [label, mask] : masks) {
+        out << "\tmov %rdx, " << mask << "\n";
+        out << "\tbt %rdx, %rcx\n";
+        out << "\tjc " << label << "\n";
+    }
+    out << "\tjmp " << defaultLabel << "\n";
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileBreak(const std::shared_ptr<ASTNode>& node) {
+    if (loopStack.empty()) {
+        std::cerr << "Error: 'break' outside of a loop or switch at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    return "\tjmp " + loopStack.back().breakLabel + "\n";
+}
+
+std::string Compiler_Amd64::compileContinue(const std::shared_ptr<ASTNode>& node) {
+    if (loopStack.empty() || loopStack.back().continueLabel.empty()) {
+        std::cerr << "Error: 'continue' outside of a loop at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    return "\tjmp " + loopStack.back().continueLabel + "\n";
 }
 
 std::string Compiler_Amd64::compileExpression(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
     if (!node) return "";
+    if (vectorTypeOf(node)) {
+        std::cerr << "Error: Vector value used where a scalar is expected at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    if (FindStructType(exprType(node))) {
+        std::cerr << "Error: Struct value used where a scalar is expected, take its address with & at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
     switch (node->type) {
+        case ASTNodeType::MemberExpr: return compileMemberLoad(node, targetReg);
         case ASTNodeType::BinaryExpr: return compileBinaryExpr(node, targetReg);
         case ASTNodeType::UnaryExpr:  return compileUnaryExpr(node, targetReg);
+        case ASTNodeType::AssignExpr: return compileAssignExpr(node, targetReg);
         case ASTNodeType::Literal: {
-            if (targetReg == "no_reg") {
-                return compileLiteral(node);
-            }
             std::ostringstream out;
-            out << "\tmov " << targetReg << ", " << compileLiteral(node) << "\n";
+            if (IsIntegerLiteral(node)) out << "\tmov " << targetReg << ", " << compileLiteral(node) << "\n";
+            else out << "\tlea " << targetReg << ", [" << compileLiteral(node) << "]\n";
             return out.str();
         }
         case ASTNodeType::Identifier: return compileIdentifier(node, targetReg);
@@ -288,47 +1002,204 @@ std::string Compiler_Amd64::compileExpression(const std::shared_ptr<ASTNode>& no
     }
 }
 
+static bool isNot(const std::shared_ptr<ASTNode>& node) {
+    return node && node->type == ASTNodeType::UnaryExpr && node->name == "~";
+}
+
 std::string Compiler_Amd64::compileBinaryExpr(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
     std::ostringstream out;
-    out << compileExpression(node->children[0], targetReg) << " " << node->name << " " << compileExpression(node->children[1], targetReg);
+    const std::string& op = node->name;
+
+    if (op == "&&" || op == "||") {
+        std::string shortLabel = newLabel("sc");
+        std::string endLabel = newLabel("sc_end");
+        out << compileExpression(node->children[0], "%rax");
+        out << "\ttest %rax, %rax\n";
+        out << (op == "&&" ? "\tje " : "\tjne ") << shortLabel << "\n";
+        out << compileExpression(node->children[1], "%rax");
+        out << "\ttest %rax, %rax\n\tsetne %al\n\tmovzx %rax, %al\n";
+        out << "\tjmp " << endLabel << "\n";
+        out << shortLabel << ":\n";
+        out << "\tmov %rax, " << (op == "&&" ? 0 : 1) << "\n";
+        out << endLabel << ":\n";
+    } else if (op == "&" && target.bmi1 && (isNot(node->children[0]) || isNot(node->children[1]))) {
+        // a & ~b in one andn, the complemented side is loaded without its ~
+        bool leftNot = isNot(node->children[0]);
+        out << compileOperandPair(leftNot ? node->children[0]->children[0] : node->children[0],
+                                  leftNot ? node->children[1] : node->children[1]->children[0]);
+        out << (leftNot ? "\tandn %rax, %rax, %rcx\n" : "\tandn %rax, %rcx, %rax\n");
+    } else if (std::string isel = compileArithIsel(node); !isel.empty()) {
+        out << isel;
+    } else {
+        out << compileExpression(node->children[0], "%rax");
+        std::string rhs = simpleOperand(node->children[1]);
+        if (rhs.empty()) {
+            out << compileSecondOperand(node->children[1]);
+            rhs = "%rcx";
+        }
+        out << emitArith(op, rhs, target, isUnsignedOp(node));
+    }
+
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
     return out.str();
 }
 
 std::string Compiler_Amd64::compileUnaryExpr(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
-    return node->name + compileExpression(node->children[0], targetReg);
+    if (node->name == "&") return compileAddressOf(node, targetReg);
+    if (node->name == "await") return compileAwait(node, targetReg);
+    std::ostringstream out;
+    out << compileExpression(node->children[0], "%rax");
+    if (node->name == "-") out << "\tneg %rax\n";
+    else if (node->name == "~") out << "\tnot %rax\n";
+    else if (node->name == "!") out << "\ttest %rax, %rax\n\tsete %al\n\tmovzx %rax, %al\n";
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileAssignExpr(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    auto& target = node->children[0];
+    if (target->type == ASTNodeType::MemberExpr) return compileMemberStore(node, targetReg);
+    std::string slot = target->type == ASTNodeType::Identifier ? variableOperand(target->name) : "";
+    if (slot.empty()) {
+        std::cerr << "Error: Invalid assignment target at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+
+    const VariableInfo* var = findVariable(target->name);
+    std::string type = var ? var->type : "";
+
+    std::ostringstream out;
+    std::string dword = var && var->size == 4 ? compileDwordArith(node->children[1]) : "";
+    if (!dword.empty()) {
+        out << dword;
+        if (FindIntegerType(type)->isSigned) out << "\tmovsxd %rax, %eax\n"; // the 32-bit op already zero-extended
+    } else {
+        out << compileExpression(node->children[1], "%rax");
+        out << WrapScalar(type, "%rax");
+    }
+    out << StoreScalar(type, slot, "%rax");
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
+
+// An i32/u32 store only keeps the low half, so + - * & | ^ on operands that can
+// be read as dwords may run on 32-bit registers: shorter encodings, no REX.W
+std::string Compiler_Amd64::compileDwordArith(const std::shared_ptr<ASTNode>& node) {
+    if (!node || node->type != ASTNodeType::BinaryExpr) return "";
+    static const std::unordered_map<std::string, std::string> ops = {
+        {"+", "add"}, {"-", "sub"}, {"*", "imul"}, {"&", "and"}, {"|", "or"}, {"^", "xor"},
+    };
+    auto op = ops.find(node->name);
+    if (op == ops.end()) return "";
+    std::string lhs = dwordOperand(node->children[0]), rhs = dwordOperand(node->children[1]);
+    if (lhs.empty() || rhs.empty()) return "";
+
+    std::ostringstream out;
+    out << "\tmov %eax, " << lhs << "\n";
+    if (op->second == "imul" && isImmediate(rhs)) out << "\timul %eax, %eax, " << rhs << "\n";
+    else out << "\t" << op->second << " %eax, " << rhs << "\n";
+    return out.str();
+}
+
+// Immediate or memory operand whose low 32 bits can be read directly
+std::string Compiler_Amd64::dwordOperand(const std::shared_ptr<ASTNode>& node) const {
+    if (IsIntegerLiteral(node) && fitsImm32(node->value)) return node->value;
+    if (!node || node->type != ASTNodeType::Identifier) return "";
+    const VariableInfo* var = findVariable(node->name);
+    if (!var || !IsScalarType(var->type) || var->size < 4) return "";
+    return variableOperand(node->name);
 }
 
 std::string Compiler_Amd64::compileIdentifier(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
-    if (!currentFunction) return node->name;
+    if (!currentFunction) return "";
 
-    // Check locals
-    for (auto& var : currentFunction->locals) {
-        if (var.name == node->name) {
-            if (targetReg == "no_reg") {
-                return "[" + std::string("%rbp") + " - " + std::to_string(var.offset) + "]\n";
-            }
-            return "\tmov " + targetReg + ", [" + std::string("%rbp") + " - " + std::to_string(var.offset) + "]\n";
-        }
+    std::string slot = variableOperand(node->name);
+    auto fn = slot.empty() ? functions.find(node->name) : functions.end();
+    if (fn != functions.end() && !isCoroutine(node->name)) {
+        // A function name is its address, for thread_spawn and the like
+        const std::string& symbol = fn->second.symbol;
+        return "\tlea " + targetReg + ", [" + (symbol.empty() ? "$" + node->name : symbol) + "]\n";
+    }
+    if (slot.empty()) {
+        std::cerr << "Error: Unknown variable '" << node->name << "' at line " << node->line << " col " << node->col << "\n";
+        return "";
     }
+    const VariableInfo* var = findVariable(node->name);
+    return LoadScalar(var ? var->type : "", targetReg, slot);
+}
 
-    // Check parameters
+const VariableInfo* Compiler_Amd64::findVariable(const std::string& name) const {
+    if (!currentFunction) return nullptr;
+
+    // Check locals in scope, the latest declaration of a name wins
+    for (auto it = currentFunction->locals.rbegin(); it != currentFunction->locals.rend(); ++it) {
+        if (it->name == name && !it->hidden) return &*it;
+    }
+
+    // Check parameters passed on the stack, register params live in locals
     for (auto& param : currentFunction->params) {
-        if (param.name == node->name) {
-            if (!param.reg.empty()) 
-                return param.reg; // use register directly
-            else 
-                return "[" + std::string("%rbp") + " + " + std::to_string(param.offset) + "]"; // stack
-        }
+        if (param.name == name && param.reg.empty()) return &param;
+    }
+
+    for (auto& global : globalVars) {
+        if (global.name == name) return &global;
+    }
+    return nullptr;
+}
+
+std::string Compiler_Amd64::variableOperand(const std::string& name) const {
+    if (!currentFunction) return "";
+
+    // Check locals in scope, the latest declaration of a name wins
+    for (auto it = currentFunction->locals.rbegin(); it != currentFunction->locals.rend(); ++it) {
+        if (it->name != name || it->hidden) continue;
+        if (FindVectorType(it->type) || it->inArea) return "[%rbx + " + std::to_string(it->offset) + "]";
+        return "[%rbp - " + std::to_string(it->offset) + "]";
+    }
+
+    // Check parameters passed on the stack, register params live in locals
+    for (auto& param : currentFunction->params) {
+        if (param.name == name && param.reg.empty())
+            return "[%rbp + " + std::to_string(param.offset) + "]";
     }
 
-    return node->name; // fallback
+    const VariableInfo* global = findVariable(name);
+    if (global && !global->label.empty()) return MemOperand(global->label, 0);
+    return "";
+}
+
+std::string Compiler_Amd64::simpleOperand(const std::shared_ptr<ASTNode>& node) const {
+    if (IsIntegerLiteral(node) && fitsImm32(node->value)) return node->value;
+    if (node && node->type == ASTNodeType::Identifier) {
+        const VariableInfo* var = findVariable(node->name);
+        return var && IsNarrowType(var->type) ? "" : variableOperand(node->name);
+    }
+    Place place;
+    if (node && node->type == ASTNodeType::MemberExpr && staticPlace(node, place) &&
+        IsScalarType(place.type) && !IsNarrowType(place.type))
+        return MemOperand(place.base, place.offset);
+    return "";
 }
 
-int Compiler_Amd64::allocateLocal(const std::string& name, int size) {
+std::string Compiler_Amd64::newLabel(const std::string& kind) {
+    return "__aol_" + kind + "_" + std::to_string(labelIdx++) + "__";
+}
+
+std::string Compiler_Amd64::push(const std::string& reg) {
+    pushDepth++;
+    return "\tpush " + reg + "\n";
+}
+
+std::string Compiler_Amd64::pop(const std::string& reg) {
+    pushDepth--;
+    return "\tpop " + reg + "\n";
+}
+
+int Compiler_Amd64::allocateLocal(const std::string& name, int size, const std::string& type, int align) {
     if (!currentFunction) return 0;
-    localOffset += size;
-    currentFunction->locals.push_back({name, localOffset, size, ""});
-    currentFunction->stackSize += size;
+    int start = localOffset;
+    localOffset = (localOffset + size + align - 1) / align * align; // %rbp is 16-byte aligned
+    currentFunction->locals.push_back({name, localOffset, size, "", type});
+    currentFunction->stackSize += localOffset - start;
     return localOffset;
 }
-
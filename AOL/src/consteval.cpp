@@ -0,0 +1,487 @@
+#include <consteval.hpp>
+#include <parser.hpp>
+#include <optimizer.hpp>
+#include <types.hpp>
+#include <bits.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <functional>
+#include <unordered_set>
+
+// Unwinds the interpreter when a call has to be left to runtime
+struct ConstEvalFailure {
+    std::string why;
+};
+
+static std::string where(const std::shared_ptr<ASTNode>& node) {
+    return " at line " + std::to_string(node->line) + " col " + std::to_string(node->col);
+}
+
+static bool literalValue(const std::shared_ptr<ASTNode>& node, int64_t* out) {
+    if (!node || node->type != ASTNodeType::Literal || node->name == "string" || node->value.empty()) return false;
+    size_t i = (node->value[0] == '-') ? 1 : 0;
+    if (i == node->value.size()) return false;
+    for (size_t k = i; k < node->value.size(); ++k)
+        if (!std::isdigit((unsigned char)node->value[k])) return false;
+    try {
+        *out = std::stoll(node->value);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+static bool hasCall(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return false;
+    if (node->type == ASTNodeType::CallExpr) return true;
+    for (auto& child : node->children)
+        if (hasCall(child)) return true;
+    return false;
+}
+
+void ConstEvaluator::define(const std::shared_ptr<ASTNode>& fn) {
+    functions[fn->name] = fn;
+}
+
+bool ConstEvaluator::isConstantExpr(const std::shared_ptr<ASTNode>& expr) const {
+    if (!expr) return false;
+    int64_t v;
+    switch (expr->type) {
+        case ASTNodeType::Literal:
+            return literalValue(expr, &v);
+        case ASTNodeType::UnaryExpr:
+            return expr->name != "&" && isConstantExpr(expr->children[0]);
+        case ASTNodeType::BinaryExpr:
+            return isConstantExpr(expr->children[0]) && isConstantExpr(expr->children[1]);
+        case ASTNodeType::CallExpr:
+            if (!isConst(expr->name) && !IsBitBuiltin(expr->name)) return false;
+            for (auto& arg : expr->children)
+                if (!isConstantExpr(arg)) return false;
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::optional<int64_t> ConstEvaluator::evaluate(const std::shared_ptr<ASTNode>& expr, std::string& why) {
+    steps = 0;
+    depth = 0;
+    Frame frame;
+    try {
+        return eval(expr, frame);
+    } catch (const ConstEvalFailure& f) {
+        why = f.why;
+        return std::nullopt;
+    }
+}
+
+void ConstEvaluator::step(const std::shared_ptr<ASTNode>& at) {
+    if (++steps > MaxSteps)
+        throw ConstEvalFailure{"step limit of " + std::to_string(MaxSteps) + " exceeded" + where(at)};
+}
+
+int64_t ConstEvaluator::call(const std::shared_ptr<ASTNode>& site, const std::vector<int64_t>& args) {
+    auto it = functions.find(site->name);
+    if (it == functions.end() && IsBitBuiltin(site->name)) {
+        if (auto v = EvaluateBitBuiltin(site->name, args)) return *v;
+        throw ConstEvalFailure{"'" + site->name + "' takes " + std::to_string(BitBuiltinArity(site->name)) + " arguments" + where(site)};
+    }
+    if (it == functions.end())
+        throw ConstEvalFailure{"'" + site->name + "' is not a const function" + where(site)};
+    auto& fn = it->second;
+    if (args.size() != fn->params.size())
+        throw ConstEvalFailure{"'" + fn->name + "' takes " + std::to_string(fn->params.size()) + " arguments" + where(site)};
+    if (depth >= MaxDepth)
+        throw ConstEvalFailure{"recursion deeper than " + std::to_string(MaxDepth) + " calls" + where(site)};
+
+    Frame frame;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (const IntegerType* t = FindIntegerType(fn->params[i]->typeName)) frame.types[fn->params[i]->name] = t;
+        store(frame, fn->params[i]->name, args[i]);
+    }
+
+    depth++;
+    Flow flow = Flow::Next;
+    for (auto& stmt : fn->children) {
+        flow = exec(stmt, frame);
+        if (flow != Flow::Next) break;
+    }
+    depth--;
+
+    if (flow != Flow::Return)
+        throw ConstEvalFailure{"'" + fn->name + "' ends without returning a value"};
+    const IntegerType* t = FindIntegerType(fn->typeName);
+    return t ? WrapInteger(t, frame.result) : frame.result;
+}
+
+void ConstEvaluator::store(Frame& frame, const std::string& name, int64_t v) {
+    auto t = frame.types.find(name);
+    frame.vars[name] = t != frame.types.end() ? WrapInteger(t->second, v) : v;
+}
+
+ConstEvaluator::Flow ConstEvaluator::exec(const std::shared_ptr<ASTNode>& stmt, Frame& frame) {
+    if (!stmt) return Flow::Next;
+    step(stmt);
+    switch (stmt->type) {
+        case ASTNodeType::VariableDecl:
+            if (const IntegerType* t = FindIntegerType(stmt->typeName)) frame.types[stmt->name] = t;
+            else frame.types.erase(stmt->name);
+            if (stmt->children.empty()) frame.vars.erase(stmt->name);
+            else store(frame, stmt->name, eval(stmt->children[0], frame));
+            return Flow::Next;
+        case ASTNodeType::StmtBlock:
+            for (auto& child : stmt->children) {
+                Flow flow = exec(child, frame);
+                if (flow != Flow::Next) return flow;
+            }
+            return Flow::Next;
+        case ASTNodeType::ReturnStmt:
+            if (stmt->children.empty()) throw ConstEvalFailure{"'ret' without a value" + where(stmt)};
+            frame.result = eval(stmt->children[0], frame);
+            return Flow::Return;
+        case ASTNodeType::IfStmt:
+            if (eval(stmt->children[0], frame)) return exec(stmt->children[1], frame);
+            return stmt->children.size() > 2 ? exec(stmt->children[2], frame) : Flow::Next;
+        case ASTNodeType::WhileStmt:
+        case ASTNodeType::ForStmt: {
+            bool isFor = stmt->type == ASTNodeType::ForStmt;
+            auto& cond = isFor ? stmt->children[1] : stmt->children[0];
+            if (isFor) exec(stmt->children[0], frame);
+            while (true) {
+                step(stmt);
+                if (cond && !eval(cond, frame)) break;
+                Flow flow = exec(stmt->children.back(), frame);
+                if (flow == Flow::Break) break;
+                if (flow == Flow::Return) return flow;
+                if (isFor) exec(stmt->children[2], frame);
+            }
+            return Flow::Next;
+        }
+        case ASTNodeType::SwitchStmt: {
+            int64_t v = eval(stmt->children[0], frame);
+            size_t start = 0;
+            for (size_t i = 1; i < stmt->children.size() && !start; ++i)
+                for (size_t k = 1; k < stmt->children[i]->children.size(); ++k)
+                    if (eval(stmt->children[i]->children[k], frame) == v) { start = i; break; }
+            for (size_t i = 1; i < stmt->children.size() && !start; ++i)
+                if (stmt->children[i]->name == "default") start = i;
+            if (!start) return Flow::Next;
+            // Clauses fall through until a break
+            for (size_t i = start; i < stmt->children.size(); ++i) {
+                Flow flow = exec(stmt->children[i]->children[0], frame);
+                if (flow == Flow::Break) break;
+                if (flow != Flow::Next) return flow;
+            }
+            return Flow::Next;
+        }
+        case ASTNodeType::BreakStmt:
+            return Flow::Break;
+        case ASTNodeType::ContinueStmt:
+            return Flow::Continue;
+        case ASTNodeType::Literal:
+        case ASTNodeType::Identifier:
+        case ASTNodeType::UnaryExpr:
+        case ASTNodeType::BinaryExpr:
+        case ASTNodeType::AssignExpr:
+        case ASTNodeType::CallExpr:
+            eval(stmt, frame);
+            return Flow::Next;
+        default:
+            throw ConstEvalFailure{"statement cannot be evaluated at compile time" + where(stmt)};
+    }
+}
+
+int64_t ConstEvaluator::eval(const std::shared_ptr<ASTNode>& expr, Frame& frame) {
+    step(expr);
+    int64_t v;
+    switch (expr->type) {
+        case ASTNodeType::Literal:
+            if (!literalValue(expr, &v)) throw ConstEvalFailure{"non-integer literal" + where(expr)};
+            return v;
+        case ASTNodeType::Identifier: {
+            auto it = frame.vars.find(expr->name);
+            if (it == frame.vars.end()) throw ConstEvalFailure{"'" + expr->name + "' is read before it is assigned" + where(expr)};
+            return it->second;
+        }
+        case ASTNodeType::AssignExpr: {
+            if (expr->children[0]->type != ASTNodeType::Identifier)
+                throw ConstEvalFailure{"assignment to a non-variable" + where(expr)};
+            store(frame, expr->children[0]->name, eval(expr->children[1], frame));
+            return frame.vars[expr->children[0]->name];
+        }
+        case ASTNodeType::CallExpr: {
+            std::vector<int64_t> args;
+            for (auto& arg : expr->children) args.push_back(eval(arg, frame));
+            return call(expr, args);
+        }
+        case ASTNodeType::UnaryExpr: {
+            uint64_t a = (uint64_t)eval(expr->children[0], frame);
+            if (expr->name == "-") return (int64_t)(0 - a);
+            if (expr->name == "~") return (int64_t)~a;
+            if (expr->name == "!") return a == 0;
+            if (expr->name == "+") return (int64_t)a;
+            throw ConstEvalFailure{"operator '" + expr->name + "' cannot be evaluated at compile time" + where(expr)};
+        }
+        case ASTNodeType::BinaryExpr: {
+            const std::string& op = expr->name;
+            int64_t a = eval(expr->children[0], frame);
+            if (op == "&&") return a && eval(expr->children[1], frame);
+            if (op == "||") return a || eval(expr->children[1], frame);
+            int64_t b = eval(expr->children[1], frame);
+
+            // Wrapping 64-bit arithmetic, matching what the generated code computes
+            uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+            if (op == "+") return (int64_t)(ua + ub);
+            if (op == "-") return (int64_t)(ua - ub);
+            if (op == "*") return (int64_t)(ua * ub);
+            if (op == "/" || op == "%") {
+                // div and idiv trap on both, leave the fault to runtime
+                if (b == 0) throw ConstEvalFailure{"division by zero" + where(expr)};
+                if (isUnsigned(expr->children[0], frame) && (isUnsigned(expr->children[1], frame) || b > 0))
+                    return (int64_t)(op == "/" ? ua / ub : ua % ub);
+                if (a == INT64_MIN && b == -1) throw ConstEvalFailure{"division overflow" + where(expr)};
+                return op == "/" ? a / b : a % b;
+            }
+            if (op == "&") return a & b;
+            if (op == "|") return a | b;
+            if (op == "^") return a ^ b;
+            if (op == "<<") return (int64_t)(ua << (b & 63));
+            if (op == "==") return a == b;
+            if (op == "!=") return a != b;
+
+            // Unsigned values compare and shift right as uint64_t, like jb and shr
+            if (isUnsignedOp(expr, frame)) {
+                if (op == ">>") return (int64_t)(ua >> (b & 63));
+                if (op == "<") return ua < ub;
+                if (op == "<=") return ua <= ub;
+                if (op == ">") return ua > ub;
+                if (op == ">=") return ua >= ub;
+            }
+            if (op == ">>") return a >> (b & 63);
+            if (op == "<") return a < b;
+            if (op == "<=") return a <= b;
+            if (op == ">") return a > b;
+            if (op == ">=") return a >= b;
+            throw ConstEvalFailure{"operator '" + op + "' cannot be evaluated at compile time" + where(expr)};
+        }
+        default:
+            throw ConstEvalFailure{"expression cannot be evaluated at compile time" + where(expr)};
+    }
+}
+
+std::string ConstEvaluator::typeOf(const std::shared_ptr<ASTNode>& expr, const Frame& frame) const {
+    switch (expr->type) {
+        case ASTNodeType::Identifier: {
+            auto it = frame.types.find(expr->name);
+            return it != frame.types.end() ? it->second->name : "";
+        }
+        case ASTNodeType::AssignExpr:
+            return typeOf(expr->children[0], frame);
+        case ASTNodeType::CallExpr: {
+            auto it = functions.find(expr->name);
+            return it != functions.end() ? it->second->typeName : "";
+        }
+        case ASTNodeType::BinaryExpr: {
+            static const std::unordered_set<std::string> arith = {"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"};
+            if (!arith.count(expr->name) || !isUnsignedOp(expr, frame)) return "";
+            bool shift = expr->name == "<<" || expr->name == ">>";
+            if (typeOf(expr->children[0], frame) == "u64" || (!shift && typeOf(expr->children[1], frame) == "u64")) return "u64";
+            return "";
+        }
+        default:
+            return "";
+    }
+}
+
+bool ConstEvaluator::isUnsigned(const std::shared_ptr<ASTNode>& expr, const Frame& frame) const {
+    const IntegerType* t = FindIntegerType(typeOf(expr, frame));
+    return t && !t->isSigned && !t->isBool;
+}
+
+// Same rule as the code generator: shifts follow their left operand, anything
+// else needs one unsigned side and the other unsigned or a non-negative literal
+bool ConstEvaluator::isUnsignedOp(const std::shared_ptr<ASTNode>& expr, const Frame& frame) const {
+    auto& lhs = expr->children[0];
+    auto& rhs = expr->children[1];
+    if (expr->name == "<<" || expr->name == ">>") return isUnsigned(lhs, frame);
+    int64_t c;
+    bool left = isUnsigned(lhs, frame), right = isUnsigned(rhs, frame);
+    bool leftFits = left || (literalValue(lhs, &c) && c >= 0);
+    bool rightFits = right || (literalValue(rhs, &c) && c >= 0);
+    return (left || right) && leftFits && rightFits;
+}
+
+// A const function may only compute on integer params and locals and call other
+// const functions, so evaluating it can never observe the program state.
+static bool checkConstFunction(const std::shared_ptr<ASTNode>& fn, const std::unordered_set<std::string>& constNames,
+                               const std::unordered_set<std::string>& constants) {
+    bool ok = true;
+    if (!fn->typeName.empty() && !FindIntegerType(fn->typeName)) {
+        std::cerr << "Error: const function '" << fn->name << "' must return an integer, not '" << fn->typeName << "'" << where(fn) << "\n";
+        ok = false;
+    }
+
+    std::unordered_set<std::string> own;
+    for (auto& param : fn->params) {
+        own.insert(param->name);
+        if (!param->typeName.empty() && !FindIntegerType(param->typeName)) {
+            std::cerr << "Error: Parameter '" << param->name << "' of const function '" << fn->name << "' must be an integer" << where(param) << "\n";
+            ok = false;
+        }
+    }
+
+    std::function<void(const std::shared_ptr<ASTNode>&)> check = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        switch (node->type) {
+            case ASTNodeType::VariableDecl:
+                own.insert(node->name);
+                if (!node->typeName.empty() && !FindIntegerType(node->typeName)) {
+                    std::cerr << "Error: Local '" << node->name << "' of const function '" << fn->name << "' must be an integer" << where(node) << "\n";
+                    ok = false;
+                }
+                break;
+            case ASTNodeType::Identifier:
+                if (!own.count(node->name) && !constants.count(node->name)) {
+                    std::cerr << "Error: const function '" << fn->name << "' uses '" << node->name << "' which is not a parameter or local" << where(node) << "\n";
+                    ok = false;
+                }
+                break;
+            case ASTNodeType::CallExpr:
+                if (!constNames.count(node->name) && !IsBitBuiltin(node->name)) {
+                    std::cerr << "Error: const function '" << fn->name << "' calls '" << node->name << "' which is not a const function" << where(node) << "\n";
+                    ok = false;
+                }
+                break;
+            case ASTNodeType::UnaryExpr:
+                if (node->name == "&") {
+                    std::cerr << "Error: const function '" << fn->name << "' takes an address" << where(node) << "\n";
+                    ok = false;
+                }
+                break;
+            case ASTNodeType::MemberExpr:
+            case ASTNodeType::AsmStmt:
+                std::cerr << "Error: const function '" << fn->name << "' accesses memory" << where(node) << "\n";
+                ok = false;
+                return;
+            default:
+                break;
+        }
+        for (auto& child : node->children) check(child);
+    };
+    for (auto& stmt : fn->children) check(stmt);
+    return ok;
+}
+
+bool EvaluateConstCalls(const std::shared_ptr<ASTNode>& program, std::vector<std::string>& remarks) {
+    if (!program) return true;
+
+    std::unordered_set<std::string> constNames;
+    for (auto& child : program->children)
+        if (child && child->type == ASTNodeType::FunctionDecl && child->attributes.count("const"))
+            constNames.insert(child->name);
+    std::unordered_set<std::string> constantNames;
+    for (auto& child : program->children)
+        if (child && child->type == ASTNodeType::VariableDecl && child->attributes.count("const"))
+            constantNames.insert(child->name);
+
+    // Functions that fail the check stay ordinary functions
+    bool ok = true;
+    ConstEvaluator evaluator;
+    for (auto& child : program->children) {
+        if (!child || child->type != ASTNodeType::FunctionDecl || !child->attributes.count("const")) continue;
+        if (checkConstFunction(child, constNames, constantNames)) {
+            evaluator.define(child);
+        } else {
+            child->attributes.erase("const");
+            ok = false;
+        }
+    }
+
+    // Top-level `const N = expr;` is a named value, every use outside a scope
+    // declaring its own N is replaced by it
+    std::unordered_map<std::string, int64_t> constants;
+    std::function<void(std::shared_ptr<ASTNode>&, const std::unordered_set<std::string>&)> substitute =
+        [&](std::shared_ptr<ASTNode>& node, const std::unordered_set<std::string>& shadowed) {
+        if (!node) return;
+        auto it = node->type == ASTNodeType::Identifier && !shadowed.count(node->name) ? constants.find(node->name) : constants.end();
+        if (it != constants.end()) {
+            auto lit = std::make_shared<ASTNode>(ASTNodeType::Literal, node->line, node->col);
+            lit->value = std::to_string(it->second);
+            node = lit;
+            return;
+        }
+        for (auto& child : node->children) substitute(child, shadowed);
+    };
+    std::vector<std::pair<std::shared_ptr<ASTNode>, std::unordered_set<std::string>>> scopes; // function, its own names
+    for (auto& child : program->children) {
+        if (!child || child->type != ASTNodeType::FunctionDecl || constantNames.empty()) continue;
+        std::unordered_set<std::string> own;
+        for (auto& param : child->params) own.insert(param->name);
+        std::function<void(const std::shared_ptr<ASTNode>&)> collect = [&](const std::shared_ptr<ASTNode>& node) {
+            if (!node) return;
+            if (node->type == ASTNodeType::VariableDecl) own.insert(node->name);
+            for (auto& c : node->children) collect(c);
+        };
+        collect(child);
+        scopes.push_back({child, own});
+    }
+    for (auto& child : program->children) {
+        if (!child || child->type != ASTNodeType::VariableDecl || !child->attributes.count("const")) continue;
+        const IntegerType* t = FindIntegerType(child->typeName);
+        if (child->children.empty() || (!child->typeName.empty() && !t)) {
+            std::cerr << "Error: const '" << child->name << "' must be an integer with an initializer" << where(child) << "\n";
+            ok = false;
+            continue;
+        }
+        substitute(child->children[0], {});
+        std::string why;
+        std::optional<int64_t> v;
+        if (evaluator.isConstantExpr(child->children[0])) v = evaluator.evaluate(child->children[0], why);
+        else why = "the initializer is not a constant expression";
+        if (!v) {
+            std::cerr << "Error: const '" << child->name << "' can't be computed at compile time: " << why << where(child) << "\n";
+            ok = false;
+            continue;
+        }
+        constants[child->name] = t ? WrapInteger(t, *v) : *v;
+        auto lit = std::make_shared<ASTNode>(ASTNodeType::Literal, child->line, child->col);
+        lit->value = std::to_string(constants[child->name]);
+        child->children[0] = lit;
+
+        // Later constants may call const functions reading this one
+        for (auto& [fn, own] : scopes)
+            for (auto& stmt : fn->children) substitute(stmt, own);
+    }
+    if (constNames.empty()) return ok;
+
+    std::string owner = "<global>";
+    std::function<void(std::shared_ptr<ASTNode>&)> fold = [&](std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        for (auto& child : node->children) fold(child);
+        if (node->type != ASTNodeType::CallExpr || !evaluator.isConstantExpr(node)) return;
+        // An argument call still standing already failed and was reported
+        for (auto& arg : node->children)
+            if (hasCall(arg)) return;
+
+        std::string call = ExprToString(node), why;
+        std::ostringstream out;
+        out << owner << ":" << node->line << ":" << node->col << ": ";
+        if (auto v = evaluator.evaluate(node, why)) {
+            out << "evaluated " << call << " = " << *v << " at compile time in " << evaluator.lastSteps() << " steps";
+            auto lit = std::make_shared<ASTNode>(ASTNodeType::Literal, node->line, node->col);
+            lit->value = std::to_string(*v);
+            node = lit;
+        } else {
+            std::cerr << "Warning: " << call << where(node) << " is evaluated at runtime: " << why << "\n";
+            out << call << " left to runtime: " << why;
+            node->attributes["runtime"] = ""; // already reported, the optimizer does not retry
+        }
+        remarks.push_back(out.str());
+    };
+    for (auto& child : program->children) {
+        owner = child && child->type == ASTNodeType::FunctionDecl ? child->name : "<global>";
+        fold(child);
+    }
+    return ok;
+}
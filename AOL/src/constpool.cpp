@@ -0,0 +1,141 @@
+#include <constpool.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+
+// Splits a literal into the source text of each byte it assembles to, an
+// escape is one unit. nullopt for an escape the assembler might read differently.
+static std::optional<std::vector<std::string>> byteUnits(const std::string& value) {
+    std::vector<std::string> units;
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] != '\\') {
+            units.emplace_back(1, value[i]);
+            continue;
+        }
+        if (i + 1 == value.size()) return std::nullopt;
+        // \0 before a digit could read as octal
+        char c = value[i + 1];
+        if (std::string("ntr0\\\"'").find(c) == std::string::npos || (c == '0' && i + 2 < value.size() && std::isdigit((unsigned char)value[i + 2])))
+            return std::nullopt;
+        units.push_back(value.substr(i, 2));
+        i += 1;
+    }
+    return units;
+}
+
+// The byte a unit assembles to
+static char unitByte(const std::string& unit) {
+    if (unit.size() == 1) return unit[0];
+    switch (unit[1]) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case '0': return '\0';
+        default: return unit[1]; // \\ \" \'
+    }
+}
+
+std::string ConstantPool::string(const std::string& value) {
+    references++;
+    naiveBytes += length(value).value_or(value.size()) + 1;
+    auto [it, added] = stringIds.emplace(value, strings.size());
+    if (added) strings.push_back({value, "str_" + std::to_string(strings.size()), strings.size()});
+    return strings[it->second].label;
+}
+
+std::optional<size_t> ConstantPool::length(const std::string& value) {
+    auto units = byteUnits(value);
+    if (!units) return std::nullopt;
+    return units->size();
+}
+
+std::string ConstantPool::bytes(const std::vector<uint8_t>& data, int align) {
+    references++;
+    naiveBytes += data.size();
+    std::string key = std::to_string(align) + ":" + std::string(data.begin(), data.end());
+    auto [it, added] = byteIds.emplace(key, byteEntries.size());
+    if (added) byteEntries.push_back({data, align, "__aol_vconst_" + std::to_string(byteEntries.size())});
+    return byteEntries[it->second].label;
+}
+
+void ConstantPool::emit(std::ostream& rodata) {
+    // Strings compare by the bytes they assemble to, so "a\n" ends "Hi a\n".
+    // One the assembler might read differently keeps its own entry.
+    std::vector<std::optional<std::vector<std::string>>> units;
+    std::vector<std::string> reversed;
+    for (auto& e : strings) {
+        units.push_back(byteUnits(e.value));
+        std::string bytes;
+        if (units.back())
+            for (auto& u : *units.back()) bytes += unitByte(u);
+        reversed.emplace_back(bytes.rbegin(), bytes.rend());
+    }
+
+    // Sorted by their reversed bytes every string comes right before the strings
+    // it is a suffix of, the longest of such a run holds the bytes for all of them
+    std::vector<size_t> order(strings.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return reversed[a] < reversed[b]; });
+    for (size_t k = order.size(); k-- > 0;) {
+        size_t i = order[k];
+        strings[i].host = i;
+        if (k + 1 == order.size()) continue;
+        size_t next = order[k + 1];
+        if (units[i] && units[next] && reversed[next].starts_with(reversed[i]))
+            strings[i].host = strings[next].host;
+    }
+
+    std::vector<std::vector<size_t>> members(strings.size());
+    for (size_t i = 0; i < strings.size(); ++i) members[strings[i].host].push_back(i);
+    for (size_t h = 0; h < strings.size(); ++h) {
+        if (members[h].empty()) continue;
+        auto& group = members[h];
+        if (!units[h]) {
+            rodata << "\t:align " << StringAlign << "\n";
+            rodata << "\t" << strings[h].label << "!ubyte[] = \"" << strings[h].value << "\", 0\n";
+            pooledBytes += strings[h].value.size() + 1;
+            continue;
+        }
+        const std::vector<std::string>& text = *units[h];
+        auto size = [&](size_t i) { return units[i]->size(); };
+        std::sort(group.begin(), group.end(), [&](size_t a, size_t b) { return size(a) > size(b); });
+
+        // One label per suffix, back to back so each runs on into the shared terminator
+        rodata << "\t:align " << StringAlign << "\n";
+        for (size_t m = 0; m < group.size(); ++m) {
+            size_t from = text.size() - size(group[m]);
+            size_t to = m + 1 < group.size() ? text.size() - size(group[m + 1]) : text.size();
+            std::string segment;
+            for (size_t u = from; u < to; ++u) segment += text[u];
+            rodata << "\t" << strings[group[m]].label << "!ubyte[] = ";
+            if (!segment.empty()) rodata << "\"" << segment << "\"";
+            if (m + 1 == group.size()) rodata << (segment.empty() ? "" : ", ") << "0";
+            rodata << "\n";
+        }
+        pooledBytes += text.size() + 1;
+        merged += group.size() - 1;
+    }
+
+    for (auto& e : byteEntries) {
+        rodata << "\t:align " << e.align << "\n\t" << e.label << "!ubyte[] = ";
+        for (size_t i = 0; i < e.data.size(); ++i) rodata << (i ? ", " : "") << (int)e.data[i];
+        rodata << "\n";
+        pooledBytes += e.data.size();
+    }
+}
+
+void ConstantPool::clear() {
+    *this = ConstantPool();
+}
+
+std::string ConstantPool::summary() const {
+    if (references == 0) return "";
+    std::ostringstream out;
+    out << "constant pool: " << references << " literals in " << strings.size() + byteEntries.size() - merged << " entries";
+    if (merged) out << " (" << merged << " strings tail-merged)";
+    out << ", .rodata " << naiveBytes << " -> " << pooledBytes << " bytes";
+    return out.str();
+}
@@ -0,0 +1,132 @@
+#include <compiler_amd64.hpp>
+#include <consteval.hpp>
+#include <algorithm>
+#include <iostream>
+#include <unordered_set>
+
+// Top-level variables. A constant initializer is laid out in .data, or in
+// .rodata when nothing ever assigns the variable, so lookup tables cost
+// nothing at startup. Variables without one start zeroed in .bss and the other
+// initializers run in source order in __aol_init_globals, called before main.
+// Every global is addressed through its label, there is no base register to set up.
+
+static std::string globalLabel(const std::string& name) {
+    return "__aol_g_" + name;
+}
+
+// Variables some statement may change: assignment targets, the root of an
+// assigned member, struct addresses handed out with & and asm operands
+static void collectWrites(const std::shared_ptr<ASTNode>& node, std::unordered_set<std::string>& written) {
+    if (!node) return;
+    auto root = [](std::shared_ptr<ASTNode> n) {
+        while (n && n->type == ASTNodeType::MemberExpr) n = n->children[0];
+        return n && n->type == ASTNodeType::Identifier ? n->name : std::string();
+    };
+    if (node->type == ASTNodeType::AssignExpr || (node->type == ASTNodeType::UnaryExpr && node->name == "&"))
+        written.insert(root(node->children[0]));
+    if (node->type == ASTNodeType::AsmStmt)
+        for (auto& operand : node->children) written.insert(root(operand));
+    for (auto& child : node->children) collectWrites(child, written);
+}
+
+static const char* dataKeyword(int bytes) {
+    switch (bytes) {
+        case 1: return "ubyte";
+        case 2: return "uword";
+        case 4: return "udword";
+        default: return "uqword";
+    }
+}
+
+// Lanes of v4i32(1, 2, 3, 4), v4i32(7) or a plain 7 splat, false unless all are constant
+static bool constantLanes(const std::shared_ptr<ASTNode>& init, const VectorType* type, ConstEvaluator& evaluator, std::vector<int64_t>& lanes) {
+    std::vector<std::shared_ptr<ASTNode>> args = {init};
+    if (init->type == ASTNodeType::CallExpr && FindVectorType(init->name) == type) args = init->children;
+    else if (init->type == ASTNodeType::CallExpr) return false;
+    if (args.size() != 1 && (int)args.size() != type->lanes) return false;
+    std::string why;
+    for (auto& arg : args) {
+        if (!evaluator.isConstantExpr(arg)) return false;
+        auto v = evaluator.evaluate(arg, why);
+        if (!v) return false;
+        lanes.push_back(*v);
+    }
+    if (lanes.size() == 1) lanes.assign(type->lanes, lanes[0]);
+    return true;
+}
+
+void Compiler_Amd64::layoutGlobals(const std::shared_ptr<ASTNode>& program) {
+    globalVars.clear();
+    globalInit = nullptr;
+    std::unordered_set<std::string> written;
+    collectWrites(program, written);
+
+    ConstEvaluator evaluator; // operators over literals, const fn calls are folded already
+    std::vector<std::shared_ptr<ASTNode>> init;
+    for (auto& node : program->children) {
+        // `const N = ...` is a named value, EvaluateConstCalls substituted every use
+        if (!node || node->type != ASTNodeType::VariableDecl || node->attributes.count("const")) continue;
+        auto where = " at line " + std::to_string(node->line) + " col " + std::to_string(node->col) + "\n";
+        if (std::any_of(globalVars.begin(), globalVars.end(), [&](const VariableInfo& g) { return g.name == node->name; })) {
+            std::cerr << "Error: Global '" << node->name << "' is already defined" << where;
+            continue;
+        }
+
+        VariableInfo var;
+        var.name = node->name;
+        var.offset = 0;
+        var.type = node->typeName;
+        var.label = globalLabel(node->name);
+        auto value = node->children.empty() ? nullptr : node->children[0];
+        int align = 8;
+        const VectorType* vt = FindVectorType(node->typeName);
+        if (const StructType* st = FindStructType(node->typeName)) {
+            if (value) {
+                std::cerr << "Error: Struct '" << node->name << "' can't have an initializer" << where;
+                value = nullptr;
+            }
+            var.size = st->size;
+            align = st->align;
+        } else if (vt) {
+            var.size = vt->bytes();
+            align = 32;
+        } else if (!node->typeName.empty() && !IsScalarType(node->typeName)) {
+            std::cerr << "Error: Unknown type '" << node->typeName << "'" << where;
+            continue;
+        } else {
+            const IntegerType* it = FindIntegerType(node->typeName);
+            var.size = align = it ? it->bytes : 8;
+        }
+        globalVars.push_back(var);
+
+        std::ostringstream* section = written.count(node->name) ? &data : &rodata;
+        std::string why;
+        std::vector<int64_t> lanes;
+        if (!value) {
+            bss << "\t:align " << align << "\n\t:res " << var.label << "!ubyte[" << var.size << "]\n";
+        } else if (vt && constantLanes(value, vt, evaluator, lanes)) {
+            *section << "\t:align " << align << "\n";
+            std::vector<uint8_t> bytes = VectorBytes(vt, lanes);
+            EmitBytes(*section, var.label, std::string(bytes.begin(), bytes.end()), false);
+        } else if (!vt && evaluator.isConstantExpr(value)) {
+            auto v = evaluator.evaluate(value, why);
+            if (!v) {
+                std::cerr << "Error: Initializer of '" << node->name << "' can't be computed: " << why << where;
+                continue;
+            }
+            const IntegerType* it = FindIntegerType(node->typeName);
+            *section << "\t:align " << align << "\n\t" << var.label << "!" << dataKeyword(var.size) << "[] = " << (it ? WrapInteger(it, *v) : *v) << "\n";
+        } else {
+            // Zeroed until __aol_init_globals stores the value
+            bss << "\t:align " << align << "\n\t:res " << var.label << "!ubyte[" << var.size << "]\n";
+            auto target = std::make_shared<ASTNode>(ASTNodeType::Identifier, node->line, node->col, node->name);
+            auto assign = std::make_shared<ASTNode>(ASTNodeType::AssignExpr, node->line, node->col, "=");
+            assign->children = {target, value};
+            init.push_back(assign);
+        }
+    }
+
+    if (init.empty()) return;
+    globalInit = std::make_shared<ASTNode>(ASTNodeType::FunctionDecl, program->line, program->col, "__aol_init_globals");
+    globalInit->children = init;
+}
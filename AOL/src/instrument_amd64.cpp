@@ -0,0 +1,298 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+
+// --instrument=functions: hooked functions call __aol_instr_enter (hook index
+// in %r11) after the prologue and __aol_instr_leave before the epilogue. They
+// keep a shadow stack of open frames and a calling context tree in .bss:
+//
+//   frame (32 bytes): context node, rdtsc at entry, cycles of finished callees, hook index
+//   node (40 bytes):  hook index, parent, first child, next sibling, self cycles
+//   function (32 bytes): calls, self cycles, inclusive cycles, open frames
+//
+// Inclusive cycles are only added when the outermost frame of a function
+// closes, so recursion isn't counted twice. Frames deeper than MaxFrames and
+// contexts beyond MaxNodes are charged to the caller. __aol_instr_dump closes
+// what is still open, prints the report sorted by self cycles and one
+// "main;f;g <self cycles>" line per context, the flame graph collapsed format.
+static const int MaxFrames = 4096;
+static const int MaxNodes = 16384;
+
+// A hooked call costs around 100 cycles, functions smaller than this and
+// without loops get no hooks and their cycles count as the caller's
+static const int SmallNodeLimit = 32;
+
+static bool containsLoop(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return false;
+    if (node->type == ASTNodeType::WhileStmt || node->type == ASTNodeType::ForStmt) return true;
+    for (auto& c : node->children)
+        if (containsLoop(c)) return true;
+    return false;
+}
+
+static int countNodes(const std::shared_ptr<ASTNode>& node, int limit) {
+    if (!node) return 0;
+    int n = 1;
+    for (auto& p : node->params) n += countNodes(p, limit - n);
+    for (auto& c : node->children) {
+        if (n >= limit) break;
+        n += countNodes(c, limit - n);
+    }
+    return n;
+}
+
+std::string Compiler_Amd64::instrumentEnter(const std::shared_ptr<ASTNode>& fn) {
+    if (options.instrumentReport.empty() || fn->attributes.count("noinstrument")) return "";
+    bool forced = fn->name == "main" || fn->attributes.count("instrument");
+    if (!forced && !containsLoop(fn) && countNodes(fn, SmallNodeLimit) < SmallNodeLimit) return "";
+    hookedFunctions.push_back(fn->name);
+    return "\tmov %r11, " + std::to_string(hookedFunctions.size() - 1) + "\n\tcall __aol_instr_enter\n";
+}
+
+static std::string readTsc(const std::string& reg) {
+    std::string out = "\trdtsc\n\tshl %rdx, 32\n\tor %rax, %rdx\n";
+    if (reg != "%rax") out += "\tmov " + reg + ", %rax\n";
+    return out;
+}
+
+// Writes the bytes at label, %rdi and %rsi are lost like in every __aol_write call
+static std::string writeBytes(const std::string& label, size_t len) {
+    return "\tlea %rdi, [" + label + "]\n\tmov %rsi, " + std::to_string(len) + "\n\tcall __aol_write\n";
+}
+
+static std::string writeNumber(const std::string& value, int width) {
+    return "\tmov %rdi, " + value + "\n\tmov %rsi, " + std::to_string(width) + "\n\tcall __aol_instr_num__\n";
+}
+
+std::string Compiler_Amd64::compileInstrumentRuntime() {
+    size_t functionCount = hookedFunctions.size();
+    std::string names;
+    std::ostringstream offsets;
+    for (auto& name : hookedFunctions) {
+        offsets << names.size() << ", ";
+        names += name;
+    }
+    offsets << names.size();
+
+    bss << "\t:align 8\n";
+    bss << "\t:res __aol_instr_frames!uqword[" << 4 * MaxFrames << "]\n";
+    bss << "\t:res __aol_instr_nodes!uqword[" << 5 * MaxNodes << "]\n";
+    bss << "\t:res __aol_instr_fn!uqword[" << 4 * std::max<size_t>(functionCount, 1) << "]\n";
+    bss << "\t:res __aol_instr_sp!uqword\n";
+    bss << "\t:res __aol_instr_free!uqword\n";
+    bss << "\t:res __aol_instr_dropped!uqword\n";
+    bss << "\t:res __aol_instr_start!uqword\n";
+    rodata << "\t:align 8\n\t__aol_instr_name_at!uqword[] = " << offsets.str() << "\n";
+    EmitBytes(rodata, "__aol_instr_names", names, true);
+    EmitBytes(rodata, "__aol_instr_report", options.instrumentReport, true);
+    EmitBytes(rodata, "__aol_instr_stacks", options.instrumentStacks, true);
+    std::string head = "# cycles per function from rdtsc, ";
+    std::string columns = " in total\n"
+                          "# functions under " + std::to_string(SmallNodeLimit) + " nodes without loops have no hooks, their cycles count for their caller\n"
+                          "#    calls            self  self%       inclusive  incl%  function\n";
+    EmitBytes(rodata, "__aol_instr_head", head, false);
+    EmitBytes(rodata, "__aol_instr_columns", columns, false);
+    EmitBytes(rodata, "__aol_instr_punct", "  .;", false);
+
+    std::ostringstream out;
+
+    // __aol_instr_init(): empty shadow stack, the root context and the start time
+    out << "__aol_instr_init:\n";
+    out << "\tlea %rax, [__aol_instr_frames]\n\tmov [__aol_instr_sp], %rax\n";
+    out << "\tlea %rax, [__aol_instr_nodes + 40]\n\tmov [__aol_instr_free], %rax\n";
+    out << readTsc("%rax");
+    out << "\tmov [__aol_instr_start], %rax\n\tret\n\n";
+
+    // __aol_instr_enter(%r11 = hook index): only %rax, %r10 and %r11 are lost,
+    // the argument registers are still live
+    out << "__aol_instr_enter:\n";
+    out << "\tpush %rcx\n\tpush %rdx\n";
+    out << "\tmov %r10, [__aol_instr_sp]\n";
+    out << "\tlea %rcx, " << MemOperand("__aol_instr_frames", 32 * MaxFrames) << "\n";
+    out << "\tcmp %r10, %rcx\n\tjae __aol_instr_deep__\n";
+    out << "\tlea %rdx, [__aol_instr_nodes]\n"; // the caller's context, the root below main
+    out << "\tlea %rcx, [__aol_instr_frames]\n";
+    out << "\tcmp %r10, %rcx\n\tje __aol_instr_find__\n";
+    out << "\tmov %rdx, [%r10 - 32]\n";
+    out << "__aol_instr_find__:\n";
+    out << "\tmov %rcx, [%rdx + 16]\n";
+    out << "__aol_instr_scan__:\n";
+    out << "\ttest %rcx, %rcx\n\tjz __aol_instr_new__\n";
+    out << "\tcmp [%rcx], %r11\n\tje __aol_instr_push__\n";
+    out << "\tmov %rcx, [%rcx + 24]\n\tjmp __aol_instr_scan__\n";
+    out << "__aol_instr_new__:\n";
+    out << "\tmov %rcx, %rdx\n"; // out of nodes: stay in the caller's context
+    out << "\tmov %rax, [__aol_instr_free]\n";
+    out << "\tlea %r10, " << MemOperand("__aol_instr_nodes", 40 * MaxNodes) << "\n";
+    out << "\tcmp %rax, %r10\n\tjae __aol_instr_reload__\n";
+    out << "\tmov %rcx, %rax\n\tadd %rax, 40\n\tmov [__aol_instr_free], %rax\n";
+    out << "\tmov [%rcx], %r11\n\tmov [%rcx + 8], %rdx\n";
+    out << "\tmov %rax, [%rdx + 16]\n\tmov [%rcx + 24], %rax\n\tmov [%rdx + 16], %rcx\n";
+    out << "__aol_instr_reload__:\n";
+    out << "\tmov %r10, [__aol_instr_sp]\n";
+    out << "__aol_instr_push__:\n";
+    out << "\tmov [%r10], %rcx\n\tmov [%r10 + 24], %r11\n";
+    out << "\txor %rax, %rax\n\tmov [%r10 + 16], %rax\n";
+    out << "\tshl %r11, 5\n\tlea %rcx, [__aol_instr_fn]\n\tadd [%rcx + %r11 + 24], 1\n";
+    out << "\tadd %r10, 32\n\tmov [__aol_instr_sp], %r10\n";
+    out << readTsc("%rax"); // last, so the hook itself is the caller's time
+    out << "\tmov [%r10 - 24], %rax\n";
+    out << "\tpop %rdx\n\tpop %rcx\n\tret\n";
+    out << "__aol_instr_deep__:\n";
+    out << "\tadd [__aol_instr_dropped], 1\n";
+    out << "\tpop %rdx\n\tpop %rcx\n\tret\n\n";
+
+    // __aol_instr_leave(): keeps %rax, the return value, only %rdx, %r10 and %r11 are lost
+    out << "__aol_instr_leave:\n";
+    out << "\tpush %rax\n\tpush %rcx\n";
+    out << "\tmov %r10, [__aol_instr_dropped]\n";
+    out << "\ttest %r10, %r10\n\tjnz __aol_instr_shallow__\n";
+    out << readTsc("%rax");
+    out << "\tmov %r10, [__aol_instr_sp]\n\tsub %r10, 32\n\tmov [__aol_instr_sp], %r10\n";
+    out << "\tsub %rax, [%r10 + 8]\n"; // inclusive cycles of the frame
+    out << "\tmov %rdx, %rax\n\tsub %rdx, [%r10 + 16]\n"; // self cycles
+    out << "\tmov %rcx, [%r10]\n\tadd [%rcx + 32], %rdx\n";
+    out << "\tmov %r11, [%r10 + 24]\n\tshl %r11, 5\n";
+    out << "\tlea %rcx, [__aol_instr_fn]\n\tadd %rcx, %r11\n";
+    out << "\tadd [%rcx], 1\n\tadd [%rcx + 8], %rdx\n";
+    out << "\tsub [%rcx + 24], 1\n\tjnz __aol_instr_nested__\n";
+    out << "\tadd [%rcx + 16], %rax\n";
+    out << "__aol_instr_nested__:\n";
+    out << "\tlea %rcx, [__aol_instr_frames]\n";
+    out << "\tcmp %r10, %rcx\n\tje __aol_instr_left__\n";
+    out << "\tadd [%r10 - 16], %rax\n"; // the caller's finished callees
+    out << "__aol_instr_left__:\n";
+    out << "\tpop %rcx\n\tpop %rax\n\tret\n";
+    out << "__aol_instr_shallow__:\n";
+    out << "\tdec %r10\n\tmov [__aol_instr_dropped], %r10\n\tjmp __aol_instr_left__\n\n";
+
+    // __aol_instr_dump(): called from __aol_exit, report and stacks are printed
+    // through the stdout buffer. %r15 holds the total for __aol_instr_pct__.
+    out << "__aol_instr_dump:\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tpush %r14\n\tpush %r15\n";
+    out << "__aol_instr_unwind__:\n"; // frames still open when exit was called
+    out << "\tmov %rax, [__aol_instr_sp]\n\tlea %rcx, [__aol_instr_frames]\n";
+    out << "\tcmp %rax, %rcx\n\tjbe __aol_instr_closed__\n";
+    out << "\tcall __aol_instr_leave\n\tjmp __aol_instr_unwind__\n";
+    out << "__aol_instr_closed__:\n";
+    out << readTsc("%r15");
+    out << "\tsub %r15, [__aol_instr_start]\n";
+    out << "\tjnz __aol_instr_timed__\n\tinc %r15\n";
+    out << "__aol_instr_timed__:\n";
+    out << "\tcall __aol_flush\n";
+
+    out << "\tlea %rdi, [__aol_instr_report]\n\tcall __aol_instr_open__\n";
+    out << "\tjs __aol_instr_stacks__\n";
+    out << writeBytes("__aol_instr_head", head.size());
+    out << writeNumber("%r15", 0);
+    out << writeBytes("__aol_instr_columns", columns.size());
+    // Selection by self cycles, a printed function gets its open frame count set to 1
+    out << "__aol_instr_pick__:\n";
+    out << "\tmov %r13, -1\n\txor %r14, %r14\n\txor %rbx, %rbx\n";
+    out << "__aol_instr_pick_scan__:\n";
+    out << "\tcmp %rbx, " << functionCount << "\n\tjae __aol_instr_picked__\n";
+    out << "\tmov %rcx, %rbx\n\tshl %rcx, 5\n\tlea %rax, [__aol_instr_fn]\n\tadd %rcx, %rax\n";
+    out << "\tmov %rax, [%rcx]\n\ttest %rax, %rax\n\tjz __aol_instr_pick_next__\n";
+    out << "\tmov %rax, [%rcx + 24]\n\ttest %rax, %rax\n\tjnz __aol_instr_pick_next__\n";
+    out << "\tmov %rax, [%rcx + 8]\n";
+    out << "\tcmp %r13, -1\n\tje __aol_instr_pick_take__\n";
+    out << "\tcmp %rax, %r14\n\tjbe __aol_instr_pick_next__\n";
+    out << "__aol_instr_pick_take__:\n";
+    out << "\tmov %r13, %rbx\n\tmov %r14, %rax\n";
+    out << "__aol_instr_pick_next__:\n";
+    out << "\tinc %rbx\n\tjmp __aol_instr_pick_scan__\n";
+    out << "__aol_instr_picked__:\n";
+    out << "\tcmp %r13, -1\n\tje __aol_instr_reported__\n";
+    out << "\tmov %rbx, %r13\n\tshl %rbx, 5\n\tlea %rax, [__aol_instr_fn]\n\tadd %rbx, %rax\n";
+    out << "\tmov %rax, 1\n\tmov [%rbx + 24], %rax\n";
+    out << writeNumber("[%rbx]", 10);
+    out << writeNumber("[%rbx + 8]", 16);
+    out << "\tmov %rdi, [%rbx + 8]\n\tcall __aol_instr_pct__\n";
+    out << writeNumber("[%rbx + 16]", 16);
+    out << "\tmov %rdi, [%rbx + 16]\n\tcall __aol_instr_pct__\n";
+    out << writeBytes("__aol_instr_punct", 2);
+    out << "\tmov %rdi, %r13\n\tcall __aol_instr_name__\n";
+    out << writeBytes("__aol_newline", 1);
+    out << "\tjmp __aol_instr_pick__\n";
+    out << "__aol_instr_reported__:\n";
+    out << "\tcall __aol_instr_close__\n";
+
+    out << "__aol_instr_stacks__:\n";
+    out << "\tlea %rdi, [__aol_instr_stacks]\n\tcall __aol_instr_open__\n";
+    out << "\tjs __aol_instr_dumped__\n";
+    out << "\tlea %rbx, [__aol_instr_nodes + 40]\n";
+    out << "__aol_instr_context__:\n";
+    out << "\tcmp %rbx, [__aol_instr_free]\n\tjae __aol_instr_contexts_done__\n";
+    out << "\tmov %rax, [%rbx + 32]\n\ttest %rax, %rax\n\tjz __aol_instr_context_next__\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_instr_path__\n";
+    out << writeBytes("__aol_instr_punct", 1);
+    out << writeNumber("[%rbx + 32]", 0);
+    out << writeBytes("__aol_newline", 1);
+    out << "__aol_instr_context_next__:\n";
+    out << "\tadd %rbx, 40\n\tjmp __aol_instr_context__\n";
+    out << "__aol_instr_contexts_done__:\n";
+    out << "\tcall __aol_instr_close__\n";
+    out << "__aol_instr_dumped__:\n";
+    out << "\tpop %r15\n\tpop %r14\n\tpop %r13\n\tpop %r12\n\tpop %rbx\n\tret\n\n";
+
+    // open(%rdi) for writing and point stdout at it, sign flag set on failure
+    out << "__aol_instr_open__:\n";
+    out << "\tmov %rax, 2\n\tmov %rsi, 577\n\tmov %rdx, 420\n\tsyscall\n"; // O_WRONLY | O_CREAT | O_TRUNC, 0644
+    out << "\ttest %rax, %rax\n\tjs __aol_instr_opened__\n";
+    out << "\tmov [__aol_stdout_fd], %rax\n";
+    out << "__aol_instr_opened__:\n";
+    out << "\tret\n\n";
+
+    // flush into the file, close it and give stdout back
+    out << "__aol_instr_close__:\n";
+    out << "\tcall __aol_flush\n";
+    out << "\tmov %rdi, [__aol_stdout_fd]\n\tmov %rax, 3\n\tsyscall\n";
+    out << "\tmov %rax, 1\n\tmov [__aol_stdout_fd], %rax\n\tret\n\n";
+
+    // __aol_instr_num__(value, width): unsigned decimal, right-aligned in width columns
+    out << "__aol_instr_num__:\n";
+    out << "\tsub %rsp, 40\n";
+    out << "\tlea %r8, [%rsp + 32]\n";
+    out << "\tmov %rax, %rdi\n\tmov %rcx, 10\n";
+    out << "__aol_instr_digit__:\n";
+    out << "\txor %rdx, %rdx\n\tdiv %rcx\n";
+    out << "\tadd %dl, 48\n\tdec %r8\n\tmov [%r8], %dl\n";
+    out << "\ttest %rax, %rax\n\tjnz __aol_instr_digit__\n";
+    out << "\tlea %rax, [%rsp + 32]\n\tsub %rax, %rsi\n\tmov %dl, 32\n";
+    out << "__aol_instr_pad__:\n";
+    out << "\tcmp %r8, %rax\n\tjbe __aol_instr_padded__\n";
+    out << "\tdec %r8\n\tmov [%r8], %dl\n\tjmp __aol_instr_pad__\n";
+    out << "__aol_instr_padded__:\n";
+    out << "\tlea %rsi, [%rsp + 32]\n\tsub %rsi, %r8\n\tmov %rdi, %r8\n";
+    out << "\tcall __aol_write\n";
+    out << "\tadd %rsp, 40\n\tret\n\n";
+
+    // __aol_instr_pct__(cycles): share of the total in %r15 as " ddd.d"
+    out << "__aol_instr_pct__:\n";
+    out << "\tcmp %rdi, %r15\n\tjbe __aol_instr_pct_in__\n\tmov %rdi, %r15\n";
+    out << "__aol_instr_pct_in__:\n";
+    out << "\tmov %rax, %rdi\n\tmov %rcx, 1000\n\tmul %rcx\n\tdiv %r15\n";
+    out << "\txor %rdx, %rdx\n\tmov %rcx, 10\n\tdiv %rcx\n";
+    out << "\tpush %rdx\n";
+    out << writeNumber("%rax", 5);
+    out << "\tlea %rdi, [__aol_instr_punct + 2]\n\tmov %rsi, 1\n\tcall __aol_write\n";
+    out << "\tpop %rdi\n\tmov %rsi, 1\n\tjmp __aol_instr_num__\n\n";
+
+    // __aol_instr_path__(node): "main;f;g", the root context has no name
+    out << "__aol_instr_path__:\n";
+    out << "\tpush %rbx\n\tmov %rbx, %rdi\n";
+    out << "\tmov %rdi, [%rbx + 8]\n\tlea %rax, [__aol_instr_nodes]\n";
+    out << "\tcmp %rdi, %rax\n\tje __aol_instr_path_name__\n";
+    out << "\tcall __aol_instr_path__\n";
+    out << "\tlea %rdi, [__aol_instr_punct + 3]\n\tmov %rsi, 1\n\tcall __aol_write\n";
+    out << "__aol_instr_path_name__:\n";
+    out << "\tmov %rdi, [%rbx]\n\tpop %rbx\n";
+    out << "\tjmp __aol_instr_name__\n\n";
+
+    // __aol_instr_name__(hook index)
+    out << "__aol_instr_name__:\n";
+    out << "\tlea %rcx, [__aol_instr_name_at]\n";
+    out << "\tmov %rax, [%rcx + %rdi*8]\n\tmov %rsi, [%rcx + %rdi*8 + 8]\n\tsub %rsi, %rax\n";
+    out << "\tlea %rdi, [__aol_instr_names]\n\tadd %rdi, %rax\n";
+    out << "\tjmp __aol_write\n\n";
+    return out.str();
+}
@@ -0,0 +1,288 @@
+#include <compiler_amd64.hpp>
+#include <bits.hpp>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
+// Interprocedural register allocation. Functions are compiled callees first and
+// the caller-saved registers each one's code touches become its summary. An
+// expression then keeps a pending value in a register none of the calls it
+// still has to make can change, instead of on the stack. Functions only AOL
+// code can reach also take two more arguments in registers.
+
+const std::vector<std::string> SysVArgRegs = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+const std::vector<std::string> InternalArgRegs = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9", "%r10", "%r11"};
+
+static uint32_t bit(const std::string& reg) {
+    return 1u << RegisterIndex(reg);
+}
+
+static uint32_t mask(std::initializer_list<const char*> regs) {
+    uint32_t m = 0;
+    for (const char* reg : regs) m |= bit(reg);
+    return m;
+}
+
+static const uint32_t CallerSaved = mask({"%rax", "%rcx", "%rdx", "%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11"});
+
+// What expression code touches without making a call: the accumulator, %rcx and
+// %rdx for a second operand and division, %r8 and %r9 in the bit built-ins
+static const uint32_t ExprScratch = mask({"%rax", "%rcx", "%rdx", "%r8", "%r9"});
+
+// Where a pending value may wait, none of them is expression scratch
+static const std::vector<std::string> HoldRegs = {"%r11", "%r10", "%rsi", "%rdi"};
+
+int RegisterIndex(const std::string& reg) {
+    static const std::unordered_map<std::string, int> names = [] {
+        std::unordered_map<std::string, int> m;
+        const char* legacy[8][4] = {
+            {"rax", "eax", "ax", "al"}, {"rcx", "ecx", "cx", "cl"}, {"rdx", "edx", "dx", "dl"}, {"rbx", "ebx", "bx", "bl"},
+            {"rsp", "esp", "sp", "spl"}, {"rbp", "ebp", "bp", "bpl"}, {"rsi", "esi", "si", "sil"}, {"rdi", "edi", "di", "dil"},
+        };
+        for (int i = 0; i < 8; ++i)
+            for (const char* name : legacy[i]) m[std::string("%") + name] = i;
+        m["%ah"] = 0, m["%ch"] = 1, m["%dh"] = 2, m["%bh"] = 3;
+        for (int i = 8; i < 16; ++i)
+            for (const char* suffix : {"", "d", "w", "b"}) m["%r" + std::to_string(i) + suffix] = i;
+        return m;
+    }();
+    auto it = names.find(reg);
+    return it == names.end() ? -1 : it->second;
+}
+
+const std::vector<std::string>& Compiler_Amd64::argRegisters(const FunctionSymbol& fn) const {
+    return fn.internalConv ? InternalArgRegs : SysVArgRegs;
+}
+
+static void collectCalls(const std::shared_ptr<ASTNode>& node, std::vector<std::string>& calls, std::vector<std::string>& asmText) {
+    if (!node) return;
+    if (node->type == ASTNodeType::CallExpr) calls.push_back(node->name);
+    if (node->type == ASTNodeType::AsmStmt) asmText.push_back(node->value);
+    for (auto& child : node->children) collectCalls(child, calls, asmText);
+}
+
+static void collectNames(const std::shared_ptr<ASTNode>& node, std::unordered_set<std::string>& names) {
+    if (!node) return;
+    if (node->type == ASTNodeType::Identifier) names.insert(node->name);
+    for (auto& child : node->children) collectNames(child, names);
+}
+
+static bool mentions(const std::string& text, const std::string& name) {
+    for (size_t at = text.find(name); at != std::string::npos; at = text.find(name, at + 1)) {
+        auto word = [](char c) { return std::isalnum((unsigned char)c) || c == '_'; };
+        if ((at == 0 || !word(text[at - 1])) && (at + name.size() == text.size() || !word(text[at + name.size()]))) return true;
+    }
+    return false;
+}
+
+// main is called by the runtime, a module's functions by whoever links it, a
+// function an asm block names or whose address is taken by code that expects
+// the System V registers and a coroutine by whatever resumes it
+void Compiler_Amd64::assignConventions(const std::shared_ptr<ASTNode>& program) {
+    std::vector<std::string> calls, asmText;
+    std::unordered_set<std::string> names;
+    collectCalls(program, calls, asmText);
+    collectNames(program, names);
+    for (auto& [name, fn] : functions) {
+        fn.internalConv = fn.symbol.empty() && name != "main" && !options.module && !fn.coroutine && !names.count(name);
+        for (auto& text : asmText)
+            if (fn.internalConv && mentions(text, name)) fn.internalConv = false;
+    }
+}
+
+// Tarjan's algorithm, it finishes a strongly connected component only after
+// every component it calls into, roots in source order
+std::vector<std::vector<std::shared_ptr<ASTNode>>> Compiler_Amd64::callGraphOrder(const std::shared_ptr<ASTNode>& program) {
+    std::vector<std::shared_ptr<ASTNode>> decls;
+    std::unordered_map<std::string, size_t> index;
+    for (auto& child : program->children) {
+        if (!child || child->type != ASTNodeType::FunctionDecl || child->attributes.count("extern")) continue;
+        if (index.emplace(child->name, decls.size()).second) decls.push_back(child);
+    }
+    std::vector<std::vector<size_t>> edges(decls.size());
+    for (size_t i = 0; i < decls.size(); ++i) {
+        std::vector<std::string> calls, asmText;
+        for (auto& stmt : decls[i]->children) collectCalls(stmt, calls, asmText);
+        for (auto& name : calls) {
+            auto callee = index.find(name);
+            if (callee != index.end()) edges[i].push_back(callee->second);
+        }
+    }
+
+    std::vector<std::vector<std::shared_ptr<ASTNode>>> order;
+    std::vector<int> number(decls.size(), -1), low(decls.size());
+    std::vector<bool> onStack(decls.size());
+    std::vector<size_t> stack;
+    int counter = 0;
+    std::function<void(size_t)> visit = [&](size_t v) {
+        number[v] = low[v] = counter++;
+        stack.push_back(v);
+        onStack[v] = true;
+        for (size_t w : edges[v]) {
+            if (number[w] < 0) {
+                visit(w);
+                low[v] = std::min(low[v], low[w]);
+            } else if (onStack[w]) {
+                low[v] = std::min(low[v], number[w]);
+            }
+        }
+        if (low[v] != number[v]) return;
+        std::vector<std::shared_ptr<ASTNode>> scc;
+        size_t w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            onStack[w] = false;
+            scc.push_back(decls[w]);
+        } while (w != v);
+        std::reverse(scc.begin(), scc.end());
+        order.push_back(scc);
+    };
+    for (size_t v = 0; v < decls.size(); ++v)
+        if (number[v] < 0) visit(v);
+
+    // Everything else emits no code or repeats a name, compile it after as before
+    std::unordered_set<ASTNode*> placed;
+    for (auto& decl : decls) placed.insert(decl.get());
+    for (auto& child : program->children)
+        if (child && !placed.count(child.get())) order.push_back({child});
+    return order;
+}
+
+// Every register the code names or an instruction uses implicitly. Calls into
+// the component itself add nothing, the union covers them.
+void Compiler_Amd64::summarize(const std::vector<std::shared_ptr<ASTNode>>& scc, const std::vector<std::string>& code) {
+    std::unordered_set<std::string> members;
+    for (auto& fn : scc)
+        if (fn->type == ASTNodeType::FunctionDecl && !fn->attributes.count("extern")) members.insert(fn->name);
+    if (members.empty()) return;
+
+    uint32_t used = 0;
+    std::vector<std::string> calls, asmText;
+    for (auto& fn : scc) collectCalls(fn, calls, asmText);
+    if (!asmText.empty()) used = CallerSaved; // an asm block may use registers it doesn't name
+
+    for (auto& text : code) {
+        std::istringstream lines(text);
+        for (std::string line; std::getline(lines, line);) {
+            std::istringstream words(line);
+            std::string op, rest;
+            words >> op;
+            std::getline(words, rest);
+            if (op.empty() || op[0] == '.' || op.back() == ':' || op.rfind("//", 0) == 0) continue;
+            if ((op == "call" || op == "jmp") && rest.find_first_not_of(' ') != std::string::npos) {
+                std::string targetName = rest.substr(rest.find_first_not_of(' '));
+                if (targetName[0] == '$') {
+                    std::string callee = targetName.substr(1);
+                    auto fn = functions.find(callee);
+                    if (!members.count(callee)) used |= fn != functions.end() && fn->second.summarized ? fn->second.clobbers : CallerSaved;
+                } else if (targetName == "__aol_instr_enter") {
+                    used |= mask({"%rax", "%r10", "%r11"});
+                } else if (targetName == "__aol_instr_leave") {
+                    used |= mask({"%rdx", "%r10", "%r11"});
+                } else if (op == "call") {
+                    used |= CallerSaved; // runtime routines follow the ABI
+                }
+                continue;
+            }
+            if (op == "cqo" || op == "div" || op == "idiv" || op == "mul" || (op == "imul" && rest.find(',') == std::string::npos))
+                used |= mask({"%rax", "%rdx"});
+            if (op == "syscall") used |= mask({"%rax", "%rcx", "%r11"});
+            if (op.rfind("rep", 0) == 0) used |= mask({"%rcx", "%rsi", "%rdi"});
+            for (size_t at = rest.find('%'); at != std::string::npos; at = rest.find('%', at + 1)) {
+                size_t end = at + 1;
+                while (end < rest.size() && std::isalnum((unsigned char)rest[end])) end++;
+                int reg = RegisterIndex(rest.substr(at, end - at));
+                if (reg >= 0) used |= 1u << reg;
+            }
+        }
+    }
+    for (auto& name : members) {
+        functions[name].clobbers = used & CallerSaved; // the rest is restored before ret
+        functions[name].summarized = true;
+    }
+}
+
+uint32_t Compiler_Amd64::callClobbers(const std::shared_ptr<ASTNode>& call) {
+    auto fn = functions.find(call->name);
+    if (fn == functions.end()) return IsBitBuiltin(call->name) || isVectorBuiltin(call->name) || isAtomicBuiltin(call->name) ? ExprScratch : CallerSaved;
+    uint32_t lost = fn->second.summarized ? fn->second.clobbers : CallerSaved;
+    auto& regs = argRegisters(fn->second);
+    for (size_t i = 0; i < call->children.size() + 1 && i < regs.size(); ++i) lost |= bit(regs[i]); // +1 for print's length
+    return lost;
+}
+
+uint32_t Compiler_Amd64::exprClobbers(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return 0;
+    if (node->type == ASTNodeType::Literal || node->type == ASTNodeType::Identifier) return bit("%rax");
+    uint32_t lost = ExprScratch;
+    if (node->type == ASTNodeType::CallExpr) lost |= callClobbers(node);
+    if (node->type == ASTNodeType::UnaryExpr && node->name == "await") return CallerSaved; // runs name__new and the resume function
+    for (auto& child : node->children) lost |= exprClobbers(child);
+    return lost;
+}
+
+std::string Compiler_Amd64::holdRegister(const std::shared_ptr<ASTNode>& node) {
+    if (!options.ipra) return "";
+    uint32_t busy = heldRegs | exprClobbers(node);
+    for (auto& reg : HoldRegs)
+        if (!(busy & bit(reg))) return reg;
+    return "";
+}
+
+std::string Compiler_Amd64::compileSecondOperand(const std::shared_ptr<ASTNode>& rhs) {
+    std::ostringstream out;
+    std::string hold = holdRegister(rhs);
+    if (hold.empty()) {
+        out << push("%rax");
+        out << compileExpression(rhs, "%rax");
+        out << "\tmov %rcx, %rax\n";
+        out << pop("%rax");
+        return out.str();
+    }
+    heldRegs |= bit(hold);
+    heldValues++;
+    out << "\tmov " << hold << ", %rax\n";
+    out << compileExpression(rhs, "%rcx");
+    out << "\tmov %rax, " << hold << "\n";
+    heldRegs &= ~bit(hold);
+    return out.str();
+}
+
+// Left to right, each value goes straight to its register when the arguments
+// after it leave that register alone, the others wait on the stack
+std::string Compiler_Amd64::compileArgRegisters(const std::vector<std::shared_ptr<ASTNode>>& args, const std::vector<std::string>& regs) {
+    std::ostringstream out;
+    std::vector<uint32_t> later(args.size() + 1, 0);
+    for (size_t i = args.size(); i-- > 0;) later[i] = later[i + 1] | exprClobbers(args[i]);
+
+    uint32_t outer = heldRegs;
+    std::vector<size_t> pushed;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (options.ipra && !((later[i + 1] | heldRegs) & bit(regs[i]))) {
+            out << compileExpression(args[i], regs[i]);
+            heldRegs |= bit(regs[i]);
+            heldValues++;
+        } else {
+            out << compileExpression(args[i], "%rax");
+            out << push("%rax");
+            pushed.push_back(i);
+        }
+    }
+    for (auto it = pushed.rbegin(); it != pushed.rend(); ++it) out << pop(regs[*it]);
+    heldRegs = outer;
+    return out.str();
+}
+
+std::string Compiler_Amd64::ipraSummary() const {
+    if (!options.ipra) return "";
+    size_t internal = 0, total = 0;
+    for (auto& [name, fn] : functions) {
+        if (!fn.symbol.empty()) continue;
+        total++;
+        if (fn.internalConv) internal++;
+    }
+    return "ipra: " + std::to_string(internal) + " of " + std::to_string(total) + " functions use the internal convention, " +
+           std::to_string(heldValues) + " values kept in registers instead of the stack";
+}
@@ -0,0 +1,556 @@
+#include <isel.hpp>
+#include <compiler_amd64.hpp>
+
+#include <climits>
+#include <ostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+typedef unsigned __int128 u128;
+typedef __int128 i128;
+
+static int log2Exact(uint64_t v) {
+    return v && !(v & (v - 1)) ? __builtin_ctzll(v) : -1;
+}
+
+static bool fitsImm32(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// and/imul take at most a sign-extended imm32, anything wider goes through %rdx
+static std::string withImm(const std::string& instr, int64_t v) {
+    if (fitsImm32(v)) return "\t" + instr + " %rax, " + (instr == "imul" ? "%rax, " : "") + std::to_string(v) + "\n";
+    return "\tmov %rdx, " + std::to_string(v) + "\n\t" + instr + " %rax, %rdx\n";
+}
+
+std::string SelectLea(const std::string& base, const std::string& index, int scale, int64_t disp) {
+    std::string addr = base;
+    if (!index.empty()) addr += (addr.empty() ? "" : " + ") + index + (scale > 1 ? "*" + std::to_string(scale) : "");
+    if (disp > 0) addr += " + " + std::to_string(disp);
+    else if (disp < 0) addr += " - " + std::to_string(-disp);
+    return "\tlea %rax, [" + addr + "]\n";
+}
+
+std::optional<std::string> SelectMulConst(int64_t c) {
+    if (c == 1) return "";
+    if (c == 0) return "\txor %rax, %rax\n";
+    if (c == -1) return "\tneg %rax\n";
+
+    // x * -c == -(x * c), INT64_MIN stays itself and is a plain shift
+    uint64_t u = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+    std::string neg = c < 0 && c != INT64_MIN ? "\tneg %rax\n" : "";
+    auto shift = [](int k) { return k ? "\tshl %rax, " + std::to_string(k) + "\n" : std::string(); };
+    auto leaTimes = [](uint64_t f) { return SelectLea("%rax", "%rax", (int)f - 1, 0); }; // f = 3, 5 or 9
+
+    if (int k = log2Exact(u); k >= 0) return shift(k) + neg;
+    for (uint64_t f : {3, 5, 9}) {
+        if (u % f) continue;
+        uint64_t rest = u / f;
+        if (int k = log2Exact(rest); k >= 0) return leaTimes(f) + shift(k) + neg;
+        for (uint64_t g : {3, 5, 9})
+            if (rest == g) return leaTimes(f) + leaTimes(g) + neg;
+    }
+    if (int k = log2Exact(u - 1); k >= 4) return "\tmov %rcx, %rax\n" + shift(k) + "\tadd %rax, %rcx\n" + neg;
+    if (int k = log2Exact(u + 1); k >= 2) return "\tmov %rcx, %rax\n" + shift(k) + "\tsub %rax, %rcx\n" + neg;
+    return std::nullopt;
+}
+
+// Smallest s with m = ceil(2^(64+s) / d) exact for every 64-bit n, m may need 65 bits
+struct UnsignedMagic {
+    uint64_t m;
+    int s;
+    bool add; // the real multiplier is 2^64 + m
+};
+
+static UnsignedMagic unsignedMagic(uint64_t d) {
+    int l = 64 - __builtin_clzll(d - 1); // ceil(log2(d))
+    for (int s = 0; s < l; ++s) {
+        u128 m = (((u128)1 << (64 + s)) + d - 1) / d;
+        if (m >> 64) break;
+        if (m * d - ((u128)1 << (64 + s)) <= ((u128)1 << s)) return {(uint64_t)m, s, false};
+    }
+    // 2^64 + m = ceil(2^(64+l) / d), q = (hi + ((n - hi) >> 1)) >> (l - 1)
+    u128 m = (((u128)1 << 64) * (((u128)1 << l) - d)) / d + 1;
+    return {(uint64_t)m, l, true};
+}
+
+// Hacker's Delight 10-1 for 2 <= |d| < 2^63
+struct SignedMagic {
+    int64_t m;
+    int s;
+};
+
+static SignedMagic signedMagic(int64_t d) {
+    const uint64_t two63 = 1ull << 63;
+    uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    uint64_t t = two63 + ((uint64_t)d >> 63);
+    uint64_t anc = t - 1 - t % ad;
+    int p = 63;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    uint64_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    int64_t m = (int64_t)(q2 + 1);
+    return {d < 0 ? -m : m, p - 64};
+}
+
+// %rax = n - q * d with q in %rax and n in %rcx
+static std::string remainder(int64_t d) {
+    return withImm("imul", d) + "\tsub %rcx, %rax\n\tmov %rax, %rcx\n";
+}
+
+std::optional<std::string> SelectDivConst(const std::string& op, int64_t d, bool isUnsigned) {
+    bool mod = op == "%";
+    std::ostringstream out;
+    if (isUnsigned) {
+        if (d <= 0) return std::nullopt;
+        if (d == 1) return mod ? "\txor %rax, %rax\n" : "";
+        if (int k = log2Exact((uint64_t)d); k >= 0) {
+            if (mod) return withImm("and", d - 1);
+            return "\tshr %rax, " + std::to_string(k) + "\n";
+        }
+        UnsignedMagic magic = unsignedMagic((uint64_t)d);
+        out << "\tmov %rcx, %rax\n\tmov %rax, " << (int64_t)magic.m << "\n\tmul %rcx\n";
+        if (!magic.add) {
+            if (magic.s) out << "\tshr %rdx, " << magic.s << "\n";
+            out << "\tmov %rax, %rdx\n";
+        } else {
+            out << "\tmov %rax, %rcx\n\tsub %rax, %rdx\n\tshr %rax, 1\n\tadd %rax, %rdx\n";
+            if (magic.s > 1) out << "\tshr %rax, " << magic.s - 1 << "\n";
+        }
+        if (mod) out << remainder(d);
+        return out.str();
+    }
+
+    // 0 and -1 trap in idiv for some dividends, INT64_MIN has no magic number
+    if (d == 0 || d == -1 || d == INT64_MIN) return std::nullopt;
+    if (d == 1) return mod ? "\txor %rax, %rax\n" : "";
+    uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    if (int k = log2Exact(ad); k >= 0) {
+        // Round towards zero: negative dividends get 2^k - 1 added first
+        out << "\tmov %rcx, %rax\n";
+        if (k > 1) out << "\tsar %rcx, 63\n";
+        out << "\tshr %rcx, " << 64 - k << "\n\tadd %rax, %rcx\n";
+        if (mod) {
+            out << withImm("and", (int64_t)ad - 1) << "\tsub %rax, %rcx\n";
+            return out.str();
+        }
+        out << "\tsar %rax, " << k << "\n";
+        if (d < 0) out << "\tneg %rax\n";
+        return out.str();
+    }
+
+    SignedMagic magic = signedMagic(d);
+    out << "\tmov %rcx, %rax\n\tmov %rax, " << magic.m << "\n\timul %rcx\n";
+    if (d > 0 && magic.m < 0) out << "\tadd %rdx, %rcx\n";
+    if (d < 0 && magic.m > 0) out << "\tsub %rdx, %rcx\n";
+    if (magic.s) out << "\tsar %rdx, " << magic.s << "\n";
+    out << "\tmov %rax, %rdx\n\tshr %rax, 63\n\tadd %rax, %rdx\n"; // +1 for a negative quotient
+    if (mod) out << remainder(d);
+    return out.str();
+}
+
+// Integer literal, also behind a unary minus
+static bool literalValue(const std::shared_ptr<ASTNode>& node, int64_t& value) {
+    bool negate = node && node->type == ASTNodeType::UnaryExpr && node->name == "-";
+    const auto& lit = negate ? node->children[0] : node;
+    if (!IsIntegerLiteral(lit)) return false;
+    try {
+        value = std::stoll(lit->value);
+    } catch (...) {
+        return false;
+    }
+    if (negate) value = (int64_t)(0 - (uint64_t)value);
+    return true;
+}
+
+// X * s or X << log2(s) with s a lea scale; 3, 5 and 9 only when allowThree (the index is X itself)
+static bool scaledTerm(const std::shared_ptr<ASTNode>& node, std::shared_ptr<ASTNode>& x, int& scale, bool allowThree) {
+    if (!node || node->type != ASTNodeType::BinaryExpr) return false;
+    int64_t v;
+    if (node->name == "<<" && literalValue(node->children[1], v) && v >= 0 && v <= 3) {
+        x = node->children[0];
+        scale = 1 << v;
+        return true;
+    }
+    if (node->name != "*") return false;
+    for (int side : {1, 0}) {
+        if (!literalValue(node->children[side], v)) continue;
+        if (v == 2 || v == 4 || v == 8 || (allowThree && (v == 3 || v == 5 || v == 9))) {
+            x = node->children[1 - side];
+            scale = (int)v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Compiler_Amd64::isUnsignedOperand(const std::shared_ptr<ASTNode>& node) {
+    const IntegerType* type = FindIntegerType(exprType(node));
+    return type && !type->isSigned && !type->isBool;
+}
+
+// Shifts follow their left operand. Other operators are unsigned when one side
+// is and the other is too or a non-negative literal, so u64 values above
+// INT64_MAX compare as large numbers and narrower types agree either way.
+bool Compiler_Amd64::isUnsignedOp(const std::shared_ptr<ASTNode>& node) {
+    auto& lhs = node->children[0];
+    auto& rhs = node->children[1];
+    if (node->name == "<<" || node->name == ">>") return isUnsignedOperand(lhs);
+    int64_t c;
+    bool left = isUnsignedOperand(lhs), right = isUnsignedOperand(rhs);
+    bool leftFits = left || (literalValue(lhs, c) && c >= 0);
+    bool rightFits = right || (literalValue(rhs, c) && c >= 0);
+    return (left || right) && leftFits && rightFits;
+}
+
+// a + b*s, a*s + b, a + b + disp and a*s + disp as one lea
+std::string Compiler_Amd64::compileLeaForm(const std::shared_ptr<ASTNode>& node) {
+    if (node->name != "+" && node->name != "-") return "";
+    auto sum = node;
+    int64_t disp = 0;
+    if (literalValue(node->children[1], disp)) {
+        if (node->name == "-") disp = (int64_t)(0 - (uint64_t)disp);
+        if (disp < INT32_MIN || disp > INT32_MAX) return "";
+        sum = node->children[0];
+    } else if (node->name == "-") {
+        return "";
+    }
+
+    std::shared_ptr<ASTNode> x;
+    int scale;
+    if (sum != node && scaledTerm(sum, x, scale, true)) {
+        std::ostringstream out;
+        out << compileExpression(x, "%rax");
+        out << (scale % 2 ? SelectLea("%rax", "%rax", scale - 1, disp) : SelectLea("", "%rax", scale, disp));
+        return out.str();
+    }
+    if (sum->type != ASTNodeType::BinaryExpr || sum->name != "+") return "";
+    auto& a = sum->children[0];
+    auto& b = sum->children[1];
+    std::ostringstream out;
+    if (scaledTerm(b, x, scale, false)) {
+        out << compileOperandPair(a, x) << SelectLea("%rax", "%rcx", scale, disp);
+    } else if (scaledTerm(a, x, scale, false)) {
+        out << compileOperandPair(x, b) << SelectLea("%rcx", "%rax", scale, disp);
+    } else if (sum != node && disp != 0) {
+        out << compileOperandPair(a, b) << SelectLea("%rax", "%rcx", 1, disp);
+    } else {
+        return ""; // a plain add is as good
+    }
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileArithIsel(const std::shared_ptr<ASTNode>& node) {
+    const std::string& op = node->name;
+    auto& lhs = node->children[0];
+    auto& rhs = node->children[1];
+    int64_t c;
+    std::ostringstream out;
+
+    if (op == "+" || op == "-") return compileLeaForm(node);
+    if (op == "*") {
+        bool right = literalValue(rhs, c);
+        if (!right && !literalValue(lhs, c)) return "";
+        auto code = SelectMulConst(c);
+        if (!code) return "";
+        out << compileExpression(right ? lhs : rhs, "%rax") << *code;
+        return out.str();
+    }
+    if (op != "/" && op != "%") return "";
+
+    bool constant = literalValue(rhs, c);
+    bool isUnsigned = isUnsignedOperand(lhs) && (constant ? c > 0 : isUnsignedOperand(rhs));
+    if (constant) {
+        if (auto code = SelectDivConst(op, c, isUnsigned)) {
+            out << compileExpression(lhs, "%rax") << *code;
+            return out.str();
+        }
+    }
+    if (!isUnsigned) return "";
+    out << compileOperandPair(lhs, rhs);
+    out << "\txor %rdx, %rdx\n\tdiv %rcx\n";
+    if (op == "%") out << "\tmov %rax, %rdx\n";
+    return out.str();
+}
+
+// --verify-isel: a small interpreter for exactly the instructions above
+
+namespace {
+
+struct Operand {
+    enum Kind { Reg, Imm, Addr } kind = Imm;
+    int reg = -1;
+    int64_t imm = 0;
+    int base = -1, index = -1, scale = 1; // Addr: [base + index*scale + imm]
+};
+
+enum class Op { Mov, Add, Sub, And, Xor, Neg, Shl, Shr, Sar, Imul, Mul, Lea };
+
+struct Instr {
+    Op op;
+    std::vector<Operand> args;
+};
+
+struct Machine {
+    uint64_t r[4] = {}; // %rax, %rcx, %rdx, %r8
+};
+
+int regIndex(const std::string& name) {
+    static const std::unordered_map<std::string, int> regs = {{"%rax", 0}, {"%rcx", 1}, {"%rdx", 2}, {"%r8", 3}};
+    auto it = regs.find(name);
+    return it == regs.end() ? -1 : it->second;
+}
+
+bool parseOperand(std::string text, Operand& out) {
+    if (text.empty()) return false;
+    if (text[0] == '%') {
+        out.kind = Operand::Reg;
+        out.reg = regIndex(text);
+        return out.reg >= 0;
+    }
+    if (text[0] != '[') {
+        out.kind = Operand::Imm;
+        try {
+            out.imm = std::stoll(text);
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+    out.kind = Operand::Addr;
+    std::istringstream terms(text.substr(1, text.size() - 2));
+    std::string term;
+    int sign = 1;
+    while (terms >> term) {
+        if (term == "+" || term == "-") {
+            sign = term == "+" ? 1 : -1;
+            continue;
+        }
+        if (term[0] != '%') {
+            out.imm += sign * std::stoll(term);
+            continue;
+        }
+        size_t star = term.find('*');
+        int reg = regIndex(term.substr(0, star));
+        if (reg < 0) return false;
+        if (star != std::string::npos) {
+            out.index = reg;
+            out.scale = std::stoi(term.substr(star + 1));
+        } else if (out.base < 0) {
+            out.base = reg;
+        } else {
+            out.index = reg;
+        }
+    }
+    return true;
+}
+
+bool decode(const std::string& code, std::vector<Instr>& program, std::string& bad) {
+    std::istringstream lines(code);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t start = line.find_first_not_of('\t');
+        if (start == std::string::npos) continue;
+        line = line.substr(start);
+        Instr instr;
+        size_t space = line.find(' ');
+        static const std::unordered_map<std::string, Op> ops = {
+            {"mov", Op::Mov}, {"add", Op::Add}, {"sub", Op::Sub}, {"and", Op::And}, {"xor", Op::Xor}, {"neg", Op::Neg},
+            {"shl", Op::Shl}, {"sal", Op::Shl}, {"shr", Op::Shr}, {"sar", Op::Sar}, {"imul", Op::Imul}, {"mul", Op::Mul}, {"lea", Op::Lea},
+        };
+        auto op = ops.find(line.substr(0, space));
+        if (op == ops.end()) {
+            bad = line;
+            return false;
+        }
+        instr.op = op->second;
+        if (space != std::string::npos) {
+            std::string rest = line.substr(space + 1);
+            size_t from = 0;
+            while (from <= rest.size()) {
+                size_t comma = rest.find(", ", from);
+                Operand operand;
+                if (!parseOperand(rest.substr(from, comma - from), operand)) {
+                    bad = line;
+                    return false;
+                }
+                instr.args.push_back(operand);
+                if (comma == std::string::npos) break;
+                from = comma + 2;
+            }
+        }
+        program.push_back(instr);
+    }
+    return true;
+}
+
+uint64_t value(const Machine& m, const Operand& o) {
+    return o.kind == Operand::Reg ? m.r[o.reg] : (uint64_t)o.imm;
+}
+
+bool execute(const std::vector<Instr>& program, Machine& m) {
+    for (auto& in : program) {
+        const auto& a = in.args;
+        size_t n = a.size();
+        if (n >= 1 && a[0].kind != Operand::Reg) return false;
+        uint64_t& dst = n ? m.r[a[0].reg] : m.r[0];
+        if (in.op == Op::Mov && n == 2) dst = value(m, a[1]);
+        else if (in.op == Op::Add && n == 2) dst += value(m, a[1]);
+        else if (in.op == Op::Sub && n == 2) dst -= value(m, a[1]);
+        else if (in.op == Op::And && n == 2) dst &= value(m, a[1]);
+        else if (in.op == Op::Xor && n == 2) dst ^= value(m, a[1]);
+        else if (in.op == Op::Neg && n == 1) dst = 0 - dst;
+        else if (in.op == Op::Shl && n == 2) dst <<= value(m, a[1]) & 63;
+        else if (in.op == Op::Shr && n == 2) dst >>= value(m, a[1]) & 63;
+        else if (in.op == Op::Sar && n == 2) dst = (uint64_t)((int64_t)dst >> (value(m, a[1]) & 63));
+        else if (in.op == Op::Imul && n == 2) dst *= value(m, a[1]);
+        else if (in.op == Op::Imul && n == 3) dst = value(m, a[1]) * value(m, a[2]);
+        else if (in.op == Op::Imul && n == 1) {
+            i128 p = (i128)(int64_t)m.r[0] * (int64_t)value(m, a[0]);
+            m.r[0] = (uint64_t)p;
+            m.r[2] = (uint64_t)((u128)p >> 64);
+        } else if (in.op == Op::Mul && n == 1) {
+            u128 p = (u128)m.r[0] * value(m, a[0]);
+            m.r[0] = (uint64_t)p;
+            m.r[2] = (uint64_t)(p >> 64);
+        } else if (in.op == Op::Lea && n == 2 && a[1].kind == Operand::Addr) {
+            uint64_t addr = (uint64_t)a[1].imm;
+            if (a[1].base >= 0) addr += m.r[a[1].base];
+            if (a[1].index >= 0) addr += m.r[a[1].index] * (uint64_t)a[1].scale;
+            dst = addr;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Dividends and multiplicands around every boundary the sequences have
+std::vector<int64_t> edgeValues(int64_t c) {
+    std::vector<int64_t> v = {0, 1, -1, 2, -2, 3, -3, INT64_MAX, INT64_MIN, INT64_MAX - 1, INT64_MIN + 1};
+    for (int k = 1; k < 64; ++k) {
+        uint64_t p = 1ull << k;
+        for (uint64_t x : {p, p - 1, p + 1, 0 - p, 0 - p - 1, 0 - p + 1}) v.push_back((int64_t)x);
+    }
+    if (c != 0) {
+        uint64_t uc = (uint64_t)c;
+        for (uint64_t q : {(uint64_t)1, (uint64_t)2, (uint64_t)3, (uint64_t)1000, UINT64_MAX / uc, (uint64_t)INT64_MAX / uc}) {
+            uint64_t base = q * uc;
+            for (uint64_t x : {base, base - 1, base + 1, 0 - base, 0 - base + 1, 0 - base - 1}) v.push_back((int64_t)x);
+        }
+    }
+    uint64_t s = 0x9E3779B97F4A7C15ull ^ (uint64_t)c;
+    for (int i = 0; i < 256; ++i) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        v.push_back((int64_t)(i % 2 ? s : s >> (s & 63)));
+    }
+    return v;
+}
+
+std::vector<int64_t> constants() {
+    std::vector<int64_t> c;
+    for (int64_t i = -300; i <= 300; ++i) c.push_back(i);
+    for (int k = 1; k < 64; ++k) {
+        uint64_t p = 1ull << k;
+        for (uint64_t x : {p, p - 1, p + 1, 3 * p, 5 * p, 9 * p}) {
+            c.push_back((int64_t)x);
+            c.push_back((int64_t)(0 - x));
+        }
+    }
+    for (int64_t x : std::initializer_list<int64_t>{1000, 1000000007, 1000000000000, 641, 6700417, 274177, 4294967295, 4294967297,
+                      6148914691236517205, INT64_MAX, INT64_MAX - 1, INT64_MIN, INT64_MIN + 1})
+        c.push_back(x);
+    uint64_t s = 88172645463325252ull;
+    for (int i = 0; i < 200; ++i) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        c.push_back((int64_t)(s >> (s & 63)));
+    }
+    return c;
+}
+
+} // namespace
+
+size_t VerifyIsel(std::ostream& log, std::ostream& err) {
+    size_t rules = 0, cases = 0, mismatches = 0;
+    auto check = [&](const std::string& what, const std::string& code, int inputs, auto reference, const std::vector<int64_t>& xs,
+                     const std::vector<int64_t>& ys) {
+        std::vector<Instr> program;
+        std::string bad;
+        rules++;
+        if (!decode(code, program, bad)) {
+            if (mismatches++ < 10) err << "Error: isel " << what << ": can't interpret '" << bad << "'\n";
+            return;
+        }
+        for (int64_t x : xs) {
+            for (size_t j = 0; j < (inputs == 2 ? ys.size() : 1); ++j) {
+                Machine m;
+                m.r[0] = (uint64_t)x;
+                if (inputs == 2) m.r[1] = (uint64_t)ys[j];
+                cases++;
+                int64_t want = reference(x, inputs == 2 ? ys[j] : 0);
+                if (execute(program, m) && (int64_t)m.r[0] == want) continue;
+                if (mismatches++ < 10)
+                    err << "Error: isel " << what << " with " << x << (inputs == 2 ? ", " + std::to_string(ys[j]) : "") << " gives "
+                        << (int64_t)m.r[0] << ", expected " << want << "\n";
+            }
+        }
+    };
+
+    for (int64_t c : constants()) {
+        std::vector<int64_t> xs = edgeValues(c);
+        std::string k = std::to_string(c);
+        if (auto code = SelectMulConst(c))
+            check("x * " + k, *code, 1, [c](int64_t x, int64_t) { return (int64_t)((uint64_t)x * (uint64_t)c); }, xs, {});
+        for (const char* op : {"/", "%"}) {
+            bool div = op[0] == '/';
+            if (auto code = SelectDivConst(op, c, false))
+                check("x " + std::string(op) + " " + k, *code, 1, [c, div](int64_t x, int64_t) {
+                    if (x == INT64_MIN && c == -1) return div ? x : 0; // never selected, idiv traps
+                    return div ? x / c : x % c;
+                }, xs, {});
+            if (auto code = SelectDivConst(op, c, true))
+                check("u64 x " + std::string(op) + " " + k, *code, 1, [c, div](int64_t x, int64_t) {
+                    return (int64_t)(div ? (uint64_t)x / (uint64_t)c : (uint64_t)x % (uint64_t)c);
+                }, xs, {});
+        }
+    }
+
+    std::vector<int64_t> small = {0, 1, -1, 7, -7, 1 << 20, INT32_MAX, INT32_MIN, INT64_MAX, INT64_MIN};
+    std::vector<int64_t> xs = edgeValues(0);
+    for (int scale : {1, 2, 4, 8}) {
+        for (int64_t disp : std::initializer_list<int64_t>{0, 1, -1, 8, -8, INT32_MAX, INT32_MIN}) {
+            std::string form = "x + y*" + std::to_string(scale) + " + " + std::to_string(disp);
+            check(form, SelectLea("%rax", "%rcx", scale, disp), 2, [scale, disp](int64_t x, int64_t y) {
+                return (int64_t)((uint64_t)x + (uint64_t)y * scale + (uint64_t)disp);
+            }, xs, small);
+            check("y + x*" + std::to_string(scale) + " + " + std::to_string(disp), SelectLea("%rcx", "%rax", scale, disp), 2,
+                  [scale, disp](int64_t x, int64_t y) { return (int64_t)((uint64_t)y + (uint64_t)x * scale + (uint64_t)disp); }, xs, small);
+            check("x*" + std::to_string(scale) + " + " + std::to_string(disp), SelectLea("", "%rax", scale, disp), 1,
+                  [scale, disp](int64_t x, int64_t) { return (int64_t)((uint64_t)x * scale + (uint64_t)disp); }, xs, {});
+        }
+    }
+
+    log << "isel: " << rules << " sequences checked on " << cases << " inputs, " << mismatches << " mismatches\n";
+    return mismatches;
+}
@@ -31,9 +31,14 @@ static inline std::unordered_map<std::string, TokenType> KeywordMap = {
     {"interface", TokenType::Interface},
     {"import", TokenType::Import},
     {"module", TokenType::Module},
+    {"async", TokenType::Async},
+    {"await", TokenType::Await},
+    {"parallel", TokenType::Parallel},
 };
 
-AOL_Lexer::AOL_Lexer(const std::string& source) : src(source) {}
+AOL_Lexer::AOL_Lexer(const std::string& source) : storage(source), src(storage) {}
+
+AOL_Lexer::AOL_Lexer(std::string_view whole, size_t start, int line, int col) : src(whole), pos(start), line(line), col(col) {}
 
 char AOL_Lexer::peek(int offset) const {
     if (pos + offset >= src.size()) return '\0';
@@ -41,7 +46,8 @@ char AOL_Lexer::peek(int offset) const {
 }
 
 char AOL_Lexer::advance() {
-    char c = src[pos++];
+    char c = pos < src.size() ? src[pos] : '\0';
+    pos++;
     if (c == '\n') { line++; col = 1; }
     else col++;
     return c;
@@ -62,8 +68,8 @@ void AOL_Lexer::skipComment() {
         while (peek() != '\n' && peek() != '\0') advance();
     } else if (peek() == '/' && peek(1) == '*') {
         advance(); advance();
-        while (!(peek() == '*' && peek(1) == '/')) advance();
-        advance(); advance();
+        while (!(peek() == '*' && peek(1) == '/') && peek() != '\0') advance();
+        if (peek() != '\0') { advance(); advance(); }
     }
 }
 
@@ -111,11 +117,27 @@ Token AOL_Lexer::operatorOrDelimiter() {
     char c = advance();
 
     // Multi-char operators first
+    if (c == '<' && peek() == '<' && peek(1) == '=') { advance(); advance(); return {TokenType::ShiftLeftAssign, "<<=", line, startCol}; }
+    if (c == '>' && peek() == '>' && peek(1) == '=') { advance(); advance(); return {TokenType::ShiftRightAssign, ">>=", line, startCol}; }
     if (c == '-' && match('>')) return {TokenType::Arrow, "->", line, startCol};
     if (c == '=' && match('=')) return {TokenType::EqualEqual, "==", line, startCol};
     if (c == '!' && match('=')) return {TokenType::NEqual, "!=", line, startCol};
     if (c == '<' && match('=')) return {TokenType::LessEqual, "<=", line, startCol};
     if (c == '>' && match('=')) return {TokenType::GreaterEqual, ">=", line, startCol};
+    if (c == '<' && match('<')) return {TokenType::ShiftLeft, "<<", line, startCol};
+    if (c == '>' && match('>')) return {TokenType::ShiftRight, ">>", line, startCol};
+    if (c == '&' && match('&')) return {TokenType::AndAnd, "&&", line, startCol};
+    if (c == '|' && match('|')) return {TokenType::OrOr, "||", line, startCol};
+    if (c == '+' && match('+')) return {TokenType::Increment, "++", line, startCol};
+    if (c == '-' && match('-')) return {TokenType::Decrement, "--", line, startCol};
+    if (c == '+' && match('=')) return {TokenType::PlusAssign, "+=", line, startCol};
+    if (c == '-' && match('=')) return {TokenType::MinusAssign, "-=", line, startCol};
+    if (c == '*' && match('=')) return {TokenType::StarAssign, "*=", line, startCol};
+    if (c == '/' && match('=')) return {TokenType::SlashAssign, "/=", line, startCol};
+    if (c == '%' && match('=')) return {TokenType::PercentAssign, "%=", line, startCol};
+    if (c == '&' && match('=')) return {TokenType::AmpAssign, "&=", line, startCol};
+    if (c == '|' && match('=')) return {TokenType::PipeAssign, "|=", line, startCol};
+    if (c == '^' && match('=')) return {TokenType::CaretAssign, "^=", line, startCol};
 
     // Single char fallback
     switch(c) {
@@ -123,21 +145,42 @@ Token AOL_Lexer::operatorOrDelimiter() {
         case '-': return {TokenType::Minus, "-", line, startCol};
         case '*': return {TokenType::Star, "*", line, startCol};
         case '/': return {TokenType::Slash, "/", line, startCol};
+        case '%': return {TokenType::Percent, "%", line, startCol};
+        case '<': return {TokenType::Less, "<", line, startCol};
+        case '>': return {TokenType::Greater, ">", line, startCol};
+        case '&': return {TokenType::Amp, "&", line, startCol};
+        case '|': return {TokenType::Pipe, "|", line, startCol};
+        case '^': return {TokenType::Caret, "^", line, startCol};
+        case '~': return {TokenType::Tilde, "~", line, startCol};
+        case '?': return {TokenType::Question, "?", line, startCol};
+        case '.': return {TokenType::Dot, ".", line, startCol};
         case '(': return {TokenType::LParen, "(", line, startCol};
         case ')': return {TokenType::RParen, ")", line, startCol};
         case '{': return {TokenType::LBrace, "{", line, startCol};
         case '}': return {TokenType::RBrace, "}", line, startCol};
+        case '[': return {TokenType::LBracket, "[", line, startCol};
+        case ']': return {TokenType::RBracket, "]", line, startCol};
         case ';': return {TokenType::Semicolon, ";", line, startCol};
         case ',': return {TokenType::Comma, ",", line, startCol};
+        case ':': return {TokenType::Colon, ":", line, startCol};
+        case '#': return {TokenType::Hash, "#", line, startCol};
         case '!': return {TokenType::Bang, "!", line, startCol};
         case '=': return {TokenType::Equal, "=", line, startCol};
     }
     return {TokenType::Unknown, std::string(1,c), line, startCol};
 }
 
+void AOL_Lexer::skipTrivia() {
+    // Comments may be stacked, so keep going until real input
+    for (;;) {
+        skipWhitespace();
+        if (peek() != '/' || (peek(1) != '/' && peek(1) != '*')) break;
+        skipComment();
+    }
+}
+
 Token AOL_Lexer::nextToken() {
-    skipWhitespace();
-    skipComment();
+    skipTrivia();
 
     if (peek() == '\0') return {TokenType::TK_EOF, "", line, col};
 
@@ -160,3 +203,13 @@ std::vector<Token> AOL_Lexer::tokenize() {
     result.push_back(t);
     return result;
 }
+
+std::vector<Token> AOL_Lexer::tokenizeRange(size_t end) {
+    std::vector<Token> result;
+    for (;;) {
+        skipTrivia();
+        if (pos >= end || peek() == '\0') break;
+        result.push_back(nextToken());
+    }
+    return result;
+}
@@ -0,0 +1,150 @@
+#include <lexer.hpp>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+// Chunks start right after a newline, so the only thing the serial lexer can
+// be in the middle of at a chunk start is a string literal, a block comment or
+// the closing quote of a char literal whose character was the newline. Every
+// chunk is scanned from each of these states at once, the states are then
+// resolved front to back and every chunk is lexed from the first byte that
+// isn't part of something the previous chunks started.
+namespace {
+enum ScanState : uint8_t {
+    Code,
+    InString,
+    InComment,
+    Skip1, // rest of a char literal or "*/"
+    Skip2,
+    LineComment,
+    CommentOpen, // the '*' of "/*"
+};
+
+const ScanState EntryStates[] = {Code, InString, InComment, Skip1};
+const size_t EntryCount = sizeof(EntryStates) / sizeof(EntryStates[0]);
+
+// Follows the lexer: strings have no escapes, a char literal is always three
+// bytes and comments are only recognized where a token could start, which in
+// code is anywhere, no operator has '/' after its first byte
+inline ScanState ScanStep(ScanState s, char c, char next) {
+    switch (s) {
+        case Code:
+            if (c == '"') return InString;
+            if (c == '\'') return Skip2;
+            if (c == '/' && next == '/') return LineComment;
+            if (c == '/' && next == '*') return CommentOpen;
+            return Code;
+        case InString: return c == '"' ? Code : InString;
+        case InComment: return c == '*' && next == '/' ? Skip1 : InComment;
+        case Skip2: return Skip1;
+        case Skip1: return Code;
+        case LineComment: return c == '\n' ? Code : LineComment;
+        case CommentOpen: return InComment;
+    }
+    return s;
+}
+
+struct LexChunk {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t newlines = 0;
+    ScanState exit[EntryCount]; // state at end for each entry state
+    ScanState entry = Code;
+    int line = 1;
+    std::vector<Token> tokens;
+    bool atEof = false;
+    Token eof;
+};
+
+template <typename Fn>
+void ParallelFor(size_t count, unsigned threads, Fn fn) {
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < count;) fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < std::min<size_t>(threads, count); ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+}
+}
+
+std::vector<Token> AOL_Lexer::tokenizeParallel(unsigned threads, size_t chunkBytes) const {
+    const char* s = src.data();
+    size_t size = src.size();
+    // The lexer stops at a NUL byte, which no chunk can know about
+    if (memchr(s, '\0', size)) return AOL_Lexer(std::string(src)).tokenize();
+
+    std::vector<LexChunk> chunks;
+    chunkBytes = std::max<size_t>(chunkBytes, 1);
+    for (size_t begin = 0; begin < size;) {
+        size_t end = std::min(size, begin + chunkBytes);
+        auto nl = (const char*)memchr(s + end - 1, '\n', size - (end - 1));
+        end = nl ? nl - s + 1 : size;
+        chunks.emplace_back();
+        chunks.back().begin = begin;
+        chunks.back().end = end;
+        begin = end;
+    }
+    if (chunks.size() < 2) return AOL_Lexer(std::string(src)).tokenize();
+    threads = std::max(threads, 1u);
+
+    // Speculative scan, one state per possible entry state
+    ParallelFor(chunks.size(), threads, [&](size_t i) {
+        auto& chunk = chunks[i];
+        ScanState states[EntryCount];
+        std::copy(EntryStates, EntryStates + EntryCount, states);
+        for (size_t p = chunk.begin; p < chunk.end; ++p) {
+            char next = p + 1 < size ? s[p + 1] : '\0';
+            chunk.newlines += s[p] == '\n';
+            for (auto& st : states) st = ScanStep(st, s[p], next);
+        }
+        std::copy(states, states + EntryCount, chunk.exit);
+    });
+
+    ScanState state = Code;
+    int line = 1;
+    for (auto& chunk : chunks) {
+        auto entry = std::find(EntryStates, EntryStates + EntryCount, state);
+        if (entry == EntryStates + EntryCount) return AOL_Lexer(std::string(src)).tokenize(); // not at a line start
+        chunk.entry = state;
+        chunk.line = line;
+        state = chunk.exit[entry - EntryStates];
+        line += (int)chunk.newlines;
+    }
+
+    ParallelFor(chunks.size(), threads, [&](size_t i) {
+        auto& chunk = chunks[i];
+        size_t p = chunk.begin, lastNewline = chunk.begin - 1; // wraps for the first chunk, only differences are used
+        int line = chunk.line;
+        for (ScanState st = chunk.entry; st != Code; ++p) {
+            if (p >= chunk.end) return; // all of it belongs to a token or comment from before
+            st = ScanStep(st, s[p], p + 1 < size ? s[p + 1] : '\0');
+            if (s[p] == '\n') {
+                ++line;
+                lastNewline = p;
+            }
+        }
+        AOL_Lexer lexer(src, p, line, (int)(p - lastNewline));
+        chunk.tokens = lexer.tokenizeRange(chunk.end);
+        if (lexer.pos >= size) {
+            chunk.atEof = true;
+            chunk.eof = {TokenType::TK_EOF, "", lexer.line, lexer.col};
+        }
+    });
+
+    size_t total = 1;
+    for (auto& chunk : chunks) total += chunk.tokens.size();
+    std::vector<Token> result;
+    result.reserve(total);
+    const Token* eof = nullptr;
+    for (auto& chunk : chunks) {
+        std::move(chunk.tokens.begin(), chunk.tokens.end(), std::back_inserter(result));
+        if (chunk.atEof) eof = &chunk.eof;
+    }
+    if (!eof) return AOL_Lexer(std::string(src)).tokenize();
+    result.push_back(*eof);
+    return result;
+}
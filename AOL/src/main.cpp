@@ -1,23 +1,48 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <filesystem>
+#include <thread>
 
 #include <args.hpp>
 #include <colors.hpp>
 #include <lexer.hpp>
 #include <parser.hpp>
+#include <optimizer.hpp>
+#include <types.hpp>
+#include <consteval.hpp>
+#include <module.hpp>
+#include <output.hpp>
+#include <profile.hpp>
 
 #include <compiler_amd64.hpp>
+#include <isel.hpp>
 
 int main(int argc, char** argv) {
     ArgParser parser(argv[0]);
 
-    parser.addOption("-o", "--output", "Specify output file name", true, true);
+    parser.addOption("-o", "--output", "Specify output file name, required unless only --verify-isel runs", true, false);
     parser.addOption("-v", "--verbose", "Enable verbose mode", false, false);
     parser.addOption("-c", "--compile-only", "Compile but do not JIT", false, false);
     parser.addOption("", "--lexout", "Stop after lexing and print all tokens", false, false);
     parser.addOption("-a", "--arch", "Target Architecture, Default: amd64", true, false);
     parser.addOption("-b", "--bits", "Target Bits, Default: 64", true, false);
+    parser.addOption("-march", "--march", "Target CPU: x86-64, x86-64-v2, x86-64-v3, x86-64-v4 or native (this machine), Default: x86-64", true, false);
+    parser.addOption("", "--avx2", "Allow AVX2 instructions, 256-bit vectors use YMM registers", false, false);
+    parser.addOption("", "--entry-banner", "Print a debug banner when the program starts", false, false);
+    parser.addOption("-O", "--opt-level", "Optimization level, 0 disables the optimizer, Default: 1", true, false);
+    parser.addOption("-I", "--module-path", "Directories searched by import, ':' separated, before the standard library", true, false);
+    parser.addOption("", "--time-passes", "Print the time spent in each compiler pass", false, false);
+    parser.addOption("", "--lex-threads", "Threads used for lexing, 1 lexes serially, Default: all cores", true, false);
+    parser.addOption("", "--lex-chunk", "Bytes per parallel lexing chunk, inputs under two chunks are lexed serially, Default: 1048576", true, false);
+    parser.addOption("", "--profile-generate", "Count function entries, branches and loop iterations and write them on exit, --profile-generate=FILE, Default: <output>.aolprof", false, false);
+    parser.addOption("", "--profile-use", "Optimize block layout, inlining and unrolling with a profile from --profile-generate", true, false);
+    parser.addOption("", "--instrument", "--instrument=functions: time every call with rdtsc, on exit write cycles per function to <output>.aolperf and collapsed stacks to <output>.folded", true, false);
+    parser.addOption("", "--lex-verify", "Lex serially as well and fail if the token streams differ", false, false);
+    parser.addOption("", "--verify-isel", "Check every arithmetic instruction selection rule against plain arithmetic on edge values before compiling", false, false);
 
     bool showHelp = false;
     if (!parser.parse(argc, argv, showHelp)) {
@@ -31,10 +56,22 @@ int main(int argc, char** argv) {
     }
 
     auto files = parser.positional();
+    if (parser.has("--verify-isel")) {
+        std::ostringstream log;
+        size_t mismatches = VerifyIsel(log, std::cerr);
+        if (parser.has("-v") || files.empty())
+            std::cout << Color::Cyan << "remark: " << Color::Reset << log.str();
+        if (mismatches) return 1;
+        if (files.empty()) return 0;
+    }
     if (files.empty()) {
         std::cout << Color::Red << "Error: No input file provided!\n" << Color::Reset << parser.help();
         return 1;
     }
+    if (!parser.has("-o")) {
+        std::cerr << Color::Red << "Error: Missing Required Option '-o'" << Color::Reset << "\n";
+        return 1;
+    }
 
     // Read file
     std::ifstream in(files[0]);
@@ -43,10 +80,53 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // --time-passes: each entry is the time since the previous one ended
+    std::vector<std::pair<std::string, double>> passTimes;
+    auto passStart = std::chrono::steady_clock::now();
+    auto endPass = [&](const std::string& name) {
+        auto now = std::chrono::steady_clock::now();
+        passTimes.push_back({name, std::chrono::duration<double, std::milli>(now - passStart).count()});
+        passStart = now;
+    };
+
     std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    endPass("read");
 
+    unsigned lexThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t lexChunk = AOL_Lexer::DefaultChunkBytes;
+    try {
+        if (auto t = parser.get("--lex-threads")) lexThreads = (unsigned)std::stoul(t.value());
+        if (auto c = parser.get("--lex-chunk")) lexChunk = std::stoull(c.value());
+    } catch (...) {
+        std::cerr << Color::Red << "Error: --lex-threads and --lex-chunk take a number" << Color::Reset << "\n";
+        return 1;
+    }
+
+    // Chunked lexing only pays off for large inputs, --lex-verify always uses it
     AOL_Lexer lexer(source);
-    auto tokens = lexer.tokenize();
+    bool parallelLex = parser.has("--lex-verify") || (lexThreads > 1 && source.size() >= 2 * lexChunk);
+    auto tokens = parallelLex ? lexer.tokenizeParallel(lexThreads, lexChunk) : lexer.tokenize();
+    endPass("lex");
+
+    if (parser.has("--lex-verify")) {
+        auto serial = AOL_Lexer(source).tokenize();
+        size_t i = 0;
+        while (i < serial.size() && i < tokens.size() && serial[i].type == tokens[i].type && serial[i].text == tokens[i].text &&
+               serial[i].line == tokens[i].line && serial[i].col == tokens[i].col)
+            ++i;
+        if (i < serial.size() || i < tokens.size()) {
+            auto show = [](const std::vector<Token>& ts, size_t i) {
+                if (i >= ts.size()) return std::string("end of stream");
+                return "'" + ts[i].text + "' at line " + std::to_string(ts[i].line) + " col " + std::to_string(ts[i].col);
+            };
+            std::cerr << Color::Red << "Error: Parallel lexing differs at token " << i << ": serial " << show(serial, i)
+                      << ", parallel " << show(tokens, i) << Color::Reset << "\n";
+            return 1;
+        }
+        if (parser.has("-v"))
+            std::cout << Color::Cyan << "remark: " << Color::Reset << "parallel lexing matches serial lexing (" << tokens.size() << " tokens)\n";
+        endPass("lex-verify");
+    }
 
     if (parser.has("--lexout")) {
         std::cout << Color::Bold << "=== Token Dump ===" << Color::Reset << "\n\n";
@@ -57,35 +137,174 @@ int main(int argc, char** argv) {
 
     AOL_Parser aol_parser(tokens);
     std::shared_ptr<ASTNode> astroot = aol_parser.parseProgram();
+    endPass("parse");
+
+    auto outOpt = parser.get("-o");
+    std::string outPath = outOpt.value_or("a.pasm");
+
+    // A module exports its interface before imports add anything to it
+    std::string moduleName = ModuleName(astroot);
+    if (!moduleName.empty()) {
+        auto ifacePath = std::filesystem::path(outPath).parent_path() / (moduleName + ".aoli");
+        if (!WriteInterface(BuildInterface(astroot, HashSource(source)), ifacePath.string()))
+            std::cerr << Color::Red << "Error: Could not write module interface " << ifacePath.string() << Color::Reset << "\n";
+        endPass("interface");
+    }
+
+    // import looks next to the source, in --module-path, then in the standard library
+    std::vector<std::string> searchPath = {std::filesystem::path(files[0]).parent_path().string()};
+    if (auto dirs = parser.get("-I")) {
+        std::stringstream list(dirs.value());
+        for (std::string dir; std::getline(list, dir, ':');)
+            if (!dir.empty()) searchPath.push_back(dir);
+    }
+    std::error_code ec;
+    auto exeDir = std::filesystem::canonical("/proc/self/exe", ec).parent_path();
+    if (ec) exeDir = std::filesystem::path(argv[0]).parent_path();
+    for (auto dir : {exeDir / "aol_stdlib", exeDir / ".." / ".." / "aol_stdlib"})
+        if (std::filesystem::is_directory(dir, ec)) searchPath.push_back(dir.lexically_normal().string());
+
+    std::vector<ModuleLoad> moduleLoads;
+    ImportModules(astroot, searchPath, moduleLoads);
+    endPass("import");
+
+    int optLevel = 1;
+    if (auto o = parser.get("-O")) {
+        try {
+            optLevel = std::stoi(o.value());
+        } catch (...) {
+            std::cerr << Color::Red << "Error: Invalid optimization level '" << o.value() << "'" << Color::Reset << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<std::string> layoutRemarks;
+    LayoutStructs(astroot, layoutRemarks);
+    endPass("layout");
+    std::vector<std::string> constRemarks;
+    EvaluateConstCalls(astroot, constRemarks);
+    endPass("const-eval");
+
+    // Counters are numbered on the tree the optimizer gets, so a profile maps back onto the same nodes
+    ProfileLayout profileLayout;
+    std::string profilePath;
+    std::vector<std::string> profileRemarks;
+    if (parser.has("--profile-generate") && parser.has("--profile-use")) {
+        std::cerr << Color::Red << "Error: --profile-generate and --profile-use can't be combined" << Color::Reset << "\n";
+        return 1;
+    }
+    if (parser.has("--profile-generate")) {
+        profilePath = parser.get("--profile-generate").value_or(
+            std::filesystem::absolute(outPath).replace_extension(".aolprof").string());
+        profileLayout = AssignProfileCounters(astroot);
+        endPass("profile");
+    } else if (auto use = parser.get("--profile-use")) {
+        ApplyProfile(astroot, use.value(), profileRemarks);
+        endPass("profile");
+    }
+
+    std::string instrumentBase;
+    if (auto mode = parser.get("--instrument")) {
+        if (mode.value() != "functions") {
+            std::cerr << Color::Red << "Error: Unknown --instrument mode '" << mode.value() << "', expected 'functions'" << Color::Reset << "\n";
+            return 1;
+        }
+        instrumentBase = std::filesystem::absolute(outPath).replace_extension().string();
+    }
+
+    AOL_Optimizer optimizer(optLevel);
+    optimizer.run(astroot);
+    endPass("optimize");
+    if (parser.has("-v")) {
+        for (auto& m : moduleLoads)
+            std::cout << Color::Cyan << "remark: " << Color::Reset << "module " << m.name << ": "
+                      << (m.fromInterface ? "mapped " : "parsed ") << m.path << " (" << m.bytes << " bytes)"
+                      << (m.fromInterface ? "" : ", interface rebuilt") << "\n";
+        for (auto& r : layoutRemarks)
+            std::cout << Color::Cyan << "remark: " << Color::Reset << r << "\n";
+        for (auto& r : constRemarks)
+            std::cout << Color::Cyan << "remark: " << Color::Reset << r << "\n";
+        for (auto& r : profileRemarks)
+            std::cout << Color::Cyan << "remark: " << Color::Reset << r << "\n";
+        for (auto& r : optimizer.remarks())
+            std::cout << Color::Cyan << "remark: " << Color::Reset << r << "\n";
+    }
 
     auto archOpt = parser.get("-a");
     std::string arch;
-    std::string out;
     if (archOpt.has_value()) {
         arch = archOpt.value();
     } else {
         arch = "amd64";
     }
 
+    // .text streams to disk during codegen, the file is assembled in the write pass
+    OutputSink out(outPath);
+    if (!out.ok()) {
+        std::cerr << Color::Red << "Error: Could not open output file!" << Color::Reset << "\n";
+        return 1;
+    }
+
+    std::vector<std::string_view> sections;
+    std::unique_ptr<Compiler_Amd64> compiler;
     if (arch == "amd64") {
-        Compiler_Amd64 compiler;
-        out = compiler.compile(astroot);
+        TargetFeatures features;
+        std::string march = parser.get("-march").value_or("x86-64");
+        if (!ParseMarch(march, features)) {
+            std::cerr << Color::Red << "Error: Unknown -march '" << march << "', expected x86-64, x86-64-v2, x86-64-v3, x86-64-v4 or native" << Color::Reset << "\n";
+            return 1;
+        }
+        features.avx2 = features.avx2 || parser.has("--avx2");
+        if (parser.has("-v"))
+            std::cout << Color::Cyan << "remark: " << Color::Reset << "target " << march << ": " << DescribeFeatures(features) << "\n";
+        CompileOptions options;
+        options.entryBanner = parser.has("--entry-banner");
+        options.module = !moduleName.empty();
+        options.profilePath = options.module ? "" : profilePath; // the importer's runtime writes the counters
+        options.profile = profileLayout;
+        options.ipra = optLevel > 0;
+        if (!instrumentBase.empty() && !options.module) {
+            options.instrumentReport = instrumentBase + ".aolperf";
+            options.instrumentStacks = instrumentBase + ".folded";
+        }
+        compiler = std::make_unique<Compiler_Amd64>(features, options);
+        compiler->compile(astroot, out);
+        sections = compiler->sections();
+        std::string poolSummary = compiler->constants().summary();
+        if (parser.has("-v") && !poolSummary.empty())
+            std::cout << Color::Cyan << "remark: " << Color::Reset << poolSummary << "\n";
+        std::string ipraSummary = compiler->ipraSummary();
+        if (parser.has("-v") && !ipraSummary.empty())
+            std::cout << Color::Cyan << "remark: " << Color::Reset << ipraSummary << "\n";
     } else {
         std::cerr << Color::Red << "Error: Unsupported Architecture '" << arch << "'" << Color::Reset << "\n";
         return 1;
     }
 
-    auto outOpt = parser.get("-o");
-    std::string outPath = outOpt.value_or("a.pasm"); 
+    endPass("codegen");
 
-    std::ofstream outfile(outPath);
-    if (outfile.is_open()) {
-        outfile << out;
-    } else {
-        std::cerr << Color::Red << "Error: Could not open output file!" << Color::Reset << "\n";
+    if (!out.finish(sections)) {
+        std::cerr << Color::Red << "Error: Could not write output file!" << Color::Reset << "\n";
+        return 1;
     }
+    endPass("write");
+    if (parser.has("-v"))
+        std::cout << Color::Cyan << "remark: " << Color::Reset << "wrote " << outPath << ", " << out.textBytes()
+                  << " bytes of .text streamed through a " << OutputSink::BufferBytes << " byte buffer\n";
 
-    outfile.close();
+    if (parser.has("--time-passes")) {
+        double total = 0;
+        std::cout << Color::Bold << "=== Pass Timings (ms) ===" << Color::Reset << "\n";
+        for (auto& [name, ms] : passTimes) {
+            std::cout << "  " << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3) << std::setw(10) << ms << "\n";
+            total += ms;
+            if (name != "import") continue;
+            for (auto& m : moduleLoads)
+                std::cout << "    " << std::left << std::setw(10) << m.name << std::right << std::setw(10) << m.ms
+                          << (m.fromInterface ? "  mapped " : "  parsed ") << m.bytes << " bytes\n";
+        }
+        std::cout << "  " << std::left << std::setw(12) << "total" << std::right << std::setw(10) << total << "\n";
+    }
 
     return 0;
 }
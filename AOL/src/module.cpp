@@ -0,0 +1,343 @@
+#include <module.hpp>
+#include <lexer.hpp>
+#include <parser.hpp>
+
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char InterfaceMagic[4] = {'A', 'O', 'L', 'I'};
+static const uint64_t InterfaceVersion = 1; // bump whenever ASTNodeType or the encoding changes
+static const int MaxNodeDepth = 10000;
+
+uint64_t HashSource(const std::string& source) {
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (unsigned char c : source) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h ^ InterfaceVersion;
+}
+
+std::string ModuleName(const std::shared_ptr<ASTNode>& program) {
+    if (!program) return "";
+    for (auto& child : program->children)
+        if (child && child->type == ASTNodeType::ModuleDecl) return child->name;
+    return "";
+}
+
+static bool isExported(const std::shared_ptr<ASTNode>& node) {
+    if (!node || node->attributes.count("module")) return false;
+    if (node->type == ASTNodeType::FunctionDecl || node->type == ASTNodeType::StructDecl) return true;
+    return node->type == ASTNodeType::VariableDecl;
+}
+
+ModuleInterface BuildInterface(const std::shared_ptr<ASTNode>& program, uint64_t hash) {
+    ModuleInterface module;
+    module.name = ModuleName(program);
+    module.hash = hash;
+    for (auto& child : program->children) {
+        if (child && child->type == ASTNodeType::ImportDecl) module.imports.push_back(child->name);
+        else if (isExported(child)) module.decls.push_back(child);
+    }
+    return module;
+}
+
+// Strings are stored once and referenced by index, which keeps the many
+// repeated identifiers and operators of the bodies down to a byte or two
+namespace {
+struct InterfaceWriter {
+    std::unordered_map<std::string, uint64_t> ids;
+    std::vector<const std::string*> strings;
+    std::string body;
+
+    void varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out += (char)(v | 0x80);
+            v >>= 7;
+        }
+        out += (char)v;
+    }
+
+    void string(const std::string& s) {
+        auto [it, added] = ids.emplace(s, strings.size());
+        if (added) strings.push_back(&it->first);
+        varint(body, it->second);
+    }
+
+    void node(const std::shared_ptr<ASTNode>& n) {
+        if (!n) {
+            body += (char)0xFF;
+            return;
+        }
+        body += (char)n->type;
+        string(n->name);
+        string(n->value);
+        string(n->typeName);
+        varint(body, n->line);
+        varint(body, n->col);
+        varint(body, n->attributes.size());
+        for (auto& [k, v] : n->attributes) {
+            string(k);
+            string(v);
+        }
+        varint(body, n->params.size());
+        for (auto& p : n->params) node(p);
+        varint(body, n->children.size());
+        for (auto& c : n->children) node(c);
+    }
+};
+
+struct InterfaceReader {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+    std::vector<std::string> strings;
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) break;
+            unsigned char b = *p++;
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+
+    const std::string& string() {
+        static const std::string empty;
+        uint64_t i = varint();
+        if (i >= strings.size()) {
+            ok = false;
+            return empty;
+        }
+        return strings[i];
+    }
+
+    // Counts are bounded by the bytes left, every entry takes at least one
+    uint64_t count() {
+        uint64_t n = varint();
+        if (n > (uint64_t)(end - p)) ok = false;
+        return ok ? n : 0;
+    }
+
+    std::shared_ptr<ASTNode> node(int depth) {
+        if (!ok || p >= end || depth > MaxNodeDepth) {
+            ok = false;
+            return nullptr;
+        }
+        unsigned char type = *p++;
+        if (type == 0xFF) return nullptr;
+        if (type > (unsigned char)ASTNodeType::Error) {
+            ok = false;
+            return nullptr;
+        }
+        auto n = std::make_shared<ASTNode>((ASTNodeType)type);
+        n->name = string();
+        n->value = string();
+        n->typeName = string();
+        n->line = (int)varint();
+        n->col = (int)varint();
+        for (uint64_t i = count(); ok && i > 0; --i) {
+            std::string k = string();
+            n->attributes[k] = string();
+        }
+        for (uint64_t i = count(); ok && i > 0; --i) n->params.push_back(node(depth + 1));
+        for (uint64_t i = count(); ok && i > 0; --i) n->children.push_back(node(depth + 1));
+        return n;
+    }
+};
+}
+
+bool WriteInterface(const ModuleInterface& module, const std::string& path) {
+    InterfaceWriter w;
+    w.string(module.name);
+    w.varint(w.body, module.imports.size());
+    for (auto& name : module.imports) w.string(name);
+    w.varint(w.body, module.decls.size());
+    for (auto& decl : module.decls) w.node(decl);
+
+    std::string header(InterfaceMagic, sizeof(InterfaceMagic));
+    w.varint(header, InterfaceVersion);
+    for (int i = 0; i < 8; ++i) header += (char)(module.hash >> (8 * i));
+    w.varint(header, w.strings.size());
+    for (auto* s : w.strings) {
+        w.varint(header, s->size());
+        header += *s;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out << header << w.body;
+    return (bool)out;
+}
+
+bool ReadInterface(const std::string& path, ModuleInterface& module, size_t* bytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(InterfaceMagic) + 9) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    InterfaceReader r;
+    r.p = (const unsigned char*)map;
+    r.end = r.p + size;
+    bool ok = std::equal(InterfaceMagic, InterfaceMagic + sizeof(InterfaceMagic), (const char*)r.p);
+    r.p += sizeof(InterfaceMagic);
+    ok = ok && r.varint() == InterfaceVersion && r.end - r.p >= 8;
+    if (ok) {
+        module.hash = 0;
+        for (int i = 0; i < 8; ++i) module.hash |= (uint64_t)r.p[i] << (8 * i);
+        r.p += 8;
+        for (uint64_t i = r.count(); r.ok && i > 0; --i) {
+            uint64_t len = r.varint();
+            if (len > (uint64_t)(r.end - r.p)) {
+                r.ok = false;
+                break;
+            }
+            r.strings.emplace_back((const char*)r.p, len);
+            r.p += len;
+        }
+        module.name = r.string();
+        module.imports.clear();
+        for (uint64_t i = r.count(); r.ok && i > 0; --i) module.imports.push_back(r.string());
+        module.decls.clear();
+        for (uint64_t i = r.count(); r.ok && i > 0; --i) module.decls.push_back(r.node(0));
+        ok = r.ok && r.p == r.end;
+    }
+
+    munmap(map, size);
+    if (bytes) *bytes = size;
+    return ok;
+}
+
+static bool fileExists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// A current interface is mapped, otherwise the source is parsed and the
+// interface written next to it for the next importer
+static bool loadModule(const std::string& name, const std::vector<std::string>& searchPath, ModuleInterface& module, ModuleLoad& load) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto& dir : searchPath) {
+        std::string base = (dir.empty() ? "" : dir + "/") + name;
+        std::string src = base + ".aol", iface = base + ".aoli";
+        bool haveSrc = fileExists(src), haveIface = fileExists(iface);
+        if (!haveSrc && !haveIface) continue;
+
+        load = {name, iface, true, 0, 0};
+        std::string source;
+        uint64_t hash = 0;
+        if (haveSrc) {
+            std::ifstream in(src);
+            source.assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            hash = HashSource(source);
+        }
+        bool current = haveIface && ReadInterface(iface, module, &load.bytes) &&
+                       module.name == name && (!haveSrc || module.hash == hash);
+        if (!current) {
+            if (!haveSrc) {
+                std::cerr << "Error: Module interface '" << iface << "' is corrupt or for another module\n";
+                return false;
+            }
+            AOL_Lexer lexer(source);
+            auto tokens = lexer.tokenize();
+            AOL_Parser parser(tokens);
+            auto program = parser.parseProgram();
+            if (ModuleName(program) != name) {
+                std::cerr << "Error: '" << src << "' does not declare module '" << name << "'\n";
+                return false;
+            }
+            module = BuildInterface(program, hash);
+            WriteInterface(module, iface); // a read-only tree just means parsing again next time
+            load.path = src;
+            load.fromInterface = false;
+            load.bytes = source.size();
+        }
+        load.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+    std::cerr << "Error: Module '" << name << "' not found\n";
+    return false;
+}
+
+bool ImportModules(const std::shared_ptr<ASTNode>& program, const std::vector<std::string>& searchPath, std::vector<ModuleLoad>& loads) {
+    std::vector<std::string> pending;
+    std::vector<std::shared_ptr<ASTNode>> own;
+    std::unordered_map<std::string, std::string> declaredBy; // top-level name -> module, "" for the program
+    for (auto& child : program->children) {
+        if (child && child->type == ASTNodeType::ImportDecl) pending.push_back(child->name);
+        else own.push_back(child);
+        if (isExported(child)) declaredBy[child->name] = "";
+    }
+    if (pending.empty()) return true;
+
+    bool ok = true;
+    std::unordered_set<std::string> loaded = {ModuleName(program)};
+    std::vector<std::shared_ptr<ASTNode>> imported;
+    while (!pending.empty()) {
+        std::string name = pending.back();
+        pending.pop_back();
+        if (!loaded.insert(name).second) continue;
+
+        ModuleInterface module;
+        ModuleLoad load;
+        if (!loadModule(name, searchPath, module, load)) {
+            ok = false;
+            continue;
+        }
+        loads.push_back(load);
+        for (auto& dep : module.imports) pending.push_back(dep);
+        for (auto& decl : module.decls) {
+            if (!decl) continue;
+            auto [it, added] = declaredBy.emplace(decl->name, name);
+            if (!added) {
+                std::cerr << "Error: '" << decl->name << "' from module '" << name << "' is already declared"
+                          << (it->second.empty() ? "" : " by module '" + it->second + "'") << "\n";
+                ok = false;
+                continue;
+            }
+            decl->attributes["module"] = name;
+            imported.push_back(decl);
+        }
+    }
+
+    // Keep only the imported functions something outside them ends up calling
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> importedFns;
+    for (auto& decl : imported)
+        if (decl->type == ASTNodeType::FunctionDecl) importedFns[decl->name] = decl;
+    std::unordered_set<std::string> used;
+    std::function<void(const std::shared_ptr<ASTNode>&)> mark = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        if (node->type == ASTNodeType::CallExpr && importedFns.count(node->name) && used.insert(node->name).second)
+            mark(importedFns[node->name]);
+        for (auto& child : node->children) mark(child);
+    };
+    for (auto& child : own) mark(child);
+    for (auto& decl : imported)
+        if (decl->type != ASTNodeType::FunctionDecl) mark(decl);
+
+    program->children.clear();
+    for (auto& decl : imported)
+        if (decl->type != ASTNodeType::FunctionDecl || used.count(decl->name)) program->children.push_back(decl);
+    for (auto& child : own) program->children.push_back(child);
+    return ok;
+}
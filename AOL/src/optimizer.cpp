@@ -0,0 +1,1603 @@
+#include <optimizer.hpp>
+#include <profile.hpp>
+#include <types.hpp>
+#include <bits.hpp>
+
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+
+static std::shared_ptr<ASTNode> makeLiteral(int64_t v, int line = 0, int col = 0) {
+    auto node = std::make_shared<ASTNode>(ASTNodeType::Literal, line, col);
+    node->value = std::to_string(v);
+    return node;
+}
+
+static std::shared_ptr<ASTNode> makeIdent(const std::string& name, int line = 0, int col = 0) {
+    return std::make_shared<ASTNode>(ASTNodeType::Identifier, line, col, name);
+}
+
+static std::shared_ptr<ASTNode> makeBinary(const std::string& op, std::shared_ptr<ASTNode> lhs, std::shared_ptr<ASTNode> rhs) {
+    auto node = std::make_shared<ASTNode>(ASTNodeType::BinaryExpr, lhs->line, lhs->col, op);
+    node->children.push_back(lhs);
+    node->children.push_back(rhs);
+    return node;
+}
+
+static std::shared_ptr<ASTNode> makeAssign(const std::string& name, std::shared_ptr<ASTNode> value) {
+    auto node = std::make_shared<ASTNode>(ASTNodeType::AssignExpr, value->line, value->col, "=");
+    node->children.push_back(makeIdent(name, value->line, value->col));
+    node->children.push_back(value);
+    return node;
+}
+
+static std::shared_ptr<ASTNode> makeLet(const std::string& name, std::shared_ptr<ASTNode> init) {
+    auto node = std::make_shared<ASTNode>(ASTNodeType::VariableDecl, init->line, init->col, name);
+    node->children.push_back(init);
+    return node;
+}
+
+static bool intLiteral(const std::shared_ptr<ASTNode>& node, int64_t* out = nullptr) {
+    if (!node || node->type != ASTNodeType::Literal || node->name == "string" || node->value.empty()) return false;
+    size_t i = (node->value[0] == '-') ? 1 : 0;
+    if (i == node->value.size()) return false;
+    for (size_t k = i; k < node->value.size(); ++k)
+        if (!std::isdigit((unsigned char)node->value[k])) return false;
+    try {
+        int64_t v = std::stoll(node->value);
+        if (out) *out = v;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+static bool isUnsignedType(const std::string& type) {
+    const IntegerType* it = FindIntegerType(type);
+    return it && !it->isSigned && !it->isBool;
+}
+
+static bool isIdent(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+    return node && node->type == ASTNodeType::Identifier && node->name == name;
+}
+
+static bool isComparison(const std::string& op) {
+    return op == "==" || op == "!=" || op == "<" || op == "<=" || op == ">" || op == ">=";
+}
+
+// Division can trap, so it is only treated as pure when the divisor is a safe constant
+static bool mayTrap(const std::shared_ptr<ASTNode>& node) {
+    if (node->type != ASTNodeType::BinaryExpr || (node->name != "/" && node->name != "%")) return false;
+    int64_t d;
+    return !intLiteral(node->children[1], &d) || d == 0 || d == -1;
+}
+
+static int countRefs(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+    if (!node) return 0;
+    int n = isIdent(node, name) ? 1 : 0;
+    for (auto& child : node->children) n += countRefs(child, name);
+    return n;
+}
+
+// Variables an asm block writes through its out and inout operands
+static std::vector<std::string> asmOutputs(const std::shared_ptr<ASTNode>& node) {
+    std::vector<std::string> names;
+    if (node->type != ASTNodeType::AsmStmt) return names;
+    for (size_t i = 0; i < node->params.size() && i < node->children.size(); ++i)
+        if (node->params[i]->attributes["dir"] != "in" && node->children[i]->type == ASTNodeType::Identifier)
+            names.push_back(node->children[i]->name);
+    return names;
+}
+
+// volatile or clobbering "memory": treated like a call to something unknown
+static bool asmHasEffects(const std::shared_ptr<ASTNode>& node) {
+    if (node->type != ASTNodeType::AsmStmt) return false;
+    auto clobber = node->attributes.find("clobber");
+    return node->attributes.count("volatile") ||
+           (clobber != node->attributes.end() && ("," + clobber->second + ",").find(",memory,") != std::string::npos);
+}
+
+static int countDefs(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+    if (!node) return 0;
+    int n = 0;
+    if (node->type == ASTNodeType::AssignExpr && isIdent(node->children[0], name)) n++;
+    for (auto& out : asmOutputs(node)) n += out == name;
+    if (node->type == ASTNodeType::VariableDecl && node->name == name) n++;
+    for (auto& child : node->children) n += countDefs(child, name);
+    return n;
+}
+
+// Turns an optional statement slot into a StmtBlock so more statements can be appended
+static std::shared_ptr<ASTNode> ensureBlock(std::shared_ptr<ASTNode>& slot, int line, int col) {
+    if (slot && slot->type == ASTNodeType::StmtBlock) return slot;
+    auto block = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, line, col);
+    if (slot) block->children.push_back(slot);
+    slot = block;
+    return block;
+}
+
+std::string ExprToString(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return "";
+    switch (node->type) {
+        case ASTNodeType::Literal:
+            return node->name == "string" ? "\"" + node->value + "\"" : node->value;
+        case ASTNodeType::Identifier:
+            return node->name;
+        case ASTNodeType::BinaryExpr:
+            return "(" + ExprToString(node->children[0]) + " " + node->name + " " + ExprToString(node->children[1]) + ")";
+        case ASTNodeType::UnaryExpr:
+            return (node->name == "await" ? "await " : node->name) + ExprToString(node->children[0]);
+        case ASTNodeType::AssignExpr:
+            return ExprToString(node->children[0]) + " = " + ExprToString(node->children[1]);
+        case ASTNodeType::MemberExpr:
+            return ExprToString(node->children[0]) + "." + node->name;
+        case ASTNodeType::CallExpr: {
+            std::string s = node->name + "(";
+            for (size_t i = 0; i < node->children.size(); ++i) {
+                if (i) s += ", ";
+                s += ExprToString(node->children[i]);
+            }
+            return s + ")";
+        }
+        default:
+            return "?";
+    }
+}
+
+std::shared_ptr<ASTNode> CloneAST(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return nullptr;
+    auto copy = std::make_shared<ASTNode>(*node);
+    for (auto& child : copy->children) child = CloneAST(child);
+    for (auto& param : copy->params) param = CloneAST(param);
+    return copy;
+}
+
+static int countNodes(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return 0;
+    int n = 1;
+    for (auto& child : node->children) n += countNodes(child);
+    return n;
+}
+
+// break/continue that leave this loop; nested loops own their own and a break
+// inside a switch only leaves the switch
+static bool hasLoopExit(const std::shared_ptr<ASTNode>& node, bool inSwitch = false) {
+    if (!node) return false;
+    if (node->type == ASTNodeType::BreakStmt) return !inSwitch;
+    if (node->type == ASTNodeType::ContinueStmt) return true;
+    if (node->type == ASTNodeType::WhileStmt || node->type == ASTNodeType::ForStmt) return false;
+    if (node->type == ASTNodeType::SwitchStmt) inSwitch = true;
+    for (auto& child : node->children)
+        if (hasLoopExit(child, inSwitch)) return true;
+    return false;
+}
+
+// Moves a for's init ahead of the loop, a block made for temporaries is spliced
+// in so its names stay visible to the statements after it
+static void appendInit(const std::shared_ptr<ASTNode>& block, const std::shared_ptr<ASTNode>& init) {
+    if (!init) return;
+    if (init->type == ASTNodeType::StmtBlock) block->children.insert(block->children.end(), init->children.begin(), init->children.end());
+    else block->children.push_back(init);
+}
+
+static void substituteConstants(std::shared_ptr<ASTNode>& node, const std::unordered_map<std::string, int64_t>& env) {
+    if (!node) return;
+    if (node->type == ASTNodeType::Identifier) {
+        auto it = env.find(node->name);
+        if (it != env.end()) node = makeLiteral(it->second, node->line, node->col);
+        return;
+    }
+    for (auto& child : node->children) substituteConstants(child, env);
+}
+
+// Built-in calls that may be value numbered like any other pure expression.
+// The atomic_* built-ins are left out on purpose, as unknown calls they keep
+// loads and stores of everything but locals from moving across them
+static const std::unordered_set<std::string> PureBuiltins = {
+    "shuffle", "select", "vmin", "vmax", "hsum", "hmin", "hmax", "extract",
+};
+
+AOL_Optimizer::AOL_Optimizer(int level) : level(level) {}
+
+// Functions whose body is a single `ret expr;` over their untyped parameters,
+// a call with plain arguments can be replaced by the expression itself
+static bool isInlineExpr(const std::shared_ptr<ASTNode>& node, const std::unordered_set<std::string>& params) {
+    if (!node) return false;
+    switch (node->type) {
+        case ASTNodeType::Literal: return true;
+        case ASTNodeType::Identifier: return params.count(node->name) != 0;
+        case ASTNodeType::UnaryExpr:
+            if (node->name == "&") return false;
+            [[fallthrough]];
+        case ASTNodeType::BinaryExpr:
+            return std::all_of(node->children.begin(), node->children.end(), [&](auto& c) { return isInlineExpr(c, params); });
+        default: return false;
+    }
+}
+
+static bool isInlineCandidate(const std::shared_ptr<ASTNode>& fn) {
+    if (fn->attributes.count("extern") || fn->attributes.count("noinline") || fn->attributes.count("async") || !fn->typeName.empty()) return false;
+    if (fn->children.size() != 1 || !fn->children[0] || fn->children[0]->type != ASTNodeType::ReturnStmt ||
+        fn->children[0]->children.size() != 1)
+        return false;
+    std::unordered_set<std::string> params;
+    for (auto& p : fn->params) {
+        if (!p->typeName.empty()) return false;
+        params.insert(p->name);
+    }
+    return isInlineExpr(fn->children[0]->children[0], params);
+}
+
+static std::shared_ptr<ASTNode> substituteParams(const std::shared_ptr<ASTNode>& expr, const std::unordered_map<std::string, std::shared_ptr<ASTNode>>& args) {
+    if (expr->type == ASTNodeType::Identifier) return CloneAST(args.at(expr->name));
+    auto copy = std::make_shared<ASTNode>(*expr);
+    for (auto& child : copy->children) child = substituteParams(child, args);
+    return copy;
+}
+
+void AOL_Optimizer::run(const std::shared_ptr<ASTNode>& program) {
+    if (!program || level <= 0) return;
+    findPureFunctions(program);
+    allocFunctions.clear();
+    freeFunctions.clear();
+    inlineCandidates.clear();
+    globalTypes.clear();
+    for (auto& child : program->children) {
+        if (child && (child->type == ASTNodeType::FunctionDecl || child->type == ASTNodeType::VariableDecl)) globalTypes[child->name] = child->typeName;
+        if (!child || child->type != ASTNodeType::FunctionDecl) continue;
+        if (child->attributes.count("alloc")) allocFunctions.insert(child->name);
+        if (child->attributes.count("free")) freeFunctions.insert(child->name);
+        if (child->attributes.count("const")) constEval.define(child);
+        if (isInlineCandidate(child)) inlineCandidates[child->name] = child;
+    }
+    for (auto& child : program->children) {
+        if (child && child->type == ASTNodeType::FunctionDecl)
+            optimizeFunction(child);
+    }
+}
+
+void AOL_Optimizer::optimizeFunction(const std::shared_ptr<ASTNode>& fn) {
+    currentFunction = fn;
+    functionLocals.clear();
+    narrowLocals.clear();
+    varTypes.clear();
+    auto declare = [&](const std::string& name, const std::string& type) {
+        auto global = globalTypes.find(name);
+        auto [it, fresh] = varTypes.emplace(name, type);
+        if ((!fresh && it->second != type) || (global != globalTypes.end() && global->second != type)) it->second = "?";
+    };
+    for (auto& param : fn->params) {
+        functionLocals.insert(param->name);
+        if (IsNarrowType(param->typeName)) narrowLocals.insert(param->name);
+        declare(param->name, param->typeName);
+    }
+
+    std::function<void(const std::shared_ptr<ASTNode>&)> collectLocals = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        if (node->type == ASTNodeType::VariableDecl) functionLocals.insert(node->name);
+        if (node->type == ASTNodeType::VariableDecl) declare(node->name, node->typeName);
+        if (node->type == ASTNodeType::VariableDecl && IsNarrowType(node->typeName)) narrowLocals.insert(node->name);
+        for (auto& child : node->children) collectLocals(child);
+    };
+    collectLocals(fn);
+
+    if (!inlineCandidates.empty())
+        for (auto& stmt : fn->children) inlineHotCalls(stmt);
+    for (auto& stmt : fn->children) foldConstants(stmt);
+    removeDeadAllocations(fn);
+    removeDeadAsm(fn);
+
+    std::vector<std::unique_ptr<LoopInfo>> loops;
+    findLoops(fn, nullptr, loops);
+
+    // Pre-order puts parents first, walking backwards visits inner loops first
+    for (auto it = loops.rbegin(); it != loops.rend(); ++it) reduceStrength(**it);
+    for (auto it = loops.rbegin(); it != loops.rend(); ++it) hoistInvariants(**it);
+    for (auto it = loops.rbegin(); it != loops.rend(); ++it) unrollLoop(**it);
+
+    numberValues(fn);
+
+    currentFunction = nullptr;
+}
+
+void AOL_Optimizer::findLoops(const std::shared_ptr<ASTNode>& block, LoopInfo* parent, std::vector<std::unique_ptr<LoopInfo>>& loops) {
+    for (auto& stmt : block->children) {
+        if (!stmt) continue;
+        switch (stmt->type) {
+            case ASTNodeType::WhileStmt:
+            case ASTNodeType::ForStmt: {
+                // A parallel for keeps its shape for the outlining, loops inside it start afresh
+                if (stmt->attributes.count("parallel")) {
+                    findLoops(stmt->children.back(), nullptr, loops);
+                    break;
+                }
+                auto loop = std::make_unique<LoopInfo>();
+                loop->node = stmt;
+                loop->block = block;
+                loop->parent = parent;
+                loop->depth = parent ? parent->depth + 1 : 1;
+                LoopInfo* self = loop.get();
+                loops.push_back(std::move(loop));
+                findLoops(stmt->children.back(), self, loops); // body
+                break;
+            }
+            case ASTNodeType::IfStmt:
+                for (size_t i = 1; i < stmt->children.size(); ++i)
+                    findLoops(stmt->children[i], parent, loops);
+                break;
+            case ASTNodeType::SwitchStmt:
+                for (size_t i = 1; i < stmt->children.size(); ++i)
+                    findLoops(stmt->children[i]->children[0], parent, loops);
+                break;
+            case ASTNodeType::StmtBlock:
+                findLoops(stmt, parent, loops);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void AOL_Optimizer::computeDefs(LoopInfo& loop) {
+    loop.defs.clear();
+    loop.hasCalls = false;
+    std::function<void(const std::shared_ptr<ASTNode>&)> walk = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        if (node->type == ASTNodeType::AssignExpr && node->children[0]->type == ASTNodeType::Identifier)
+            loop.defs.insert(node->children[0]->name);
+        if (node->type == ASTNodeType::VariableDecl) loop.defs.insert(node->name);
+        for (auto& out : asmOutputs(node)) loop.defs.insert(out);
+        if (node->type == ASTNodeType::CallExpr && clobbersGlobals(node->name)) loop.hasCalls = true;
+        if (asmHasEffects(node)) loop.hasCalls = true;
+        for (auto& child : node->children) walk(child);
+    };
+    walk(loop.node);
+}
+
+bool AOL_Optimizer::isInvariant(const std::shared_ptr<ASTNode>& expr, const LoopInfo& loop) const {
+    if (!expr) return false;
+    switch (expr->type) {
+        case ASTNodeType::Literal:
+            return true;
+        case ASTNodeType::Identifier:
+            // Anything that isn't a local could be written by a callee
+            return !loop.defs.count(expr->name) && (functionLocals.count(expr->name) || !loop.hasCalls);
+        case ASTNodeType::BinaryExpr:
+        case ASTNodeType::UnaryExpr:
+            if (mayTrap(expr)) return false;
+            for (auto& child : expr->children)
+                if (!isInvariant(child, loop)) return false;
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::vector<InductionVar> AOL_Optimizer::findInductionVars(const LoopInfo& loop) const {
+    std::vector<InductionVar> ivs;
+    if (loop.node->type != ASTNodeType::ForStmt || !loop.node->children[2]) return ivs;
+
+    auto& step = loop.node->children[2];
+    std::vector<std::shared_ptr<ASTNode>> updates;
+    if (step->type == ASTNodeType::StmtBlock) updates = step->children;
+    else updates.push_back(step);
+
+    for (auto& u : updates) {
+        if (!u || u->type != ASTNodeType::AssignExpr || u->children[0]->type != ASTNodeType::Identifier) continue;
+        const std::string& name = u->children[0]->name;
+        auto& rhs = u->children[1];
+        if (rhs->type != ASTNodeType::BinaryExpr || (rhs->name != "+" && rhs->name != "-")) continue;
+
+        int64_t c;
+        if (isIdent(rhs->children[0], name) && intLiteral(rhs->children[1], &c)) {
+            if (rhs->name == "-") c = (int64_t)(0 - (uint64_t)c);
+        } else if (rhs->name == "+" && intLiteral(rhs->children[0], &c) && isIdent(rhs->children[1], name)) {
+            // c + v
+        } else {
+            continue;
+        }
+
+        // The step must be the only write in the loop. Narrow integers wrap on every
+        // store, which the 64-bit trip count and stride reasoning doesn't model.
+        if (!functionLocals.count(name) || narrowLocals.count(name)) continue;
+        if (countDefs(step, name) != 1) continue;
+        if (countDefs(loop.node->children[1], name) || countDefs(loop.node->children[3], name)) continue;
+        ivs.push_back({name, c});
+    }
+    return ivs;
+}
+
+// Only calls the profile marked hot, without one nothing is inlined
+void AOL_Optimizer::inlineHotCalls(std::shared_ptr<ASTNode>& node) {
+    if (!node) return;
+    for (auto& child : node->children) inlineHotCalls(child);
+    if (node->type != ASTNodeType::CallExpr || !node->attributes.count("hot") || node->name == currentFunction->name) return;
+    auto callee = inlineCandidates.find(node->name);
+    if (callee == inlineCandidates.end() || callee->second->params.size() != node->children.size()) return;
+
+    // Arguments are substituted for every use, so they must be free to repeat
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> args;
+    for (size_t i = 0; i < node->children.size(); ++i) {
+        auto& arg = node->children[i];
+        bool plain = arg && (arg->type == ASTNodeType::Literal || (arg->type == ASTNodeType::Identifier && functionLocals.count(arg->name)));
+        if (!plain) return;
+        args[callee->second->params[i]->name] = arg;
+    }
+    remark(node, "inlined hot call to " + node->name + " (" + node->attributes["count"] + " calls in the profile)");
+    auto expr = substituteParams(callee->second->children[0]->children[0], args);
+    expr->line = node->line;
+    expr->col = node->col;
+    node = expr;
+}
+
+void AOL_Optimizer::foldConstants(std::shared_ptr<ASTNode>& node) {
+    if (!node) return;
+    for (auto& child : node->children) foldConstants(child);
+
+    if (node->type == ASTNodeType::CallExpr && constEval.isConst(node->name) && !node->attributes.count("runtime") &&
+        std::all_of(node->children.begin(), node->children.end(), [](auto& arg) { return intLiteral(arg); })) {
+        std::string call = ExprToString(node), why;
+        if (auto v = constEval.evaluate(node, why)) {
+            remark(node, "evaluated " + call + " = " + std::to_string(*v) + " at compile time");
+            node = makeLiteral(*v, node->line, node->col);
+        } else {
+            remark(node, call + " left to runtime: " + why);
+        }
+        return;
+    }
+
+    if (node->type == ASTNodeType::CallExpr && IsBitBuiltin(node->name)) {
+        std::vector<int64_t> args;
+        for (auto& arg : node->children) {
+            int64_t v;
+            if (!intLiteral(arg, &v)) return;
+            args.push_back(v);
+        }
+        if (auto v = EvaluateBitBuiltin(node->name, args)) node = makeLiteral(*v, node->line, node->col);
+        return;
+    }
+
+    int64_t a, b;
+    if (node->type == ASTNodeType::UnaryExpr && intLiteral(node->children[0], &a)) {
+        uint64_t ua = (uint64_t)a;
+        if (node->name == "-") node = makeLiteral((int64_t)(0 - ua), node->line, node->col);
+        else if (node->name == "~") node = makeLiteral((int64_t)~ua, node->line, node->col);
+        else if (node->name == "!") node = makeLiteral(a == 0, node->line, node->col);
+        else if (node->name == "+") node = node->children[0];
+        return;
+    }
+
+    if (node->type != ASTNodeType::BinaryExpr || !intLiteral(node->children[0], &a) || !intLiteral(node->children[1], &b))
+        return;
+
+    // Wrapping 64-bit arithmetic, matching what the generated code computes
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    const std::string& op = node->name;
+    int64_t r;
+    if (op == "+") r = (int64_t)(ua + ub);
+    else if (op == "-") r = (int64_t)(ua - ub);
+    else if (op == "*") r = (int64_t)(ua * ub);
+    else if (op == "/" || op == "%") {
+        if (b == 0 || (a == INT64_MIN && b == -1)) return;
+        r = op == "/" ? a / b : a % b;
+    }
+    else if (op == "&") r = a & b;
+    else if (op == "|") r = a | b;
+    else if (op == "^") r = a ^ b;
+    else if (op == "<<") r = (int64_t)(ua << (b & 63));
+    else if (op == ">>") r = a >> (b & 63);
+    else if (op == "==") r = a == b;
+    else if (op == "!=") r = a != b;
+    else if (op == "<") r = a < b;
+    else if (op == "<=") r = a <= b;
+    else if (op == ">") r = a > b;
+    else if (op == ">=") r = a >= b;
+    else if (op == "&&") r = a && b;
+    else if (op == "||") r = a || b;
+    else return;
+
+    node = makeLiteral(r, node->line, node->col);
+}
+
+// Replaces v * k (k constant or loop invariant) by a derived induction variable
+// that is stepped by an add next to v's own update.
+void AOL_Optimizer::reduceStrength(LoopInfo& loop) {
+    if (loop.node->type != ASTNodeType::ForStmt) return;
+    computeDefs(loop);
+
+    auto& init = loop.node->children[0];
+    auto& step = loop.node->children[2];
+
+    for (auto& iv : findInductionVars(loop)) {
+        struct Derived {
+            std::shared_ptr<ASTNode> factor;
+            std::vector<std::shared_ptr<ASTNode>*> uses;
+        };
+        std::vector<std::pair<std::string, Derived>> groups;
+
+        std::function<void(std::shared_ptr<ASTNode>&)> scan = [&](std::shared_ptr<ASTNode>& node) {
+            if (!node) return;
+            if (node->type == ASTNodeType::BinaryExpr && node->name == "*") {
+                std::shared_ptr<ASTNode> factor;
+                if (isIdent(node->children[0], iv.name)) factor = node->children[1];
+                else if (isIdent(node->children[1], iv.name)) factor = node->children[0];
+
+                bool usable = factor && (intLiteral(factor) ||
+                    (factor->type == ASTNodeType::Identifier && factor->name != iv.name && isInvariant(factor, loop)));
+                if (usable) {
+                    std::string key = ExprToString(factor);
+                    auto it = std::find_if(groups.begin(), groups.end(), [&](auto& g) { return g.first == key; });
+                    if (it == groups.end()) {
+                        groups.push_back({key, {factor, {}}});
+                        it = groups.end() - 1;
+                    }
+                    it->second.uses.push_back(&node);
+                    return;
+                }
+            }
+            for (auto& child : node->children) scan(child);
+        };
+        scan(loop.node->children[1]); // condition
+        scan(loop.node->children[3]); // body
+
+        std::string lftrTemp;
+        int64_t lftrScale = 0;
+
+        for (auto& [key, d] : groups) {
+            int line = loop.node->line, col = loop.node->col;
+
+            // The derived variable takes the product's type, a u64 product stays unsigned
+            auto product = makeBinary("*", makeIdent(iv.name, line, col), d.factor);
+            std::string type = typeOf(product);
+            if (type == "?") continue;
+            std::string temp = newTemp("iv");
+
+            auto initBlock = ensureBlock(init, line, col);
+            auto decl = makeLet(temp, product);
+            decl->typeName = varTypes[temp] = type;
+            initBlock->children.push_back(decl);
+
+            std::shared_ptr<ASTNode> stride;
+            int64_t k;
+            if (intLiteral(d.factor, &k)) {
+                stride = makeLiteral((int64_t)((uint64_t)k * (uint64_t)iv.step), line, col);
+                if (lftrTemp.empty() && k > 0) {
+                    lftrTemp = temp;
+                    lftrScale = k;
+                }
+            } else if (iv.step == 1) {
+                stride = makeIdent(d.factor->name, line, col);
+            } else {
+                std::string strideTemp = newTemp("ivstep");
+                auto strideDecl = makeLet(strideTemp, makeBinary("*", makeIdent(d.factor->name, line, col), makeLiteral(iv.step, line, col)));
+                strideDecl->typeName = varTypes[strideTemp] = type;
+                initBlock->children.push_back(strideDecl);
+                stride = makeIdent(strideTemp, line, col);
+            }
+
+            auto stepBlock = ensureBlock(step, line, col);
+            stepBlock->children.push_back(makeAssign(temp, makeBinary("+", makeIdent(temp, line, col), stride)));
+
+            for (auto* use : d.uses) *use = makeIdent(temp, (*use)->line, (*use)->col);
+
+            remark(loop.node, "strength-reduced " + ExprToString(makeBinary("*", makeIdent(iv.name), d.factor)) +
+                " to induction variable " + temp + " stepped by " + ExprToString(stride) +
+                " (" + std::to_string(d.uses.size()) + " use" + (d.uses.size() == 1 ? "" : "s") + ")");
+        }
+
+        if (!lftrTemp.empty()) replaceExitTest(loop, iv, lftrTemp, lftrScale);
+    }
+}
+
+// Linear function test replacement: when v only feeds its exit test and a derived
+// v * scale exists, test the derived variable instead and drop v's update.
+void AOL_Optimizer::replaceExitTest(LoopInfo& loop, const InductionVar& iv, const std::string& derived, int64_t scale) {
+    auto& init = loop.node->children[0];
+    auto& cond = loop.node->children[1];
+    auto& step = loop.node->children[2];
+
+    if (!cond || cond->type != ASTNodeType::BinaryExpr || !isComparison(cond->name) || cond->name == "==" || cond->name == "!=") return;
+    int64_t bound, start = 0;
+    if (!isIdent(cond->children[0], iv.name) || !intLiteral(cond->children[1], &bound)) return;
+
+    bool upward = cond->name == "<" || cond->name == "<=";
+    if ((upward && iv.step <= 0) || (!upward && iv.step >= 0)) return;
+
+    // v has to be born in this loop's init with a known value and be dead outside it
+    bool declared = false;
+    if (init && init->type == ASTNodeType::StmtBlock) {
+        for (auto& s : init->children)
+            if (s->type == ASTNodeType::VariableDecl && s->name == iv.name && !s->children.empty() && intLiteral(s->children[0], &start))
+                declared = true;
+    }
+    if (!declared) return;
+
+    // Besides the derived inits, v may appear only in the test and its own update
+    int outside = countRefs(currentFunction, iv.name) - countRefs(loop.node, iv.name);
+    if (outside != 0 || countRefs(loop.node->children[3], iv.name) != 0) return;
+    if (countRefs(cond, iv.name) != 1 || countRefs(step, iv.name) != 2) return;
+
+    // Every value v takes, scaled, has to stay exact or the comparison changes meaning
+    auto fits = [&](int64_t v) {
+        __int128 p = (__int128)v * scale;
+        return p >= INT64_MIN && p <= INT64_MAX;
+    };
+    __int128 last = (__int128)bound + iv.step;
+    if (last < INT64_MIN || last > INT64_MAX) return;
+    if (!fits(start) || !fits(bound) || !fits((int64_t)last)) return;
+
+    // An unsigned test stays unsigned, its values have to be the same read as signed
+    auto isUnsigned = isUnsignedCompare(cond->children[0], cond->children[1]);
+    if (!isUnsigned || (*isUnsigned && (start < 0 || bound < 0 || last < 0))) return;
+    auto lhs = makeIdent(derived, cond->line, cond->col);
+    auto rhs = makeLiteral(bound * scale, cond->line, cond->col);
+    if (isUnsignedCompare(lhs, rhs) != isUnsigned) return;
+
+    cond->children[0] = lhs;
+    cond->children[1] = rhs;
+
+    auto& updates = step->children;
+    updates.erase(std::remove_if(updates.begin(), updates.end(), [&](const std::shared_ptr<ASTNode>& u) {
+        return u->type == ASTNodeType::AssignExpr && isIdent(u->children[0], iv.name);
+    }), updates.end());
+
+    remark(loop.node, "exit test rewritten to " + ExprToString(cond) + ", induction variable " + iv.name + " removed");
+}
+
+void AOL_Optimizer::hoistInvariants(LoopInfo& loop) {
+    for (LoopInfo* l = &loop; l; l = l->parent) computeDefs(*l);
+
+    auto isCandidate = [&](const std::shared_ptr<ASTNode>& expr) {
+        if (expr->type != ASTNodeType::BinaryExpr && expr->type != ASTNodeType::UnaryExpr) return false;
+        if (expr->type == ASTNodeType::UnaryExpr && expr->children[0]->type == ASTNodeType::Literal) return false;
+        return isInvariant(expr, loop);
+    };
+
+    std::vector<std::shared_ptr<ASTNode>*> slots;
+    std::function<void(std::shared_ptr<ASTNode>&)> scanExpr = [&](std::shared_ptr<ASTNode>& expr) {
+        if (!expr) return;
+        if (isCandidate(expr)) {
+            slots.push_back(&expr);
+            return;
+        }
+        if (expr->type == ASTNodeType::AssignExpr) {
+            scanExpr(expr->children[1]);
+            return;
+        }
+        for (auto& child : expr->children) scanExpr(child);
+    };
+    std::function<void(std::shared_ptr<ASTNode>&)> scanStmt = [&](std::shared_ptr<ASTNode>& stmt) {
+        if (!stmt) return;
+        switch (stmt->type) {
+            case ASTNodeType::StmtBlock:
+                for (auto& child : stmt->children) scanStmt(child);
+                break;
+            case ASTNodeType::IfStmt:
+                scanExpr(stmt->children[0]);
+                for (size_t i = 1; i < stmt->children.size(); ++i) scanStmt(stmt->children[i]);
+                break;
+            case ASTNodeType::SwitchStmt:
+                scanExpr(stmt->children[0]);
+                for (size_t i = 1; i < stmt->children.size(); ++i) scanStmt(stmt->children[i]->children[0]);
+                break;
+            case ASTNodeType::WhileStmt:
+                scanExpr(stmt->children[0]);
+                scanStmt(stmt->children[1]);
+                break;
+            case ASTNodeType::ForStmt:
+                scanStmt(stmt->children[0]);
+                scanExpr(stmt->children[1]);
+                scanStmt(stmt->children[2]);
+                scanStmt(stmt->children[3]);
+                break;
+            case ASTNodeType::AssignExpr:
+                scanExpr(stmt->children[1]);
+                break;
+            default:
+                // Statement-level expressions are only searched, never hoisted whole
+                for (auto& child : stmt->children) scanExpr(child);
+                break;
+        }
+    };
+
+    auto& node = loop.node;
+    if (node->type == ASTNodeType::WhileStmt) {
+        scanExpr(node->children[0]);
+        scanStmt(node->children[1]);
+    } else {
+        scanExpr(node->children[1]);
+        scanStmt(node->children[2]);
+        scanStmt(node->children[3]);
+    }
+
+    struct Hoist {
+        LoopInfo* target;
+        std::shared_ptr<ASTNode> decl;
+    };
+    std::vector<Hoist> hoists;
+    std::unordered_map<std::string, std::string> temps;
+
+    for (auto* slot : slots) {
+        // Move as far out as the expression stays invariant
+        LoopInfo* target = &loop;
+        for (LoopInfo* p = loop.parent; p && isInvariant(*slot, *p); p = p->parent) target = p;
+
+        std::string key = ExprToString(*slot) + "@" + std::to_string((uintptr_t)target);
+        // The temporary takes the value's type, a u64 stays unsigned and a pointer keeps its pointee
+        std::string type = typeOf(*slot);
+        if (type == "?") continue;
+
+        auto it = temps.find(key);
+        if (it == temps.end()) {
+            std::string temp = newTemp("licm");
+            it = temps.emplace(key, temp).first;
+            auto decl = makeLet(temp, *slot);
+            decl->typeName = varTypes[temp] = type;
+            hoists.push_back({target, decl});
+            remark(*slot, "hoisted loop-invariant " + ExprToString(*slot) + " out of loop at " +
+                std::to_string(target->node->line) + ":" + std::to_string(target->node->col));
+        }
+        *slot = makeIdent(it->second, (*slot)->line, (*slot)->col);
+    }
+
+    for (auto& h : hoists) insertBefore(h.target->block, h.target->node, h.decl);
+}
+
+std::string AOL_Optimizer::typeOf(const std::shared_ptr<ASTNode>& expr) const {
+    switch (expr->type) {
+        case ASTNodeType::Literal:
+            return "";
+        case ASTNodeType::UnaryExpr: {
+            if (expr->name != "&") return "";
+            std::string inner = typeOf(expr->children[0]);
+            return inner == "?" ? "?" : "*" + inner;
+        }
+        case ASTNodeType::Identifier: {
+            auto local = varTypes.find(expr->name);
+            if (local != varTypes.end()) return local->second;
+            auto global = globalTypes.find(expr->name);
+            return global != globalTypes.end() ? global->second : "?";
+        }
+        case ASTNodeType::CallExpr: {
+            auto fn = globalTypes.find(expr->name);
+            return fn != globalTypes.end() ? fn->second : "";
+        }
+        case ASTNodeType::MemberExpr: {
+            std::string objType = typeOf(expr->children[0]);
+            if (objType == "?") return "?";
+            const StructType* st = FindStructType(IsPointerType(objType) ? PointeeType(objType) : objType);
+            const StructField* f = st ? st->field(expr->name) : nullptr;
+            return f ? f->type : "";
+        }
+        case ASTNodeType::BinaryExpr: {
+            static const std::unordered_set<std::string> arith = {"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"};
+            if (!arith.count(expr->name)) return "";
+            std::string a = typeOf(expr->children[0]), b = typeOf(expr->children[1]);
+            if (a == "?" || b == "?") return "?";
+            bool shift = expr->name == "<<" || expr->name == ">>";
+            auto isUnsigned = shift ? std::optional<bool>(isUnsignedType(a)) : isUnsignedCompare(expr->children[0], expr->children[1]);
+            return *isUnsigned && (a == "u64" || (!shift && b == "u64")) ? "u64" : "";
+        }
+        default:
+            return "?";
+    }
+}
+
+// Whether the code generator compares lhs with rhs unsigned, nullopt when a
+// type is unknown. One side has to be unsigned, the other too or a
+// non-negative literal.
+std::optional<bool> AOL_Optimizer::isUnsignedCompare(const std::shared_ptr<ASTNode>& lhs, const std::shared_ptr<ASTNode>& rhs) const {
+    std::string a = typeOf(lhs), b = typeOf(rhs);
+    if (a == "?" || b == "?") return std::nullopt;
+    int64_t c;
+    bool left = isUnsignedType(a), right = isUnsignedType(b);
+    bool leftFits = left || (intLiteral(lhs, &c) && c >= 0);
+    bool rightFits = right || (intLiteral(rhs, &c) && c >= 0);
+    return (left || right) && leftFits && rightFits;
+}
+
+bool AOL_Optimizer::analyzeCountedLoop(const LoopInfo& loop, CountedLoop& out) {
+    if (loop.node->type != ASTNodeType::ForStmt) return false;
+    auto& cond = loop.node->children[1];
+    if (!cond || cond->type != ASTNodeType::BinaryExpr || !isComparison(cond->name) || cond->name == "==") return false;
+
+    auto ivs = findInductionVars(loop);
+    auto findIV = [&](const std::shared_ptr<ASTNode>& node) -> const InductionVar* {
+        if (!node || node->type != ASTNodeType::Identifier) return nullptr;
+        for (auto& iv : ivs)
+            if (iv.name == node->name) return &iv;
+        return nullptr;
+    };
+
+    std::string rel = cond->name;
+    const InductionVar* iv = findIV(cond->children[0]);
+    std::shared_ptr<ASTNode> bound = cond->children[1];
+    if (!iv) {
+        // bound REL v, flip it around
+        iv = findIV(cond->children[1]);
+        bound = cond->children[0];
+        if (rel == "<") rel = ">";
+        else if (rel == ">") rel = "<";
+        else if (rel == "<=") rel = ">=";
+        else if (rel == ">=") rel = "<=";
+    }
+    if (!iv || !isInvariant(bound, loop)) return false;
+
+    bool upward = rel == "<" || rel == "<=";
+    bool downward = rel == ">" || rel == ">=";
+    if ((upward && iv->step <= 0) || (downward && iv->step >= 0) || iv->step == 0) return false;
+
+    out.iv = *iv;
+    out.relation = rel;
+    out.bound = bound;
+    out.knownStart = false;
+
+    // Run the init clause over constants to find where the variable starts
+    std::unordered_map<std::string, int64_t> env;
+    auto& init = loop.node->children[0];
+    std::vector<std::shared_ptr<ASTNode>> stmts;
+    if (init && init->type == ASTNodeType::StmtBlock) stmts = init->children;
+    else if (init) stmts.push_back(init);
+    for (auto& stmt : stmts) {
+        std::string name;
+        std::shared_ptr<ASTNode> value;
+        if (stmt->type == ASTNodeType::VariableDecl && !stmt->children.empty()) {
+            name = stmt->name;
+            value = stmt->children[0];
+        } else if (stmt->type == ASTNodeType::AssignExpr && stmt->children[0]->type == ASTNodeType::Identifier) {
+            name = stmt->children[0]->name;
+            value = stmt->children[1];
+        } else {
+            continue;
+        }
+        auto folded = CloneAST(value);
+        substituteConstants(folded, env);
+        foldConstants(folded);
+        int64_t v;
+        if (intLiteral(folded, &v)) env[name] = v;
+        else env.erase(name);
+    }
+    auto it = env.find(iv->name);
+    if (it != env.end()) {
+        out.knownStart = true;
+        out.start = it->second;
+    }
+    return true;
+}
+
+std::optional<int64_t> AOL_Optimizer::constTripCount(const CountedLoop& cl) const {
+    int64_t b;
+    if (!cl.knownStart || !intLiteral(cl.bound, &b)) return std::nullopt;
+
+    // An unsigned exit test counts over 0 .. UINT64_MAX instead
+    auto isUnsigned = isUnsignedCompare(makeIdent(cl.iv.name), cl.bound);
+    if (!isUnsigned) return std::nullopt;
+    __int128 lowest = *isUnsigned ? 0 : (__int128)INT64_MIN;
+    __int128 highest = *isUnsigned ? (__int128)UINT64_MAX : (__int128)INT64_MAX;
+    __int128 start = *isUnsigned ? (__int128)(uint64_t)cl.start : cl.start;
+    __int128 bound = *isUnsigned ? (__int128)(uint64_t)b : b;
+    __int128 step = cl.iv.step, n = 0;
+    if (cl.relation == "<") n = start >= bound ? 0 : (bound - start + step - 1) / step;
+    else if (cl.relation == "<=") n = start > bound ? 0 : (bound - start) / step + 1;
+    else if (cl.relation == ">") n = start <= bound ? 0 : (start - bound - step - 1) / -step;
+    else if (cl.relation == ">=") n = start < bound ? 0 : (start - bound) / -step + 1;
+    else {
+        // != only terminates when the step lands exactly on the bound
+        if ((bound - start) % step != 0 || (bound - start) / step < 0) return std::nullopt;
+        n = (bound - start) / step;
+    }
+
+    // The variable must not wrap on its way to the exit value
+    __int128 exitValue = start + n * step;
+    if (exitValue < lowest || exitValue > highest) return std::nullopt;
+    return (int64_t)n;
+}
+
+void AOL_Optimizer::unrollLoop(LoopInfo& loop) {
+    if (loop.node->type != ASTNodeType::ForStmt) return;
+    auto& attrs = loop.node->attributes;
+
+    if (attrs.count("nounroll")) {
+        if (!attrs.count("unrolled")) remark(loop.node, "loop not unrolled: #[nounroll]");
+        return;
+    }
+
+    // 0: heuristics decide, -1: #[unroll] without a count, fully if the trip count allows
+    int requested = 0;
+    if (attrs.count("unroll")) {
+        try {
+            requested = attrs["unroll"].empty() ? -1 : std::stoi(attrs["unroll"]);
+        } catch (...) {
+            std::cerr << "Warning: Invalid #[unroll(" << attrs["unroll"] << ")] at line " << loop.node->line << "\n";
+        }
+        if (requested == 1) {
+            remark(loop.node, "loop not unrolled: #[unroll(1)]");
+            return;
+        }
+    }
+
+    if (hasLoopExit(loop.node->children[3])) {
+        remark(loop.node, "loop not unrolled: body contains break or continue");
+        return;
+    }
+
+    // A profile replaces guessing: loops that never ran stay rolled and a partial
+    // unroll needs enough iterations per run to use the unrolled body
+    int64_t runs = ProfileCount(loop.node), iterations = ProfileCount(loop.node->children[3]);
+    std::optional<int64_t> profiledTrips;
+    if (requested == 0 && runs >= 0 && iterations >= 0) {
+        if (iterations == 0) {
+            remark(loop.node, "loop not unrolled: never ran in the profile");
+            return;
+        }
+        profiledTrips = iterations / std::max<int64_t>(runs, 1);
+    }
+
+    computeDefs(loop);
+    CountedLoop cl;
+    if (!analyzeCountedLoop(loop, cl)) {
+        remark(loop.node, "loop not unrolled: exit test is not a counted induction variable test");
+        return;
+    }
+
+    int size = countNodes(loop.node->children[3]) + countNodes(loop.node->children[2]);
+    auto trips = constTripCount(cl);
+
+    if (trips) {
+        int64_t limit = requested > 0 ? requested : (requested < 0 ? 1024 : 8);
+        bool small = requested != 0 || *trips * size <= 256;
+        if (*trips <= limit && small) {
+            unrollFully(loop, *trips);
+            remark(loop.node, "loop fully unrolled, " + std::to_string(*trips) + " iterations (" +
+                (requested != 0 ? std::string("#[unroll]") : "small constant trip count") + ")");
+            return;
+        }
+    }
+
+    int factor = requested > 0 ? requested : (size <= 16 ? 4 : (size <= 48 ? 2 : 1));
+    if (factor <= 1) {
+        remark(loop.node, "loop not unrolled: body too large (" + std::to_string(size) + " nodes)");
+        return;
+    }
+    if (cl.relation == "!=") {
+        remark(loop.node, "loop not unrolled: '!=' exit test has no safe remainder bound");
+        return;
+    }
+    if (!trips && profiledTrips && *profiledTrips < factor) {
+        remark(loop.node, "loop not unrolled: " + std::to_string(*profiledTrips) + " iterations per run in the profile");
+        return;
+    }
+    if (trips && *trips < factor) {
+        unrollFully(loop, *trips);
+        remark(loop.node, "loop fully unrolled, " + std::to_string(*trips) + " iterations (trip count below unroll factor)");
+        return;
+    }
+
+    if (!unrollPartially(loop, cl, factor)) return;
+    remark(loop.node, "loop unrolled by " + std::to_string(factor) + " with remainder loop (" +
+        (requested > 0 ? std::string("#[unroll(") + std::to_string(requested) + ")]" : std::to_string(size) + " node body") +
+        (trips ? ", " + std::to_string(*trips) + " iterations" : ", runtime trip count") + ")");
+}
+
+// init; body; step; body; step; ... with the exit test gone
+void AOL_Optimizer::unrollFully(LoopInfo& loop, int64_t tripCount) {
+    auto& node = loop.node;
+    auto block = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, node->line, node->col);
+    appendInit(block, node->children[0]);
+
+    // Each copy is a block of its own and declares its locals again
+    for (int64_t k = 0; k < tripCount; ++k) {
+        auto body = k == 0 ? node->children[3] : CloneAST(node->children[3]);
+        block->children.push_back(body);
+        if (node->children[2]) block->children.push_back(CloneAST(node->children[2]));
+    }
+
+    auto& list = loop.block->children;
+    std::replace(list.begin(), list.end(), node, block);
+}
+
+// init; let ub = bound - (factor - 1) * step;
+// if (ub <= bound) for (; v REL ub; step) { body; step; ... body }   factor copies
+// for (; v REL bound; step) { body }                                 remainder
+//
+// A bound within (factor - 1) * step of the type's range end wraps ub, the
+// guard (ub >= bound counting down) leaves such loops to the remainder loop.
+// The comparisons take the signedness of the loop's own exit test.
+bool AOL_Optimizer::unrollPartially(LoopInfo& loop, const CountedLoop& cl, int factor) {
+    auto& node = loop.node;
+    int line = node->line, col = node->col;
+    auto& body = node->children[3];
+    auto& step = node->children[2];
+
+    auto isUnsigned = isUnsignedCompare(makeIdent(cl.iv.name, line, col), cl.bound);
+    if (!isUnsigned) {
+        remark(node, "loop not unrolled: can't tell the signedness of the exit test");
+        return false;
+    }
+    bool upward = cl.relation == "<" || cl.relation == "<=";
+    auto inRange = [&](int64_t ub, int64_t bound) {
+        if (*isUnsigned) return upward ? (uint64_t)ub <= (uint64_t)bound : (uint64_t)ub >= (uint64_t)bound;
+        return upward ? ub <= bound : ub >= bound;
+    };
+
+    std::shared_ptr<ASTNode> mainBound = makeBinary("-", CloneAST(cl.bound),
+        makeLiteral((int64_t)((uint64_t)(factor - 1) * (uint64_t)cl.iv.step), line, col));
+    foldConstants(mainBound);
+    int64_t ubValue, boundValue;
+    if (intLiteral(mainBound, &ubValue) && intLiteral(cl.bound, &boundValue) && !inRange(ubValue, boundValue)) {
+        remark(node, "loop not unrolled: bound " + std::to_string(boundValue) + " is too close to the end of its range");
+        return false;
+    }
+
+    // The remainder loop continues with the variable, so it is declared ahead of both
+    auto block = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, line, col);
+    appendInit(block, node->children[0]);
+
+    std::shared_ptr<ASTNode> guard;
+    if (!intLiteral(mainBound)) {
+        std::string ub = newTemp("unroll_ub");
+        auto decl = makeLet(ub, mainBound);
+        decl->typeName = *isUnsigned ? "u64" : "";
+        varTypes[ub] = decl->typeName;
+        block->children.push_back(decl);
+        mainBound = makeIdent(ub, line, col);
+        guard = makeBinary(upward ? "<=" : ">=", makeIdent(ub, line, col), CloneAST(cl.bound));
+    }
+
+    auto mainBody = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, body->line, body->col);
+    for (int k = 0; k < factor; ++k) {
+        if (k > 0) {
+            auto copy = CloneAST(body);
+            mainBody->children.push_back(CloneAST(step));
+            mainBody->children.push_back(copy);
+        } else {
+            mainBody->children.push_back(body);
+        }
+    }
+
+    auto mainLoop = std::make_shared<ASTNode>(ASTNodeType::ForStmt, line, col);
+    mainLoop->children = {nullptr,
+                          makeBinary(cl.relation, makeIdent(cl.iv.name, line, col), mainBound),
+                          step, mainBody};
+    mainLoop->attributes["nounroll"] = "";
+    mainLoop->attributes["unrolled"] = std::to_string(factor);
+
+    auto remBody = CloneAST(body);
+    auto remLoop = std::make_shared<ASTNode>(ASTNodeType::ForStmt, line, col);
+    remLoop->children = {nullptr,
+                         makeBinary(cl.relation, makeIdent(cl.iv.name, line, col), CloneAST(cl.bound)),
+                         CloneAST(step), remBody};
+    remLoop->attributes["nounroll"] = "";
+    remLoop->attributes["unrolled"] = "remainder";
+
+    if (guard) {
+        auto then = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, line, col);
+        then->children.push_back(mainLoop);
+        auto check = std::make_shared<ASTNode>(ASTNodeType::IfStmt, line, col);
+        check->children = {guard, then};
+        block->children.push_back(check);
+    } else {
+        block->children.push_back(mainLoop);
+    }
+    block->children.push_back(remLoop);
+
+    auto& list = loop.block->children;
+    std::replace(list.begin(), list.end(), node, block);
+    return true;
+}
+
+// Optimistically assumes every function is pure, then strips those that call
+// something unknown or impure or touch names that aren't their own.
+void AOL_Optimizer::findPureFunctions(const std::shared_ptr<ASTNode>& program) {
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> defs;
+    for (auto& child : program->children)
+        if (child && child->type == ASTNodeType::FunctionDecl && !child->children.empty() && !child->attributes.count("async")) defs[child->name] = child;
+
+    pureFunctions.clear();
+    for (auto& [name, fn] : defs) pureFunctions.insert(name);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& [name, fn] : defs) {
+            if (!pureFunctions.count(name)) continue;
+
+            std::unordered_set<std::string> own;
+            for (auto& param : fn->params) own.insert(param->name);
+            std::function<void(const std::shared_ptr<ASTNode>&)> collect = [&](const std::shared_ptr<ASTNode>& node) {
+                if (!node) return;
+                if (node->type == ASTNodeType::VariableDecl) own.insert(node->name);
+                for (auto& child : node->children) collect(child);
+            };
+            collect(fn);
+
+            bool pure = true;
+            std::function<void(const std::shared_ptr<ASTNode>&)> check = [&](const std::shared_ptr<ASTNode>& node) {
+                if (!node || !pure) return;
+                if (node->type == ASTNodeType::CallExpr && !isPureCall(node->name)) pure = false;
+                if (node->type == ASTNodeType::Identifier && !own.count(node->name)) pure = false;
+                if (node->type == ASTNodeType::MemberExpr || node->type == ASTNodeType::AsmStmt) pure = false;
+                for (auto& child : node->children) check(child);
+            };
+            for (auto& stmt : fn->children) check(stmt);
+
+            if (!pure) {
+                pureFunctions.erase(name);
+                changed = true;
+            }
+        }
+    }
+}
+
+bool AOL_Optimizer::isPureCall(const std::string& name) const {
+    // Vector constructors are pure too, v4i32(...) etc.
+    return pureFunctions.count(name) || PureBuiltins.count(name) || IsBitBuiltin(name) || FindVectorType(name);
+}
+
+// An asm block that isn't volatile only computes its outputs, when none of them
+// is read anywhere the block goes. Blocks without outputs are kept.
+void AOL_Optimizer::removeDeadAsm(const std::shared_ptr<ASTNode>& fn) {
+    std::function<void(const std::shared_ptr<ASTNode>&)> sweep = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        bool list = node->type == ASTNodeType::StmtBlock || node->type == ASTNodeType::FunctionDecl;
+        for (size_t i = 0; i < node->children.size();) {
+            auto& child = node->children[i];
+            if (list && child && child->type == ASTNodeType::AsmStmt && !asmHasEffects(child)) {
+                auto outputs = asmOutputs(child);
+                bool dead = !outputs.empty();
+                for (auto& out : outputs) dead = dead && countRefs(fn, out) == countRefs(child, out);
+                if (dead) {
+                    remark(child, "removed asm block, its outputs are never read");
+                    node->children.erase(node->children.begin() + i);
+                    continue;
+                }
+            }
+            sweep(child);
+            ++i;
+        }
+    };
+    sweep(fn);
+}
+
+// Allocation functions only touch the allocator's own bookkeeping, which AOL code can't name
+bool AOL_Optimizer::clobbersGlobals(const std::string& name) const {
+    return !isPureCall(name) && !allocFunctions.count(name) && !freeFunctions.count(name);
+}
+
+// An allocation whose pointer only ever reaches free calls is never observed,
+// so it is dropped together with the frees. Discarded results go the same way.
+void AOL_Optimizer::removeDeadAllocations(const std::shared_ptr<ASTNode>& fn) {
+    if (allocFunctions.empty()) return;
+
+    std::function<bool(const std::shared_ptr<ASTNode>&)> sideEffects = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return false;
+        if (node->type == ASTNodeType::AssignExpr || node->type == ASTNodeType::AsmStmt) return true;
+        if (node->type == ASTNodeType::CallExpr && !isPureCall(node->name)) return true;
+        for (auto& child : node->children)
+            if (sideEffects(child)) return true;
+        return false;
+    };
+    auto isAlloc = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node || node->type != ASTNodeType::CallExpr || !allocFunctions.count(node->name)) return false;
+        for (auto& arg : node->children)
+            if (sideEffects(arg)) return false;
+        return true;
+    };
+    auto isFreeOf = [&](const std::shared_ptr<ASTNode>& node, const std::string& name) {
+        if (!node || node->type != ASTNodeType::CallExpr || !freeFunctions.count(node->name) || node->children.empty()) return false;
+        if (!isIdent(node->children[0], name)) return false;
+        for (size_t i = 1; i < node->children.size(); ++i)
+            if (sideEffects(node->children[i]) || countRefs(node->children[i], name)) return false;
+        return true;
+    };
+
+    std::vector<std::shared_ptr<ASTNode>> decls;
+    std::function<void(const std::shared_ptr<ASTNode>&)> findDecls = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        bool list = node->type == ASTNodeType::StmtBlock || node->type == ASTNodeType::FunctionDecl;
+        for (auto& child : node->children) {
+            if (list && child && child->type == ASTNodeType::VariableDecl && !child->children.empty() &&
+                isAlloc(child->children[0]) && countDefs(fn, child->name) == 1)
+                decls.push_back(child);
+            findDecls(child);
+        }
+    };
+    findDecls(fn);
+
+    std::unordered_set<ASTNode*> dead;
+    for (auto& decl : decls) {
+        bool isParam = false;
+        for (auto& param : fn->params) isParam |= param->name == decl->name;
+        if (isParam) continue;
+
+        // Only frees that are statements of their own can go, anything else is a use
+        std::vector<ASTNode*> frees;
+        std::function<void(const std::shared_ptr<ASTNode>&)> findFrees = [&](const std::shared_ptr<ASTNode>& node) {
+            if (!node) return;
+            bool list = node->type == ASTNodeType::StmtBlock || node->type == ASTNodeType::FunctionDecl;
+            for (auto& child : node->children) {
+                if (list && isFreeOf(child, decl->name)) frees.push_back(child.get());
+                else findFrees(child);
+            }
+        };
+        findFrees(fn);
+        if ((int)frees.size() != countRefs(fn, decl->name)) continue;
+
+        dead.insert(decl.get());
+        dead.insert(frees.begin(), frees.end());
+        remark(decl, "removed unused allocation '" + decl->name + "' (" + ExprToString(decl->children[0]) + ")");
+    }
+
+    std::function<void(const std::shared_ptr<ASTNode>&)> sweep = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        bool list = node->type == ASTNodeType::StmtBlock || node->type == ASTNodeType::FunctionDecl;
+        for (size_t i = 0; i < node->children.size();) {
+            auto& child = node->children[i];
+            if (list && isAlloc(child)) {
+                remark(child, "removed discarded allocation " + ExprToString(child));
+                dead.insert(child.get());
+            }
+            if (list && dead.count(child.get())) {
+                node->children.erase(node->children.begin() + i);
+                continue;
+            }
+            sweep(child);
+            ++i;
+        }
+    };
+    sweep(fn);
+}
+
+// Dominator-based value numbering. AOL control flow is structured, so the
+// dominator tree is the statement nesting: a statement dominates the ones after
+// it in its block and everything nested in them, an if condition dominates both
+// arms. Values live in scoped tables that are popped when leaving a block.
+//
+// Variables carry a version that is bumped on every write (and at loop headers
+// and joins for anything written inside), so a table hit always means the same
+// value. The first occurrence is only materialized into a temporary once a
+// second one shows up.
+void AOL_Optimizer::numberValues(const std::shared_ptr<ASTNode>& fn) {
+    struct ValueEntry {
+        std::string temp; // empty while only the first occurrence exists
+        std::shared_ptr<ASTNode>* slot;
+        std::shared_ptr<ASTNode> block;
+        std::shared_ptr<ASTNode> anchor; // statement the first occurrence is evaluated in
+    };
+    struct Context {
+        std::shared_ptr<ASTNode> block;
+        std::shared_ptr<ASTNode> anchor;
+        bool record = true; // false where a statement position can't hold the temporary (loop headers)
+        bool conditional = false; // right of && / ||, evaluated only sometimes
+        bool noGlobals = false; // statement calls something impure
+        bool disabled = false;
+    };
+
+    std::vector<ValueEntry> entries;
+    std::vector<std::unordered_map<std::string, size_t>> scopes;
+    std::unordered_map<std::string, int> version;
+    int nextVersion = 0;
+    int globalEpoch = 0;
+
+    auto bump = [&](const std::string& name) { version[name] = ++nextVersion; };
+
+    auto defsIn = [&](const std::shared_ptr<ASTNode>& node, std::unordered_set<std::string>& out) {
+        std::function<void(const std::shared_ptr<ASTNode>&)> walk = [&](const std::shared_ptr<ASTNode>& n) {
+            if (!n) return;
+            if (n->type == ASTNodeType::AssignExpr && n->children[0]->type == ASTNodeType::Identifier) out.insert(n->children[0]->name);
+            if (n->type == ASTNodeType::VariableDecl) out.insert(n->name);
+            for (auto& name : asmOutputs(n)) out.insert(name);
+            for (auto& child : n->children) walk(child);
+        };
+        walk(node);
+    };
+
+    std::function<bool(const std::shared_ptr<ASTNode>&)> hasImpureCall = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return false;
+        if (node->type == ASTNodeType::CallExpr && clobbersGlobals(node->name)) return true;
+        if (asmHasEffects(node)) return true;
+        for (auto& child : node->children)
+            if (hasImpureCall(child)) return true;
+        return false;
+    };
+
+    std::function<bool(const std::shared_ptr<ASTNode>&)> hasCall = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return false;
+        if (node->type == ASTNodeType::CallExpr) return true;
+        for (auto& child : node->children)
+            if (hasCall(child)) return true;
+        return false;
+    };
+
+    std::function<bool(const std::shared_ptr<ASTNode>&)> hasAssign = [&](const std::shared_ptr<ASTNode>& node) {
+        if (!node) return false;
+        if (node->type == ASTNodeType::AssignExpr || node->type == ASTNodeType::AsmStmt) return true;
+        for (auto& child : node->children)
+            if (hasAssign(child)) return true;
+        return false;
+    };
+
+    // Structural key with variable versions, "" when the expression can't be numbered
+    std::function<std::string(const std::shared_ptr<ASTNode>&, const Context&)> keyOf = [&](const std::shared_ptr<ASTNode>& node, const Context& ctx) -> std::string {
+        switch (node->type) {
+            case ASTNodeType::Literal:
+                return node->name == "string" ? "" : "#" + node->value;
+            case ASTNodeType::Identifier:
+                if (functionLocals.count(node->name)) return node->name + "@" + std::to_string(version[node->name]);
+                if (ctx.noGlobals) return "";
+                return node->name + "@g" + std::to_string(globalEpoch);
+            case ASTNodeType::UnaryExpr: {
+                std::string k = keyOf(node->children[0], ctx);
+                return k.empty() ? "" : node->name + k;
+            }
+            case ASTNodeType::BinaryExpr: {
+                std::string a = keyOf(node->children[0], ctx), b = keyOf(node->children[1], ctx);
+                if (a.empty() || b.empty()) return "";
+                const std::string& op = node->name;
+                bool commutative = op == "+" || op == "*" || op == "&" || op == "|" || op == "^" || op == "==" || op == "!=";
+                if (commutative && b < a) std::swap(a, b);
+                return "(" + op + " " + a + " " + b + ")";
+            }
+            case ASTNodeType::CallExpr: {
+                if (!isPureCall(node->name)) return "";
+                std::string k = node->name + "(";
+                for (auto& arg : node->children) {
+                    std::string a = keyOf(arg, ctx);
+                    if (a.empty()) return "";
+                    k += a + ",";
+                }
+                return k + ")";
+            }
+            default:
+                return "";
+        }
+    };
+
+    auto slotWithin = [](const std::shared_ptr<ASTNode>& root, std::shared_ptr<ASTNode>* slot) {
+        std::function<bool(const std::shared_ptr<ASTNode>&)> walk = [&](const std::shared_ptr<ASTNode>& n) {
+            if (!n) return false;
+            for (auto& child : n->children)
+                if (&child == slot || walk(child)) return true;
+            return false;
+        };
+        return walk(root);
+    };
+
+    auto materialize = [&](ValueEntry& entry) {
+        entry.temp = newTemp("cse");
+        auto decl = makeLet(entry.temp, *entry.slot);
+        decl->typeName = varTypes[entry.temp] = typeOf(*entry.slot);
+        insertBefore(entry.block, entry.anchor, decl);
+
+        // Pending values nested in the moved expression are now evaluated by the new declaration
+        for (auto& other : entries)
+            if (other.temp.empty() && other.anchor == entry.anchor && slotWithin(decl, other.slot)) other.anchor = decl;
+
+        *entry.slot = makeIdent(entry.temp, (*entry.slot)->line, (*entry.slot)->col);
+    };
+
+    auto lookup = [&](const std::string& key) -> ValueEntry* {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            auto found = it->find(key);
+            if (found != it->end()) return &entries[found->second];
+        }
+        return nullptr;
+    };
+
+    std::function<void(std::shared_ptr<ASTNode>&, Context)> visitExpr = [&](std::shared_ptr<ASTNode>& slot, Context ctx) {
+        auto node = slot;
+        if (!node) return;
+
+        bool candidate = node->type == ASTNodeType::BinaryExpr ||
+                         (node->type == ASTNodeType::UnaryExpr && node->children[0]->type != ASTNodeType::Literal) ||
+                         (node->type == ASTNodeType::CallExpr && isPureCall(node->name));
+
+        // A temporary of unknown type could change how the value compares
+        if (candidate && !ctx.disabled && typeOf(node) != "?") {
+            std::string key = keyOf(node, ctx);
+            if (!key.empty()) {
+                if (ValueEntry* entry = lookup(key)) {
+                    if (entry->temp.empty()) {
+                        std::string firstPos = std::to_string((*entry->slot)->line) + ":" + std::to_string((*entry->slot)->col);
+                        materialize(*entry);
+                        remark(node, "value " + ExprToString(node) + " already computed at " + firstPos + ", kept in " + entry->temp);
+                    } else {
+                        remark(node, "value " + ExprToString(node) + " reused from " + entry->temp);
+                    }
+                    slot = makeIdent(entry->temp, node->line, node->col);
+                    return;
+                }
+                // Moving a maybe-skipped evaluation in front of the statement must not add a trap or a call
+                bool speculable = !ctx.conditional || (!hasCall(node) && !mayTrap(node));
+                if (ctx.record && speculable) {
+                    entries.push_back({"", &slot, ctx.block, ctx.anchor});
+                    scopes.back()[key] = entries.size() - 1;
+                }
+            }
+        }
+
+        if (node->type == ASTNodeType::BinaryExpr && (node->name == "&&" || node->name == "||")) {
+            visitExpr(node->children[0], ctx);
+            Context rhs = ctx;
+            rhs.conditional = true;
+            visitExpr(node->children[1], rhs);
+            return;
+        }
+        if (node->type == ASTNodeType::AssignExpr) {
+            visitExpr(node->children[1], ctx);
+            return;
+        }
+        for (auto& child : node->children) visitExpr(child, ctx);
+    };
+
+    std::function<void(const std::shared_ptr<ASTNode>&)> visitBlock;
+
+    // Statement expressions; defs and impure calls take effect once the statement is done
+    auto visitSimple = [&](const std::shared_ptr<ASTNode>& stmt, const std::shared_ptr<ASTNode>& block, bool record) {
+        Context ctx;
+        ctx.block = block;
+        ctx.anchor = stmt;
+        ctx.record = record;
+        ctx.noGlobals = hasImpureCall(stmt);
+
+        switch (stmt->type) {
+            case ASTNodeType::VariableDecl:
+                if (!stmt->children.empty()) {
+                    ctx.disabled = hasAssign(stmt->children[0]);
+                    visitExpr(stmt->children[0], ctx);
+                }
+                break;
+            case ASTNodeType::AssignExpr:
+                ctx.disabled = hasAssign(stmt->children[1]);
+                visitExpr(stmt->children[1], ctx);
+                break;
+            default:
+                ctx.disabled = hasAssign(stmt);
+                for (auto& child : stmt->children) visitExpr(child, ctx);
+                break;
+        }
+
+        std::unordered_set<std::string> defs;
+        defsIn(stmt, defs);
+        for (auto& d : defs) bump(d);
+        if (ctx.noGlobals) globalEpoch++;
+    };
+
+    auto enterLoop = [&](const std::shared_ptr<ASTNode>& loop, std::unordered_set<std::string>& defs) {
+        defsIn(loop, defs);
+        for (auto& d : defs) bump(d);
+        if (hasImpureCall(loop)) globalEpoch++;
+    };
+
+    std::function<void(const std::shared_ptr<ASTNode>&, const std::shared_ptr<ASTNode>&)> visitStmt =
+        [&](const std::shared_ptr<ASTNode>& stmt, const std::shared_ptr<ASTNode>& block) {
+        if (!stmt) return;
+        switch (stmt->type) {
+            case ASTNodeType::StmtBlock:
+                visitBlock(stmt);
+                break;
+            case ASTNodeType::IfStmt: {
+                Context ctx;
+                ctx.block = block;
+                ctx.anchor = stmt;
+                ctx.noGlobals = hasImpureCall(stmt->children[0]);
+                ctx.disabled = hasAssign(stmt->children[0]);
+                visitExpr(stmt->children[0], ctx);
+                if (ctx.noGlobals) globalEpoch++;
+
+                std::unordered_set<std::string> defs;
+                auto saved = version;
+                for (size_t i = 1; i < stmt->children.size(); ++i) {
+                    defsIn(stmt->children[i], defs);
+                    visitBlock(stmt->children[i]);
+                    version = saved;
+                }
+                for (auto& d : defs) bump(d);
+                for (size_t i = 1; i < stmt->children.size(); ++i)
+                    if (hasImpureCall(stmt->children[i])) globalEpoch++;
+                break;
+            }
+            case ASTNodeType::SwitchStmt: {
+                Context ctx;
+                ctx.block = block;
+                ctx.anchor = stmt;
+                ctx.noGlobals = hasImpureCall(stmt->children[0]);
+                ctx.disabled = hasAssign(stmt->children[0]);
+                visitExpr(stmt->children[0], ctx);
+                if (ctx.noGlobals) globalEpoch++;
+
+                // Each clause is dominated by the switch value only. Clauses fall through,
+                // so anything the earlier ones write is stale on entry to the later ones.
+                std::unordered_set<std::string> defs;
+                auto saved = version;
+                for (size_t i = 1; i < stmt->children.size(); ++i) {
+                    for (auto& d : defs) bump(d);
+                    auto& body = stmt->children[i]->children[0];
+                    visitBlock(body);
+                    version = saved;
+                    defsIn(body, defs);
+                    if (hasImpureCall(body)) globalEpoch++;
+                }
+                for (auto& d : defs) bump(d);
+                break;
+            }
+            case ASTNodeType::WhileStmt: {
+                std::unordered_set<std::string> defs;
+                enterLoop(stmt, defs);
+                scopes.emplace_back();
+                Context ctx;
+                ctx.record = false;
+                ctx.noGlobals = hasImpureCall(stmt);
+                ctx.disabled = hasAssign(stmt->children[0]);
+                visitExpr(stmt->children[0], ctx);
+                visitBlock(stmt->children[1]);
+                scopes.pop_back();
+                enterLoop(stmt, defs);
+                break;
+            }
+            case ASTNodeType::ForStmt: {
+                // The init runs once ahead of the loop, give it a block so temporaries have a home
+                if (stmt->children[0]) {
+                    ensureBlock(stmt->children[0], stmt->line, stmt->col);
+                    visitBlock(stmt->children[0]);
+                }
+
+                std::unordered_set<std::string> defs;
+                enterLoop(stmt, defs);
+                scopes.emplace_back();
+                Context ctx;
+                ctx.record = false;
+                ctx.noGlobals = hasImpureCall(stmt);
+                ctx.disabled = hasAssign(stmt->children[1]);
+                visitExpr(stmt->children[1], ctx);
+                visitBlock(stmt->children[3]);
+
+                // The step is reached from every continue, only the condition dominates it
+                if (auto& step = stmt->children[2]) {
+                    std::vector<std::shared_ptr<ASTNode>> updates;
+                    if (step->type == ASTNodeType::StmtBlock) updates = step->children;
+                    else updates.push_back(step);
+                    for (auto& u : updates) visitSimple(u, step, false);
+                }
+                scopes.pop_back();
+                enterLoop(stmt, defs);
+                break;
+            }
+            case ASTNodeType::BreakStmt:
+            case ASTNodeType::ContinueStmt:
+                break;
+            default:
+                visitSimple(stmt, block, true);
+                break;
+        }
+    };
+
+    visitBlock = [&](const std::shared_ptr<ASTNode>& block) {
+        scopes.emplace_back();
+        auto stmts = block->children; // temporaries get inserted while walking
+        for (auto& stmt : stmts) visitStmt(stmt, block);
+        scopes.pop_back();
+    };
+
+    visitBlock(fn);
+}
+
+void AOL_Optimizer::insertBefore(const std::shared_ptr<ASTNode>& block, const std::shared_ptr<ASTNode>& anchor, const std::shared_ptr<ASTNode>& stmt) {
+    auto& list = block->children;
+    auto it = std::find(list.begin(), list.end(), anchor);
+    list.insert(it, stmt);
+}
+
+std::string AOL_Optimizer::newTemp(const std::string& kind) {
+    std::string name = "__" + kind + "_" + std::to_string(tempIdx++);
+    functionLocals.insert(name);
+    varTypes[name] = ""; // the declarations carry no type unless the caller sets one
+    return name;
+}
+
+void AOL_Optimizer::remark(const std::shared_ptr<ASTNode>& at, const std::string& msg) {
+    std::ostringstream out;
+    out << (currentFunction ? currentFunction->name : std::string("<global>")) << ":" << at->line << ":" << at->col << ": " << msg;
+    remarkLog.push_back(out.str());
+}
@@ -0,0 +1,105 @@
+#include <output.hpp>
+
+#include <algorithm>
+#include <filesystem>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static bool writeAll(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+// Same directory as the output, so copy_file_range stays on one filesystem
+OutputSink::OutputSink(const std::string& path) : path(path) {
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    if (dir.empty()) dir = ".";
+    tmpFd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (tmpFd < 0) {
+        std::string name = dir + "/.aol-text-XXXXXX";
+        tmpFd = mkostemp(name.data(), O_CLOEXEC);
+        if (tmpFd >= 0) unlink(name.c_str());
+    }
+    buffer.reserve(BufferBytes);
+}
+
+OutputSink::~OutputSink() {
+    if (tmpFd >= 0) close(tmpFd);
+}
+
+void OutputSink::text(std::string_view s) {
+    if (buffer.size() + s.size() > BufferBytes && !flush()) return;
+    if (s.size() >= BufferBytes) {
+        failed |= !writeAll(tmpFd, s.data(), s.size());
+        spilled += s.size();
+        return;
+    }
+    buffer.append(s);
+}
+
+bool OutputSink::flush() {
+    if (failed || tmpFd < 0) return false;
+    failed = !writeAll(tmpFd, buffer.data(), buffer.size());
+    spilled += buffer.size();
+    buffer.clear();
+    return !failed;
+}
+
+bool OutputSink::finish(const std::vector<std::string_view>& head) {
+    if (!flush()) return false;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    std::vector<iovec> iov;
+    for (auto& s : head)
+        if (!s.empty()) iov.push_back({(void*)s.data(), s.size()});
+    bool ok = true;
+    for (size_t i = 0; ok && i < iov.size();) {
+        ssize_t w = writev(fd, iov.data() + i, (int)std::min<size_t>(iov.size() - i, IOV_MAX));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            ok = false;
+            break;
+        }
+        // Partial write: drop what went out and retry the rest
+        for (size_t done = (size_t)w; done > 0 && i < iov.size();) {
+            size_t take = std::min(done, iov[i].iov_len);
+            iov[i].iov_base = (char*)iov[i].iov_base + take;
+            iov[i].iov_len -= take;
+            done -= take;
+            if (iov[i].iov_len == 0) ++i;
+        }
+    }
+
+    loff_t in = 0;
+    while (ok && (size_t)in < spilled) {
+        ssize_t n = copy_file_range(tmpFd, &in, fd, nullptr, spilled - (size_t)in, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) continue;
+        if (n == 0) {
+            ok = false;
+            break;
+        }
+        // Kernels or filesystems without copy_file_range: copy through the buffer
+        buffer.resize(BufferBytes);
+        while (ok && (size_t)in < spilled) {
+            ssize_t r = pread(tmpFd, buffer.data(), std::min(BufferBytes, spilled - (size_t)in), in);
+            if (r < 0 && errno == EINTR) continue;
+            ok = r > 0 && writeAll(fd, buffer.data(), (size_t)r);
+            in += r;
+        }
+        buffer.clear();
+    }
+    return close(fd) == 0 && ok;
+}
@@ -0,0 +1,164 @@
+#include <compiler_amd64.hpp>
+#include <iostream>
+#include <sstream>
+#include <functional>
+#include <unordered_set>
+
+// parallel for (let i = lo; i < hi; i++) { body }
+//
+// The body is outlined into __aol_pfor_N__(lo, hi, env), a plain for over
+// [lo, hi), and __aol_parallel_for splits the range into tasks for the thread
+// pool. env is the enclosing frame: the outlined function copies the locals the
+// body reads from it on entry, so iterations see their values from before the
+// loop and can't assign them. Results go through memory the body is given a
+// pointer to. The loop variable itself isn't updated in the enclosing function.
+
+static bool isIdent(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+    return node && node->type == ASTNodeType::Identifier && node->name == name;
+}
+
+static std::shared_ptr<ASTNode> ident(const std::string& name, int line, int col) {
+    return std::make_shared<ASTNode>(ASTNodeType::Identifier, line, col, name);
+}
+
+// i++, i += 1 and i = i + 1 all parse to the last one
+static bool isIncrement(const std::shared_ptr<ASTNode>& step, const std::string& iv) {
+    if (!step || step->type != ASTNodeType::AssignExpr || !isIdent(step->children[0], iv)) return false;
+    auto& sum = step->children[1];
+    return sum && sum->type == ASTNodeType::BinaryExpr && sum->name == "+" && isIdent(sum->children[0], iv) &&
+           IsIntegerLiteral(sum->children[1]) && sum->children[1]->value == "1";
+}
+
+static bool declares(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+    if (!node) return false;
+    if (node->type == ASTNodeType::VariableDecl && node->name == name) return true;
+    for (auto& child : node->children)
+        if (declares(child, name)) return true;
+    return false;
+}
+
+// The declaration of the loop variable, the optimizer may have wrapped the init in a block
+static std::shared_ptr<ASTNode> findInit(const std::shared_ptr<ASTNode>& init, const std::string& iv) {
+    if (!init) return nullptr;
+    if (init->type == ASTNodeType::VariableDecl) return init->name == iv ? init : nullptr;
+    if (init->type != ASTNodeType::StmtBlock) return nullptr;
+    for (auto& stmt : init->children)
+        if (auto decl = findInit(stmt, iv)) return decl;
+    return nullptr;
+}
+
+std::string Compiler_Amd64::compileParallelFor(const std::shared_ptr<ASTNode>& node) {
+    auto where = " at line " + std::to_string(node->line) + " col " + std::to_string(node->col) + "\n";
+    auto& init = node->children[0];
+    auto& cond = node->children[1];
+    auto& step = node->children[2];
+    auto& body = node->children[3];
+
+    std::string iv = cond && cond->type == ASTNodeType::BinaryExpr && cond->children[0]->type == ASTNodeType::Identifier ? cond->children[0]->name : "";
+    auto decl = findInit(init, iv);
+    if (!decl || (cond->name != "<" && cond->name != "<=") || !isIncrement(step, iv)) {
+        std::cerr << "Error: parallel for needs the form (let i = lo; i < hi; i++)" << where;
+        return "";
+    }
+    if (coroutine.active) {
+        std::cerr << "Error: parallel for inside an async function" << where;
+        return "";
+    }
+
+    // What the body reads from the enclosing function, and what it must not do
+    bool ok = true;
+    std::vector<Capture> reads;
+    std::unordered_set<std::string> seen = {iv};
+    std::function<void(const std::shared_ptr<ASTNode>&, int)> scan = [&](const std::shared_ptr<ASTNode>& n, int loops) {
+        if (!n) return;
+        auto at = " at line " + std::to_string(n->line) + " col " + std::to_string(n->col) + "\n";
+        switch (n->type) {
+            case ASTNodeType::ReturnStmt:
+                std::cerr << "Error: ret inside a parallel for" << at;
+                ok = false;
+                break;
+            case ASTNodeType::BreakStmt:
+                if (loops == 0) { std::cerr << "Error: break out of a parallel for" << at; ok = false; }
+                break;
+            case ASTNodeType::WhileStmt:
+            case ASTNodeType::ForStmt:
+            case ASTNodeType::SwitchStmt:
+                loops++;
+                break;
+            case ASTNodeType::AssignExpr: {
+                auto& target = n->children[0];
+                if (target->type == ASTNodeType::Identifier && target->name != iv && variableOperand(target->name).rfind("[%rbp", 0) == 0 &&
+                    !declares(body, target->name)) {
+                    std::cerr << "Error: parallel for body assigns '" << target->name << "' of the enclosing function, write through a pointer instead" << at;
+                    ok = false;
+                }
+                break;
+            }
+            case ASTNodeType::Identifier: {
+                if (!seen.insert(n->name).second) break;
+                std::string operand = variableOperand(n->name);
+                const VariableInfo* var = findVariable(n->name);
+                if (operand.rfind("[%rbx", 0) == 0 || (var && FindStructType(var->type))) {
+                    std::cerr << "Error: parallel for body can't use the vector or struct '" << n->name << "', pass a pointer to it" << at;
+                    ok = false;
+                } else if (operand.rfind("[%rbp", 0) == 0) {
+                    reads.push_back({n->name, var ? var->type : "", "[%rcx" + operand.substr(5)});
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        for (auto& child : n->children) scan(child, loops);
+    };
+    scan(body, 0);
+    if (!ok) return "";
+
+    std::ostringstream out;
+    out << compileLoopClause(init);
+    std::string lo = variableOperand(iv);
+    int hiSlot = allocateLocal("%hi");
+    out << compileExpression(cond->children[1], "%rax");
+    if (cond->name == "<=") out << "\tinc %rax\n";
+    out << "\tmov [%rbp - " << hiSlot << "], %rax\n";
+
+    // __aol_pfor_N__(%lo, %hi, %env) { for (let i = %lo; i < %hi; i++) body }
+    auto fn = std::make_shared<ASTNode>(ASTNodeType::FunctionDecl, node->line, node->col, newLabel("pfor"));
+    fn->attributes["parallel"] = "";
+    for (const char* param : {"%lo", "%hi", "%env"}) fn->params.push_back(ident(param, node->line, node->col));
+    auto loop = std::make_shared<ASTNode>(ASTNodeType::ForStmt, node->line, node->col);
+    auto first = std::make_shared<ASTNode>(ASTNodeType::VariableDecl, decl->line, decl->col, iv);
+    first->typeName = decl->typeName;
+    first->children.push_back(ident("%lo", node->line, node->col));
+    auto bound = std::make_shared<ASTNode>(ASTNodeType::BinaryExpr, cond->line, cond->col, "<");
+    bound->children = {ident(iv, cond->line, cond->col), ident("%hi", cond->line, cond->col)};
+    loop->children = {first, bound, step, body};
+    fn->children.push_back(loop);
+    captures[fn.get()] = reads;
+    parallelBodies.push_back(fn);
+
+    out << "\tlea %rdi, [$" << fn->name << "]\n";
+    const VariableInfo* var = findVariable(iv);
+    out << LoadScalar(var ? var->type : "", "%rsi", lo);
+    out << "\tmov %rdx, [%rbp - " << hiSlot << "]\n";
+    out << "\tmov %rcx, %rbp\n";
+    out << "\tcall __aol_parallel_for\n";
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileCaptures(const std::shared_ptr<ASTNode>& fn) {
+    auto found = captures.find(fn.get());
+    if (found == captures.end()) return "";
+    std::ostringstream out;
+    std::string env = variableOperand("%env");
+    for (auto& c : found->second) {
+        const IntegerType* it = FindIntegerType(c.type);
+        int size = it ? it->bytes : 8;
+        int offset = allocateLocal(c.name, size, c.type, size);
+        out << "\tmov %rcx, " << env << "\n";
+        out << LoadScalar(c.type, "%rax", c.operand);
+        out << StoreScalar(c.type, "[%rbp - " + std::to_string(offset) + "]", "%rax");
+    }
+    captures.erase(found);
+    return out.str();
+}
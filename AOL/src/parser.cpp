@@ -47,19 +47,86 @@ void AOL_Parser::expect(TokenType type, const std::string& errMsg) {
 static int precedence(TokenType t) {
     switch (t) {
         case TokenType::Star:
-        case TokenType::Slash: return 3;
+        case TokenType::Slash:
+        case TokenType::Percent: return 10;
         case TokenType::Plus:
-        case TokenType::Minus: return 2;
-        case TokenType::EqualEqual:
-        case TokenType::BangEqual:
+        case TokenType::Minus: return 9;
+        case TokenType::ShiftLeft:
+        case TokenType::ShiftRight: return 8;
         case TokenType::Less:
         case TokenType::LessEqual:
         case TokenType::Greater:
-        case TokenType::GreaterEqual: return 1;
+        case TokenType::GreaterEqual: return 7;
+        case TokenType::EqualEqual:
+        case TokenType::NEqual:
+        case TokenType::BangEqual: return 6;
+        case TokenType::Amp: return 5;
+        case TokenType::Caret: return 4;
+        case TokenType::Pipe: return 3;
+        case TokenType::AndAnd: return 2;
+        case TokenType::OrOr: return 1;
         default: return 0;
     }
 }
 
+// Binary operator a compound assignment desugars to, or "" if t isn't one
+static std::string compoundOperator(TokenType t) {
+    switch (t) {
+        case TokenType::PlusAssign: return "+";
+        case TokenType::MinusAssign: return "-";
+        case TokenType::StarAssign: return "*";
+        case TokenType::SlashAssign: return "/";
+        case TokenType::PercentAssign: return "%";
+        case TokenType::AmpAssign: return "&";
+        case TokenType::PipeAssign: return "|";
+        case TokenType::CaretAssign: return "^";
+        case TokenType::ShiftLeftAssign: return "<<";
+        case TokenType::ShiftRightAssign: return ">>";
+        default: return "";
+    }
+}
+
+static std::shared_ptr<ASTNode> makeAssign(std::shared_ptr<ASTNode> target, std::shared_ptr<ASTNode> value, int line, int col) {
+    auto node = std::make_shared<ASTNode>(ASTNodeType::AssignExpr, line, col);
+    node->name = "=";
+    node->children.push_back(target);
+    node->children.push_back(value);
+    return node;
+}
+
+static std::shared_ptr<ASTNode> makeBinary(const std::string& op, std::shared_ptr<ASTNode> lhs, std::shared_ptr<ASTNode> rhs, int line, int col) {
+    auto node = std::make_shared<ASTNode>(ASTNodeType::BinaryExpr, line, col);
+    node->name = op;
+    node->children.push_back(lhs);
+    node->children.push_back(rhs);
+    return node;
+}
+
+static std::shared_ptr<ASTNode> cloneNode(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return nullptr;
+    auto copy = std::make_shared<ASTNode>(*node);
+    for (auto& child : copy->children) child = cloneNode(child);
+    return copy;
+}
+
+static bool hasSideEffects(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return false;
+    if (node->type == ASTNodeType::CallExpr || node->type == ASTNodeType::AssignExpr ||
+        (node->type == ASTNodeType::UnaryExpr && node->name == "await")) return true;
+    for (auto& child : node->children)
+        if (hasSideEffects(child)) return true;
+    return false;
+}
+
+// target = target op rhs, the operand reads a copy of the target. The target
+// is evaluated twice, so one that calls or assigns is an error.
+static std::shared_ptr<ASTNode> makeCompound(const std::string& op, std::shared_ptr<ASTNode> target, std::shared_ptr<ASTNode> rhs, const Token& at) {
+    if (hasSideEffects(target))
+        std::cerr << Color::Red << "Target of '" << at.text << "' must not call functions or assign, store it in a variable first, at "
+                  << at.line << ":" << at.col << "\n";
+    return makeAssign(target, makeBinary(op, cloneNode(target), rhs, at.line, at.col), at.line, at.col);
+}
+
 std::shared_ptr<ASTNode> AOL_Parser::parseProgram() {
     auto program = std::make_shared<ASTNode>(ASTNodeType::Program);
     while (!isAtEnd()) {
@@ -72,21 +139,160 @@ std::shared_ptr<ASTNode> AOL_Parser::parseStatement() {
     Token t = peek();
     switch (t.type) {
         case TokenType::Function:   return parseFunction();
+        case TokenType::Struct:     return parseStruct();
+        case TokenType::Import:     return parseModuleName(ASTNodeType::ImportDecl);
+        case TokenType::Module:     return parseModuleName(ASTNodeType::ModuleDecl);
+        case TokenType::External: {
+            advance(); // extern
+            auto fn = parseFunction();
+            if (!fn->attributes.count("extern"))
+                std::cerr << Color::Red << "extern function '" << fn->name << "' must not have a body at " << t.line << ":" << t.col << "\n";
+            return fn;
+        }
+        case TokenType::Async: {
+            advance(); // async, the function becomes a coroutine resumed through its frame
+            auto fn = parseFunction();
+            fn->attributes["async"] = "";
+            if (fn->attributes.count("extern"))
+                std::cerr << Color::Red << "async function '" << fn->name << "' must have a body at " << t.line << ":" << t.col << "\n";
+            return fn;
+        }
+        case TokenType::ConstDecl: {
+            if (peek(1).type != TokenType::Function) return parseVariableDecl();
+            advance(); // const, calls with constant arguments are evaluated at compile time
+            auto fn = parseFunction();
+            fn->attributes["const"] = "";
+            if (fn->attributes.count("extern"))
+                std::cerr << Color::Red << "const function '" << fn->name << "' must have a body at " << t.line << ":" << t.col << "\n";
+            return fn;
+        }
         case TokenType::VarDecl:
-        case TokenType::Let:
-        case TokenType::ConstDecl:  return parseVariableDecl();
+        case TokenType::Let:        return parseVariableDecl();
         case TokenType::Return:     return parseReturn();
         case TokenType::If:         return parseIf();
         case TokenType::While:      return parseWhile();
         case TokenType::For:        return parseFor();
+        case TokenType::Parallel: {
+            advance(); // parallel, the iterations of the for run as tasks on the thread pool
+            if (peek().type != TokenType::For) {
+                std::cerr << Color::Red << "Expected 'for' after 'parallel' at " << t.line << ":" << t.col << "\n";
+                return nullptr;
+            }
+            auto loop = parseFor();
+            loop->attributes["parallel"] = "";
+            return loop;
+        }
+        case TokenType::Switch:     return parseSwitch();
         case TokenType::Break:      return parseBreak();
         case TokenType::Continue:   return parseContinue();
-        default:                    return parseExpression();
+        case TokenType::Assembly:   return parseAsm();
+        case TokenType::Unsafe: {
+            advance(); // unsafe, only marks the block
+            auto block = parseBlock();
+            block->attributes["unsafe"] = "";
+            return block;
+        }
+        case TokenType::LBrace:     return parseBlock();
+        case TokenType::Hash: {
+            auto attrs = parseAttributes();
+            auto stmt = parseStatement();
+            if (stmt) stmt->attributes.insert(attrs.begin(), attrs.end());
+            return stmt;
+        }
+        default: {
+            auto expr = parseStatementExpression();
+            expect(TokenType::Semicolon, "Expected ';' after expression");
+            return expr;
+        }
     }
 }
 
+// #[name] or #[name(arg)], several attributes may share one bracket: #[a, b(1)]
+std::unordered_map<std::string, std::string> AOL_Parser::parseAttributes() {
+    std::unordered_map<std::string, std::string> attrs;
+    while (match(TokenType::Hash)) {
+        expect(TokenType::LBracket, "Expected '[' after '#'");
+        while (peek().type != TokenType::RBracket && !isAtEnd()) {
+            Token name = advance();
+            std::string arg;
+            if (match(TokenType::LParen)) {
+                while (peek().type != TokenType::RParen && !isAtEnd())
+                    arg += advance().text;
+                expect(TokenType::RParen, "Expected ')' after attribute argument");
+            }
+            attrs[name.text] = arg;
+            if (!match(TokenType::Comma)) break;
+        }
+        expect(TokenType::RBracket, "Expected ']' to close attribute");
+    }
+    return attrs;
+}
+
+// Parses either a braced statement list or a single statement, always yielding a StmtBlock
+std::shared_ptr<ASTNode> AOL_Parser::parseBlock() {
+    auto block = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, peek().line, peek().col);
+    if (match(TokenType::LBrace)) {
+        while (!match(TokenType::RBrace) && !isAtEnd()) {
+            block->children.push_back(parseStatement());
+        }
+    } else {
+        block->children.push_back(parseStatement());
+    }
+    return block;
+}
+
 std::shared_ptr<ASTNode> AOL_Parser::parseExpression() {
-    return parseBinaryOp(0);
+    return parseAssignment();
+}
+
+// Expression statements and the clauses of a for, where the value is unused
+std::shared_ptr<ASTNode> AOL_Parser::parseStatementExpression() {
+    statementPosition = true;
+    return parseExpression();
+}
+
+// Assignment is right associative and binds loosest. Compound forms and ++/--
+// are desugared here so later stages only ever see plain '='. x++ and x--
+// yield the new value like their prefix forms would, so they are only allowed
+// where the value is unused.
+std::shared_ptr<ASTNode> AOL_Parser::parseAssignment() {
+    bool statement = statementPosition;
+    statementPosition = false;
+
+    Token t = peek();
+    if (t.type == TokenType::Increment || t.type == TokenType::Decrement) {
+        advance();
+        auto target = parseUnary();
+        auto one = std::make_shared<ASTNode>(ASTNodeType::Literal, t.line, t.col);
+        one->value = "1";
+        return makeCompound(t.type == TokenType::Increment ? "+" : "-", target, one, t);
+    }
+
+    auto left = parseBinaryOp(0);
+    Token op = peek();
+
+    if (op.type == TokenType::Equal) {
+        advance();
+        return makeAssign(left, parseAssignment(), op.line, op.col);
+    }
+
+    std::string binop = compoundOperator(op.type);
+    if (!binop.empty()) {
+        advance();
+        return makeCompound(binop, left, parseAssignment(), op);
+    }
+
+    if (op.type == TokenType::Increment || op.type == TokenType::Decrement) {
+        advance();
+        if (!statement)
+            std::cerr << Color::Red << "Postfix '" << op.text << "' can only be a statement, use prefix '" << op.text
+                      << "' for the updated value, at " << op.line << ":" << op.col << "\n";
+        auto one = std::make_shared<ASTNode>(ASTNodeType::Literal, op.line, op.col);
+        one->value = "1";
+        return makeCompound(op.type == TokenType::Increment ? "+" : "-", left, one, op);
+    }
+
+    return left;
 }
 
 std::shared_ptr<ASTNode> AOL_Parser::parseBinaryOp(int minPrecedence) {
@@ -96,7 +302,7 @@ std::shared_ptr<ASTNode> AOL_Parser::parseBinaryOp(int minPrecedence) {
         int p = precedence(op.type);
         if (p < minPrecedence || p == 0) break;
         advance();
-        int nextMin = p;
+        int nextMin = p + 1; // left associative
         auto right = parseBinaryOp(nextMin);
         auto node = std::make_shared<ASTNode>(ASTNodeType::BinaryExpr, op.line, op.col);
         node->name = op.text;
@@ -109,7 +315,8 @@ std::shared_ptr<ASTNode> AOL_Parser::parseBinaryOp(int minPrecedence) {
 
 std::shared_ptr<ASTNode> AOL_Parser::parseUnary() {
     Token t = peek();
-    if (t.type == TokenType::Plus || t.type == TokenType::Minus || t.type == TokenType::Bang) {
+    if (t.type == TokenType::Plus || t.type == TokenType::Minus || t.type == TokenType::Bang || t.type == TokenType::Tilde ||
+        t.type == TokenType::Amp || t.type == TokenType::Await) {
         advance();
         auto right = parseUnary();
         auto node = std::make_shared<ASTNode>(ASTNodeType::UnaryExpr, t.line, t.col);
@@ -126,16 +333,23 @@ std::shared_ptr<ASTNode> AOL_Parser::parsePrimary() {
         advance();
         auto id = std::make_shared<ASTNode>(ASTNodeType::Identifier, t.line, t.col);
         id->name = t.text;
-        return parseCallExpr(id);
+        return parsePostfix(parseCallExpr(id));
     }
     if (t.type == TokenType::IntegerLiteral || t.type == TokenType::StringLiteral) {
         return parseLiteral();
     }
+    if (t.type == TokenType::True || t.type == TokenType::False || t.type == TokenType::CharLiteral) {
+        advance();
+        auto node = std::make_shared<ASTNode>(ASTNodeType::Literal, t.line, t.col);
+        if (t.type == TokenType::CharLiteral) node->value = std::to_string((int)(unsigned char)t.text[0]);
+        else node->value = t.type == TokenType::True ? "1" : "0";
+        return node;
+    }
     if (t.type == TokenType::LParen) {
         advance();
         auto expr = parseExpression();
         expect(TokenType::RParen, "Expected ')'");
-        return expr;
+        return parsePostfix(expr);
     }
     if (t.type == TokenType::Semicolon) {
     }
@@ -174,6 +388,7 @@ std::shared_ptr<ASTNode> AOL_Parser::parseLiteral() {
     Token t = advance();
     auto node = std::make_shared<ASTNode>(ASTNodeType::Literal, t.line, t.col);
     node->value = t.text;
+    if (t.type == TokenType::StringLiteral) node->name = "string";
     return node;
 }
 
@@ -195,10 +410,70 @@ std::shared_ptr<ASTNode> AOL_Parser::parseCallExpr(std::shared_ptr<ASTNode> call
             expect(TokenType::Comma, "Expected ','");
         }
     }
-    expect(TokenType::Semicolon, "Expected ';");
     return call;
 }
 
+// Field access chain: expr.a.b
+std::shared_ptr<ASTNode> AOL_Parser::parsePostfix(std::shared_ptr<ASTNode> expr) {
+    while (match(TokenType::Dot)) {
+        Token field = advance();
+        if (field.type != TokenType::Identifier) {
+            std::cerr << Color::Red << "Expected field name after '.' at " << field.line << ":" << field.col << "\n";
+            break;
+        }
+        auto node = std::make_shared<ASTNode>(ASTNodeType::MemberExpr, field.line, field.col);
+        node->name = field.text;
+        node->children.push_back(expr);
+        expr = node;
+    }
+    return expr;
+}
+
+// Type annotation after ':' or '->', *T is a pointer to T
+std::string AOL_Parser::parseType() {
+    if (match(TokenType::Star)) {
+        std::string pointee = parseType();
+        return pointee.empty() ? "" : "*" + pointee;
+    }
+    Token t = advance();
+    if (t.type != TokenType::Identifier) {
+        std::cerr << Color::Red << "Expected type name at " << t.line << ":" << t.col << "\n";
+        return "";
+    }
+    return t.text;
+}
+
+// struct Name { field: Type, #[align(64)] hot, ... }, fields without a type are 64-bit integers
+std::shared_ptr<ASTNode> AOL_Parser::parseStruct() {
+    expect(TokenType::Struct, "Expected 'struct'");
+    Token nameToken = advance();
+    auto node = std::make_shared<ASTNode>(ASTNodeType::StructDecl, nameToken.line, nameToken.col);
+    if (nameToken.type != TokenType::Identifier) {
+        std::cerr << Color::Red << "Expected struct name at " << nameToken.line << ":" << nameToken.col << "\n";
+        return node;
+    }
+    node->name = nameToken.text;
+
+    expect(TokenType::LBrace, "Expected '{' after struct name");
+    while (peek().type != TokenType::RBrace && !isAtEnd()) {
+        auto attrs = parseAttributes();
+        Token fieldToken = advance();
+        if (fieldToken.type != TokenType::Identifier) {
+            std::cerr << Color::Red << "Expected field name at " << fieldToken.line << ":" << fieldToken.col << "\n";
+            break;
+        }
+        auto field = std::make_shared<ASTNode>(ASTNodeType::Identifier, fieldToken.line, fieldToken.col);
+        field->name = fieldToken.text;
+        field->attributes = attrs;
+        if (match(TokenType::Colon)) field->typeName = parseType();
+        node->params.push_back(field);
+
+        if (!match(TokenType::Comma) && !match(TokenType::Semicolon)) break;
+    }
+    expect(TokenType::RBrace, "Expected '}' to close struct");
+    return node;
+}
+
 std::shared_ptr<ASTNode> AOL_Parser::parseFunction() {
     expect(TokenType::Function, "Expected 'fn'");
     Token nameToken = advance();
@@ -222,12 +497,18 @@ std::shared_ptr<ASTNode> AOL_Parser::parseFunction() {
 
         auto paramNode = std::make_shared<ASTNode>(ASTNodeType::Identifier, paramToken.line, paramToken.col);
         paramNode->name = paramToken.text;
+        if (match(TokenType::Colon)) paramNode->typeName = parseType();
         node->params.push_back(paramNode);
 
         if (!match(TokenType::Comma)) break;
     }
 
     expect(TokenType::RParen, "Expected ')' after parameters");
+    if (match(TokenType::Arrow)) node->typeName = parseType();
+    if (match(TokenType::Semicolon)) { // prototype, defined elsewhere
+        node->attributes["extern"] = "";
+        return node;
+    }
 
     if (!match(TokenType::LBrace)) {
         std::cerr << Color::Red << "Expected '{' to start function body at " 
@@ -245,6 +526,7 @@ std::shared_ptr<ASTNode> AOL_Parser::parseFunction() {
 std::shared_ptr<ASTNode> AOL_Parser::parseVariableDecl() {
     Token declToken = advance(); // var, let, or const
     auto node = std::make_shared<ASTNode>(ASTNodeType::VariableDecl, declToken.line, declToken.col);
+    if (declToken.type == TokenType::ConstDecl) node->attributes["const"] = "";
 
     Token nameToken = advance();
     if (nameToken.type != TokenType::Identifier) {
@@ -252,6 +534,7 @@ std::shared_ptr<ASTNode> AOL_Parser::parseVariableDecl() {
         return node;
     }
     node->name = nameToken.text; 
+    if (match(TokenType::Colon)) node->typeName = parseType();
 
     if (match(TokenType::Equal)) {
         node->children.push_back(parseExpression());
@@ -281,24 +564,10 @@ std::shared_ptr<ASTNode> AOL_Parser::parseIf() {
     node->children.push_back(parseExpression()); // condition
     expect(TokenType::RParen, "Expected ')' after condition");
 
-    if (match(TokenType::LBrace)) {
-        while (!match(TokenType::RBrace) && !isAtEnd()) {
-            node->children.push_back(parseStatement());
-        }
-    } else {
-        node->children.push_back(parseStatement());
-    }
+    node->children.push_back(parseBlock()); // then
 
     if (match(TokenType::Else)) {
-        if (match(TokenType::LBrace)) {
-            auto elseNode = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, peek().line, peek().col);
-            while (!match(TokenType::RBrace) && !isAtEnd()) {
-                elseNode->children.push_back(parseStatement());
-            }
-            node->children.push_back(elseNode);
-        } else {
-            node->children.push_back(parseStatement());
-        }
+        node->children.push_back(parseBlock()); // else
     }
 
     return node;
@@ -312,13 +581,7 @@ std::shared_ptr<ASTNode> AOL_Parser::parseWhile() {
     node->children.push_back(parseExpression()); // condition
     expect(TokenType::RParen, "Expected ')' after condition");
 
-    if (match(TokenType::LBrace)) {
-        while (!match(TokenType::RBrace) && !isAtEnd()) {
-            node->children.push_back(parseStatement());
-        }
-    } else {
-        node->children.push_back(parseStatement());
-    }
+    node->children.push_back(parseBlock()); // body
 
     return node;
 }
@@ -329,31 +592,77 @@ std::shared_ptr<ASTNode> AOL_Parser::parseFor() {
 
     expect(TokenType::LParen, "Expected '(' after 'for'");
 
-    if (peek().type != TokenType::Semicolon) {
-        if (peek().type == TokenType::VarDecl || peek().type == TokenType::ConstDecl || peek().type == TokenType::Let) {
-            node->children.push_back(parseVariableDecl());
-        } else {
-            node->children.push_back(parseExpression());
-        }
+    // children: init, condition, step, body. Absent clauses are kept as nullptr
+    // so the layout stays fixed.
+    if (peek().type == TokenType::VarDecl || peek().type == TokenType::ConstDecl || peek().type == TokenType::Let) {
+        node->children.push_back(parseVariableDecl()); // consumes ';'
+    } else {
+        node->children.push_back(peek().type != TokenType::Semicolon ? parseStatementExpression() : nullptr);
+        expect(TokenType::Semicolon, "Expected, ';'");
     }
-    expect(TokenType::Semicolon, "Expected, ';'");
 
-    if (peek().type != TokenType::Semicolon)
-        node->children.push_back(parseExpression());
+    node->children.push_back(peek().type != TokenType::Semicolon ? parseExpression() : nullptr);
     expect(TokenType::Semicolon, "Expected ';'");
 
-    if (peek().type != TokenType::RParen)
-        node->children.push_back(parseExpression());
+    node->children.push_back(peek().type != TokenType::RParen ? parseStatementExpression() : nullptr);
     expect(TokenType::RParen, "Expected ')'");
 
-    if (match(TokenType::LBrace)) {
-        while (!match(TokenType::RBrace) && !isAtEnd()) {
-            node->children.push_back(parseStatement());
+    node->children.push_back(parseBlock()); // body
+
+    return node;
+}
+
+// switch (x) { case 1, 2: ... case 3: ... default: ... }
+// Clauses fall through like C, 'break' leaves the switch. A CaseClause holds its body
+// block first and its values after it, the default clause has no values.
+std::shared_ptr<ASTNode> AOL_Parser::parseSwitch() {
+    Token switchToken = advance(); // 'switch'
+    auto node = std::make_shared<ASTNode>(ASTNodeType::SwitchStmt, switchToken.line, switchToken.col);
+
+    expect(TokenType::LParen, "Expected '(' after 'switch'");
+    node->children.push_back(parseExpression());
+    expect(TokenType::RParen, "Expected ')' after switch value");
+    expect(TokenType::LBrace, "Expected '{' to start switch body");
+
+    bool hasDefault = false;
+    while (!match(TokenType::RBrace) && !isAtEnd()) {
+        Token label = advance();
+        auto clause = std::make_shared<ASTNode>(ASTNodeType::CaseClause, label.line, label.col);
+        auto body = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, label.line, label.col);
+        clause->children.push_back(body);
+
+        if (label.type == TokenType::Case) {
+            do {
+                clause->children.push_back(parseExpression());
+            } while (match(TokenType::Comma));
+        } else if (label.type == TokenType::Default) {
+            if (hasDefault)
+                std::cerr << Color::Red << "Duplicate 'default' at " << label.line << ":" << label.col << "\n";
+            hasDefault = true;
+            clause->name = "default";
+        } else {
+            std::cerr << Color::Red << "Expected 'case' or 'default' at " << label.line << ":" << label.col << "\n";
+            continue;
         }
-    } else {
-        node->children.push_back(parseStatement());
+        expect(TokenType::Colon, "Expected ':' after case label");
+
+        while (!isAtEnd() && peek().type != TokenType::Case && peek().type != TokenType::Default && peek().type != TokenType::RBrace)
+            body->children.push_back(parseStatement());
+        node->children.push_back(clause);
     }
+    return node;
+}
 
+std::shared_ptr<ASTNode> AOL_Parser::parseModuleName(ASTNodeType type) {
+    Token keyword = advance(); // 'import' or 'module'
+    auto node = std::make_shared<ASTNode>(type, keyword.line, keyword.col);
+    Token nameToken = advance();
+    if (nameToken.type != TokenType::Identifier) {
+        std::cerr << Color::Red << "Expected module name at " << nameToken.line << ":" << nameToken.col << "\n";
+        return node;
+    }
+    node->name = nameToken.text;
+    expect(TokenType::Semicolon, "Expected ';' after module name");
     return node;
 }
 
@@ -370,3 +679,72 @@ std::shared_ptr<ASTNode> AOL_Parser::parseContinue() {
     match(TokenType::Semicolon);
     return node;
 }
+
+// asm [volatile] [(out t: "r", f: "r" = s.f; in x: "rcx", y: "r" = n * 2; inout acc: "r"; clobber "rdx", "memory")] {
+//     "instruction with {t}, {x} ..."
+// }
+// Operand i is described by params[i] (name = placeholder, value = constraint,
+// attributes["dir"] = in/out/inout) and evaluated from or stored to children[i].
+std::shared_ptr<ASTNode> AOL_Parser::parseAsm() {
+    Token asmToken = advance(); // asm
+    auto node = std::make_shared<ASTNode>(ASTNodeType::AsmStmt, asmToken.line, asmToken.col);
+    if (peek().type == TokenType::Identifier && peek().text == "volatile") {
+        advance();
+        node->attributes["volatile"] = "";
+    }
+
+    if (match(TokenType::LParen)) {
+        std::string clobbers;
+        while (peek().type != TokenType::RParen && !isAtEnd()) {
+            Token section = advance();
+            bool isClobber = section.text == "clobber";
+            if (!isClobber && section.text != "in" && section.text != "out" && section.text != "inout") {
+                std::cerr << Color::Red << "Expected in, out, inout or clobber at " << section.line << ":" << section.col << "\n";
+                break;
+            }
+            do {
+                if (isClobber) {
+                    Token reg = advance();
+                    if (reg.type != TokenType::StringLiteral) {
+                        std::cerr << Color::Red << "Expected clobbered register as a string at " << reg.line << ":" << reg.col << "\n";
+                        break;
+                    }
+                    clobbers += (clobbers.empty() ? "" : ",") + reg.text;
+                    continue;
+                }
+                Token name = advance();
+                if (name.type != TokenType::Identifier) {
+                    std::cerr << Color::Red << "Expected operand name at " << name.line << ":" << name.col << "\n";
+                    break;
+                }
+                expect(TokenType::Colon, "Expected ':' before operand constraint");
+                Token constraint = advance();
+                if (constraint.type != TokenType::StringLiteral) {
+                    std::cerr << Color::Red << "Expected operand constraint as a string at " << constraint.line << ":" << constraint.col << "\n";
+                    break;
+                }
+
+                auto operand = std::make_shared<ASTNode>(ASTNodeType::Identifier, name.line, name.col, name.text);
+                operand->value = constraint.text;
+                operand->attributes["dir"] = section.text;
+                node->params.push_back(operand);
+
+                // Bound to the variable of the same name unless given: the value of
+                // an input, the variable or struct field an output is stored to
+                if (match(TokenType::Equal)) node->children.push_back(parseExpression());
+                else node->children.push_back(std::make_shared<ASTNode>(ASTNodeType::Identifier, name.line, name.col, name.text));
+            } while (match(TokenType::Comma));
+            if (!match(TokenType::Semicolon)) break;
+        }
+        expect(TokenType::RParen, "Expected ')' after asm operands");
+        if (!clobbers.empty()) node->attributes["clobber"] = clobbers;
+    }
+
+    expect(TokenType::LBrace, "Expected '{' to start asm block");
+    while (peek().type == TokenType::StringLiteral) {
+        node->value += advance().text + "\n";
+        if (!match(TokenType::Comma)) match(TokenType::Semicolon);
+    }
+    expect(TokenType::RBrace, "Expected '}' to close asm block, instructions are string literals");
+    return node;
+}
@@ -0,0 +1,195 @@
+#include <profile.hpp>
+#include <parser.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <functional>
+#include <unordered_map>
+
+static const int ProfileVersion = 1;
+static const uint64_t HotFraction = 100; // hot calls run at least 1/HotFraction as often as the hottest block
+
+static void hashNode(const std::shared_ptr<ASTNode>& node, uint64_t& h) {
+    auto mix = [&](const std::string& s) {
+        for (unsigned char c : s) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        h ^= 0xFF; // separator, so "ab","c" and "a","bc" differ
+        h *= 1099511628211ull;
+    };
+    if (!node) {
+        mix("~");
+        return;
+    }
+    mix(std::to_string((int)node->type));
+    mix(node->name);
+    mix(node->value);
+    mix(node->typeName);
+    mix(std::to_string(node->params.size()));
+    for (auto& p : node->params) hashNode(p, h);
+    mix(std::to_string(node->children.size()));
+    for (auto& c : node->children) hashNode(c, h);
+}
+
+uint64_t HashFunction(const std::shared_ptr<ASTNode>& fn) {
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    hashNode(fn, h);
+    return h;
+}
+
+std::string ProfileLayout::header() const {
+    std::ostringstream out;
+    out << "AOLPROF " << ProfileVersion << "\n";
+    for (auto& f : functions) out << "fn " << f.name << " " << std::hex << f.hash << std::dec << " " << f.first << " " << f.count << "\n";
+    out << "counters " << counters << "\n";
+    return out.str();
+}
+
+// The counted places of fn in their fixed order: the function itself, then in
+// pre-order both arms of every if and the body of every loop. An absent else
+// arm is reported with block == nullptr.
+struct CountedSite {
+    std::shared_ptr<ASTNode> owner;
+    std::shared_ptr<ASTNode> block;
+};
+
+static void collectSites(const std::shared_ptr<ASTNode>& node, std::vector<CountedSite>& sites) {
+    if (!node) return;
+    if (node->type == ASTNodeType::IfStmt && node->children.size() >= 2) {
+        sites.push_back({node, node->children[1]});
+        sites.push_back({node, node->children.size() > 2 ? node->children[2] : nullptr});
+    } else if (node->type == ASTNodeType::WhileStmt && node->children.size() >= 2) {
+        sites.push_back({node, node->children[1]});
+    } else if (node->type == ASTNodeType::ForStmt && node->children.size() >= 4) {
+        sites.push_back({node, node->children[3]});
+    }
+    for (auto& child : node->children) collectSites(child, sites);
+}
+
+static bool isCounted(const std::shared_ptr<ASTNode>& fn) {
+    return fn && fn->type == ASTNodeType::FunctionDecl && !fn->attributes.count("extern");
+}
+
+ProfileLayout AssignProfileCounters(const std::shared_ptr<ASTNode>& program) {
+    ProfileLayout layout;
+    for (auto& fn : program->children) {
+        if (!isCounted(fn)) continue;
+        ProfileFunction record{fn->name, HashFunction(fn), layout.counters, 0};
+        std::vector<CountedSite> sites;
+        for (auto& stmt : fn->children) collectSites(stmt, sites);
+
+        fn->attributes["prof"] = std::to_string(layout.counters++);
+        for (auto& site : sites) {
+            auto block = site.block;
+            if (!block) {
+                block = std::make_shared<ASTNode>(ASTNodeType::StmtBlock, site.owner->line, site.owner->col);
+                site.owner->children.push_back(block);
+            }
+            block->attributes["prof"] = std::to_string(layout.counters++);
+        }
+        record.count = layout.counters - record.first;
+        layout.functions.push_back(record);
+    }
+    return layout;
+}
+
+static bool readProfile(const std::string& path, std::vector<ProfileFunction>& functions, std::vector<uint64_t>& counters) {
+    std::ifstream in(path, std::ios::binary);
+    std::string line, word;
+    int version = 0;
+    if (!std::getline(in, line) || !(std::istringstream(line) >> word >> version) || word != "AOLPROF" || version != ProfileVersion)
+        return false;
+    size_t n = 0;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        fields >> word;
+        if (word == "counters") {
+            if (!(fields >> n)) return false;
+            break;
+        }
+        ProfileFunction f;
+        if (word != "fn" || !(fields >> f.name >> std::hex >> f.hash >> std::dec >> f.first >> f.count)) return false;
+        functions.push_back(f);
+    }
+    counters.resize(n);
+    if (!in.read((char*)counters.data(), (std::streamsize)(n * sizeof(uint64_t)))) return false;
+    for (auto& f : functions)
+        if (f.first > n || f.count > n - f.first) return false;
+    return true;
+}
+
+bool ApplyProfile(const std::shared_ptr<ASTNode>& program, const std::string& path, std::vector<std::string>& remarks) {
+    std::vector<ProfileFunction> functions;
+    std::vector<uint64_t> counters;
+    if (!readProfile(path, functions, counters)) {
+        std::cerr << "Warning: Can't read profile '" << path << "', compiling without it\n";
+        return false;
+    }
+    std::unordered_map<std::string, const ProfileFunction*> byName;
+    for (auto& f : functions) byName[f.name] = &f;
+
+    uint64_t hottest = 0;
+    for (auto c : counters) hottest = std::max(hottest, c);
+
+    size_t matched = 0, stale = 0, missing = 0;
+    for (auto& fn : program->children) {
+        if (!isCounted(fn)) continue;
+        auto it = byName.find(fn->name);
+        if (it == byName.end()) {
+            missing++;
+            continue;
+        }
+        const ProfileFunction& record = *it->second;
+        std::vector<CountedSite> sites;
+        for (auto& stmt : fn->children) collectSites(stmt, sites);
+        if (record.hash != HashFunction(fn) || record.count != sites.size() + 1) {
+            std::cerr << "Warning: Profile for '" << fn->name << "' is stale, the function changed since " << path
+                      << " was recorded, compiling it without profile at line " << fn->line << " col " << fn->col << "\n";
+            stale++;
+            continue;
+        }
+        matched++;
+
+        // Everything inside a counted block is taken to run as often as the block,
+        // an early ret, break or continue makes that an overestimate
+        const uint64_t* count = counters.data() + record.first;
+        std::unordered_map<ASTNode*, uint64_t> blockCount;
+        for (size_t i = 0; i < sites.size(); ++i) {
+            if (sites[i].block) blockCount[sites[i].block.get()] = count[i + 1];
+            else sites[i].owner->attributes["else_count"] = std::to_string(count[i + 1]);
+        }
+        std::function<void(const std::shared_ptr<ASTNode>&, uint64_t)> annotate = [&](const std::shared_ptr<ASTNode>& node, uint64_t region) {
+            if (!node) return;
+            auto own = blockCount.find(node.get());
+            if (own != blockCount.end()) region = own->second;
+            if (own != blockCount.end() || node->type == ASTNodeType::IfStmt || node->type == ASTNodeType::WhileStmt ||
+                node->type == ASTNodeType::ForStmt || node->type == ASTNodeType::CallExpr)
+                node->attributes["count"] = std::to_string(region);
+            if (node->type == ASTNodeType::CallExpr && region > 0 && region * HotFraction >= hottest) node->attributes["hot"] = "";
+            for (auto& child : node->children) annotate(child, region);
+        };
+        fn->attributes["count"] = std::to_string(count[0]);
+        for (auto& stmt : fn->children) annotate(stmt, count[0]);
+    }
+
+    std::ostringstream summary;
+    summary << "profile " << path << ": " << matched << " functions matched";
+    if (stale) summary << ", " << stale << " stale";
+    if (missing) summary << ", " << missing << " not in the profile";
+    remarks.push_back(summary.str());
+    return true;
+}
+
+int64_t ProfileCount(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return -1;
+    auto it = node->attributes.find("count");
+    if (it == node->attributes.end()) return -1;
+    try {
+        return (int64_t)std::stoull(it->second);
+    } catch (...) {
+        return -1;
+    }
+}
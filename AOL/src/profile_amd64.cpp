@@ -0,0 +1,45 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+
+// --profile-generate: the counters live in .bss and are bumped in place, the
+// header naming them is a constant written in front of them on exit
+
+std::string Compiler_Amd64::profileCounter(const std::shared_ptr<ASTNode>& node) {
+    if (options.profilePath.empty() || !node) return "";
+    auto it = node->attributes.find("prof");
+    if (it == node->attributes.end()) return "";
+    return "\tadd " + MemOperand("__aol_prof_counters", 8 * std::stoi(it->second)) + ", 1\n";
+}
+
+// __aol_prof_dump(): header and counters to options.profilePath, truncating it.
+// Called from __aol_exit, a failing open or write loses the profile silently.
+std::string Compiler_Amd64::compileProfileRuntime() {
+    std::string header = options.profile.header();
+    bss << "\t:align 8\n\t:res __aol_prof_counters!uqword[" << std::max<size_t>(options.profile.counters, 1) << "]\n";
+    EmitBytes(rodata, "__aol_prof_header", header, false);
+    EmitBytes(rodata, "__aol_prof_path", options.profilePath, true);
+
+    std::ostringstream out;
+    out << "__aol_prof_dump:\n";
+    out << "\tmov %rax, 2\n\tlea %rdi, [__aol_prof_path]\n";
+    out << "\tmov %rsi, 577\n\tmov %rdx, 420\n\tsyscall\n"; // open(O_WRONLY | O_CREAT | O_TRUNC, 0644)
+    out << "\ttest %rax, %rax\n\tjs __aol_prof_done__\n";
+    out << "\tmov %r8, %rax\n";
+    out << "\tlea %rsi, [__aol_prof_header]\n\tmov %rdx, " << header.size() << "\n\tcall __aol_prof_write__\n";
+    out << "\tlea %rsi, [__aol_prof_counters]\n\tmov %rdx, " << 8 * options.profile.counters << "\n\tcall __aol_prof_write__\n";
+    out << "\tmov %rax, 3\n\tmov %rdi, %r8\n\tsyscall\n"; // close
+    out << "__aol_prof_done__:\n";
+    out << "\tret\n\n";
+
+    // write(%r8, %rsi, %rdx) until everything is out
+    out << "__aol_prof_write__:\n";
+    out << "\ttest %rdx, %rdx\n\tjz __aol_prof_written__\n";
+    out << "\tmov %rax, 1\n\tmov %rdi, %r8\n\tsyscall\n";
+    out << "\ttest %rax, %rax\n\tjs __aol_prof_write_err__\n";
+    out << "\tadd %rsi, %rax\n\tsub %rdx, %rax\n\tjmp __aol_prof_write__\n";
+    out << "__aol_prof_write_err__:\n";
+    out << "\tcmp %rax, -4\n\tje __aol_prof_write__\n"; // -EINTR
+    out << "__aol_prof_written__:\n";
+    out << "\tret\n\n";
+    return out.str();
+}
@@ -0,0 +1,227 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+
+// Standard output is collected in a .bss buffer and written when it fills, on
+// __aol_flush and in __aol_exit, so printing costs one syscall per buffer
+// instead of one per call. Writes larger than the buffer go out directly.
+static const int StdoutBufferSize = 64 * 1024;
+
+// Heap: requests up to PoolMaxSize come from per-size-class free lists (16, 32,
+// ... 2048 bytes) refilled a PoolSlabSize slab at a time, bigger ones are mapped
+// directly. Nothing is ever returned to the kernel except large blocks and arenas.
+static const int PoolClasses = 8;
+static const int PoolMaxSize = 16 << (PoolClasses - 1);
+static const int PoolSlabSize = 64 * 1024;
+
+// Process entry and the runtime helpers the standard library is declared against,
+// see aol_stdlib/. All of them follow the SysV ABI and only clobber
+// caller-saved registers.
+std::string Compiler_Amd64::compileRuntime() {
+    std::ostringstream out;
+
+    bss << "\t:align 16\n";
+    bss << "\t:res __aol_stdout_buf!ubyte[" << StdoutBufferSize << "]\n";
+    bss << "\t:res __aol_stdout_len!uqword\n";
+    bss << "\t:res __aol_pool_heads!uqword[" << PoolClasses << "]\n";
+    rodata << "\t__aol_newline!ubyte[] = 10\n";
+    if (!options.instrumentReport.empty()) data << "\t__aol_stdout_fd!uqword[] = 1\n";
+
+    out << "\t:align 16\n:section .text\n\t:global __aol_main__\n\n";
+    out << "__aol_main__:\n";
+    if (options.entryBanner) {
+        rodata << "\t__aol_entry_dbg!ubyte[] = \"DBG: Entry!\", 10, 0\n";
+        out << "\tlea %rdi, [__aol_entry_dbg]\n\tcall __aol_print\n";
+    }
+    if (!options.instrumentReport.empty()) out << "\tcall __aol_instr_init\n";
+    if (globalInit) out << "\tcall $" << globalInit->name << "\n";
+    out << "\tcall $main\n";
+    out << "\tmov %rdi, %rax\n\tjmp __aol_exit\n\n";
+
+    // __aol_exit(code): flush, then end every thread of the process
+    out << "__aol_exit:\n";
+    out << "\tpush %rdi\n";
+    if (!options.profilePath.empty()) out << "\tcall __aol_prof_dump\n";
+    if (!options.instrumentReport.empty()) out << "\tcall __aol_instr_dump\n";
+    out << "\tcall __aol_flush\n\tpop %rdi\n";
+    out << "\tmov %rax, 231\n\tsyscall\n\n"; // exit_group
+
+    // __aol_print(str): NUL-terminated string
+    out << "__aol_print:\n";
+    out << "\tmov %rsi, %rdi\n";
+    out << "__aol_print_scan__:\n";
+    out << "\tmov %al, [%rsi]\n\ttest %al, %al\n\tjz __aol_print_end__\n";
+    out << "\tinc %rsi\n\tjmp __aol_print_scan__\n";
+    out << "__aol_print_end__:\n";
+    out << "\tsub %rsi, %rdi\n\tjmp __aol_write\n\n";
+
+    // __aol_println(str): string and a newline
+    out << "__aol_println:\n";
+    out << "\tcall __aol_print\n";
+    out << "\tlea %rdi, [__aol_newline]\n\tmov %rsi, 1\n\tjmp __aol_write\n\n";
+
+    // __aol_writeln(ptr, len): len bytes and a newline
+    out << "__aol_writeln:\n";
+    out << "\tcall __aol_write\n";
+    out << "\tlea %rdi, [__aol_newline]\n\tmov %rsi, 1\n\tjmp __aol_write\n\n";
+
+    // __aol_write(ptr, len): append len bytes
+    out << "__aol_write:\n";
+    out << "\tmov %rax, [__aol_stdout_len]\n";
+    out << "\tmov %rcx, %rax\n\tadd %rcx, %rsi\n";
+    out << "\tcmp %rcx, " << StdoutBufferSize << "\n\tjbe __aol_write_copy__\n";
+    out << "\tpush %rdi\n\tpush %rsi\n\tcall __aol_flush\n\tpop %rsi\n\tpop %rdi\n";
+    out << "\txor %rax, %rax\n";
+    out << "\tcmp %rsi, " << StdoutBufferSize << "\n\tjbe __aol_write_copy__\n";
+    out << "\tmov %rdx, %rsi\n\tmov %rsi, %rdi\n\tjmp __aol_write_fd__\n";
+    out << "__aol_write_copy__:\n";
+    out << "\tmov %rcx, %rsi\n\tmov %rsi, %rdi\n";
+    out << "\tlea %rdi, [__aol_stdout_buf]\n\tadd %rdi, %rax\n";
+    out << "\tadd %rax, %rcx\n\tmov [__aol_stdout_len], %rax\n";
+    out << "\trep movsb\n\tret\n\n";
+
+    // __aol_flush(): write out and empty the buffer
+    out << "__aol_flush:\n";
+    out << "\tlea %rsi, [__aol_stdout_buf]\n\tmov %rdx, [__aol_stdout_len]\n";
+    out << "\txor %rax, %rax\n\tmov [__aol_stdout_len], %rax\n";
+    out << "\tjmp __aol_write_fd__\n\n";
+
+    // write(1, %rsi, %rdx) until everything is out, retrying short writes and EINTR
+    out << "__aol_write_fd__:\n";
+    out << "\ttest %rdx, %rdx\n\tjz __aol_write_done__\n";
+    // With --instrument the report goes through the buffer too, __aol_stdout_fd is pointed at its file
+    if (options.instrumentReport.empty()) out << "\tmov %rax, 1\n\tmov %rdi, 1\n\tsyscall\n";
+    else out << "\tmov %rax, 1\n\tmov %rdi, [__aol_stdout_fd]\n\tsyscall\n";
+    out << "\ttest %rax, %rax\n\tjs __aol_write_err__\n";
+    out << "\tadd %rsi, %rax\n\tsub %rdx, %rax\n\tjmp __aol_write_fd__\n";
+    out << "__aol_write_err__:\n";
+    out << "\tcmp %rax, -4\n\tje __aol_write_fd__\n"; // -EINTR, any other error drops the output
+    out << "__aol_write_done__:\n";
+    out << "\tret\n\n";
+
+    // __aol_print_int(value): signed decimal, formatted backwards on the stack
+    out << "__aol_print_int:\n";
+    out << "\tsub %rsp, 40\n";
+    out << "\tlea %rsi, [%rsp + 32]\n";
+    out << "\tmov %rax, %rdi\n\tmov %r8, %rdi\n\tmov %rcx, 10\n";
+    out << "\ttest %rax, %rax\n\tjns __aol_print_int_digit__\n";
+    out << "\tneg %rax\n"; // INT64_MIN stays 2^63, which the unsigned divide handles
+    out << "__aol_print_int_digit__:\n";
+    out << "\txor %rdx, %rdx\n\tdiv %rcx\n";
+    out << "\tadd %dl, 48\n\tdec %rsi\n\tmov [%rsi], %dl\n";
+    out << "\ttest %rax, %rax\n\tjnz __aol_print_int_digit__\n";
+    out << "\ttest %r8, %r8\n\tjns __aol_print_int_out__\n";
+    out << "\tmov %dl, 45\n\tdec %rsi\n\tmov [%rsi], %dl\n"; // '-'
+    out << "__aol_print_int_out__:\n";
+    out << "\tlea %rdx, [%rsp + 32]\n\tsub %rdx, %rsi\n";
+    out << "\tmov %rdi, %rsi\n\tmov %rsi, %rdx\n";
+    out << "\tcall __aol_write\n";
+    out << "\tadd %rsp, 40\n\tret\n\n";
+
+    // __aol_mmap(size): fresh zeroed pages, 0 when the kernel refuses
+    out << "__aol_mmap:\n";
+    out << "\txor %rsi, %rsi\n";
+    out << "__aol_map__:\n"; // %rsi = extra MAP_* flags
+    out << "\tmov %r10, 34\n\tor %r10, %rsi\n"; // MAP_PRIVATE | MAP_ANONYMOUS
+    out << "\tlea %rsi, [%rdi + 4095]\n\tand %rsi, -4096\n";
+    out << "\txor %rdi, %rdi\n\tmov %rdx, 3\n\tmov %r8, -1\n\txor %r9, %r9\n"; // PROT_READ | PROT_WRITE
+    out << "\tmov %rax, 9\n\tsyscall\n";
+    out << "\tcmp %rax, -4096\n\tjbe __aol_map_done__\n\txor %rax, %rax\n";
+    out << "__aol_map_done__:\n";
+    out << "\tret\n\n";
+
+    // __aol_munmap(ptr, size)
+    out << "__aol_munmap:\n";
+    out << "\tadd %rsi, 4095\n\tand %rsi, -4096\n";
+    out << "\tmov %rax, 11\n\tsyscall\n\tret\n\n";
+
+    // __aol_madvise_huge(ptr, size): back the range with transparent huge pages if possible
+    out << "__aol_madvise_huge:\n";
+    out << "\tmov %rdx, 14\n\tmov %rax, 28\n\tsyscall\n\tret\n\n"; // MADV_HUGEPAGE
+
+    // Size class of 0 ... PoolMaxSize bytes into %rcx, 0 is taken as 1 so it
+    // lands in the 16-byte class instead of past the table
+    auto sizeClass = [&](const std::string& size) {
+        out << "\tmov %rcx, 1\n\ttest " << size << ", " << size << "\n\tcmovz " << size << ", %rcx\n";
+        out << "\tlea %rcx, [" << size << " - 1]\n\tor %rcx, 15\n\tbsr %rcx, %rcx\n\tsub %rcx, 3\n";
+    };
+
+    // __aol_alloc(size): uninitialized block of at least size bytes, 16-byte aligned
+    out << "__aol_alloc:\n";
+    out << "\tcmp %rdi, " << PoolMaxSize << "\n\tja __aol_alloc_large__\n";
+    sizeClass("%rdi");
+    out << "\tlea %rdx, [__aol_pool_heads]\n";
+    out << "\tmov %rax, [%rdx + %rcx*8]\n\ttest %rax, %rax\n\tjz __aol_alloc_refill__\n";
+    out << "\tmov %rsi, [%rax]\n\tmov [%rdx + %rcx*8], %rsi\n\tret\n";
+    out << "__aol_alloc_refill__:\n"; // carve a slab, hand out its first block and chain the rest
+    out << "\tpush %rcx\n\tmov %rdi, " << PoolSlabSize << "\n\tcall __aol_mmap\n\tpop %rcx\n";
+    out << "\ttest %rax, %rax\n\tjz __aol_alloc_done__\n";
+    out << "\tmov %r8, 16\n\tshl %r8, %cl\n";
+    out << "\tlea %rsi, [%rax + " << PoolSlabSize << "]\n\tlea %rdi, [%rax + %r8]\n";
+    out << "\tlea %rdx, [__aol_pool_heads]\n\tmov [%rdx + %rcx*8], %rdi\n";
+    out << "__aol_alloc_chain__:\n";
+    out << "\tlea %r9, [%rdi + %r8]\n\tcmp %r9, %rsi\n\tjae __aol_alloc_last__\n";
+    out << "\tmov [%rdi], %r9\n\tmov %rdi, %r9\n\tjmp __aol_alloc_chain__\n";
+    out << "__aol_alloc_last__:\n";
+    out << "\txor %r9, %r9\n\tmov [%rdi], %r9\n";
+    out << "__aol_alloc_done__:\n";
+    out << "\tret\n";
+    out << "__aol_alloc_large__:\n";
+    out << "\tjmp __aol_mmap\n\n";
+
+    // __aol_free(ptr, size): size must be the one passed to __aol_alloc
+    out << "__aol_free:\n";
+    out << "\ttest %rdi, %rdi\n\tjz __aol_free_done__\n";
+    out << "\tcmp %rsi, " << PoolMaxSize << "\n\tja __aol_munmap\n";
+    sizeClass("%rsi");
+    out << "\tlea %rdx, [__aol_pool_heads]\n";
+    out << "\tmov %rax, [%rdx + %rcx*8]\n\tmov [%rdi], %rax\n\tmov [%rdx + %rcx*8], %rdi\n";
+    out << "__aol_free_done__:\n";
+    out << "\tret\n\n";
+
+    // Arenas are one reservation that is bumped through, the header at its
+    // start holds the bump pointer and the end. Pages are only committed once
+    // touched, so the capacity can be generous.
+    // __aol_arena_new(capacity, hugePages): arena handle, 0 on failure
+    out << "__aol_arena_new:\n";
+    out << "\tpush %rsi\n";
+    out << "\tadd %rdi, 4111\n\tand %rdi, -4096\n"; // capacity + 16 byte header, page rounded
+    out << "\tpush %rdi\n\tmov %rsi, 16384\n\tcall __aol_map__\n\tpop %rsi\n\tpop %rdx\n"; // MAP_NORESERVE
+    out << "\ttest %rax, %rax\n\tjz __aol_arena_new_done__\n";
+    out << "\tlea %rcx, [%rax + 16]\n\tmov [%rax], %rcx\n";
+    out << "\tlea %rcx, [%rax + %rsi]\n\tmov [%rax + 8], %rcx\n";
+    out << "\ttest %rdx, %rdx\n\tjz __aol_arena_new_done__\n";
+    out << "\tmov %rdi, %rax\n\tcall __aol_madvise_huge\n\tmov %rax, %rdi\n";
+    out << "__aol_arena_new_done__:\n";
+    out << "\tret\n\n";
+
+    // __aol_arena_alloc(arena, size): 16-byte aligned, 0 once the arena is full
+    out << "__aol_arena_alloc:\n";
+    out << "\tadd %rsi, 15\n\tand %rsi, -16\n";
+    out << "\tmov %rax, [%rdi]\n\tadd %rsi, %rax\n";
+    out << "\tcmp %rsi, [%rdi + 8]\n\tja __aol_arena_full__\n";
+    out << "\tmov [%rdi], %rsi\n\tret\n";
+    out << "__aol_arena_full__:\n";
+    out << "\txor %rax, %rax\n\tret\n\n";
+
+    // __aol_arena_mark(arena) / __aol_arena_reset(arena, mark): everything
+    // allocated after the mark is released at once, its pages stay mapped for reuse
+    out << "__aol_arena_mark:\n";
+    out << "\tmov %rax, [%rdi]\n\tret\n\n";
+    out << "__aol_arena_reset:\n";
+    out << "\tmov [%rdi], %rsi\n\tret\n\n";
+
+    // __aol_arena_free(arena)
+    out << "__aol_arena_free:\n";
+    out << "\ttest %rdi, %rdi\n\tjz __aol_free_done__\n";
+    out << "\tmov %rsi, [%rdi + 8]\n\tsub %rsi, %rdi\n\tjmp __aol_munmap\n\n";
+
+    // __aol_async_resume(task): runs a coroutine frame to its next suspension,
+    // 0 once it finished, otherwise the task that is ready to run again
+    out << "__aol_async_resume:\n";
+    out << "\tjmp [%rdi]\n\n";
+
+    out << compileAioRuntime();
+    out << compileThreadRuntime();
+    if (!options.profilePath.empty()) out << compileProfileRuntime();
+    return out.str();
+}
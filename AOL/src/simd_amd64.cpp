@@ -0,0 +1,769 @@
+#include <compiler_amd64.hpp>
+#include <bits.hpp>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <unordered_set>
+#include <algorithm>
+
+// Vector temporaries form a stack in xmm0-xmm13 (ymm with AVX2), a 256-bit value
+// without AVX2 takes two consecutive xmm registers. xmm14/xmm15 are scratch for
+// multi-instruction sequences and never hold a value across an expression.
+static const int VecStackRegs = 14;
+static const int VecScratch1 = 14;
+static const int VecScratch2 = 15;
+
+static const std::unordered_set<std::string> VectorBuiltins = {
+    "shuffle", "select", "vmin", "vmax", "hsum", "hmin", "hmax", "extract", "store", "storeu",
+};
+
+// How one vector type is lowered on the current target
+struct VecShape {
+    const VectorType* type;
+    bool avx; // VEX encoded, three-operand forms
+    int width; // register width in bits
+    int parts; // registers per value
+
+    std::string r(int idx) const { return (width == 256 ? "%ymm" : "%xmm") + std::to_string(idx); }
+
+    std::string movOp(bool aligned) const {
+        if (type->isFloat) return std::string(aligned ? "mova" : "movu") + (type->laneBits == 32 ? "ps" : "pd");
+        return aligned ? "movdqa" : "movdqu";
+    }
+
+    // d = d <op> src
+    std::string ins(const std::string& op, const std::string& d, const std::string& src) const {
+        if (avx) return "\tv" + op + " " + d + ", " + d + ", " + src + "\n";
+        return "\t" + op + " " + d + ", " + src + "\n";
+    }
+
+    // d = op(src, imm), e.g. pshufd
+    std::string unaryImm(const std::string& op, const std::string& d, const std::string& src, int imm) const {
+        return "\t" + std::string(avx ? "v" : "") + op + " " + d + ", " + src + ", " + std::to_string(imm) + "\n";
+    }
+
+    // d = op(d, src, imm), e.g. cmpps
+    std::string binaryImm(const std::string& op, const std::string& d, const std::string& src, int imm) const {
+        if (avx) return "\tv" + op + " " + d + ", " + d + ", " + src + ", " + std::to_string(imm) + "\n";
+        return "\t" + op + " " + d + ", " + src + ", " + std::to_string(imm) + "\n";
+    }
+
+    std::string mov(const std::string& d, const std::string& src) const {
+        if (d == src) return "";
+        return "\t" + std::string(avx ? "v" : "") + movOp(true) + " " + d + ", " + src + "\n";
+    }
+};
+
+static VecShape shapeOf(const VectorType* type, const TargetFeatures& target) {
+    bool wide = type->bytes() == 32;
+    return {type, target.avx2, wide && target.avx2 ? 256 : 128, wide && !target.avx2 ? 2 : 1};
+}
+
+// The same type viewed as one 128-bit register, used once a reduction has folded the upper half
+static VecShape lowHalf(const VecShape& s) {
+    return {s.type, s.avx, 128, 1};
+}
+
+static std::string intSuffix(int bits) {
+    switch (bits) {
+        case 8:  return "b";
+        case 16: return "w";
+        case 32: return "d";
+        default: return "q";
+    }
+}
+
+static std::string gpr(int bits) {
+    switch (bits) {
+        case 8:  return "%al";
+        case 16: return "%ax";
+        case 32: return "%eax";
+        default: return "%rax";
+    }
+}
+
+static std::string sizeKeyword(int bits) {
+    switch (bits) {
+        case 8:  return "byte ";
+        case 16: return "word ";
+        case 32: return "dword ";
+        default: return "";
+    }
+}
+
+static void unsupported(const std::string& what, const VectorType* type, int line, int col) {
+    std::cerr << "Error: " << what << " is not supported on " << type->name << " at line " << line << " col " << col << "\n";
+}
+
+// d = d <op> src lane by lane over one register, src is a register or an aligned memory operand
+static std::string laneOp(const VecShape& s, const std::string& op, const std::string& d, const std::string& src, int line, int col) {
+    const VectorType* t = s.type;
+    std::string t1 = s.r(VecScratch1), t2 = s.r(VecScratch2);
+    std::ostringstream out;
+
+    if (t->isFloat) {
+        std::string sfx = t->laneBits == 32 ? "ps" : "pd";
+        if (op == "+") return s.ins("add" + sfx, d, src);
+        if (op == "-") return s.ins("sub" + sfx, d, src);
+        if (op == "*") return s.ins("mul" + sfx, d, src);
+        if (op == "/") return s.ins("div" + sfx, d, src);
+        if (op == "&") return s.ins("and" + sfx, d, src);
+        if (op == "|") return s.ins("or" + sfx, d, src);
+        if (op == "^") return s.ins("xor" + sfx, d, src);
+        if (op == "min") return s.ins("min" + sfx, d, src);
+        if (op == "max") return s.ins("max" + sfx, d, src);
+        if (op == "==") return s.binaryImm("cmp" + sfx, d, src, 0);
+        if (op == "<")  return s.binaryImm("cmp" + sfx, d, src, 1);
+        if (op == "<=") return s.binaryImm("cmp" + sfx, d, src, 2);
+        if (op == "!=") return s.binaryImm("cmp" + sfx, d, src, 4);
+        if (op == ">" || op == ">=") {
+            // Legacy SSE has no greater-than predicates, a > b is b < a
+            out << s.mov(t1, src) << s.binaryImm("cmp" + sfx, t1, d, op == ">" ? 1 : 2) << s.mov(d, t1);
+            return out.str();
+        }
+        unsupported("Operator '" + op + "'", t, line, col);
+        return "";
+    }
+
+    int bits = t->laneBits;
+    std::string sfx = intSuffix(bits);
+    if (op == "+") return s.ins("padd" + sfx, d, src);
+    if (op == "-") return s.ins("psub" + sfx, d, src);
+    if (op == "&") return s.ins("pand", d, src);
+    if (op == "|") return s.ins("por", d, src);
+    if (op == "^") return s.ins("pxor", d, src);
+
+    if (op == "*") {
+        if (bits == 16) return s.ins("pmullw", d, src);
+        if (bits == 32 && s.avx) return s.ins("pmulld", d, src);
+        if (bits == 32) {
+            // No pmulld before SSE4.1: multiply even and odd lanes with pmuludq and interleave the low halves
+            out << s.mov(t1, d) << s.ins("pmuludq", d, src) << s.ins("psrlq", t1, "32");
+            out << s.mov(t2, src) << s.ins("psrlq", t2, "32") << s.ins("pmuludq", t1, t2);
+            out << s.unaryImm("pshufd", d, d, 0x08) << s.unaryImm("pshufd", t1, t1, 0x08);
+            out << s.ins("punpckldq", d, t1);
+            return out.str();
+        }
+        if (bits == 64) {
+            // lo(a)*lo(b) + ((hi(a)*lo(b) + lo(a)*hi(b)) << 32)
+            out << s.mov(t1, d) << s.ins("psrlq", t1, "32") << s.ins("pmuludq", t1, src);
+            out << s.mov(t2, src) << s.ins("psrlq", t2, "32") << s.ins("pmuludq", t2, d);
+            out << s.ins("paddq", t1, t2) << s.ins("psllq", t1, "32");
+            out << s.ins("pmuludq", d, src) << s.ins("paddq", d, t1);
+            return out.str();
+        }
+        unsupported("Operator '*'", t, line, col);
+        return "";
+    }
+
+    bool hasGtq = bits != 64 || s.avx;
+    if (op == "==") {
+        if (bits == 64 && !s.avx) {
+            // No pcmpeqq before SSE4.1: both dword halves must match
+            out << s.ins("pcmpeqd", d, src) << s.unaryImm("pshufd", t1, d, 0xB1) << s.ins("pand", d, t1);
+            return out.str();
+        }
+        return s.ins("pcmpeq" + sfx, d, src);
+    }
+    if ((op == ">" || op == "<" || op == "<=" || op == ">=" || op == "min" || op == "max") && !hasGtq) {
+        unsupported("Ordered compare", t, line, col);
+        return "";
+    }
+    if (op == ">") return s.ins("pcmpgt" + sfx, d, src);
+    if (op == "<") {
+        out << s.mov(t1, src) << s.ins("pcmpgt" + sfx, t1, d) << s.mov(d, t1);
+        return out.str();
+    }
+    if (op == "!=" || op == "<=" || op == ">=") {
+        std::string cmp = laneOp(s, op == "!=" ? "==" : op == "<=" ? ">" : "<", d, src, line, col);
+        if (cmp.empty()) return "";
+        out << cmp << s.ins("pcmpeqd", t2, t2) << s.ins("pxor", d, t2);
+        return out.str();
+    }
+    if (op == "min" || op == "max") {
+        if (bits == 16 || (s.avx && bits != 64))
+            return s.ins((op == "min" ? "pmins" : "pmaxs") + sfx, d, src);
+        // Pick lanes through a compare mask
+        if (op == "min") out << s.mov(t2, d) << s.ins("pcmpgt" + sfx, t2, src);
+        else out << s.mov(t2, src) << s.ins("pcmpgt" + sfx, t2, d);
+        out << s.mov(t1, src) << s.ins("pand", t1, t2) << s.ins("pandn", t2, d) << s.ins("por", t2, t1) << s.mov(d, t2);
+        return out.str();
+    }
+
+    unsupported("Operator '" + op + "'", t, line, col);
+    return "";
+}
+
+// Lane 0 of xmm<reg> into %rax, integers sign-extended, floats as their bit pattern
+static std::string lane0ToRax(const VecShape& s, int reg) {
+    std::string x = "%xmm" + std::to_string(reg);
+    std::string v = s.avx ? "v" : "";
+    int bits = s.type->laneBits;
+    if (bits == 64) return "\t" + v + "movq %rax, " + x + "\n";
+    std::string out = "\t" + v + "movd %eax, " + x + "\n";
+    if (s.type->isFloat) return out;
+    if (bits == 32) return out + "\tmovsxd %rax, %eax\n";
+    return out + "\tmovsx %rax, " + gpr(bits) + "\n";
+}
+
+static std::string laneToRax(const VectorType* t, const std::string& operand) {
+    if (t->laneBits == 64) return "\tmov %rax, " + operand + "\n";
+    if (t->isFloat) return "\tmov %eax, " + operand + "\n";
+    if (t->laneBits == 32) return "\tmovsxd %rax, dword " + operand + "\n";
+    return "\tmovsx %rax, " + sizeKeyword(t->laneBits) + operand + "\n";
+}
+
+static const VectorType* loadBuiltinType(const std::string& name, bool* aligned) {
+    for (const char* suffix : {"_loadu", "_load"}) {
+        size_t n = std::strlen(suffix);
+        if (name.size() > n && name.compare(name.size() - n, n, suffix) == 0) {
+            if (aligned) *aligned = n == 5;
+            return FindVectorType(name.substr(0, name.size() - n));
+        }
+    }
+    return nullptr;
+}
+
+int Compiler_Amd64::vectorParts(const VectorType* type) const {
+    return type->bytes() == 32 && !target.avx2 ? 2 : 1;
+}
+
+bool Compiler_Amd64::isVectorBuiltin(const std::string& name) const {
+    if (functions.count(name)) return false;
+    return VectorBuiltins.count(name) || FindVectorType(name) || loadBuiltinType(name, nullptr);
+}
+
+// Calls clobber every vector register, vector and bit builtins do not
+bool Compiler_Amd64::containsCall(const std::shared_ptr<ASTNode>& node) const {
+    if (!node) return false;
+    if (node->type == ASTNodeType::CallExpr && !isVectorBuiltin(node->name) && !IsBitBuiltin(node->name)) return true;
+    for (auto& child : node->children)
+        if (containsCall(child)) return true;
+    return false;
+}
+
+const VectorType* Compiler_Amd64::vectorTypeOf(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return nullptr;
+    switch (node->type) {
+        case ASTNodeType::Identifier: {
+            const VariableInfo* v = findVariable(node->name);
+            return v ? FindVectorType(v->type) : nullptr;
+        }
+        case ASTNodeType::AssignExpr:
+            return vectorTypeOf(node->children[0]);
+        case ASTNodeType::MemberExpr:
+            return FindVectorType(exprType(node));
+        case ASTNodeType::UnaryExpr:
+            return node->name == "!" || node->name == "&" ? nullptr : vectorTypeOf(node->children[0]);
+        case ASTNodeType::BinaryExpr: {
+            const std::string& op = node->name;
+            if (op == "&&" || op == "||") return nullptr;
+            const VectorType* t = vectorTypeOf(node->children[0]);
+            if (op == "<<" || op == ">>") return t;
+            if (!t) t = vectorTypeOf(node->children[1]);
+            return IsComparisonOp(op) ? MaskTypeOf(t) : t;
+        }
+        case ASTNodeType::CallExpr: {
+            auto fn = functions.find(node->name);
+            if (fn != functions.end()) return FindVectorType(fn->second.returnType);
+            if (const VectorType* t = FindVectorType(node->name)) return t;
+            if (const VectorType* t = loadBuiltinType(node->name, nullptr)) return t;
+            auto& args = node->children;
+            if (node->name == "shuffle" && !args.empty()) return vectorTypeOf(args[0]);
+            if ((node->name == "vmin" || node->name == "vmax") && args.size() == 2) {
+                const VectorType* t = vectorTypeOf(args[0]);
+                return t ? t : vectorTypeOf(args[1]);
+            }
+            if (node->name == "select" && args.size() == 3) {
+                const VectorType* t = vectorTypeOf(args[1]);
+                return t ? t : vectorTypeOf(args[2]);
+            }
+            return nullptr;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+int Compiler_Amd64::allocateVectorSlot(int bytes, int align) {
+    if (!align) align = bytes >= 32 ? 32 : 16;
+    areaAlign = std::max(areaAlign, align);
+    vectorAreaSize = (vectorAreaSize + align - 1) & ~(align - 1);
+    int offset = vectorAreaSize;
+    vectorAreaSize += bytes;
+    return offset;
+}
+
+std::string Compiler_Amd64::loadVector(const VectorType* type, int reg, const std::string& base, int offset, bool aligned) {
+    VecShape s = shapeOf(type, target);
+    if (s.width == 256) usesYmm = true;
+    std::ostringstream out;
+    for (int j = 0; j < s.parts; ++j)
+        out << "\t" << (s.avx ? "v" : "") << s.movOp(aligned) << " " << s.r(reg + j) << ", " << MemOperand(base, offset + 16 * j) << "\n";
+    return out.str();
+}
+
+std::string Compiler_Amd64::storeVector(const VectorType* type, int reg, const std::string& base, int offset, bool aligned) {
+    VecShape s = shapeOf(type, target);
+    if (s.width == 256) usesYmm = true;
+    std::ostringstream out;
+    for (int j = 0; j < s.parts; ++j)
+        out << "\t" << (s.avx ? "v" : "") << s.movOp(aligned) << " " << MemOperand(base, offset + 16 * j) << ", " << s.r(reg + j) << "\n";
+    return out.str();
+}
+
+std::vector<uint8_t> VectorBytes(const VectorType* type, const std::vector<int64_t>& lanes) {
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        uint64_t bits = (uint64_t)lanes[i];
+        if (type->isFloat && type->laneBits == 32) {
+            float f = (float)lanes[i];
+            uint32_t b;
+            std::memcpy(&b, &f, sizeof(b));
+            bits = b;
+        } else if (type->isFloat) {
+            double f = (double)lanes[i];
+            std::memcpy(&bits, &f, sizeof(bits));
+        }
+        for (int b = 0; b < type->laneBytes(); ++b)
+            data.push_back((bits >> (8 * b)) & 0xff);
+    }
+    return data;
+}
+
+// A 32-byte aligned constant from the pool
+std::string Compiler_Amd64::vectorConstant(const VectorType* type, const std::vector<int64_t>& lanes) {
+    return pool.bytes(VectorBytes(type, lanes), 32);
+}
+
+std::string Compiler_Amd64::compileVectorDecl(const std::shared_ptr<ASTNode>& node, const VectorType* type) {
+    if (!currentFunction) return "";
+
+    std::ostringstream out;
+    int slot = allocateVectorSlot(type->bytes());
+    if (!node->children.empty()) {
+        out << compileVectorExpr(node->children[0], vecTop, type);
+    } else {
+        VecShape s = shapeOf(type, target);
+        for (int j = 0; j < s.parts; ++j)
+            out << s.ins("pxor", s.r(vecTop + j), s.r(vecTop + j));
+    }
+    out << storeVector(type, vecTop, "%rbx", slot);
+
+    // Registered after the initializer so `let v = v * 2` still reads the outer v
+    currentFunction->locals.push_back({node->name, slot, type->bytes(), "", type->name});
+    return out.str();
+}
+
+// Evaluates operands of a lane-wise operation. The first always ends up in reg. The rest go
+// to the registers above it, or stay in spill slots when registers run out or a later
+// operand makes a call that would clobber the earlier ones.
+std::string Compiler_Amd64::compileVectorOperands(const std::vector<std::shared_ptr<ASTNode>>& args, const std::vector<const VectorType*>& types, int reg, std::vector<VecOperand>& operands) {
+    std::ostringstream out;
+    operands.assign(args.size(), VecOperand{});
+
+    int k = vectorParts(types[0]);
+    bool spill = reg + k * (int)args.size() > VecStackRegs;
+    for (size_t i = 1; i < args.size(); ++i)
+        if (containsCall(args[i])) spill = true;
+
+    if (!spill) {
+        for (size_t i = 0; i < args.size(); ++i) {
+            out << compileVectorExpr(args[i], reg + (int)i * k, types[i]);
+            operands[i].reg = reg + (int)i * k;
+        }
+        return out.str();
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        operands[i].slot = allocateVectorSlot(types[i]->bytes());
+        out << compileVectorExpr(args[i], reg, types[i]);
+        out << storeVector(types[i], reg, "%rbx", operands[i].slot);
+    }
+    out << loadVector(types[0], reg, "%rbx", operands[0].slot);
+    operands[0].reg = reg;
+    return out.str();
+}
+
+static std::string operandPart(const VecShape& s, const VecOperand& op, int part) {
+    if (op.reg >= 0) return s.r(op.reg + part);
+    return MemOperand("%rbx", op.slot + 16 * part);
+}
+
+// Broadcasts a scalar expression to every lane
+std::string Compiler_Amd64::compileSplat(const std::shared_ptr<ASTNode>& node, int reg, const VectorType* type) {
+    if (IsIntegerLiteral(node))
+        return loadVector(type, reg, vectorConstant(type, std::vector<int64_t>(type->lanes, std::stoll(node->value))), 0);
+    if (node->type == ASTNodeType::Literal) {
+        std::cerr << "Error: Cannot convert a string to " << type->name << " at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+
+    std::ostringstream out;
+    VecShape s = shapeOf(type, target);
+    std::string x = "%xmm" + std::to_string(reg);
+    std::string v = s.avx ? "v" : "";
+    out << compileExpression(node, "%rax");
+
+    if (type->isFloat) {
+        std::string sfx = type->laneBits == 32 ? "ss" : "sd";
+        if (s.avx) out << "\tvcvtsi2" << sfx << " " << x << ", " << x << ", %rax\n";
+        else out << "\tcvtsi2" << sfx << " " << x << ", %rax\n";
+
+        if (s.avx) out << "\tvbroadcast" << sfx << " " << s.r(reg) << ", " << x << "\n";
+        else if (type->laneBits == 32) out << "\tshufps " << x << ", " << x << ", 0\n";
+        else out << "\tunpcklpd " << x << ", " << x << "\n";
+    } else {
+        out << "\t" << v << "movq " << x << ", %rax\n";
+        if (s.avx) {
+            out << "\tvpbroadcast" << intSuffix(type->laneBits) << " " << s.r(reg) << ", " << x << "\n";
+        } else {
+            if (type->laneBits == 8) out << "\tpunpcklbw " << x << ", " << x << "\n";
+            if (type->laneBits <= 16) out << "\tpunpcklwd " << x << ", " << x << "\n";
+            if (type->laneBits <= 32) out << "\tpshufd " << x << ", " << x << ", 0\n";
+            else out << "\tpunpcklqdq " << x << ", " << x << "\n";
+        }
+    }
+    for (int j = 1; j < s.parts; ++j)
+        out << s.mov(s.r(reg + j), s.r(reg));
+    return out.str();
+}
+
+// Evaluates a vector-typed expression into register reg (and reg+1 for a split 256-bit value).
+// Registers below reg hold live temporaries and are left alone.
+std::string Compiler_Amd64::compileVectorExpr(const std::shared_ptr<ASTNode>& node, int reg, const VectorType* type) {
+    if (!node || !type) return "";
+
+    const VectorType* actual = vectorTypeOf(node);
+    if (!actual) return compileSplat(node, reg, type);
+    if (actual != type) {
+        std::cerr << "Error: Type mismatch, expected " << type->name << " but got " << actual->name
+                  << " at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+
+    int savedTop = vecTop;
+    vecTop = reg;
+
+    std::ostringstream out;
+    VecShape s = shapeOf(type, target);
+    if (s.width == 256) usesYmm = true;
+    std::string t1 = s.r(VecScratch1);
+
+    switch (node->type) {
+        case ASTNodeType::Identifier:
+        {
+            const VariableInfo* v = findVariable(node->name);
+            out << (v->label.empty() ? loadVector(type, reg, "%rbx", v->offset) : loadVector(type, reg, v->label, 0));
+            break;
+        }
+
+        case ASTNodeType::MemberExpr: {
+            Place place;
+            if (compilePlace(node, out, place)) out << loadVector(type, reg, place.base, place.offset, !place.packed);
+            break;
+        }
+
+        case ASTNodeType::AssignExpr: {
+            auto& target = node->children[0];
+            if (target->type == ASTNodeType::MemberExpr) {
+                out << compileVectorExpr(node->children[1], reg, type);
+                Place place;
+                if (compilePlace(target, out, place)) out << storeVector(type, reg, place.base, place.offset, !place.packed);
+                break;
+            }
+            const VariableInfo* v = target->type == ASTNodeType::Identifier ? findVariable(target->name) : nullptr;
+            if (!v) {
+                std::cerr << "Error: Invalid assignment target at line " << node->line << " col " << node->col << "\n";
+                break;
+            }
+            out << compileVectorExpr(node->children[1], reg, type);
+            out << (v->label.empty() ? storeVector(type, reg, "%rbx", v->offset) : storeVector(type, reg, v->label, 0));
+            break;
+        }
+
+        case ASTNodeType::UnaryExpr: {
+            out << compileVectorExpr(node->children[0], reg, type);
+            for (int j = 0; j < s.parts; ++j) {
+                std::string d = s.r(reg + j);
+                if (node->name == "-" && type->isFloat) {
+                    // Flip the sign bits
+                    out << s.ins("pcmpeqd", t1, t1) << s.ins(type->laneBits == 32 ? "pslld" : "psllq", t1, std::to_string(type->laneBits - 1));
+                    out << s.ins(type->laneBits == 32 ? "xorps" : "xorpd", d, t1);
+                } else if (node->name == "-") {
+                    out << s.ins("pxor", t1, t1) << s.ins("psub" + intSuffix(type->laneBits), t1, d) << s.mov(d, t1);
+                } else if (node->name == "~" && !type->isFloat) {
+                    out << s.ins("pcmpeqd", t1, t1) << s.ins("pxor", d, t1);
+                } else {
+                    unsupported("Operator '" + node->name + "'", type, node->line, node->col);
+                    break;
+                }
+            }
+            break;
+        }
+
+        case ASTNodeType::BinaryExpr: {
+            const std::string& op = node->name;
+            auto& lhs = node->children[0];
+            auto& rhs = node->children[1];
+
+            if (op == "<<" || op == ">>") {
+                int bits = type->laneBits;
+                if (type->isFloat || bits == 8 || (op == ">>" && bits == 64)) {
+                    unsupported("Operator '" + op + "'", type, node->line, node->col);
+                    break;
+                }
+                std::string instr = (op == "<<" ? "psll" : "psra") + intSuffix(bits);
+                std::string count;
+                out << compileVectorExpr(lhs, reg, type);
+                if (IsIntegerLiteral(rhs)) {
+                    count = rhs->value;
+                } else if (vectorTypeOf(rhs)) {
+                    std::cerr << "Error: Shift count must be a scalar at line " << node->line << " col " << node->col << "\n";
+                    break;
+                } else {
+                    int slot = -1;
+                    if (containsCall(rhs)) {
+                        slot = allocateVectorSlot(type->bytes());
+                        out << storeVector(type, reg, "%rbx", slot);
+                    }
+                    out << compileExpression(rhs, "%rax");
+                    if (slot >= 0) out << loadVector(type, reg, "%rbx", slot);
+                    count = "%xmm" + std::to_string(VecScratch1);
+                    out << "\t" << (s.avx ? "v" : "") << "movq " << count << ", %rax\n";
+                }
+                for (int j = 0; j < s.parts; ++j)
+                    out << s.ins(instr, s.r(reg + j), count);
+                break;
+            }
+
+            // Compares are done on the operand type and produce its integer mask type
+            const VectorType* operandType = vectorTypeOf(lhs);
+            if (!operandType) operandType = vectorTypeOf(rhs);
+            VecShape os = shapeOf(operandType, target);
+            std::vector<VecOperand> ops;
+            out << compileVectorOperands({lhs, rhs}, {operandType, operandType}, reg, ops);
+            for (int j = 0; j < os.parts; ++j)
+                out << laneOp(os, op, os.r(reg + j), operandPart(os, ops[1], j), node->line, node->col);
+            break;
+        }
+
+        case ASTNodeType::CallExpr:
+            out << compileVectorCall(node, reg, type);
+            break;
+
+        default:
+            std::cerr << "Error: Unsupported vector expression at line " << node->line << " col " << node->col << "\n";
+            break;
+    }
+
+    vecTop = savedTop;
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileVectorCall(const std::shared_ptr<ASTNode>& node, int reg, const VectorType* type) {
+    std::ostringstream out;
+    const std::string& name = node->name;
+    auto& args = node->children;
+    VecShape s = shapeOf(type, target);
+    std::string t1 = s.r(VecScratch1);
+
+    auto argError = [&](const std::string& msg) {
+        std::cerr << "Error: " << name << ": " << msg << " at line " << node->line << " col " << node->col << "\n";
+        return std::string();
+    };
+
+    // User function, the result comes back in xmm0 (ymm0, or xmm0:xmm1 without AVX2)
+    if (functions.count(name)) {
+        out << compileCallExpr(node);
+        for (int j = s.parts; j-- > 0;)
+            out << s.mov(s.r(reg + j), s.r(j));
+        return out.str();
+    }
+
+    bool aligned = true;
+    if (loadBuiltinType(name, &aligned)) {
+        if (args.size() != 1) return argError("expects an address");
+        out << compileExpression(args[0], "%rax");
+        out << loadVector(type, reg, "%rax", 0, aligned);
+        return out.str();
+    }
+
+    if (FindVectorType(name)) {
+        // v4i32(x) splats, v4i32(a, b, c, d) builds lane by lane
+        if (args.size() == 1) return compileSplat(args[0], reg, type);
+        if ((int)args.size() != type->lanes) return argError("expects 1 or " + std::to_string(type->lanes) + " values");
+
+        std::vector<int64_t> values;
+        for (auto& a : args)
+            if (IsIntegerLiteral(a)) values.push_back(std::stoll(a->value));
+        if ((int)values.size() == type->lanes)
+            return loadVector(type, reg, vectorConstant(type, values), 0);
+
+        int slot = allocateVectorSlot(type->bytes());
+        std::string x = "%xmm" + std::to_string(VecScratch1);
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (vectorTypeOf(args[i])) return argError("lane values must be scalars");
+            std::string lane = MemOperand("%rbx", slot + (int)i * type->laneBytes());
+            out << compileExpression(args[i], "%rax");
+            if (type->isFloat) {
+                std::string sfx = type->laneBits == 32 ? "ss" : "sd";
+                if (s.avx) out << "\tvcvtsi2" << sfx << " " << x << ", " << x << ", %rax\n\tvmov" << sfx << " " << lane << ", " << x << "\n";
+                else out << "\tcvtsi2" << sfx << " " << x << ", %rax\n\tmov" << sfx << " " << lane << ", " << x << "\n";
+            } else {
+                out << "\tmov " << lane << ", " << gpr(type->laneBits) << "\n";
+            }
+        }
+        out << loadVector(type, reg, "%rbx", slot);
+        return out.str();
+    }
+
+    if (name == "shuffle") {
+        if ((int)args.size() != type->lanes + 1) return argError("expects a vector and " + std::to_string(type->lanes) + " lane indices");
+        std::vector<int64_t> idx;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (!IsIntegerLiteral(args[i])) return argError("lane indices must be constants");
+            int64_t v = std::stoll(args[i]->value);
+            if (v < 0 || v >= type->lanes) return argError("lane index out of range");
+            idx.push_back(v);
+        }
+
+        out << compileVectorExpr(args[0], reg, type);
+        std::string d = s.r(reg);
+        if (s.width == 128 && s.parts == 1 && type->laneBits >= 32) {
+            // pshufd moves dwords, a qword lane is a pair of them
+            int imm = 0;
+            if (type->laneBits == 32) imm = (int)(idx[0] | idx[1] << 2 | idx[2] << 4 | idx[3] << 6);
+            else imm = (int)((2 * idx[0]) | (2 * idx[0] + 1) << 2 | (2 * idx[1]) << 4 | (2 * idx[1] + 1) << 6);
+            out << s.unaryImm("pshufd", d, d, imm);
+        } else if (s.width == 256 && type->laneBits == 32) {
+            out << loadVector(FindVectorType("v8i32"), VecScratch1, vectorConstant(FindVectorType("v8i32"), idx), 0);
+            out << "\tvpermd " << d << ", " << t1 << ", " << d << "\n";
+        } else if (s.width == 256 && type->laneBits == 64) {
+            out << s.unaryImm("permq", d, d, (int)(idx[0] | idx[1] << 2 | idx[2] << 4 | idx[3] << 6));
+        } else {
+            // No single instruction for this lane width, permute through memory
+            int from = allocateVectorSlot(type->bytes());
+            int to = allocateVectorSlot(type->bytes());
+            int lb = type->laneBytes();
+            std::string r = gpr(type->laneBits == 64 ? 64 : 32);
+            out << storeVector(type, reg, "%rbx", from);
+            for (size_t i = 0; i < idx.size(); ++i) {
+                std::string src = MemOperand("%rbx", from + (int)idx[i] * lb);
+                if (type->laneBits < 32) out << "\tmovzx %eax, " << sizeKeyword(type->laneBits) << src << "\n";
+                else out << "\tmov " << r << ", " << src << "\n";
+                out << "\tmov " << MemOperand("%rbx", to + (int)i * lb) << ", " << gpr(type->laneBits) << "\n";
+            }
+            out << loadVector(type, reg, "%rbx", to);
+        }
+        return out.str();
+    }
+
+    if (name == "select") {
+        if (args.size() != 3) return argError("expects a mask and two vectors");
+        const VectorType* maskType = vectorTypeOf(args[0]);
+        if (!maskType || maskType->bytes() != type->bytes() || maskType->lanes != type->lanes)
+            return argError("mask must be a vector of the same shape");
+
+        // (mask & a) | (~mask & b)
+        std::vector<VecOperand> ops;
+        out << compileVectorOperands(args, {maskType, type, type}, reg, ops);
+        for (int j = 0; j < s.parts; ++j) {
+            std::string d = s.r(reg + j);
+            out << s.mov(t1, d) << s.ins("pandn", t1, operandPart(s, ops[2], j));
+            out << s.ins("pand", d, operandPart(s, ops[1], j)) << s.ins("por", d, t1);
+        }
+        return out.str();
+    }
+
+    if (name == "vmin" || name == "vmax") {
+        if (args.size() != 2) return argError("expects two vectors");
+        std::vector<VecOperand> ops;
+        out << compileVectorOperands(args, {type, type}, reg, ops);
+        for (int j = 0; j < s.parts; ++j)
+            out << laneOp(s, name == "vmin" ? "min" : "max", s.r(reg + j), operandPart(s, ops[1], j), node->line, node->col);
+        return out.str();
+    }
+
+    return argError("does not produce a vector");
+}
+
+// Vector builtins with a scalar or no result: reductions, lane extraction and stores
+std::string Compiler_Amd64::compileVectorScalarBuiltin(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    std::ostringstream out;
+    const std::string& name = node->name;
+    auto& args = node->children;
+    int r = vecTop;
+
+    auto argError = [&](const std::string& msg) {
+        std::cerr << "Error: " << name << ": " << msg << " at line " << node->line << " col " << node->col << "\n";
+        return std::string();
+    };
+
+    if (name == "store" || name == "storeu") {
+        if (args.size() != 2) return argError("expects an address and a vector");
+        const VectorType* type = vectorTypeOf(args[1]);
+        if (!type) return argError("expects a vector to store");
+
+        // The address is computed first, it may not survive the vector expression in a register
+        std::string addr = simpleOperand(args[0]);
+        if (addr.empty()) {
+            out << compileExpression(args[0], "%rax");
+            out << push("%rax");
+        }
+        out << compileVectorExpr(args[1], r, type);
+        if (addr.empty()) out << pop("%rcx");
+        else out << "\tmov %rcx, " << addr << "\n";
+        out << storeVector(type, r, "%rcx", 0, name == "store");
+        return out.str();
+    }
+
+    if (args.empty()) return argError("expects a vector");
+    const VectorType* type = vectorTypeOf(args[0]);
+    if (!type) return argError("expects a vector");
+    VecShape s = shapeOf(type, target);
+    VecShape h = lowHalf(s);
+    std::string x = "%xmm" + std::to_string(r);
+    std::string t1 = "%xmm" + std::to_string(VecScratch1);
+
+    if (name == "extract") {
+        if (args.size() != 2 || !IsIntegerLiteral(args[1])) return argError("expects a vector and a constant lane");
+        int64_t lane = std::stoll(args[1]->value);
+        if (lane < 0 || lane >= type->lanes) return argError("lane index out of range");
+
+        out << compileVectorExpr(args[0], r, type);
+        if (lane == 0) {
+            out << lane0ToRax(s, r);
+        } else {
+            int slot = allocateVectorSlot(type->bytes());
+            out << storeVector(type, r, "%rbx", slot);
+            out << laneToRax(type, MemOperand("%rbx", slot + (int)lane * type->laneBytes()));
+        }
+    } else if (name == "hsum" || name == "hmin" || name == "hmax") {
+        if (args.size() != 1) return argError("expects one vector");
+        std::string op = name == "hsum" ? "+" : name == "hmin" ? "min" : "max";
+
+        out << compileVectorExpr(args[0], r, type);
+
+        // Fold the upper 128 bits onto the lower, then halve the register until one lane is left
+        if (s.parts == 2) {
+            out << laneOp(h, op, x, "%xmm" + std::to_string(r + 1), node->line, node->col);
+        } else if (s.width == 256) {
+            out << "\tvextracti128 " << t1 << ", " << s.r(r) << ", 1\n";
+            out << laneOp(h, op, x, t1, node->line, node->col);
+        }
+        out << h.unaryImm("pshufd", t1, x, 0x4E) << laneOp(h, op, x, t1, node->line, node->col);
+        if (type->laneBits <= 32)
+            out << h.unaryImm("pshufd", t1, x, 0xB1) << laneOp(h, op, x, t1, node->line, node->col);
+        if (type->laneBits <= 16)
+            out << h.unaryImm("pshuflw", t1, x, 0xB1) << laneOp(h, op, x, t1, node->line, node->col);
+        if (type->laneBits == 8)
+            out << h.mov(t1, x) << h.ins("psrlw", t1, "8") << laneOp(h, op, x, t1, node->line, node->col);
+        out << lane0ToRax(s, r);
+    } else {
+        return argError("unknown vector builtin");
+    }
+
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
@@ -0,0 +1,164 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+#include <iostream>
+#include <unordered_set>
+
+// Declared type of an expression, "" for plain 64-bit integers
+std::string Compiler_Amd64::exprType(const std::shared_ptr<ASTNode>& node) {
+    if (!node) return "";
+    switch (node->type) {
+        case ASTNodeType::Identifier: {
+            const VariableInfo* v = findVariable(node->name);
+            return v ? v->type : "";
+        }
+        case ASTNodeType::MemberExpr: {
+            std::string objType = exprType(node->children[0]);
+            const StructType* st = FindStructType(IsPointerType(objType) ? PointeeType(objType) : objType);
+            const StructField* f = st ? st->field(node->name) : nullptr;
+            return f ? f->type : "";
+        }
+        case ASTNodeType::UnaryExpr:
+            if (node->name == "&") return "*" + exprType(node->children[0]);
+            break;
+        case ASTNodeType::AssignExpr:
+            return exprType(node->children[0]);
+        case ASTNodeType::BinaryExpr: {
+            // u64 arithmetic wraps like the 64-bit registers, so it stays u64
+            static const std::unordered_set<std::string> arith = {"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"};
+            if (!arith.count(node->name) || !isUnsignedOp(node)) break;
+            bool shift = node->name == "<<" || node->name == ">>";
+            if (exprType(node->children[0]) == "u64" || (!shift && exprType(node->children[1]) == "u64")) return "u64";
+            break;
+        }
+        case ASTNodeType::CallExpr: {
+            auto fn = functions.find(node->name);
+            if (fn != functions.end()) return fn->second.returnType;
+            break;
+        }
+        default:
+            break;
+    }
+    const VectorType* vt = vectorTypeOf(node);
+    return vt ? vt->name : "";
+}
+
+// Struct variables and value fields nested in them sit at a fixed frame or .bss address
+bool Compiler_Amd64::staticPlace(const std::shared_ptr<ASTNode>& node, Place& place) const {
+    if (node->type == ASTNodeType::Identifier) {
+        if (const VariableInfo* v = findVariable(node->name)) {
+            if (!FindStructType(v->type)) return false;
+            if (!v->label.empty()) place = {v->label, 0, v->type};
+            else place = v->inArea ? Place{"%rbx", v->offset, v->type} : Place{"%rbp", -v->offset, v->type};
+            return true;
+        }
+        return false;
+    }
+    if (node->type != ASTNodeType::MemberExpr || !staticPlace(node->children[0], place)) return false;
+    const StructType* st = FindStructType(place.type);
+    const StructField* f = st ? st->field(node->name) : nullptr;
+    if (!f) return false;
+    place.offset += f->offset;
+    place.type = f->type;
+    place.packed |= st->packed;
+    return true;
+}
+
+// Emits whatever the address needs into out, a pointer being followed ends up in %rax
+bool Compiler_Amd64::compilePlace(const std::shared_ptr<ASTNode>& node, std::ostringstream& out, Place& place) {
+    if (staticPlace(node, place)) return true;
+
+    if (node->type != ASTNodeType::MemberExpr) {
+        std::cerr << "Error: Expected a struct at line " << node->line << " col " << node->col << "\n";
+        return false;
+    }
+
+    auto& obj = node->children[0];
+    std::string objType = exprType(obj);
+    if (IsPointerType(objType)) {
+        out << compileExpression(obj, "%rax");
+        place = {"%rax", 0, PointeeType(objType)};
+    } else if (!compilePlace(obj, out, place)) {
+        return false;
+    }
+
+    const StructType* st = FindStructType(place.type);
+    if (!st) {
+        std::cerr << "Error: Field access '." << node->name << "' on a value that is not a struct at line " << node->line << " col " << node->col << "\n";
+        return false;
+    }
+    const StructField* f = st->field(node->name);
+    if (!f) {
+        std::cerr << "Error: Struct '" << st->name << "' has no field '" << node->name << "' at line " << node->line << " col " << node->col << "\n";
+        return false;
+    }
+    place.offset += f->offset;
+    place.type = f->type;
+    place.packed |= st->packed;
+    return true;
+}
+
+// Struct locals up to 16-byte alignment sit with the scalars, over-aligned ones
+// (#[align(64)] and friends) go to the %rbx area that is realigned per frame
+std::string Compiler_Amd64::compileStructDecl(const std::shared_ptr<ASTNode>& node, const StructType* type) {
+    if (!node->children.empty()) {
+        std::cerr << "Error: Struct '" << node->name << "' can't have an initializer, assign its fields at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    if (type->align <= 16) {
+        allocateLocal(node->name, type->size, type->name, type->align);
+    } else {
+        VariableInfo v{node->name, allocateVectorSlot(type->size, type->align), type->size, "", type->name};
+        v.inArea = true;
+        currentFunction->locals.push_back(v);
+    }
+    return "\t// struct " + type->name + " " + node->name + ", " + std::to_string(type->size) + " bytes\n";
+}
+
+std::string Compiler_Amd64::compileMemberLoad(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    std::ostringstream out;
+    Place place;
+    if (!compilePlace(node, out, place)) return "";
+    out << LoadScalar(place.type, targetReg, MemOperand(place.base, place.offset));
+    return out.str();
+}
+
+std::string Compiler_Amd64::compileMemberStore(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    auto& target = node->children[0];
+    std::ostringstream addr;
+    Place place;
+    if (!compilePlace(target, addr, place)) return "";
+    if (!IsScalarType(place.type)) {
+        std::cerr << "Error: Can't assign a whole '" << place.type << "' field, assign its members at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+
+    std::ostringstream out;
+    out << compileExpression(node->children[1], "%rax");
+    out << WrapScalar(place.type, "%rax");
+    if (addr.str().empty()) {
+        out << StoreScalar(place.type, MemOperand(place.base, place.offset), "%rax");
+    } else {
+        out << push("%rax");
+        out << addr.str();
+        out << "\tmov %rcx, %rax\n";
+        out << pop("%rax");
+        out << StoreScalar(place.type, MemOperand("%rcx", place.offset), "%rax");
+    }
+    if (targetReg != "%rax") out << "\tmov " << targetReg << ", %rax\n";
+    return out.str();
+}
+
+// Scalar locals never have their address taken, so the optimizer may keep
+// assuming only direct assignments change them
+std::string Compiler_Amd64::compileAddressOf(const std::shared_ptr<ASTNode>& node, const std::string& targetReg) {
+    auto& operand = node->children[0];
+    if (operand->type != ASTNodeType::MemberExpr && !FindStructType(exprType(operand))) {
+        std::cerr << "Error: Only structs and their fields can have their address taken at line " << node->line << " col " << node->col << "\n";
+        return "";
+    }
+    std::ostringstream out;
+    Place place;
+    if (!compilePlace(operand, out, place)) return "";
+    out << "\tlea " << targetReg << ", " << MemOperand(place.base, place.offset) << "\n";
+    return out.str();
+}
@@ -0,0 +1,64 @@
+#include <compiler_amd64.hpp>
+#include <cpuid.h>
+
+// The x86-64 psABI microarchitecture levels, each includes the ones below
+bool ParseMarch(const std::string& name, TargetFeatures& features) {
+    if (name == "native") {
+        features = HostFeatures();
+        return true;
+    }
+    int level;
+    if (name == "x86-64") level = 1;
+    else if (name == "x86-64-v2" || name == "v2") level = 2;
+    else if (name == "x86-64-v3" || name == "v3") level = 3;
+    else if (name == "x86-64-v4" || name == "v4") level = 4;
+    else return false;
+
+    features = TargetFeatures();
+    features.popcnt = level >= 2;
+    features.lzcnt = features.bmi1 = features.bmi2 = features.movbe = features.avx2 = level >= 3;
+    features.avx512 = level >= 4;
+    return true;
+}
+
+TargetFeatures HostFeatures() {
+    TargetFeatures features;
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d)) return features;
+    features.popcnt = c & bit_POPCNT;
+    features.movbe = c & bit_MOVBE;
+
+    // AVX needs the OS to save the YMM state as well
+    bool ymmState = false, zmmState = false;
+    if (c & bit_OSXSAVE) {
+        unsigned lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        ymmState = (lo & 0x6) == 0x6;
+        zmmState = (lo & 0xE6) == 0xE6;
+    }
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        features.bmi1 = b & bit_BMI;
+        features.bmi2 = b & bit_BMI2;
+        features.avx2 = ymmState && (b & bit_AVX2);
+        features.avx512 = zmmState && (b & bit_AVX512F);
+    }
+    if (__get_cpuid(0x80000001, &a, &b, &c, &d)) features.lzcnt = c & bit_LZCNT;
+    return features;
+}
+
+std::string DescribeFeatures(const TargetFeatures& features) {
+    std::string out;
+    auto add = [&](bool on, const char* name) {
+        if (!on) return;
+        if (!out.empty()) out += " ";
+        out += name;
+    };
+    add(features.popcnt, "popcnt");
+    add(features.lzcnt, "lzcnt");
+    add(features.bmi1, "bmi1");
+    add(features.bmi2, "bmi2");
+    add(features.movbe, "movbe");
+    add(features.avx2, "avx2");
+    add(features.avx512, "avx512");
+    return out.empty() ? "baseline" : out;
+}
@@ -0,0 +1,389 @@
+#include <compiler_amd64.hpp>
+#include <sstream>
+
+// Threads, futex locks and the work-stealing pool behind aol_stdlib/thread.aol
+// and `parallel for`, on raw clone, futex and mmap.
+//
+// A thread runs on its own mapping, the handle sits at the top of it just
+// above the initial stack. The kernel writes the thread id into the handle and
+// clears it (with a futex wake) when the thread exits, join waits for that and
+// unmaps the stack.
+//
+// The pool starts one worker thread per CPU besides the calling thread, which
+// is worker 0. Every worker owns a Chase-Lev deque: the owner pushes and pops
+// at the bottom, thieves take from the top with a compare-and-swap. A task is
+// an entry of four words, fn(a, b, env) plus the group it belongs to. Groups
+// count their pending tasks, waiting on a group runs tasks, its own or
+// stolen ones, until the count drops to zero. A group with a grain splits a
+// task over [a, b) in halves, pushing the upper half, until it is no longer
+// than the grain. Idle workers spin for a while, then sleep on a futex that
+// pushes bump when someone sleeps.
+//
+// The pool finds the deque of the calling thread by its stack, so it may be
+// used from the main thread and from pool tasks, not from threads of
+// thread_spawn.
+static const int ThreadStackSize = 8 << 20; // reserved, pages are committed as the stack grows
+
+// Thread handle, the top 64 bytes of the mapping
+static const int ThreadTid = 0; // u32, 0 once the thread has exited
+static const int ThreadFn = 8;
+static const int ThreadArg = 16;
+static const int ThreadResult = 24;
+static const int ThreadHandleSize = 64;
+
+// clone flags: VM, FS, FILES, SIGHAND, THREAD, SYSVSEM, PARENT_SETTID, CHILD_CLEARTID
+static const int CloneThread = 0x350f00;
+
+static const int FutexWait = 128; // FUTEX_WAIT | FUTEX_PRIVATE_FLAG
+static const int FutexWake = 129;
+
+static const int PoolMaxWorkers = 256;
+static const int PoolSpins = 4096; // empty rounds before a worker sleeps
+
+// Deque, top and bottom on their own cache lines
+static const int DequeTop = 0;
+static const int DequeBottom = 64;
+static const int DequeStackLow = 128; // the owner's stack, 0 for worker 0
+static const int DequeStackHigh = 136;
+static const int DequeSeed = 144; // victim choice
+static const int DequeEntries = 192;
+static const int DequeCapacity = 4096;
+static const int DequeSize = DequeEntries + DequeCapacity * 32;
+
+// Task group, struct TaskGroup in thread.aol
+static const int GroupPending = 0;
+static const int GroupEnv = 8;
+static const int GroupGrain = 16;
+
+static std::string at(const std::string& reg, int offset) {
+    return "[" + reg + " + " + std::to_string(offset) + "]";
+}
+
+static std::string futex(int op, const std::string& count) {
+    return "\tmov %esi, " + std::to_string(op) + "\n\tmov %edx, " + count + "\n\txor %r10d, %r10d\n\tmov %eax, 202\n\tsyscall\n";
+}
+
+std::string Compiler_Amd64::compileThreadRuntime() {
+    std::ostringstream out;
+
+    bss << "\t:res __aol_pool_count!uqword\n";
+    bss << "\t:res __aol_pool_deques!uqword\n";
+    bss << "\t:res __aol_pool_epoch!uqword\n"; // futex, bumped by a push that sees sleepers
+    bss << "\t:res __aol_pool_idle!uqword\n";
+
+    // __aol_thread_spawn(fn, arg): handle of a thread running fn(arg), 0 on failure
+    out << "__aol_thread_spawn:\n";
+    out << "\tpush %rdi\n\tpush %rsi\n\tsub %rsp, 8\n";
+    out << "\tmov %rdi, " << ThreadStackSize << "\n\tmov %rsi, 147456\n\tcall __aol_map__\n"; // MAP_NORESERVE | MAP_STACK
+    out << "\tadd %rsp, 8\n\tpop %rdx\n\tpop %rcx\n";
+    out << "\ttest %rax, %rax\n\tjz __aol_thread_spawn_done__\n";
+    out << "\tlea %rsi, [%rax + " << ThreadStackSize - ThreadHandleSize << "]\n";
+    out << "\tmov " << at("%rsi", ThreadFn) << ", %rcx\n\tmov " << at("%rsi", ThreadArg) << ", %rdx\n";
+    out << "\txor %ecx, %ecx\n\tmov " << at("%rsi", ThreadResult) << ", %rcx\n\tmov dword " << at("%rsi", ThreadTid) << ", %ecx\n";
+    out << "\tmov %rdi, " << CloneThread << "\n\tlea %rdx, " << at("%rsi", ThreadTid) << "\n\tmov %r10, %rdx\n\txor %r8d, %r8d\n";
+    out << "\tmov %eax, 56\n\tsyscall\n"; // clone, the child starts on the stack below the handle
+    out << "\ttest %rax, %rax\n\tjz __aol_thread_start__\n\tjs __aol_thread_spawn_failed__\n";
+    out << "\tmov %rax, %rsi\n";
+    out << "__aol_thread_spawn_done__:\n";
+    out << "\tret\n";
+    out << "__aol_thread_spawn_failed__:\n";
+    out << "\tlea %rdi, [%rsi - " << ThreadStackSize - ThreadHandleSize << "]\n\tmov %rsi, " << ThreadStackSize << "\n";
+    out << "\tsub %rsp, 8\n\tcall __aol_munmap\n\tadd %rsp, 8\n\txor %eax, %eax\n\tret\n";
+    out << "__aol_thread_start__:\n";
+    out << "\tmov %rdi, " << at("%rsp", ThreadArg) << "\n\tcall " << at("%rsp", ThreadFn) << "\n";
+    out << "\tmov " << at("%rsp", ThreadResult) << ", %rax\n";
+    out << "\txor %edi, %edi\n\tmov %eax, 60\n\tsyscall\n\n"; // exit, this thread only
+
+    // __aol_thread_join(handle): what the thread's function returned. The
+    // exit wake comes from the kernel on a shared futex, so the wait is shared too.
+    out << "__aol_thread_join:\n";
+    out << "\tpush %rdi\n";
+    out << "__aol_thread_join_wait__:\n";
+    out << "\tmov %edx, dword " << at("%rdi", ThreadTid) << "\n\ttest %edx, %edx\n\tjz __aol_thread_join_done__\n";
+    out << "\txor %esi, %esi\n\txor %r10d, %r10d\n\tmov %eax, 202\n\tsyscall\n"; // FUTEX_WAIT
+    out << "\tmov %rdi, [%rsp]\n\tjmp __aol_thread_join_wait__\n";
+    out << "__aol_thread_join_done__:\n";
+    out << "\tmov %rax, " << at("%rdi", ThreadResult) << "\n\tmov [%rsp], %rax\n";
+    out << "\tsub %rdi, " << ThreadStackSize - ThreadHandleSize << "\n\tmov %rsi, " << ThreadStackSize << "\n\tcall __aol_munmap\n";
+    out << "\tpop %rax\n\tret\n\n";
+
+    // __aol_cpu_count(): CPUs this process may run on, from its affinity mask
+    out << "__aol_cpu_count:\n";
+    out << "\tsub %rsp, 136\n";
+    out << "\txor %edi, %edi\n\tmov %esi, 128\n\tmov %rdx, %rsp\n\tmov %eax, 204\n\tsyscall\n"; // sched_getaffinity
+    out << "\tmov %rcx, %rax\n\txor %eax, %eax\n\ttest %rcx, %rcx\n\tjle __aol_cpu_count_done__\n";
+    out << "\tshr %rcx, 3\n";
+    out << "__aol_cpu_count_word__:\n";
+    out << "\tmov %rdx, [%rsp + %rcx*8 - 8]\n";
+    out << "__aol_cpu_count_bit__:\n";
+    out << "\ttest %rdx, %rdx\n\tjz __aol_cpu_count_next__\n";
+    out << "\tlea %rsi, [%rdx - 1]\n\tand %rdx, %rsi\n\tinc %rax\n\tjmp __aol_cpu_count_bit__\n";
+    out << "__aol_cpu_count_next__:\n";
+    out << "\tdec %rcx\n\tjnz __aol_cpu_count_word__\n";
+    out << "__aol_cpu_count_done__:\n";
+    out << "\ttest %rax, %rax\n\tjnz __aol_cpu_count_ret__\n\tinc %rax\n";
+    out << "__aol_cpu_count_ret__:\n";
+    out << "\tadd %rsp, 136\n\tret\n\n";
+
+    // Mutex: 0 free, 1 locked, 2 locked with waiters. Only a contended unlock
+    // makes a syscall.
+    // __aol_mutex_lock(mutex)
+    out << "__aol_mutex_lock:\n";
+    out << "\txor %eax, %eax\n\tmov %ecx, 1\n\tlock cmpxchg dword [%rdi], %ecx\n\tjnz __aol_mutex_lock_contended__\n\tret\n";
+    out << "__aol_mutex_lock_contended__:\n";
+    out << "\tmov %eax, 2\n\txchg dword [%rdi], %eax\n\ttest %eax, %eax\n\tjz __aol_mutex_lock_done__\n";
+    out << futex(FutexWait, "2");
+    out << "\tjmp __aol_mutex_lock_contended__\n";
+    out << "__aol_mutex_lock_done__:\n";
+    out << "\tret\n\n";
+
+    // __aol_mutex_trylock(mutex): 1 if it took the lock
+    out << "__aol_mutex_trylock:\n";
+    out << "\txor %eax, %eax\n\tmov %ecx, 1\n\tlock cmpxchg dword [%rdi], %ecx\n\tsete %al\n\tmovzx %eax, %al\n\tret\n\n";
+
+    // __aol_mutex_unlock(mutex)
+    out << "__aol_mutex_unlock:\n";
+    out << "\tlock dec dword [%rdi]\n\tjz __aol_mutex_unlock_done__\n";
+    out << "\tmov dword [%rdi], 0\n";
+    out << futex(FutexWake, "1");
+    out << "__aol_mutex_unlock_done__:\n";
+    out << "\tret\n\n";
+
+    // Condition variable: a sequence number bumped by every signal. A waiter
+    // sleeps only while the number is the one it saw before unlocking, so a
+    // signal between the unlock and the sleep isn't lost.
+    // __aol_cond_wait(cond, mutex): the mutex is held again on return
+    out << "__aol_cond_wait:\n";
+    out << "\tpush %rdi\n\tpush %rsi\n\tmov %eax, dword [%rdi]\n\tpush %rax\n";
+    out << "\tmov %rdi, %rsi\n\tcall __aol_mutex_unlock\n";
+    out << "\tmov %rdi, [%rsp + 16]\n" << futex(FutexWait, "[%rsp]");
+    out << "\tmov %rdi, [%rsp + 8]\n\tadd %rsp, 24\n";
+    out << "\tjmp __aol_mutex_lock_contended__\n\n"; // somebody else may have been woken too
+
+    // __aol_cond_signal(cond) / __aol_cond_broadcast(cond)
+    out << "__aol_cond_signal:\n";
+    out << "\tlock inc dword [%rdi]\n" << futex(FutexWake, "1") << "\tret\n\n";
+    out << "__aol_cond_broadcast:\n";
+    out << "\tlock inc dword [%rdi]\n" << futex(FutexWake, "2147483647") << "\tret\n\n";
+
+    auto entry = [&](const std::string& reg) {
+        return "\tmov %r10, " + reg + "\n\tand %r10, " + std::to_string(DequeCapacity - 1) + "\n\tshl %r10, 5\n\tadd %r10, %rdi\n";
+    };
+    auto loadEntry = [&] {
+        return "\tmov %rsi, " + at("%r10", DequeEntries) + "\n\tmov %rdx, " + at("%r10", DequeEntries + 8) + "\n" +
+               "\tmov %rcx, " + at("%r10", DequeEntries + 16) + "\n\tmov %r8, " + at("%r10", DequeEntries + 24) + "\n";
+    };
+
+    // Pool internals, deque in %rdi, a task entry in %rsi (fn), %rdx (a), %rcx (b), %r8 (group)
+
+    // __aol_pool_push__: 0 when the deque is full. Keeps the entry registers.
+    out << "__aol_pool_push__:\n";
+    out << "\tmov %rax, " << at("%rdi", DequeBottom) << "\n\tmov %r9, %rax\n\tsub %r9, " << at("%rdi", DequeTop) << "\n";
+    out << "\tcmp %r9, " << DequeCapacity << "\n\tjge __aol_pool_push_full__\n";
+    out << entry("%rax");
+    out << "\tmov " << at("%r10", DequeEntries) << ", %rsi\n\tmov " << at("%r10", DequeEntries + 8) << ", %rdx\n";
+    out << "\tmov " << at("%r10", DequeEntries + 16) << ", %rcx\n\tmov " << at("%r10", DequeEntries + 24) << ", %r8\n";
+    out << "\tinc %rax\n\tmov " << at("%rdi", DequeBottom) << ", %rax\n";
+    out << "\tmfence\n\tmov %eax, dword [__aol_pool_idle]\n\ttest %eax, %eax\n\tjz __aol_pool_push_done__\n";
+    out << "\tpush %rdi\n\tpush %rsi\n\tpush %rdx\n\tpush %rcx\n";
+    out << "\tlock inc dword [__aol_pool_epoch]\n\tlea %rdi, [__aol_pool_epoch]\n" << futex(FutexWake, "1");
+    out << "\tpop %rcx\n\tpop %rdx\n\tpop %rsi\n\tpop %rdi\n";
+    out << "__aol_pool_push_done__:\n";
+    out << "\tmov %eax, 1\n\tret\n";
+    out << "__aol_pool_push_full__:\n";
+    out << "\txor %eax, %eax\n\tret\n\n";
+
+    // __aol_pool_pop__: 1 and the entry from the bottom, 0 when empty. Taking
+    // the last entry races the thieves for it on top.
+    out << "__aol_pool_pop__:\n";
+    out << "\tmov %rax, " << at("%rdi", DequeBottom) << "\n\tdec %rax\n";
+    out << "\tmov %r9, %rax\n\txchg " << at("%rdi", DequeBottom) << ", %r9\n"; // a full fence before top is read
+    out << "\tmov %r9, " << at("%rdi", DequeTop) << "\n";
+    out << "\tcmp %r9, %rax\n\tjg __aol_pool_pop_empty__\n";
+    out << entry("%rax") << loadEntry();
+    out << "\tcmp %r9, %rax\n\tjne __aol_pool_pop_got__\n";
+    out << "\tlea %r10, [%r9 + 1]\n\tmov %rax, %r9\n\tlock cmpxchg " << at("%rdi", DequeTop) << ", %r10\n";
+    out << "\tmov " << at("%rdi", DequeBottom) << ", %r10\n\tjne __aol_pool_pop_lost__\n";
+    out << "__aol_pool_pop_got__:\n";
+    out << "\tmov %eax, 1\n\tret\n";
+    out << "__aol_pool_pop_empty__:\n";
+    out << "\tinc %rax\n\tmov " << at("%rdi", DequeBottom) << ", %rax\n";
+    out << "__aol_pool_pop_lost__:\n";
+    out << "\txor %eax, %eax\n\tret\n\n";
+
+    // __aol_pool_steal__: 1 and the entry from the top of the deque in %rdi, 0 when empty or lost
+    out << "__aol_pool_steal__:\n";
+    out << "\tmov %r9, " << at("%rdi", DequeTop) << "\n\tmov %rax, " << at("%rdi", DequeBottom) << "\n";
+    out << "\tcmp %r9, %rax\n\tjge __aol_pool_steal_none__\n";
+    out << entry("%r9") << loadEntry();
+    out << "\tlea %r10, [%r9 + 1]\n\tmov %rax, %r9\n\tlock cmpxchg " << at("%rdi", DequeTop) << ", %r10\n";
+    out << "\tjne __aol_pool_steal_none__\n";
+    out << "\tmov %eax, 1\n\tret\n";
+    out << "__aol_pool_steal_none__:\n";
+    out << "\txor %eax, %eax\n\tret\n\n";
+
+    // __aol_pool_find__: an entry from the own deque in %rdi, else one stolen
+    // from the others, starting at a random victim
+    out << "__aol_pool_find__:\n";
+    out << "\tpush %r12\n\tpush %r13\n\tpush %r14\n\tmov %r12, %rdi\n";
+    out << "\tcall __aol_pool_pop__\n\ttest %eax, %eax\n\tjnz __aol_pool_find_done__\n";
+    out << "\tmov %r14, [__aol_pool_count]\n\tcmp %r14, 1\n\tjle __aol_pool_find_done__\n";
+    out << "\tmov %rax, " << at("%r12", DequeSeed) << "\n"; // xorshift64
+    out << "\tmov %rdx, %rax\n\tshl %rdx, 13\n\txor %rax, %rdx\n\tmov %rdx, %rax\n\tshr %rdx, 7\n\txor %rax, %rdx\n";
+    out << "\tmov %rdx, %rax\n\tshl %rdx, 17\n\txor %rax, %rdx\n\tmov " << at("%r12", DequeSeed) << ", %rax\n";
+    out << "\txor %edx, %edx\n\tdiv %r14\n\tmov %r13, %rdx\n";
+    out << "__aol_pool_find_victim__:\n";
+    out << "\timul %rdi, %r13, " << DequeSize << "\n\tadd %rdi, [__aol_pool_deques]\n";
+    out << "\tcmp %rdi, %r12\n\tje __aol_pool_find_next__\n";
+    out << "\tcall __aol_pool_steal__\n\ttest %eax, %eax\n\tjnz __aol_pool_find_done__\n";
+    out << "__aol_pool_find_next__:\n";
+    out << "\tinc %r13\n\tcmp %r13, [__aol_pool_count]\n\tjb __aol_pool_find_wrap__\n\txor %r13d, %r13d\n";
+    out << "__aol_pool_find_wrap__:\n";
+    out << "\tdec %r14\n\tjnz __aol_pool_find_victim__\n";
+    out << "\txor %eax, %eax\n";
+    out << "__aol_pool_find_done__:\n";
+    out << "\tpop %r14\n\tpop %r13\n\tpop %r12\n\tret\n\n";
+
+    // __aol_pool_run__: runs the entry. A range of a group with a grain gives
+    // away its upper halves first.
+    out << "__aol_pool_run__:\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tpush %r14\n\tpush %r15\n";
+    out << "\tmov %rbx, %rdi\n\tmov %r12, %rsi\n\tmov %r13, %rdx\n\tmov %r14, %rcx\n\tmov %r15, %r8\n";
+    out << "\tmov %rax, " << at("%r15", GroupGrain) << "\n\ttest %rax, %rax\n\tjz __aol_pool_run_call__\n";
+    out << "\tmov %rax, [__aol_pool_count]\n\tcmp %rax, 1\n\tjle __aol_pool_run_call__\n"; // nobody to give work to
+    out << "__aol_pool_run_split__:\n";
+    out << "\tmov %rdx, %r14\n\tsub %rdx, %r13\n\tcmp %rdx, " << at("%r15", GroupGrain) << "\n\tjle __aol_pool_run_call__\n";
+    out << "\tshr %rdx, 1\n\tadd %rdx, %r13\n";
+    out << "\tmov %r9, 1\n\tlock xadd " << at("%r15", GroupPending) << ", %r9\n";
+    out << "\tmov %rdi, %rbx\n\tmov %rsi, %r12\n\tmov %rcx, %r14\n\tmov %r8, %r15\n\tcall __aol_pool_push__\n";
+    out << "\ttest %eax, %eax\n\tjz __aol_pool_run_full__\n";
+    out << "\tmov %r14, %rdx\n\tjmp __aol_pool_run_split__\n";
+    out << "__aol_pool_run_full__:\n";
+    out << "\tmov %r9, -1\n\tlock xadd " << at("%r15", GroupPending) << ", %r9\n";
+    out << "__aol_pool_run_call__:\n";
+    out << "\tmov %rdi, %r13\n\tmov %rsi, %r14\n\tmov %rdx, " << at("%r15", GroupEnv) << "\n\tcall %r12\n";
+    out << "\tmov %r9, -1\n\tlock xadd " << at("%r15", GroupPending) << ", %r9\n"; // the task's stores are visible first
+    out << "\tpop %r15\n\tpop %r14\n\tpop %r13\n\tpop %r12\n\tpop %rbx\n\tret\n\n";
+
+    // __aol_pool_wait__: runs tasks until the group in %rsi has none pending
+    out << "__aol_pool_wait__:\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tmov %rbx, %rdi\n\tmov %r12, %rsi\n";
+    out << "__aol_pool_wait_loop__:\n";
+    out << "\tmov %rax, " << at("%r12", GroupPending) << "\n\ttest %rax, %rax\n\tjz __aol_pool_wait_done__\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_pool_find__\n\ttest %eax, %eax\n\tjz __aol_pool_wait_idle__\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_pool_run__\n\tjmp __aol_pool_wait_loop__\n";
+    out << "__aol_pool_wait_idle__:\n";
+    out << "\tpause\n\tjmp __aol_pool_wait_loop__\n";
+    out << "__aol_pool_wait_done__:\n";
+    out << "\tpop %r13\n\tpop %r12\n\tpop %rbx\n\tret\n\n";
+
+    // __aol_pool_self__: the deque of the calling thread, into %rax. Clobbers %rcx and %rdx.
+    out << "__aol_pool_self__:\n";
+    out << "\tmov %rax, [__aol_pool_deques]\n\tmov %rcx, [__aol_pool_count]\n\tmov %rdx, %rax\n";
+    out << "__aol_pool_self_next__:\n";
+    out << "\tdec %rcx\n\tjle __aol_pool_self_done__\n";
+    out << "\tadd %rdx, " << DequeSize << "\n";
+    out << "\tcmp %rsp, " << at("%rdx", DequeStackLow) << "\n\tjb __aol_pool_self_next__\n";
+    out << "\tcmp %rsp, " << at("%rdx", DequeStackHigh) << "\n\tjae __aol_pool_self_next__\n";
+    out << "\tmov %rax, %rdx\n";
+    out << "__aol_pool_self_done__:\n";
+    out << "\tret\n\n";
+
+    // __aol_pool_worker__(deque): a worker thread, records its stack and never returns
+    out << "__aol_pool_worker__:\n";
+    out << "\tlea %rax, [%rsp + " << 8 + ThreadHandleSize << "]\n\tmov " << at("%rdi", DequeStackHigh) << ", %rax\n";
+    out << "\tsub %rax, " << ThreadStackSize << "\n\tmov " << at("%rdi", DequeStackLow) << ", %rax\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tmov %rbx, %rdi\n";
+    out << "__aol_pool_worker_loop__:\n";
+    out << "\tmov %r12, " << PoolSpins << "\n";
+    out << "__aol_pool_worker_spin__:\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_pool_find__\n\ttest %eax, %eax\n\tjz __aol_pool_worker_miss__\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_pool_run__\n\tjmp __aol_pool_worker_loop__\n";
+    out << "__aol_pool_worker_miss__:\n";
+    out << "\tpause\n\tdec %r12\n\tjnz __aol_pool_worker_spin__\n";
+    // Announce the sleep, look once more, then sleep unless a push bumped the epoch since
+    out << "\tmov %r13d, dword [__aol_pool_epoch]\n\tlock inc dword [__aol_pool_idle]\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_pool_find__\n\ttest %eax, %eax\n\tjnz __aol_pool_worker_found__\n";
+    out << "\tlea %rdi, [__aol_pool_epoch]\n" << futex(FutexWait, "%r13d");
+    out << "\tlock dec dword [__aol_pool_idle]\n\tjmp __aol_pool_worker_loop__\n";
+    out << "__aol_pool_worker_found__:\n";
+    out << "\tlock dec dword [__aol_pool_idle]\n";
+    out << "\tmov %rdi, %rbx\n\tcall __aol_pool_run__\n\tjmp __aol_pool_worker_loop__\n\n";
+
+    // __aol_pool_start(workers): starts the pool once, 0 workers means one per
+    // CPU. Returns the number of workers, the caller included.
+    out << "__aol_pool_start:\n";
+    out << "\tmov %rax, [__aol_pool_count]\n\ttest %rax, %rax\n\tjnz __aol_pool_start_ret__\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tmov %rbx, %rdi\n";
+    out << "\ttest %rbx, %rbx\n\tjg __aol_pool_start_clamp__\n\tcall __aol_cpu_count\n\tmov %rbx, %rax\n";
+    out << "__aol_pool_start_clamp__:\n";
+    out << "\tcmp %rbx, " << PoolMaxWorkers << "\n\tjle __aol_pool_start_map__\n\tmov %rbx, " << PoolMaxWorkers << "\n";
+    out << "__aol_pool_start_map__:\n";
+    out << "\timul %rdi, %rbx, " << DequeSize << "\n\tcall __aol_mmap\n";
+    out << "\ttest %rax, %rax\n\tjz __aol_pool_start_done__\n";
+    out << "\tmov [__aol_pool_deques], %rax\n\txor %r12d, %r12d\n";
+    out << "__aol_pool_start_seed__:\n";
+    out << "\timul %rdi, %r12, " << DequeSize << "\n\tadd %rdi, [__aol_pool_deques]\n";
+    out << "\tlea %rax, [%r12 + 1]\n\tmov %rcx, -7046029254386353131\n\timul %rax, %rcx\n\tmov " << at("%rdi", DequeSeed) << ", %rax\n";
+    out << "\tinc %r12\n\tcmp %r12, %rbx\n\tjb __aol_pool_start_seed__\n";
+    out << "\tmov [__aol_pool_count], %rbx\n\tmov %r12, 1\n";
+    out << "__aol_pool_start_spawn__:\n";
+    out << "\tcmp %r12, %rbx\n\tjae __aol_pool_start_done__\n";
+    out << "\tlea %rdi, [__aol_pool_worker__]\n\timul %rsi, %r12, " << DequeSize << "\n\tadd %rsi, [__aol_pool_deques]\n";
+    out << "\tcall __aol_thread_spawn\n\tinc %r12\n\tjmp __aol_pool_start_spawn__\n"; // a worker that failed to start leaves its deque empty
+    out << "__aol_pool_start_done__:\n";
+    out << "\tmov %rax, [__aol_pool_count]\n\tpop %r13\n\tpop %r12\n\tpop %rbx\n";
+    out << "__aol_pool_start_ret__:\n";
+    out << "\tret\n\n";
+
+    // __aol_pool_workers(): workers of the running pool, 0 before it started
+    out << "__aol_pool_workers:\n";
+    out << "\tmov %rax, [__aol_pool_count]\n\tret\n\n";
+
+    // __aol_parallel_for(fn, lo, hi, env): fn(a, b, env) over pieces of [lo, hi)
+    // that together cover it once, about eight per worker
+    out << "__aol_parallel_for:\n";
+    out << "\tcmp %rsi, %rdx\n\tjge __aol_parallel_for_ret__\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tpush %r14\n\tpush %r15\n\tsub %rsp, 32\n"; // the group
+    out << "\tmov %r12, %rdi\n\tmov %r13, %rsi\n\tmov %r14, %rdx\n\tmov %r15, %rcx\n";
+    out << "\txor %edi, %edi\n\tcall __aol_pool_start\n";
+    out << "\tcmp %rax, 1\n\tjle __aol_parallel_for_serial__\n";
+    out << "\tmov %rcx, %rax\n\tshl %rcx, 3\n\tmov %rax, %r14\n\tsub %rax, %r13\n\txor %edx, %edx\n\tdiv %rcx\n";
+    out << "\ttest %rax, %rax\n\tjnz __aol_parallel_for_grain__\n\tinc %rax\n";
+    out << "__aol_parallel_for_grain__:\n";
+    out << "\tmov " << at("%rsp", GroupGrain) << ", %rax\n\tmov " << at("%rsp", GroupEnv) << ", %r15\n";
+    out << "\tmov %rax, 1\n\tmov " << at("%rsp", GroupPending) << ", %rax\n";
+    out << "\tcall __aol_pool_self__\n\tmov %rbx, %rax\n";
+    out << "\tmov %rdi, %rbx\n\tmov %rsi, %r12\n\tmov %rdx, %r13\n\tmov %rcx, %r14\n\tmov %r8, %rsp\n\tcall __aol_pool_run__\n";
+    out << "\tmov %rdi, %rbx\n\tmov %rsi, %rsp\n\tcall __aol_pool_wait__\n";
+    out << "\tjmp __aol_parallel_for_done__\n";
+    out << "__aol_parallel_for_serial__:\n";
+    out << "\tmov %rdi, %r13\n\tmov %rsi, %r14\n\tmov %rdx, %r15\n\tcall %r12\n";
+    out << "__aol_parallel_for_done__:\n";
+    out << "\tadd %rsp, 32\n\tpop %r15\n\tpop %r14\n\tpop %r13\n\tpop %r12\n\tpop %rbx\n";
+    out << "__aol_parallel_for_ret__:\n";
+    out << "\tret\n\n";
+
+    // __aol_task_spawn(group, fn, a, b): fn(a, b, group.env) on the pool, run
+    // right away when the deque is full or there is no pool
+    out << "__aol_task_spawn:\n";
+    out << "\tpush %rbx\n\tpush %r12\n\tpush %r13\n\tpush %r14\n\tpush %r15\n";
+    out << "\tmov %rbx, %rdi\n\tmov %r12, %rsi\n\tmov %r13, %rdx\n\tmov %r14, %rcx\n";
+    out << "\txor %edi, %edi\n\tcall __aol_pool_start\n\tmov %r15, %rax\n";
+    out << "\tmov %r9, 1\n\tlock xadd " << at("%rbx", GroupPending) << ", %r9\n";
+    out << "\tcall __aol_pool_self__\n";
+    out << "\tmov %rdi, %rax\n\tmov %rsi, %r12\n\tmov %rdx, %r13\n\tmov %rcx, %r14\n\tmov %r8, %rbx\n";
+    out << "\tcmp %r15, 1\n\tjle __aol_task_spawn_run__\n";
+    out << "\tcall __aol_pool_push__\n\ttest %eax, %eax\n\tjnz __aol_task_spawn_done__\n";
+    out << "__aol_task_spawn_run__:\n";
+    out << "\tcall __aol_pool_run__\n";
+    out << "__aol_task_spawn_done__:\n";
+    out << "\txor %eax, %eax\n\tpop %r15\n\tpop %r14\n\tpop %r13\n\tpop %r12\n\tpop %rbx\n\tret\n\n";
+
+    // __aol_task_wait(group): helps with the pool's tasks until the group's are done
+    out << "__aol_task_wait:\n";
+    out << "\tpush %rbx\n\tmov %rbx, %rdi\n";
+    out << "\tcall __aol_pool_self__\n\tmov %rdi, %rax\n\tmov %rsi, %rbx\n\tcall __aol_pool_wait__\n";
+    out << "\txor %eax, %eax\n\tpop %rbx\n\tret\n\n";
+    return out.str();
+}
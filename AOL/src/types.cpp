@@ -0,0 +1,297 @@
+#include <types.hpp>
+#include <parser.hpp>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+
+static const std::vector<VectorType> VectorTypes = {
+    // 128-bit, SSE2
+    {"v16i8", 16, 8, false},
+    {"v8i16", 8, 16, false},
+    {"v4i32", 4, 32, false},
+    {"v2i64", 2, 64, false},
+    {"v4f32", 4, 32, true},
+    {"v2f64", 2, 64, true},
+    // 256-bit, AVX2 or a pair of SSE2 registers
+    {"v32i8", 32, 8, false},
+    {"v16i16", 16, 16, false},
+    {"v8i32", 8, 32, false},
+    {"v4i64", 4, 64, false},
+    {"v8f32", 8, 32, true},
+    {"v4f64", 4, 64, true},
+};
+
+const VectorType* FindVectorType(const std::string& name) {
+    for (auto& t : VectorTypes)
+        if (t.name == name) return &t;
+    return nullptr;
+}
+
+const VectorType* MaskTypeOf(const VectorType* type) {
+    if (!type || !type->isFloat) return type;
+    for (auto& t : VectorTypes)
+        if (!t.isFloat && t.lanes == type->lanes && t.laneBits == type->laneBits) return &t;
+    return nullptr;
+}
+
+static const std::vector<IntegerType> IntegerTypes = {
+    {"i8", 1, true, false},
+    {"i16", 2, true, false},
+    {"i32", 4, true, false},
+    {"i64", 8, true, false},
+    {"u8", 1, false, false},
+    {"u16", 2, false, false},
+    {"u32", 4, false, false},
+    {"u64", 8, false, false},
+    {"bool", 1, false, true},
+    // Spellings the lexer already knows
+    {"int", 8, true, false},
+    {"uint", 8, false, false},
+    {"char", 1, false, false},
+};
+
+const IntegerType* FindIntegerType(const std::string& name) {
+    for (auto& t : IntegerTypes)
+        if (t.name == name) return &t;
+    return nullptr;
+}
+
+int64_t WrapInteger(const IntegerType* type, int64_t v) {
+    if (type->isBool) return v != 0;
+    if (type->bytes == 8) return v;
+    int bits = type->bytes * 8;
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    uint64_t u = (uint64_t)v & mask;
+    if (type->isSigned && (u >> (bits - 1))) u |= ~mask;
+    return (int64_t)u;
+}
+
+bool IsNarrowType(const std::string& type) {
+    const IntegerType* t = FindIntegerType(type);
+    return t && t->bytes < 8;
+}
+
+bool IsScalarType(const std::string& type) {
+    return type.empty() || IsPointerType(type) || FindIntegerType(type);
+}
+
+static std::unordered_map<std::string, StructType> StructTypes;
+
+const StructField* StructType::field(const std::string& name) const {
+    for (auto& f : fields)
+        if (f.name == name) return &f;
+    return nullptr;
+}
+
+const StructType* FindStructType(const std::string& name) {
+    auto it = StructTypes.find(name);
+    return it == StructTypes.end() ? nullptr : &it->second;
+}
+
+bool IsPointerType(const std::string& type) {
+    return !type.empty() && type[0] == '*';
+}
+
+std::string PointeeType(const std::string& type) {
+    return IsPointerType(type) ? type.substr(1) : "";
+}
+
+bool TypeLayout(const std::string& type, int& size, int& align) {
+    if (type.empty() || IsPointerType(type)) {
+        size = align = 8;
+        return true;
+    }
+    if (const IntegerType* it = FindIntegerType(type)) {
+        size = align = it->bytes;
+        return true;
+    }
+    if (const VectorType* vt = FindVectorType(type)) {
+        size = align = vt->bytes();
+        return true;
+    }
+    if (const StructType* st = FindStructType(type)) {
+        size = st->size;
+        align = st->align;
+        return true;
+    }
+    return false;
+}
+
+static bool isPowerOfTwo(int v) {
+    return v > 0 && (v & (v - 1)) == 0;
+}
+
+static int alignUp(int v, int align) {
+    return (v + align - 1) / align * align;
+}
+
+static std::string where(const std::shared_ptr<ASTNode>& node) {
+    return " at line " + std::to_string(node->line) + " col " + std::to_string(node->col);
+}
+
+// #[align(N)] argument, 0 when absent or invalid
+static int alignAttribute(const std::shared_ptr<ASTNode>& node) {
+    auto it = node->attributes.find("align");
+    if (it == node->attributes.end()) return 0;
+    int n = 0;
+    try {
+        n = std::stoi(it->second);
+    } catch (...) {}
+    if (!isPowerOfTwo(n)) {
+        std::cerr << "Error: align(" << it->second << ") is not a power of two" << where(node) << "\n";
+        return 0;
+    }
+    return n;
+}
+
+// Fields are sorted by falling alignment unless the declaration order is fixed.
+// Every size is a multiple of its alignment, so that order leaves no holes
+// between fields. An #[align(N)] field starts on an N-byte boundary and owns the
+// whole N bytes, so nothing else shares its cache line.
+static bool layoutStruct(const std::shared_ptr<ASTNode>& decl, std::unordered_map<std::string, std::shared_ptr<ASTNode>>& decls,
+                         std::unordered_set<std::string>& active, std::vector<std::string>& remarks) {
+    if (FindStructType(decl->name)) return true;
+    if (active.count(decl->name)) {
+        std::cerr << "Error: Struct '" << decl->name << "' contains itself" << where(decl) << "\n";
+        return false;
+    }
+    active.insert(decl->name);
+
+    StructType st;
+    st.name = decl->name;
+    st.packed = decl->attributes.count("packed") > 0;
+    auto repr = decl->attributes.find("repr");
+    bool fixedOrder = st.packed || (repr != decl->attributes.end() && repr->second == "C");
+    if (repr != decl->attributes.end() && repr->second != "C")
+        std::cerr << "Error: Unknown representation repr(" << repr->second << ")" << where(decl) << "\n";
+
+    bool ok = true;
+    std::unordered_set<std::string> names;
+    for (auto& f : decl->params) {
+        if (!names.insert(f->name).second) {
+            std::cerr << "Error: Duplicate field '" << f->name << "' in struct '" << decl->name << "'" << where(f) << "\n";
+            ok = false;
+            continue;
+        }
+        auto dep = decls.find(f->typeName);
+        if (dep != decls.end() && !layoutStruct(dep->second, decls, active, remarks)) {
+            ok = false;
+            continue;
+        }
+
+        StructField field{f->name, f->typeName, 0, 0, 0};
+        if (!TypeLayout(f->typeName, field.size, field.align)) {
+            std::cerr << "Error: Unknown type '" << f->typeName << "' of field '" << f->name << "'" << where(f) << "\n";
+            ok = false;
+            continue;
+        }
+        if (st.packed) field.align = 1;
+        if (int n = alignAttribute(f)) {
+            field.align = std::max(field.align, n);
+            field.size = alignUp(field.size, n);
+        }
+        st.fields.push_back(field);
+    }
+    active.erase(decl->name);
+    if (!ok) return false;
+    if (st.fields.empty()) {
+        std::cerr << "Error: Struct '" << decl->name << "' has no fields" << where(decl) << "\n";
+        return false;
+    }
+
+    auto place = [](std::vector<StructField>& fields, int& size, int& align) {
+        size = 0;
+        align = 1;
+        for (auto& f : fields) {
+            f.offset = alignUp(size, f.align);
+            size = f.offset + f.size;
+            align = std::max(align, f.align);
+        }
+    };
+
+    std::vector<StructField> declared = st.fields;
+    int declaredSize, declaredAlign;
+    place(declared, declaredSize, declaredAlign);
+
+    if (!fixedOrder)
+        std::stable_sort(st.fields.begin(), st.fields.end(), [](const StructField& a, const StructField& b) { return a.align > b.align; });
+    place(st.fields, st.size, st.align);
+
+    if (int n = alignAttribute(decl)) st.align = std::max(st.align, n);
+    st.size = alignUp(st.size, st.align);
+    declaredSize = alignUp(declaredSize, std::max(declaredAlign, st.align));
+
+    std::string summary = "struct " + st.name + ": size " + std::to_string(st.size) + ", align " + std::to_string(st.align);
+    if (st.size < declaredSize)
+        summary += ", fields reordered (" + std::to_string(declaredSize) + " bytes in declaration order)";
+    remarks.push_back(summary);
+
+    StructTypes[st.name] = st;
+    return true;
+}
+
+bool LayoutStructs(const std::shared_ptr<ASTNode>& program, std::vector<std::string>& remarks) {
+    StructTypes.clear();
+    if (!program) return true;
+
+    std::unordered_map<std::string, std::shared_ptr<ASTNode>> decls;
+    bool ok = true;
+    for (auto& child : program->children) {
+        if (!child || child->type != ASTNodeType::StructDecl) continue;
+        if (FindVectorType(child->name) || !decls.emplace(child->name, child).second) {
+            std::cerr << "Error: Redefinition of type '" << child->name << "'" << where(child) << "\n";
+            ok = false;
+        }
+    }
+
+    std::unordered_set<std::string> active;
+    for (auto& child : program->children)
+        if (child && child->type == ASTNodeType::StructDecl && decls[child->name] == child)
+            ok = layoutStruct(child, decls, active, remarks) && ok;
+
+    // sizeof(T) and offsetof(T, field) become literals
+    std::function<void(std::shared_ptr<ASTNode>&)> fold = [&](std::shared_ptr<ASTNode>& node) {
+        if (!node) return;
+        for (auto& child : node->children) fold(child);
+        if (node->type != ASTNodeType::CallExpr || (node->name != "sizeof" && node->name != "offsetof")) return;
+
+        auto& args = node->children;
+        size_t arity = node->name == "sizeof" ? 1 : 2;
+        bool wellFormed = args.size() == arity;
+        for (auto& arg : args) wellFormed = wellFormed && arg->type == ASTNodeType::Identifier;
+        if (!wellFormed) {
+            std::cerr << "Error: " << node->name << " expects " << (arity == 1 ? "a type name" : "a struct and a field name") << where(node) << "\n";
+            ok = false;
+            return;
+        }
+
+        int size, align;
+        int64_t value;
+        if (node->name == "sizeof") {
+            if (!TypeLayout(args[0]->name, size, align)) {
+                std::cerr << "Error: Unknown type '" << args[0]->name << "'" << where(node) << "\n";
+                ok = false;
+                return;
+            }
+            value = size;
+        } else {
+            const StructType* st = FindStructType(args[0]->name);
+            const StructField* f = st ? st->field(args[1]->name) : nullptr;
+            if (!f) {
+                std::cerr << "Error: '" << args[0]->name << "' has no field '" << args[1]->name << "'" << where(node) << "\n";
+                ok = false;
+                return;
+            }
+            value = f->offset;
+        }
+        auto lit = std::make_shared<ASTNode>(ASTNodeType::Literal, node->line, node->col);
+        lit->value = std::to_string(value);
+        node = lit;
+    };
+    for (auto& child : program->children) fold(child);
+
+    return ok;
+}